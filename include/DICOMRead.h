@@ -52,6 +52,8 @@ typedef unsigned short int BOOL;
 #ifdef _DICOMRead_SRC
 char *SDCMStatusFile = 0;
 char *SDCMListFile = 0;
+char *SDCMScanIndexDir = 0; // ScanSiemensDCMDir() index cache, or FS_DICOM_SCAN_INDEX
+int  SDCMScanNProc = 0;     // ScanSiemensDCMDir() processes, or FS_DICOM_SCAN_NPROC
 int  UseDICOMRead2 = 1; // use new dicom reader by default
 /* These variables allow the user to change the first tag checked to
    get the slice thickness.  This is needed with siemens mag res
@@ -62,6 +64,8 @@ int AutoSliceResElTag = 0; // automatically determine which tag to use based on
 #else
 extern char *SDCMStatusFile;
 extern char *SDCMListFile;
+extern char *SDCMScanIndexDir;
+extern int  SDCMScanNProc;
 extern int  UseDICOMRead2;
 extern long SliceResElTag1;
 extern long SliceResElTag2;
@@ -297,6 +301,8 @@ int DumpSDCMFileInfo(FILE *fp, SDCMFILEINFO *sdcmfi);
 int FreeSDCMFileInfo(SDCMFILEINFO **ppsdcmfi);
 SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile);
 SDCMFILEINFO **ScanSiemensDCMDir(const char *PathName, int *NSDCMFiles);
+int WriteSDCMFileInfo(FILE *fp, SDCMFILEINFO *sdcmfi);
+SDCMFILEINFO *ReadSDCMFileInfo(FILE *fp);
 int CompareSDCMFileInfo(const void *a, const void *b);
 int SortSDCMFileInfo(SDCMFILEINFO **sdcmfi_list, int nlist);
 
@@ -101,6 +101,7 @@ int MRIfromSymMatrix(MRI *mri, int c, int r, int s, MATRIX *M);
 MRI *MRInormWeights(MRI *w, int sqrtFlag, int invFlag, MRI *mask, MRI *wn);
 
 int MRIglmFitAndTest(MRIGLM *mriglm);
+int MRIglmFitAndTestBatch(MRIGLM *mriglm);
 int MRIglmFit(MRIGLM *glmmri);
 int MRIglmTest(MRIGLM *mriglm);
 int MRIglmLoadVox(MRIGLM *mriglm, int c, int r, int s, int LoadBeta);
@@ -208,6 +208,7 @@ typedef struct
   int          total_training ;
   int          max_label ;
   COLOR_TABLE  *ct ;
+  void         *flat ;   // non-NULL if read with GCAreadFlat()
 }
 GAUSSIAN_CLASSIFIER_ARRAY, GCA ;
 
@@ -263,6 +264,9 @@ int  GCAtrain(GCA *gca, MRI *mri_inputs, MRI *mri_labels, TRANSFORM *transform,
 int  GCAtrainCovariances(GCA *gca, MRI *mri_inputs, MRI *mri_labels, TRANSFORM *transform) ;
 int  GCAwrite(GCA *gca,const char *fname) ;
 GCA  *GCAread(const char *fname) ;
+int  GCAwriteFlat(GCA *gca, const char *fname) ;
+GCA  *GCAreadFlat(const char *fname) ;
+int  GCAisFlat(const char *fname) ;
 int  GCAcompleteMeanTraining(GCA *gca) ;
 int  GCAcompleteCovarianceTraining(GCA *gca) ;
 MRI  *GCAlabel(MRI *mri_src, GCA *gca, MRI *mri_dst, TRANSFORM *transform) ;
@@ -541,6 +545,10 @@ int free_gcs(GC1D *gcs, int nlabels, int ninputs) ;
 int GCAmapRenormalizeByClass(GCA *gca, MRI *mri, TRANSFORM *transform) ;
 extern int Ggca_x, Ggca_y, Ggca_z, Ggca_label, Ggca_nbr_label, Gxp, Gyp, Gzp ;
 extern char *G_write_probs ;
+/* if set, GCAreclassifyUsingGibbsPriors uses the original sequential
+   (probability-ordered/permuted) ICM sweep instead of the parallel
+   checkerboard sweep */
+extern int gca_sequential_gibbs ;
 MRI *GCAmarkImpossible(GCA *gca, MRI *mri_labeled, MRI *mri_dst, TRANSFORM *transform) ;
 int GCAclassMode(GCA *gca, int the_class, float *modes) ;
 int GCAcomputeLabelMeansAndCovariances(GCA *gca, int target_label, MATRIX **p_mcov, VECTOR **p_vmeans) ;
@@ -97,6 +97,27 @@ typedef struct
 }
 GCA_MORPH_NODE, GMN ;
 
+/*!
+  \struct GCAM_SOA
+  \brief Node-major structure-of-arrays copy of the node fields read
+  by the neighborhood terms (see GCAMsoaLoad()). GCA_MORPH_NODE is
+  large, so the 3x3x3 neighborhood loops pull a few cache lines per
+  neighbor to read a displacement. Node (x,y,z) is at index
+  (x*height + y)*depth + z, the order of gcam->nodes, so the z
+  neighbors of a node are adjacent. Not kept in sync automatically:
+  load before use.
+*/
+typedef struct
+{
+  int    width, height, depth ;
+  double *vx, *vy, *vz ;  // displacement, (x,y,z) - (origx,origy,origz)
+  char   *invalid ;
+}
+GCAM_SOA ;
+
+#define GCAM_SOA_INDEX(soa,x,y,z) \
+  ((((size_t)(x)*(soa)->height + (y)) * (soa)->depth) + (z))
+
 typedef struct
 {
   int  width, height ,depth ;
@@ -116,6 +137,7 @@ typedef struct
   MATRIX   *m_affine ;         // affine transform to initialize with
   double   det ;               // determinant of affine transform
   void    *vgcam_ms ;
+  GCAM_SOA *soa ;              // SoA node store (may be NULL)
 }
 GCA_MORPH, GCAM ;
 
@@ -278,6 +300,9 @@ GCA_MORPH *GCAMreadAndInvert(const char *gcamfname);
 GCA_MORPH *GCAMreadAndInvertNonTal(const char *gcamfname);
 int       GCAMfree(GCA_MORPH **pgcam) ;
 int       GCAMfreeContents(GCA_MORPH *gcam) ;
+GCAM_SOA  *GCAMsoaAlloc(GCA_MORPH *gcam) ;
+int       GCAMsoaFree(GCAM_SOA **psoa) ;
+int       GCAMsoaLoad(GCA_MORPH *gcam) ;
 
 MRI       *GCAMmorphFromAtlas(MRI *mri_src, GCA_MORPH *gcam, MRI *mri_dst, int sample_type) ;
 int GCAMmorphPlistFromAtlas(int N, float *points_in, GCA_MORPH *gcam, float *points_out) ;
@@ -552,8 +577,8 @@ double MRIlabelMorphSSE(MRI *mri_source, MRI *mri_atlas, MRI *mri_morph) ;
 			  const MRI *mri,
 			  const double label_dist );
 
-  //! Compute the smoothness energy
-  double gcamSmoothnessEnergy( const GCA_MORPH *gcam, const MRI *mri );
+  //! Compute the smoothness energy (gcam is not const: this fills gcam->soa)
+  double gcamSmoothnessEnergy( GCA_MORPH *gcam, const MRI *mri );
 
   double gcamComputeSSE( GCA_MORPH *gcam, 
 			 MRI *mri, 
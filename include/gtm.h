@@ -69,6 +69,21 @@ typedef struct
   MATRIX *p;
 } GTM_CONTRAST, GTMCON;
 
+/*!
+  \brief GTM design matrix stored by column. Column j holds the nnz[j]
+  nonzero values of column j of X with their 0-based rows in ascending
+  order. A column is only nonzero inside the padded bounding box of
+  its seg, so this is much smaller than the dense nmask x nsegs matrix.
+*/
+typedef struct 
+{
+  int rows, cols;
+  int *nnz;    // number of nonzero values in each column
+  int *nalloc; // allocated length of row[j] and val[j]
+  int **row;   // row of each value
+  float **val; // nonzero values
+} GTM_SPARSE, GTMSPARSE;
+
 typedef struct 
 {
   int nrad;
@@ -122,6 +137,7 @@ typedef struct
 
   // GLM stuff for GTM
   MATRIX *X,*X0;
+  GTMSPARSE *Xsp; // sparse copy of X, used by GTMsolve()
   MATRIX *y, *XtX, *iXtX, *Xty, *beta, *res, *yhat,*betavar;
   MATRIX *rvar,*rvargm,*rvarbrain,*rvarUnscaled; // residual variance, all vox and only GM
   MATRIX *som; // spillover matrix
@@ -199,6 +215,11 @@ int GTMsegidlist(GTM *gtm);
 int GTMnPad(GTM *gtm);
 int GTMbuildX(GTM *gtm);
 int GTMsolve(GTM *gtm);
+GTMSPARSE *GTMsparseAlloc(int rows, int cols);
+int GTMsparseFree(GTMSPARSE **psp);
+MATRIX *GTMsparseMtM(GTMSPARSE *sp, MATRIX *mout);
+MATRIX *GTMsparseAtB(GTMSPARSE *sp, MATRIX *B, MATRIX *mout);
+MATRIX *GTMsparseMultiply(GTMSPARSE *sp, MATRIX *B, MATRIX *mout);
 int GTMsegrvar(GTM *gtm);
 int GTMsynth(GTM *gtm, int NoiseSeed, int nReps);
 int GTMsmoothSynth(GTM *gtm);
@@ -89,6 +89,10 @@ MATRIX  *MatrixAlloc( const int rows, const int cols, const int type);
 int     MatrixFree(MATRIX **pmat) ;
 MATRIX  *MatrixMultiplyD( const MATRIX *m1, const MATRIX *m2, MATRIX *m3); // use this one
 MATRIX  *MatrixMultiply( const MATRIX *m1, const MATRIX *m2, MATRIX *m3) ;
+#define MATRIX_BACKEND_NATIVE 0 // blocked, multithreaded loops in matrix.c
+#define MATRIX_BACKEND_CBLAS  1 // CBLAS, if configured --with-cblas
+int     MatrixSetBackend(int backend) ;
+int     MatrixGetBackend(void) ;
 MATRIX  *MatrixCopy( const MATRIX *mIn, MATRIX *mOut );
 int     MatrixWriteTxt(const char *fname, MATRIX *mat) ;
 MATRIX  *MatrixReadTxt(const char *fname, MATRIX *mat) ;
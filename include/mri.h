@@ -1303,6 +1303,36 @@ int GetSPMStartFrame(void);
 int MRIwrite(MRI *mri,const  char *fname);
 int MRIwriteFrame(MRI *mri,const  char *fname, int frame) ;
 int MRIwriteType(MRI *mri,const  char *fname, int type);
+
+/*!
+  \struct MRI_FRAME_STREAM
+  \brief A 4D volume read or written a few frames at a time, so that
+  frame-wise operations (concatenation, sums over frames, ...) run in
+  memory bounded by the number of frames held, not by the size of the
+  file. See MRIframeStreamOpenRead() and MRIframeStreamOpenWrite().
+  Voxel-wise fits over all frames (the GLM in mri_glmfit) need every
+  frame of a voxel at once, so they cannot be fed from a frame stream.
+*/
+typedef struct
+{
+  char   fname[STRLEN] ;
+  MRI    *mri ;           // header of the whole volume (no voxel data)
+  int    nframes ;        // number of frames in the volume
+  int    frame ;          // next frame to read or write
+  int    writing ;
+  struct znzptr *fp ;     // open .mgh/.mgz file (znzFile), or NULL
+  MRI    *mri_all ;       // whole volume, for formats that are not streamed
+}
+MRI_FRAME_STREAM ;
+
+MRI_FRAME_STREAM *MRIframeStreamOpenRead(const char *fname) ;
+MRI_FRAME_STREAM *MRIframeStreamOpenWrite(const char *fname,
+                                          MRI *mri_template, int nframes) ;
+MRI *MRIframeStreamAlloc(MRI_FRAME_STREAM *fs, int nframes) ;
+int MRIframeStreamRead(MRI_FRAME_STREAM *fs, MRI *mri, int nframes) ;
+int MRIframeStreamWrite(MRI_FRAME_STREAM *fs, MRI *mri, int nframes) ;
+int MRIframeStreamClose(MRI_FRAME_STREAM **pfs) ;
+
 MRI *MRIreadRaw(FILE *fp, int width, int height, int depth, int type);
 int MRIreorderVox2RAS(MRI *mri_src, MRI *mri_dst, int xdim, int ydim, int zdim);
 MRI *MRIreorder(MRI *mri_src, MRI *mri_dst, int xdim, int ydim, int zdim);
@@ -1486,6 +1516,21 @@ int MRInormalizeFrames(MRI *mri);
 int MRInormalizeFramesMean(MRI *mri);
 int MRInormalizeFramesFirst(MRI *mri);
 MRI *MRIaverageFrames(MRI *mri_src, MRI *mri_dst, int start_frame, int end_frame) ;
+
+/* Typed kernels behind MRIthreshold(), MRIbinarize(), MRIscalarMul(),
+   MRIlinearScale(), MRImask() and MRIaverageFrames() (mrivoxel.cpp).
+   mri_dst must be allocated. They return ERROR_UNSUPPORTED, without
+   touching mri_dst, for type combinations they do not handle. */
+int MRItypedThreshold(const MRI *mri_src, MRI *mri_dst, float threshold) ;
+int MRItypedBinarize(const MRI *mri_src, MRI *mri_dst, float threshold,
+                     float low_val, float hi_val) ;
+int MRItypedScalarMul(const MRI *mri_src, MRI *mri_dst, float scalar) ;
+int MRItypedLinearScale(const MRI *mri_src, MRI *mri_dst, float scale,
+                        float offset, int only_nonzero) ;
+int MRItypedMask(const MRI *mri_src, const MRI *mri_mask, MRI *mri_dst,
+                 int mask, float out_val) ;
+int MRItypedAverageFrames(const MRI *mri_src, MRI *mri_dst,
+                          int start_frame, int end_frame) ;
 MRI *MRIsort(MRI *in, MRI *mask, MRI *sorted);
 int CompareDoubles(const void *a, const void *b);
 int MRIlabeledVoxels(MRI *mri_src, int label) ;
@@ -123,6 +123,61 @@ int MRIsegStatsRobust(MRI *seg, int segid, MRI *mri,int frame,
 		      float *min, float *max, float *range,
 		      float *mean, float *std, float Pct);
 
+/*!
+  \struct SEGSTATTABLE
+  \brief Per-segment, per-frame accumulators computed in a single pass
+  over the volume by MRIsegStatsTable(). Frame-wise arrays are stored
+  segment-major, ie, element [nthseg*nframes + frame].
+*/
+typedef struct
+{
+  int nsegs;        // number of segments (rows)
+  int nframes;      // number of frames in the input (0 if counts only)
+  int *segidlist;   // segmentation id of each row
+  int *nhits;       // number of voxels in each segmentation
+  double *min, *max, *sum, *sum2; // nsegs*nframes
+  int robustframe;  // frame stored in vlist, or -1
+  float **vlist;    // sorted values of robustframe for each row (or NULL)
+  int lutmin, nlut; // segid-to-row lookup covering [lutmin,lutmin+nlut)
+  int *lut;
+} SEGSTATTABLE;
+
+SEGSTATTABLE *MRIsegStatsTable(MRI *seg, int segframe, MRI *mri,
+			       const int *segidlist, int nsegs, int robustframe);
+int MRIsegStatsTableFree(SEGSTATTABLE **ptable);
+int MRIsegStatsTableRow(const SEGSTATTABLE *table, int segid);
+int MRIsegStatsTableGet(const SEGSTATTABLE *table, int segid, int frame,
+			float *min, float *max, float *range,
+			float *mean, float *std);
+int MRIsegStatsTableGetRobust(const SEGSTATTABLE *table, int segid,
+			      float *min, float *max, float *range,
+			      float *mean, float *std, float Pct);
+int MRIsegStatsTableFrameAvg(const SEGSTATTABLE *table, int segid, double *favg);
+
+/*!
+  \struct SEGOVERLAP
+  \brief Sparse joint label histogram (confusion matrix) of two
+  segmentations computed in one pass by MRIsegOverlap(). Only pairs
+  that occur are stored. n1, n2, and n12 are indexed like segidlist.
+*/
+typedef struct
+{
+  int npairs;       // number of (id1,id2) pairs with a nonzero count
+  int *id1, *id2;   // pair ids, sorted by id1 then id2
+  int *count;       // number of voxels with each pair
+  int nsegs;        // number of unique ids in either seg
+  int *segidlist;   // sorted union of the ids
+  int *n1, *n2;     // number of voxels of each id in seg1 and seg2
+  int *n12;         // number of voxels with that id in both
+} SEGOVERLAP;
+
+SEGOVERLAP *MRIsegOverlap(MRI *seg1, MRI *seg2, MRI *mask, int frame);
+int MRIsegOverlapFree(SEGOVERLAP **pov);
+int MRIsegOverlapRow(const SEGOVERLAP *ov, int segid);
+int MRIsegOverlapCount(const SEGOVERLAP *ov, int id1, int id2);
+double MRIsegOverlapDice(const SEGOVERLAP *ov, int segid);
+double MRIsegOverlapJaccard(const SEGOVERLAP *ov, int segid);
+
 MRI *MRImask_with_T2_and_aparc_aseg(MRI *mri_src, MRI *mri_dst, MRI *mri_T2, MRI *mri_aparc_aseg, float T2_thresh, int mm_from_exterior) ;
 int *MRIsegmentationList(MRI *seg, int *pListLength);
 
@@ -82,11 +82,25 @@ typedef struct
 // VOXEL_RES: Default value for MHT->vres for when caller doesn't set it.
 #define VOXEL_RES      1.0
 
-// TABLE_SIZE dimensions for array of hash buckets. As defined here
-// TABLE_SIZE = 400.
+// TABLE_SIZE: range of the voxel indices along each axis. Voxel
+// indices outside [0,TABLE_SIZE) are clamped when adding.
 //#define TABLE_SIZE     ((int)(FIELD_OF_VIEW / VOXEL_RES))
 #define TABLE_SIZE     2000
 
+//--------------------------
+// Only occupied voxels have a bucket. They are found through an
+// open-addressing (linear probing) table of slots keyed on the
+// voxel index, which is grown as buckets are added. This replaces
+// the fixed TABLE_SIZE x TABLE_SIZE array of bucket pointers, which
+// cost 32MB per table before anything was added to it. Each (xv,yv)
+// column that has a bucket also has a slot with zv = -1 and no
+// bucket, standing in for the non-NULL buckets[xv][yv] of the array.
+typedef struct
+{
+  short              xv, yv, zv ;  /* voxel index; xv < 0 if slot empty */
+  MRIS_HASH_BUCKET  *bucket ;      /* NULL for a column slot (zv < 0) */
+} MRIS_HASH_SLOT, MHTS ;
+
 #define WORLD_TO_VOLUME(mht,x)   (((x)+FIELD_OF_VIEW/2)/((mht)->vres))
 #define WORLD_TO_VOXEL(mht,x)    ((int)(WORLD_TO_VOLUME(mht,x)))
 #define VOXEL_TO_WORLD(mht,x)    ((((x)*(mht)->vres)-FIELD_OF_VIEW/2))
@@ -103,7 +117,9 @@ typedef struct _mht
   MHTFNO_t           fno_usage; /* 2007-03-20 GW Added: To enforce consistent 
                                    use of fno:  face number or vertex number */
   int                nbuckets ; /* total # of buckets */
-  MRIS_HASH_BUCKET **buckets[TABLE_SIZE][TABLE_SIZE] ;
+  int                ncolumns ; /* # of (xv,yv) columns with a bucket */
+  int                nslots ;   /* size of slots[] (a power of 2) */
+  MRIS_HASH_SLOT    *slots ;    /* bucket lookup by voxel index */
   int                which_vertices ;  /* ORIGINAL, CANONICAL, CURRENT */
   struct _mht       *mhts[MAX_SURFACES] ; // for MRI_SURFACE_ARRAYs
   MRI_SURFACE       *mris[MAX_SURFACES] ;
@@ -199,6 +215,20 @@ VERTEX *MHTfindClosestVertexInTable(MRIS_HASH_TABLE *mht,
                                     MRI_SURFACE *mris,
                                     float x, float y, float z, int do_global_search) ;
 
+//------- batched finds, run across threads ------------
+// The find functions only read the mht and surface, so they can also
+// be called concurrently from the caller's own parallel loops.
+int MHTfindClosestVertexNoBatch(MRIS_HASH_TABLE *mht,
+                                MRI_SURFACE *mris,
+                                int npoints, const float *xyz,
+                                int *vtxnos, float *min_dists);
+int MHTfindClosestVertexGenericBatch(MRIS_HASH_TABLE *mht,
+                                     MRI_SURFACE *mris,
+                                     int npoints, const float *xyz,
+                                     double in_max_distance_mm,
+                                     int in_max_mhts,
+                                     int *vtxnums, double *vtx_distances);
+
 //------------------------------------------------
 //  Utility
 //------------------------------------------------
@@ -232,6 +262,13 @@ int MHTfindClosestFaceGeneric(MRIS_HASH_TABLE *mht,
                               FACE **pface, 
                               int *pfno, 
                               double *pface_distance);
+int MHTfindClosestFaceGenericBatch(MRIS_HASH_TABLE *mht,
+                                   MRI_SURFACE *mris,
+                                   int npoints, const float *xyz,
+                                   double in_max_distance_mm,
+                                   int in_max_mhts,
+                                   int project_into_face,
+                                   int *fnos, double *face_distances);
 int mhtBruteForceClosestFace(MRI_SURFACE *mris, 
                              float x, float y, float z, 
                              int which,                  // which surface within mris to search
@@ -209,6 +209,31 @@ STRIP;
 
 #include "transform.h" // TRANSFORM, LTA
 
+/*!
+  \struct MRIS_SOA
+  \brief Structure-of-arrays copy of the vertex fields used by the
+  surface deformation hot loops (see MRISsoaLoad()). VERTEX is large,
+  so loops that visit the neighbors of every vertex pull a whole cache
+  line per neighbor to read a few floats. The arrays here are
+  contiguous. They are not kept in sync automatically: load them
+  before use and store back anything that was changed.
+*/
+typedef struct
+{
+  int    nvertices ;
+  float  *x, *y, *z ;     // current coordinates
+  float  *nx, *ny, *nz ;  // normals
+  float  *dx, *dy, *dz ;  // gradient
+  float  *tx, *ty, *tz ;  // scratch (eg, neighbor sums)
+  int    *nnbrs ;         // scratch count (eg, unripped neighbors)
+  char   *ripflag ;
+}
+MRIS_SOA ;
+
+#define MRIS_SOA_POSITIONS  0x01
+#define MRIS_SOA_NORMALS    0x02
+#define MRIS_SOA_GRADIENT   0x04
+
 typedef struct
 {
   int          nvertices ;      /* # of vertices on surface */
@@ -303,6 +328,7 @@ typedef struct
   MATRIX *m_sras2vox ;             // for converting surface ras to voxel 
   MRI    *mri_sras2vox ;           // volume that the above matrix is for
   void   *mht ;
+  MRIS_SOA *soa ;                  // SoA vertex store (may be NULL)
 }
 MRI_SURFACE, MRIS ;
 
@@ -1837,6 +1863,10 @@ int MRISsegmentAnnotated(MRI_SURFACE *mris,
 int MRISaverageGradients(MRI_SURFACE *mris, int num_avgs) ;
 int MRISaverageGradientsFast(MRI_SURFACE *mris, int num_avgs);
 int MRISaverageGradientsFastCheck(int num_avgs);
+MRIS_SOA *MRISsoaAlloc(MRI_SURFACE *mris);
+int MRISsoaFree(MRIS_SOA **psoa);
+int MRISsoaLoad(MRI_SURFACE *mris, int which);
+int MRISsoaStore(MRI_SURFACE *mris, int which);
 
 int MRISnormalTermWithGaussianCurvature(MRI_SURFACE *mris,double l_lambda) ;
 int MRISnormalSpringTermWithGaussianCurvature(MRI_SURFACE *mris,
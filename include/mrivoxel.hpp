@@ -0,0 +1,296 @@
+/**
+ * @file  mrivoxel.hpp
+ * @brief Typed row/slice views and loops over MRI voxel data
+ *
+ * MRIgetVoxVal() and MRIsetVoxVal() switch on mri->type (and on
+ * mri->ischunked) for every voxel they touch. The templates here do
+ * that switch once per volume (MRIdispatchType(), MRIdispatchTypes())
+ * and then run a plain typed loop over the rows of the volume
+ * (MRIforEachRow()), which the compiler can inline and vectorize.
+ * Rows are found through mri->slices, which is set up for both chunked
+ * and per-slice allocations.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ * CVS Revision Info:
+ *    $Author$
+ *    $Date$
+ *    $Revision$
+ *
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#ifndef MRI_VOXEL_HPP
+#define MRI_VOXEL_HPP
+
+#include <climits>
+
+extern "C"
+{
+#include "mri.h"
+#include "utils.h"
+#include "error.h"
+}
+
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
+namespace Freesurfer
+{
+
+//! nint() from utils.c, inlined so that the typed loops can vectorize
+inline int MRIvoxelNint( const double f )
+{
+  return( f < 0 ? (int)(f-0.5) : (int)(f+0.5) );
+}
+
+//! Storage traits of the voxel types
+/*!
+  FromFloat() converts a float the way MRIsetVoxVal() does: clip to
+  the range of the type, then round like nint(). Kernels that go
+  through it produce bit-identical volumes to the generic accessors.
+*/
+template<typename T>
+class MRIvoxelTraits;
+
+template<>
+class MRIvoxelTraits<unsigned char>
+{
+public:
+  static unsigned char FromFloat( float val )
+  {
+    if( val < 0.0f )
+    {
+      val = 0.0f;
+    }
+    if( val > 255.0f )
+    {
+      val = 255.0f;
+    }
+    return( MRIvoxelNint(val) );
+  }
+};
+
+template<>
+class MRIvoxelTraits<short>
+{
+public:
+  static short FromFloat( float val )
+  {
+    if( val < -32768.0f )
+    {
+      val = -32768.0f;
+    }
+    if( val > 32767.0f )
+    {
+      val = 32767.0f;
+    }
+    return( MRIvoxelNint(val) );
+  }
+};
+
+template<>
+class MRIvoxelTraits<int>
+{
+public:
+  static int FromFloat( float val )
+  {
+    if( val < (float)INT_MIN )
+    {
+      val = (float)INT_MIN;
+    }
+    if( val > (float)INT_MAX )
+    {
+      val = (float)INT_MAX;
+    }
+    return( MRIvoxelNint(val) );
+  }
+};
+
+template<>
+class MRIvoxelTraits<float>
+{
+public:
+  static float FromFloat( float val )
+  {
+    return( val );
+  }
+};
+
+
+// ======================================================
+
+//! Typed view of one slice (of one frame) of an MRI
+template<typename T>
+class MRIsliceView
+{
+public:
+  MRIsliceView( BUFTYPE **_rows ) : rows(_rows) {};
+
+  //! Pointer to the first voxel of row y
+  T* Row( const int y ) const
+  {
+    return( reinterpret_cast<T*>( this->rows[y] ) );
+  }
+
+  T& operator()( const int x, const int y ) const
+  {
+    return( this->Row(y)[x] );
+  }
+
+private:
+  BUFTYPE **rows;
+};
+
+
+//! Typed view of the voxels of an MRI
+/*!
+  The caller is responsible for T matching mri->type (see
+  MRIdispatchType()). Each row is contiguous. Rows are not
+  guaranteed to be contiguous with each other.
+*/
+template<typename T>
+class MRIvoxelView
+{
+public:
+  MRIvoxelView( const MRI *mri ) : slices(mri->slices),
+    depth(mri->depth) {};
+
+  MRIsliceView<T> Slice( const int z, const int f = 0 ) const
+  {
+    return( MRIsliceView<T>( this->slices[z + f*this->depth] ) );
+  }
+
+  T* Row( const int y, const int z, const int f = 0 ) const
+  {
+    return( reinterpret_cast<T*>( this->slices[z + f*this->depth][y] ) );
+  }
+
+  T& operator()( const int x, const int y, const int z,
+                 const int f = 0 ) const
+  {
+    return( this->Row(y, z, f)[x] );
+  }
+
+private:
+  BUFTYPE ***slices;
+  const int depth;
+};
+
+
+// ======================================================
+
+//! Calls op.template Apply<T>() with T the C type of an MRI type code
+/*!
+  Returns ERROR_UNSUPPORTED (without calling op) for types that have
+  no plain scalar layout (MRI_BITMAP, MRI_TENSOR, ...) and for
+  MRI_LONG, whose element size is not the same in all allocators (the
+  row buffers hold longs, MRILvox() reads long32s), otherwise whatever
+  Apply() returns. Callers keep a generic path for those types.
+*/
+template<typename Op>
+int MRIdispatchType( const int type, Op &op )
+{
+  switch( type )
+  {
+  case MRI_UCHAR:
+    return( op.template Apply<unsigned char>() );
+  case MRI_SHORT:
+    return( op.template Apply<short>() );
+  case MRI_INT:
+    return( op.template Apply<int>() );
+  case MRI_FLOAT:
+    return( op.template Apply<float>() );
+  default:
+    return( ERROR_UNSUPPORTED );
+  }
+}
+
+
+//! Helper for MRIdispatchTypes(): binds the first type
+template<typename TS, typename Op>
+class MRIdispatchSecondType
+{
+public:
+  MRIdispatchSecondType( Op &_op ) : op(_op) {};
+
+  template<typename TD>
+  int Apply( void )
+  {
+    return( this->op.template Apply<TS,TD>() );
+  }
+
+private:
+  Op &op;
+};
+
+template<typename Op>
+class MRIdispatchFirstType
+{
+public:
+  MRIdispatchFirstType( const int _type2, Op &_op ) :
+    type2(_type2), op(_op) {};
+
+  template<typename TS>
+  int Apply( void )
+  {
+    MRIdispatchSecondType<TS,Op> second(this->op);
+    return( MRIdispatchType( this->type2, second ) );
+  }
+
+private:
+  const int type2;
+  Op &op;
+};
+
+//! Calls op.template Apply<T1,T2>() for the C types of two MRI type codes
+template<typename Op>
+int MRIdispatchTypes( const int type1, const int type2, Op &op )
+{
+  MRIdispatchFirstType<Op> first(type2, op);
+  return( MRIdispatchType( type1, first ) );
+}
+
+
+// ======================================================
+
+//! Parallel loop over all rows of a width x height x depth x nframes grid
+/*!
+  Calls kernel(y, z, f) once per row. Slices (of all frames) are
+  shared out between threads; the rows of a slice are visited in
+  order by one thread. The kernel typically takes the row pointers
+  of its volumes from MRIvoxelView::Row() and runs a plain loop over
+  the width voxels.
+*/
+template<typename Kernel>
+void MRIforEachRow( const int height, const int depth, const int nframes,
+                    const Kernel &kernel )
+{
+  int zf;
+
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for
+#endif
+  for( zf = 0; zf < depth*nframes; zf++ )
+  {
+    const int z = zf % depth, f = zf / depth;
+    for( int y = 0; y < height; y++ )
+    {
+      kernel( y, z, f );
+    }
+  }
+}
+
+}
+
+#endif
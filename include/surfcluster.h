@@ -92,4 +92,23 @@ int sclustGrowByDist(MRIS *surf, int seedvtxno, double dthresh,
 		     int shape, int vtxno, int *vtxlist);
 const char *sculstSrcVersion(void);
 
+/* Surface graph for clustering the same surface many times (eg, in
+   simulations): the neighbors of vertex k are
+   nbr[nbrstart[k]] ... nbr[nbrstart[k+1]-1] */
+typedef struct
+{
+  int   nvertices;
+  int   *nbrstart;  // nvertices+1 offsets into nbr
+  int   *nbr;       // neighbor vertex numbers
+  float *area;      // vertex area (group average if loaded)
+  char  *inmask;    // 0 if the vertex cannot be in a cluster
+}
+SURFCLUSTERGRAPH, SCG;
+
+SCG *sclustGraphAlloc(MRI_SURFACE *Surf, MRI *mask);
+int sclustGraphFree(SCG **pscg);
+SCS *sclustGraphClusters(SCG *scg, MRI *mri, int frame,
+                         float thmin, float thmax, int thsign,
+                         int *clusterno, int *nClusters);
+
 #endif
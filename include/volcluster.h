@@ -46,6 +46,7 @@ typedef struct
   int maxmember;
   float maxval;
   float voxsize;
+  float ccol, crow, cslc; /* centroid, set by clustLabelClusters() */
   double pval_clusterwise;
   double pval_clusterwise_low;
   double pval_clusterwise_hi;
@@ -80,6 +81,12 @@ VOLCLUSTER *clustGrow(int col0, int row0, int slc0,
                       MRI *HitMap, int AllowDiag);
 int clustGrowOneVoxel(VOLCLUSTER *vc, int col0, int row0, int slc0,
                       MRI *HitMap, int AllowDiag);
+int clustFindRoot(int *parent, int k);
+int clustUnionSets(int *parent, int a, int b);
+VOLCLUSTER **clustLabelClusters(MRI *vol, int frame,
+                                float thmin, float thmax, int thsign,
+                                MRI *binmask, int maskframe, int nbrs,
+                                int *nClusters);
 
 int clustMaxMember(VOLCLUSTER *vc, MRI *vol, int frame, int thsign);
 
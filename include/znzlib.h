@@ -84,6 +84,7 @@ extern "C"
     FILE* nzfptr;
 #ifdef HAVE_ZLIB
     gzFile zfptr;
+    struct znzblocks *zbfptr; /* blocked gzip, see znzlib.c */
 #endif
   } ;
 
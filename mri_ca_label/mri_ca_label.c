@@ -231,6 +231,7 @@ MRI *insert_wm_segmentation( MRI *mri_labeled, MRI *mri_wm,
 int MRItoUCHAR(MRI **pmri);
 extern char *gca_write_fname ;
 extern int gca_write_iterations ;
+extern int gca_sequential_gibbs ;
 
 //static int expand_flag = TRUE ;
 static int expand_flag = FALSE ;
@@ -1460,6 +1461,11 @@ get_option(int argc, char *argv[])
     no_gibbs = 1 ;
     printf("disabling gibbs priors...\n") ;
   }
+  else if (!stricmp(option, "SEQUENTIAL_GIBBS"))
+  {
+    gca_sequential_gibbs = 1 ;
+    printf("using sequential (single-threaded) gibbs relabeling\n") ;
+  }
   else if (!stricmp(option, "LH"))
   {
     remove_rh = 1  ;
@@ -41,6 +41,7 @@
 #include "version.h"
 #include "gca.h"
 #include "cma.h"
+#include "mri2.h"
 
 int main(int argc, char *argv[]) ;
 static int get_option(int argc, char *argv[]) ;
@@ -72,6 +73,7 @@ main(int argc, char *argv[]) {
   int          msec, minutes, seconds/*, wrong, total, correct*/ ;
   struct timeb start ;
   MRI    *mri1, *mri2 ;
+  SEGOVERLAP *ov ;
   FILE   *log_fp ;
   float  nvox_mean, nunion, total_nunion ;
   float tmp = 0.0;
@@ -172,15 +174,22 @@ main(int argc, char *argv[]) {
     if (isSeg)
       lnoLimit = MAX_CMA_LABEL;
 
-    for (lno = 0 ; lno < lnoLimit ; lno++) {
+    // one pass over both volumes instead of several per label
+    ov = MRIsegOverlap(mri1, mri2, NULL, 0) ;
+    if (!ov)
+      ErrorExit(ERROR_BADPARM, "%s: could not compute label overlap",Progname) ;
+    for (i = 0 ; i < ov->nsegs ; i++) {
 #if 1
-      nvox1 = MRIvoxelsInLabel(mri1, lno) ;
-      nvox2 = MRIvoxelsInLabel(mri2, lno) ;
+      lno = ov->segidlist[i] ;
+      if (lno < 0 || lno >= lnoLimit)
+        continue ;
+      nvox1 = ov->n1[i] ;
+      nvox2 = ov->n2[i] ;
       if (!nvox1 && !nvox2)
         continue ;
       nvox_mean = (float)(nvox1+nvox2)/2.0f ;
-      nshared = MRIlabelOverlap(mri1, mri2, lno) ;
-      nunion  = (float)MRIlabelUnion(mri1, mri2, lno) ;
+      nshared = ov->n12[i] ;
+      nunion  = (float)(nvox1 + nvox2 - nshared) ;
       if (nunion > 0.0) tmp = (float)nshared/nunion;
       else tmp = 0.0;
 
@@ -240,21 +249,27 @@ main(int argc, char *argv[]) {
       total_nunion += nunion ;
       nlabels++ ;
     }
+    MRIsegOverlapFree(&ov) ;
     if (log_fp)
       fclose(log_fp) ;
   } else { // using a user provided lable list
     
+    ov = MRIsegOverlap(mri1, mri2, NULL, 0) ;
+    if (!ov)
+      ErrorExit(ERROR_BADPARM, "%s: could not compute label overlap",Progname) ;
     for (i = 3 ; i < argc ; i++) {
       float volume_overlap, volume_diff, volume_overlap_jacc ;
+      int   row ;
 
       lno = atoi(argv[i]) ;
       // only counts number of lno label
-      nvox1 = MRIvoxelsInLabel(mri1, lno) ;
-      nvox2 = MRIvoxelsInLabel(mri2, lno) ;
+      row = MRIsegOverlapRow(ov, lno) ;
+      nvox1 = row < 0 ? 0 : ov->n1[row] ;
+      nvox2 = row < 0 ? 0 : ov->n2[row] ;
       nvox_mean = (float)(nvox1+nvox2)/2.0f ;
       // if both mri1 and mri2 has the same label, count it.
-      nshared = MRIlabelOverlap(mri1, mri2, lno) ;
-      nunion  = (float) MRIlabelUnion(mri1, mri2, lno) ;
+      nshared = row < 0 ? 0 : ov->n12[row] ;
+      nunion  = (float)(nvox1 + nvox2 - nshared) ;
       volume_diff = 100.0f*(float)abs(nvox1-nvox2)/nvox_mean ;
       volume_overlap = 100.0f*(float)nshared/nvox_mean ;
       if(nunion>0.)
@@ -280,6 +295,7 @@ main(int argc, char *argv[]) {
       total_nunion += nunion ;
       nlabels++ ;
     }
+    MRIsegOverlapFree(&ov) ;
     if (log_fp)
       fclose(log_fp) ;
   }
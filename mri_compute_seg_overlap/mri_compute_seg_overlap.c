@@ -38,6 +38,7 @@
 #include <sys/stat.h>
 
 #include "mri.h"
+#include "mri2.h"
 #include "macros.h"
 #include "error.h"
 #include "diag.h"
@@ -125,8 +126,8 @@ int main(int argc, char *argv[])
   MRI *mri_seg1, *mri_seg2;
   int nargs, ac;
   char **av;
-  int width, height, depth, x, y, z, f, nframes;
-  int v1, v2;
+  SEGOVERLAP *ov;
+  int v1, v2, nvox;
   int i, skipped;
   FILE *log_fp;
 
@@ -194,59 +195,54 @@ int main(int argc, char *argv[])
     Volume_from2[i] = 0;
   }
 
-  width = mri_seg1->width ;
-  height = mri_seg1->height ;
-  depth = mri_seg1->depth ;
-  nframes = mri_seg1->nframes ;
-  if (nframes == 0)
-  {
-    nframes = 1;
-  }
+  /* One pass over both volumes (all frames) gives the count of every
+     (v1,v2) label pair that occurs; the per-label volumes are then
+     accumulated from the pairs rather than from the voxels. */
+  ov = MRIsegOverlap(mri_seg1, mri_seg2, NULL, -1);
+  if (ov == NULL)
+    ErrorExit(ERROR_BADPARM,
+              "%s: could not compute overlap of label volumes\n", Progname);
 
   subcorvolume_overlap = 0;
   subcorvolume1 = 0;
   subcorvolume2 = 0;
 
-  for (f = 0 ; f < nframes ; f++)  {
-    for (z = 0 ; z < depth ; z++)    {
-      for (y = 0 ; y < height ; y++)      {
-        for (x = 0 ; x < width ; x++)        {
-          v1 = (int) MRIgetVoxVal(mri_seg1,x,y,z,f);
-          v2 = (int) MRIgetVoxVal(mri_seg2,x,y,z,f);
-
-          if (v1 > MAX_CLASS_NUM || v1 <= 0 || v2 > MAX_CLASS_NUM || v2 <= 0) continue;
-
-          /* do not include these in the overall Dice coefficient calculations:
-             Left/Right-Cerebral-White-Matter (labels 2 and 41),
-             Left/Right-Cerebral-Cortex (labels 3 and 42),
-             Left/Right-Accumbens-area (labels 26 and 58)
-             Notice that these labels are not included in the 'if' checks: */
-
-          if (v1 == v2){
-            if (all_labels_flag)             subcorvolume_overlap++;
-            else if (isOverallDiceLabel(v1)) subcorvolume_overlap++;
-          }
-
-          if(all_labels_flag)              subcorvolume1++;
-          else if (isOverallDiceLabel(v1)) subcorvolume1++;
-          if (all_labels_flag)             subcorvolume2++;
-          else if (isOverallDiceLabel(v2)) subcorvolume2++;
-
-          Volume_from1[v1]++;
-          Volume_from2[v2]++;
-
-          if (v1 == v2) {
-            Volume_overlap[v1]++;
-            Volume_union[v1]++;
-          }
-          else {
-            Volume_union[v1]++;
-            Volume_union[v2]++;
-          }
-        }
-      }
+  for (i = 0 ; i < ov->npairs ; i++)  {
+    v1 = ov->id1[i];
+    v2 = ov->id2[i];
+    nvox = ov->count[i];
+
+    if (v1 > MAX_CLASS_NUM || v1 <= 0 || v2 > MAX_CLASS_NUM || v2 <= 0) continue;
+
+    /* do not include these in the overall Dice coefficient calculations:
+       Left/Right-Cerebral-White-Matter (labels 2 and 41),
+       Left/Right-Cerebral-Cortex (labels 3 and 42),
+       Left/Right-Accumbens-area (labels 26 and 58)
+       Notice that these labels are not included in the 'if' checks: */
+
+    if (v1 == v2){
+      if (all_labels_flag)             subcorvolume_overlap += nvox;
+      else if (isOverallDiceLabel(v1)) subcorvolume_overlap += nvox;
+    }
+
+    if(all_labels_flag)              subcorvolume1 += nvox;
+    else if (isOverallDiceLabel(v1)) subcorvolume1 += nvox;
+    if (all_labels_flag)             subcorvolume2 += nvox;
+    else if (isOverallDiceLabel(v2)) subcorvolume2 += nvox;
+
+    Volume_from1[v1] += nvox;
+    Volume_from2[v2] += nvox;
+
+    if (v1 == v2) {
+      Volume_overlap[v1] += nvox;
+      Volume_union[v1] += nvox;
+    }
+    else {
+      Volume_union[v1] += nvox;
+      Volume_union[v2] += nvox;
     }
   }
+  MRIsegOverlapFree(&ov);
 
   for (i=0; i < MAX_CLASSES; i++)
   {
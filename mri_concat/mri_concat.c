@@ -56,6 +56,7 @@ static void check_options(void);
 static void print_usage(void) ;
 static void usage_exit(void);
 static void print_help(void) ;
+static int  StreamConcat(int nframestot, int datatype);
 static void print_version(void) ;
 static void argnerr(char *option, int n);
 static void dump_options(FILE *fp);
@@ -132,6 +133,7 @@ MRI *PruneMask = NULL;
 int DoRMS = 0; // compute root-mean-square on multi-frame input
 int DoCumSum = 0;
 int DoFNorm = 0;
+int DoStream = 0;
 char *rusage_file=NULL;
 
 /*--------------------------------------------------*/
@@ -289,6 +291,13 @@ int main(int argc, char **argv)
   {
     datatype = inputDatatype;
   }
+  if (DoStream)
+  {
+    err = StreamConcat(nframestot, datatype);
+    if(err) exit(1);
+    if(rusage_file) WriteRUsage(RUSAGE_SELF, "", rusage_file);
+    return(0);
+  }
   if (DoRMS)
   {
     // RMS always has single frame output
@@ -953,6 +962,10 @@ static int parse_commandline(int argc, char **argv)
     {
       DoKeepDatatype = 1;
     }
+    else if (!strcasecmp(option, "--stream"))
+    {
+      DoStream = 1;
+    }
     else if (!strcasecmp(option, "--pca"))
     {
       DoPCA = 1;
@@ -1184,6 +1197,9 @@ static void print_usage(void)
   printf("   --rms : root mean square (eg. combine memprage)\n");
   printf("           (square, sum, div-by-nframes, square root)\n");
   printf("   --no-check : do not check inputs (faster)\n");
+  printf("   --stream : read and write one frame at a time to bound memory\n");
+  printf("              (only with plain concatenation, --mean or --sum,\n");
+  printf("               optionally with --abs/--pos/--neg, --mul, --add)\n");
   printf("   --help      print out information on how to use this program\n");
   printf("   --version   print out version and exit\n");
   printf("\n");
@@ -1288,6 +1304,25 @@ static void check_options(void)
     printf("ERROR: do not use more than one of --abs, --pos, --neg\n");
     exit(1);
   }
+  if(DoStream)
+  {
+    if(DoNormMean || DoNorm1 || DoMeanDivN || DoMedian || DoVar || DoStd ||
+       DoMax || DoMaxIndex || DoMin || DoConjunction || DoPaired || DoASL ||
+       DoVote || DoSort || DoCombine || matfile || ngroups || DoBonfCor ||
+       DoPCA || DoSCM || DoTAR1 || NReplications || DoPrune || DoRMS ||
+       DoCumSum || DoFNorm || (DoMean && DoSum))
+    {
+      printf("ERROR: --stream only supports plain concatenation, "
+             "--mean or --sum\n");
+      exit(1);
+    }
+    if(!DoCheck)
+    {
+      printf("ERROR: --stream needs the input check to count frames, "
+             "cannot use --no-check\n");
+      exit(1);
+    }
+  }
 
 
   return;
@@ -1299,6 +1334,127 @@ static void dump_options(FILE *fp)
   return;
 }
 
+/*---------------------------------------------------------------
+  StreamConcat() - the --stream version of concatenation, --mean and
+  --sum. The inputs are read one frame at a time. Concatenated frames
+  are written out as they come, the sum over frames is kept in a
+  double per voxel. The values go through an output-type frame as in
+  the in-memory path, so the results are the same.
+  ---------------------------------------------------------------*/
+static int StreamConcat(int nframestot, int datatype)
+{
+  MRI_FRAME_STREAM *fsin, *fsout=NULL;
+  MRI *mriin, *mrif;
+  double *sum=NULL, v;
+  size_t i;
+  int nthin, n=0, c, r, s, nc, nr, ns, err;
+
+  mritmp = MRIreadHeader(inlist[0],MRI_VOLUME_TYPE_UNKNOWN);
+  if(mritmp == NULL) return(1);
+  nc = mritmp->width;
+  nr = mritmp->height;
+  ns = mritmp->depth;
+  MRIfree(&mritmp);
+
+  mrif = MRIallocSequence(nc,nr,ns,datatype,1);
+  if(mrif == NULL) return(1);
+  if(DoMean || DoSum)
+  {
+    sum = (double *) calloc((size_t)nc*nr*ns,sizeof(double));
+    if(sum == NULL)
+    {
+      printf("ERROR: could not alloc %d voxel sums\n",nc*nr*ns);
+      return(1);
+    }
+  }
+
+  for(nthin = 0; nthin < ninputs; nthin++)
+  {
+    if(Gdiag_no > 0 || debug)
+    {
+      printf("Streaming %dth input %s\n",
+             nthin+1,fio_basename(inlist[nthin],NULL));
+      fflush(stdout);
+    }
+    fsin = MRIframeStreamOpenRead(inlist[nthin]);
+    if(fsin == NULL)
+    {
+      printf("ERROR: loading %s\n",inlist[nthin]);
+      return(1);
+    }
+    if(nthin == 0)
+    {
+      MRIcopyHeader(fsin->mri, mrif);
+      if(sum == NULL)
+      {
+        fsout = MRIframeStreamOpenWrite(out, mrif, nframestot);
+        if(fsout == NULL) return(1);
+      }
+    }
+    mriin = MRIframeStreamAlloc(fsin,1);
+    if(mriin == NULL) return(1);
+    while((n = MRIframeStreamRead(fsin, mriin, 1)) > 0)
+    {
+      if(DoAbs) MRIabs(mriin,mriin);
+      if(DoPos) MRIpos(mriin,mriin);
+      if(DoNeg) MRIneg(mriin,mriin);
+      for(i=0, s=0; s < ns; s++)
+      {
+        for(r=0; r < nr; r++)
+        {
+          for(c=0; c < nc; c++, i++)
+          {
+            MRIsetVoxVal(mrif,c,r,s,0,MRIgetVoxVal(mriin,c,r,s,0));
+            if(sum) sum[i] += MRIgetVoxVal(mrif,c,r,s,0);
+          }
+        }
+      }
+      if(sum) continue;
+      if(DoMultiply) MRImultiplyConst(mrif, MultiplyVal, mrif);
+      if(DoAdd) MRIaddConst(mrif, AddVal, mrif);
+      if(MRIframeStreamWrite(fsout, mrif, 1) != NO_ERROR) return(1);
+    }
+    MRIfree(&mriin);
+    MRIframeStreamClose(&fsin);
+    if(n < 0)
+    {
+      printf("ERROR: reading %s\n",inlist[nthin]);
+      return(1);
+    }
+  }
+
+  if(sum == NULL)
+  {
+    printf("Wrote %s\n",out);
+    MRIfree(&mrif);
+    return(MRIframeStreamClose(&fsout));
+  }
+
+  printf("Computing %s across frames\n", DoMean ? "mean" : "sum");
+  mriout = MRIallocSequence(nc,nr,ns,MRI_FLOAT,1);
+  MRIcopyHeader(mrif, mriout);
+  for(i=0, s=0; s < ns; s++)
+  {
+    for(r=0; r < nr; r++)
+    {
+      for(c=0; c < nc; c++, i++)
+      {
+        v = sum[i];
+        if(DoMean) v /= nframestot;
+        MRIsetVoxVal(mriout,c,r,s,0,v);
+      }
+    }
+  }
+  free(sum);
+  MRIfree(&mrif);
+  if(DoMultiply) MRImultiplyConst(mriout, MultiplyVal, mriout);
+  if(DoAdd) MRIaddConst(mriout, AddVal, mriout);
+  printf("Writing to %s\n",out);
+  err = MRIwrite(mriout,out);
+  MRIfree(&mriout);
+  return(err);
+}
+
 MATRIX *GroupedMeanMatrix(int ngroups, int ntotal)
 {
   int nper,r,c;
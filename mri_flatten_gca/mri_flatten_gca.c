@@ -0,0 +1,147 @@
+/**
+ * @file  mri_flatten_gca.c
+ * @brief convert a gca atlas to the flat, memory-mappable layout
+ *
+ * Reads a gca in any format GCAread() understands and writes it with
+ * GCAwriteFlat(), which GCAread() then maps instead of parsing.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ * CVS Revision Info:
+ *    $Author$
+ *    $Date$
+ *    $Revision$
+ *
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <ctype.h>
+
+#include "mri.h"
+#include "macros.h"
+#include "error.h"
+#include "diag.h"
+#include "proto.h"
+#include "utils.h"
+#include "const.h"
+#include "timer.h"
+#include "version.h"
+#include "gca.h"
+
+int main(int argc, char *argv[]) ;
+static int get_option(int argc, char *argv[]) ;
+
+char *Progname ;
+static void usage_exit(int code) ;
+
+static int check_flag = 0 ;
+
+int
+main(int argc, char *argv[]) {
+  int          nargs ;
+  int          msec ;
+  struct timeb start ;
+  GCA          *gca ;
+
+  /* rkt: check for and handle version tag */
+  nargs = handle_version_option (argc, argv, "$Id$", "$Name:  $");
+  if (nargs && argc - nargs == 1)
+    exit (0);
+  argc -= nargs;
+
+  Progname = argv[0] ;
+  ErrorInit(NULL, NULL, NULL) ;
+  DiagInit(NULL, NULL, NULL) ;
+
+  for ( ; argc > 1 && ISOPTION(*argv[1]) ; argc--, argv++) {
+    nargs = get_option(argc, argv) ;
+    argc -= nargs ;
+    argv += nargs ;
+  }
+
+  if (argc < 3)
+    usage_exit(1) ;
+
+  TimerStart(&start) ;
+  gca = GCAread(argv[1]) ;
+  if (gca == NULL)
+    ErrorExit(ERROR_NOFILE, "%s: could not read gca from %s", Progname, argv[1]) ;
+  msec = TimerStop(&start) ;
+  printf("reading %s took %2.2f seconds\n", argv[1], (float)msec/1000.0f) ;
+
+  printf("writing flat gca to %s...\n", argv[2]) ;
+  if (GCAwriteFlat(gca, argv[2]) != NO_ERROR)
+    ErrorExit(Gerror, "%s: could not write flat gca to %s", Progname, argv[2]) ;
+  GCAfree(&gca) ;
+
+  if (check_flag) {
+    TimerStart(&start) ;
+    gca = GCAread(argv[2]) ;
+    if (gca == NULL)
+      ErrorExit(ERROR_BADFILE, "%s: could not read back %s", Progname, argv[2]) ;
+    msec = TimerStop(&start) ;
+    printf("reading %s back took %2.2f seconds\n", argv[2], (float)msec/1000.0f) ;
+    GCAfree(&gca) ;
+  }
+  exit(0) ;
+  return(0) ;
+}
+/*----------------------------------------------------------------------
+            Parameters:
+
+           Description:
+----------------------------------------------------------------------*/
+static int
+get_option(int argc, char *argv[]) {
+  int  nargs = 0 ;
+  char *option ;
+
+  option = argv[1] + 1 ;            /* past '-' */
+  switch (toupper(*option)) {
+  case 'C':
+    check_flag = 1 ;
+    break ;
+  case '?':
+  case 'U':
+    usage_exit(0) ;
+    break ;
+  default:
+    fprintf(stderr, "unknown option %s\n", argv[1]) ;
+    exit(1) ;
+    break ;
+  }
+
+  return(nargs) ;
+}
+/*----------------------------------------------------------------------
+            Parameters:
+
+           Description:
+----------------------------------------------------------------------*/
+static void
+usage_exit(int code) {
+  printf("usage: %s [options] <input gca> <output flat gca>\n", Progname) ;
+  printf("\n") ;
+  printf("Writes the gca in a flat layout that GCAread() maps into memory\n") ;
+  printf("instead of parsing (so the atlas loads almost instantly and is\n") ;
+  printf("shared between processes). The layout is native-endian. Output\n") ;
+  printf("names ending in .fgca are also written flat by any tool that\n") ;
+  printf("calls GCAwrite().\n") ;
+  printf("\n") ;
+  printf("  -c   read the flat gca back and report the load time\n") ;
+  printf("  -u   print usage\n") ;
+  exit(code) ;
+}
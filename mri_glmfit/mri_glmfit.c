@@ -118,6 +118,7 @@ USAGE: ./mri_glmfit
    --allow-zero-dof : mostly for very special purposes
    --illcond : allow ill-conditioned design matrices
    --sim-done SimDoneFile : create DoneFile when simulation finished 
+   --threads N : run N simulation iterations in parallel (with --sim)
 
 ENDUSAGE --------------------------------------------------------------
 
@@ -553,6 +554,10 @@ double round(double x);
 #include "image.h"
 #include "stats.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 int MRISmaskByLabel(MRI *y, MRIS *surf, LABEL *lb, int invflag);
 
 static int  parse_commandline(int argc, char **argv);
@@ -729,6 +734,32 @@ int  nSignList = 3, nthSign;
 int SignList[3] = {-1,0,1};
 CSD *csdList[5][3][20];
 
+/* State for one simulation iteration. The random inputs are drawn
+   serially by GLMSIMdraw(); the fit, test, and clustering are done by
+   GLMSIMrun(), which can run concurrently on different GLMSIMs. The
+   first GLMSIM uses the global mriglm and rfs. Surface clusters are
+   found on simgraph, which all GLMSIMs share. */
+typedef struct {
+  int nthsim;       // iteration number
+  MRIGLM *mriglm;   // private fit/test output (y shared unless mc-full)
+  MRIS *surf;       // surface for smoothing (or NULL), shared
+  RFS *rfs;         // private rfs for rescaling (mc-z, mc-t)
+  MRI *zsynth[20];  // unsmoothed random field for each contrast
+  MRI *z, *zabs, *sig;
+  int    nClusters[5][3][20];
+  double csize[5][3][20], sigmax[5][3][20], Fmax[5][3][20];
+} GLMSIM;
+GLMSIM **simlist;
+int nsimworkers=1, nsimrun;
+SCG *simgraph=NULL; // surface graph for clustering
+MATRIX *XgPerm=NULL; // permuted design, carried across iterations
+static int GLMSIMnWorkers(void);
+static GLMSIM *GLMSIMalloc(int nthworker);
+static int GLMSIMdraw(GLMSIM *sim);
+static int GLMSIMrun(GLMSIM *sim);
+static int GLMSIMmerge(GLMSIM *sim);
+static int GLMSIMwriteCSD(int msecFitTime);
+
 MATRIX *RTM_Cr, *RTM_intCr, *RTM_TimeSec, *RTM_TimeMin;
 int DoMRTM1=0;
 int DoMRTM2=0;
@@ -763,8 +794,7 @@ int main(int argc, char **argv) {
   MATRIX *wvect=NULL, *Mtmp=NULL, *Xselfreg=NULL, *Ex=NULL, *XgNew=NULL;
   MATRIX *Ct, *CCt;
   FILE *fp;
-  double Ccond, dtmp, threshadj, eff;
-  char *tmpstr2=NULL;
+  double Ccond, dtmp, eff;
 
   eresfwhm = -1;
   csd = CSDalloc();
@@ -1636,16 +1666,11 @@ int main(int argc, char **argv) {
       rfs->name = strcpyalloc("gaussian");
       rfs->params[0] = 0;
       rfs->params[1] = 1;
-      //z = MRIalloc(mriglm->y->width,mriglm->y->height,mriglm->y->depth,MRI_FLOAT);
-      z = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
-      zabs = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
     }
     if (!strcmp(csd->simtype,"mc-t")) {
       rfs = RFspecInit(SynthSeed,NULL);
       rfs->name = strcpyalloc("t");
       rfs->params[0] = mriglm->glm->dof;
-      z = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
-      zabs = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
     }
     printf("thresh = %g, threshadj = %g \n",csd->thresh,csd->thresh-log10(2.0));
 
@@ -1670,203 +1695,45 @@ int main(int argc, char **argv) {
       }
     }
 
+    if (!strcmp(csd->simtype,"perm")) XgPerm = MatrixCopy(mriglm->Xg,NULL);
+
+    // Iterations are run nsimworkers at a time. The random inputs for
+    // each iteration are drawn serially in iteration order so that the
+    // CSD files are the same regardless of the number of threads.
+    if(surf){
+      simgraph = sclustGraphAlloc(surf, mriglm->mask);
+      if(simgraph == NULL) exit(1);
+    }
+    nsimworkers = GLMSIMnWorkers();
+    simlist = (GLMSIM **) calloc(sizeof(GLMSIM *),nsimworkers);
+    for(n=0; n < nsimworkers; n++) simlist[n] = GLMSIMalloc(n);
+    if(nsimworkers > 1) printf("Running %d simulation iterations in parallel\n",nsimworkers);
+
     printf("\n\nStarting simulation sim over %d trials\n",nsim);
     TimerStart(&mytimer) ;
-    for (nthsim=0; nthsim < nsim; nthsim++) {
+    for (nthsim=0; nthsim < nsim; nthsim += nsimworkers) {
       msecFitTime = TimerStop(&mytimer) ;
-      if(debug) printf("%d/%d t=%g ---------------------------------\n",
-             nthsim+1,nsim,msecFitTime/(1000*60.0));
-
-      if (!strcmp(csd->simtype,"mc-full")) {
-	if(! UseUniform)
-	  MRIrandn(mriglm->y->width,mriglm->y->height,mriglm->y->depth,
-		   mriglm->y->nframes,0,1,mriglm->y);
-	else
-	  MRIdrand48(mriglm->y->width,mriglm->y->height,mriglm->y->depth,
-		  mriglm->y->nframes,UniformMin,UniformMax,mriglm->y);
-        if(logflag) MRIlog(mriglm->y,mriglm->mask,-1,1,mriglm->y);
-        if(FWHM > 0)
-          SmoothSurfOrVol(surf, mriglm->y, mriglm->mask, SmoothLevel);
+      nsimrun = MIN(nsimworkers,nsim-nthsim);
+      for(n=0; n < nsimrun; n++){
+	simlist[n]->nthsim = nthsim+n;
+	if(debug) printf("%d/%d t=%g ---------------------------------\n",
+			 nthsim+n+1,nsim,msecFitTime/(1000*60.0));
+	GLMSIMdraw(simlist[n]);
       }
-      if (!strcmp(csd->simtype,"perm")) {
-        if (!OneSamplePerm) MatrixRandPermRows(mriglm->Xg);
-        else {
-          for (n=0; n < mriglm->y->nframes; n++) {
-            if (drand48() > 0.5) m = +1;
-            else                m = -1;
-            mriglm->Xg->rptr[n+1][1] = m;
-          }
-          //MatrixPrint(stdout,mriglm->Xg);
-        }
-      }
-
-      // Variance smoothing
-      if (!strcmp(csd->simtype,"mc-full") || !strcmp(csd->simtype,"perm")) {
-        // If variance smoothing, then need to test and fit separately
-        if (VarFWHM > 0) {
-          if(!DoSim) printf("Starting fit\n");
-          MRIglmFit(mriglm);
-          if(!DoSim) printf("Variance smoothing\n");
-          SmoothSurfOrVol(surf, mriglm->rvar, mriglm->mask, VarSmoothLevel);
-          if(!DoSim) printf("Starting test\n");
-          MRIglmTest(mriglm);
-        }
-	else {
-          if(!DoSim) printf("Starting fit and test\n");
-          MRIglmFitAndTest(mriglm);
-        }
+      if(nsimrun == 1) GLMSIMrun(simlist[0]);
+      else {
+#ifdef _OPENMP
+	#pragma omp parallel for num_threads(nsimrun) schedule(static,1)
+#endif
+	for(n=0; n < nsimrun; n++) GLMSIMrun(simlist[n]);
       }
-
-      for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
-	for(nthSign = 0; nthSign < nSignList; nthSign++){
-	  // Go through each contrast.
-	  for (n=0; n < mriglm->glm->ncontrasts; n++) {
-	    if(DoSimThreshLoop) {
-	      csd = csdList[nthThresh][nthSign][n];
-	      tSimSign = SignList[nthSign];
-	    }
-	    if(debug) printf("%2d %d %5.1f  %d %2d %5.1f\n",nthsim,nthThresh,
-			     csd->thresh,nthSign,tSimSign,TimerStop(&mytimer)/1000.0);
-
-	    // Change sign to abs for F-tests
-	    csd->threshsign = tSimSign;
-	    if(mriglm->glm->C[n]->rows > 1) csd->threshsign = 0;
-	    
-	    // Adjust threshold for one- or two-sided
-	    if(csd->threshsign == 0) threshadj = csd->thresh;
-	    else threshadj = csd->thresh - log10(2.0); // one-sided test
-
-	    if (!strcmp(csd->simtype,"mc-full") || !strcmp(csd->simtype,"perm")) {
-	      sig = MRIlog10(mriglm->p[n],NULL,sig,1);
-	      // If test is not ABS then apply the sign
-	      if(csd->threshsign != 0) MRIsetSign(sig,mriglm->gamma[n],0);
-	      sigmax = MRIframeMax(sig,0,mriglm->mask,csd->threshsign,
-				   &cmax,&rmax,&smax);
-	      // Get Fmax at sig max 
-	      Fmax = MRIgetVoxVal(mriglm->F[n],cmax,rmax,smax,0);
-	      if(csd->threshsign != 0) Fmax = Fmax*SIGN(sigmax);
-	    } 
-	    else {
-	      // mc-z or mc-t: synth z-field, smooth, rescale,
-	      // compute p, compute sig
-	      // This should do the same thing as AFNI's AlphaSim
-	      // Synth and rescale without the mask, otherwise smoothing
-	      // smears the 0s into the mask area. Also, the stuff outisde
-	      // the mask area wont get zeroed.
-	      if(nthThresh == 0 && nthSign == 0) {
-		RFsynth(z,rfs,mriglm->mask); // z or t, as needed
-		if (SmoothLevel > 0) {
-		  SmoothSurfOrVol(surf, z, mriglm->mask, SmoothLevel);
-		  if(DiagCluster) {
-		    sprintf(tmpstr,"./%s-zsm0.%s",mriglm->glm->Cname[n],format);
-		    printf("Saving z into %s\n",tmpstr);
-		    MRIwrite(z,tmpstr);
-		    // Exits below
-		  }
-		  RFrescale(z,rfs,mriglm->mask,z);
-		}
-	      }
-	      if(DiagCluster) {
-		sprintf(tmpstr,"./%s-zsm1.%s",mriglm->glm->Cname[n],format);
-		printf("Saving z into %s\n",tmpstr);
-		MRIwrite(z,tmpstr);
-		// Exits below
-	      }
-	      // Slightly tortured way to get the right p-values because
-	      //   RFstat2P() computes one-sided, but I handle sidedness
-	      //   during thresholding.
-	      // First, use zabs to get a two-sided pval bet 0 and 0.5
-	      zabs = MRIabs(z,zabs);
-	      mriglm->p[n] = RFstat2P(zabs,rfs,mriglm->mask,0,mriglm->p[n]);
-	      // Next, mult pvals by 2 to get two-sided bet 0 and 1
-	      MRIscalarMul(mriglm->p[n],mriglm->p[n],2);
-	      // sig = -log10(p)
-	      sig = MRIlog10(mriglm->p[n],NULL,sig,1);
-	      // If test is not ABS then apply the sign
-	      if(csd->threshsign != 0) MRIsetSign(sig,z,0);
-
-	      sigmax = MRIframeMax(sig,0,mriglm->mask,csd->threshsign,
-				   &cmax,&rmax,&smax);
-	      Fmax = MRIgetVoxVal(z,cmax,rmax,smax,0);
-	      if(csd->threshsign == 0) Fmax = fabs(Fmax);
-	    }
-	    if(mriglm->mask) MRImask(sig,mriglm->mask,sig,0.0,0.0);
-
-	    if(surf) {
-	      // surface clustering -------------
-	      MRIScopyMRI(surf, sig, 0, "val");
-	      if(debug || Gdiag_no > 0) printf("Clustering on surface %lf\n",
-					       TimerStop(&mytimer)/1000.0);
-	      SurfClustList = sclustMapSurfClusters(surf,threshadj,-1,csd->threshsign,
-						    0,&nClusters,NULL);
-	      csize = sclustMaxClusterArea(SurfClustList, nClusters);
-	    } 
-	    else {
-	      // volume clustering -------------
-	      if (debug) printf("Clustering on volume\n");
-	      VolClustList = clustGetClusters(sig, 0, threshadj,-1,csd->threshsign,0,
-					      mriglm->mask, &nClusters, NULL);
-	      csize = voxelsize*clustMaxClusterCount(VolClustList,nClusters);
-	      if (Gdiag_no > 0) clustDumpSummary(stdout,VolClustList,nClusters);
-	      clustFreeClusterList(&VolClustList,nClusters);
-	    }
-	    if(debug) printf("%s %d nc=%d  maxcsize=%g  sigmax=%g  Fmax=%g\n",
-			     mriglm->glm->Cname[n],nthsim,nClusters,csize,sigmax,Fmax);
-
-	    // Re-write the full CSD file each time. Should not take that
-	    // long and assures output can be used immediately regardless
-	    // of whether the job terminated properly or not
-	    strcpy(csd->contrast,mriglm->glm->Cname[n]);
-	    if(DoSimThreshLoop && (nThreshList > 1 || nSignList > 1) ){
-	      if(round(csd->threshsign) ==  0) tmpstr2 = "abs"; 
-	      if(round(csd->threshsign) == +1) tmpstr2 = "pos"; 
-	      if(round(csd->threshsign) == -1) tmpstr2 = "neg"; 
-	      //sprintf(tmpstr,"%s-%s.th%04d.%s.csd",simbase,mriglm->glm->Cname[n],
-	      //      (int)round(csd->thresh*100),tmpstr2);
-	      sprintf(tmpstr,"%s.th%02d.%s.j001-%s.csd",simbase,
-		      (int)round(csd->thresh*10),tmpstr2,mriglm->glm->Cname[n]);
-	    }
-	    else
-	      sprintf(tmpstr,"%s-%s.csd",simbase,mriglm->glm->Cname[n]);
-	    if(debug) printf("csd %s \n",tmpstr);
-	    fflush(stdout);
-	    fp = fopen(tmpstr,"w");
-	    if (fp == NULL) {
-	      printf("ERROR: opening %s\n",tmpstr);
-	      exit(1);
-	    }
-	    fprintf(fp,"# ClusterSimulationData 2\n");
-	    fprintf(fp,"# mri_glmfit simulation sim\n");
-	    fprintf(fp,"# hostname %s\n",uts.nodename);
-	    fprintf(fp,"# machine  %s\n",uts.machine);
-	    fprintf(fp,"# runtime_min %g\n",msecFitTime/(1000*60.0));
-	    fprintf(fp,"# FixVertexAreaFlag %d\n",MRISgetFixVertexAreaValue());
-	    if (mriglm->mask) fprintf(fp,"# masking 1\n");
-	    else             fprintf(fp,"# masking 0\n");
-	    fprintf(fp,"# num_dof %d\n",mriglm->glm->C[n]->rows);
-	    fprintf(fp,"# den_dof %g\n",mriglm->glm->dof);
-	    fprintf(fp,"# SmoothLevel %g\n",SmoothLevel);
-	    csd->nreps = nthsim+1;
-	    csd->nClusters[nthsim] = nClusters;
-	    csd->MaxClusterSize[nthsim] = csize;
-	    csd->MaxSig[nthsim] = sigmax;
-	    csd->MaxStat[nthsim] = Fmax;
-	    CSDprint(fp, csd);
-	    fclose(fp);
-	    if(debug) CSDprint(stdout, csd);
-
-	    if(DiagCluster) {
-	      sprintf(tmpstr,"./%s-sig.%s",mriglm->glm->Cname[n],format);
-	      printf("Saving sig into %s and exiting ... \n",tmpstr);
-	      MRIwrite(sig,tmpstr);
-	      exit(1);
-	    }
-	    free(SurfClustList);
-	  } // contrasts
-	} // sign list
-      } // thresh list
-      //MRIfree(&sig);
+      // Merge in iteration order, then re-write the full CSD files.
+      // Should not take that long and assures output can be used
+      // immediately regardless of whether the job terminated properly
+      for(n=0; n < nsimrun; n++) GLMSIMmerge(simlist[n]);
+      GLMSIMwriteCSD(msecFitTime);
     }// simulation loop
+    sclustGraphFree(&simgraph);
     if(SimDoneFile){
       fp = fopen(SimDoneFile,"w");
       fclose(fp);
@@ -2868,6 +2735,15 @@ static int parse_commandline(int argc, char **argv) {
       SimDoneFile = pargv[0];
       nargsused = 1;
     } 
+    else if(!strcasecmp(option, "--threads") || !strcasecmp(option, "--nthreads") ){
+      if(nargc < 1) CMDargNErr(option,1);
+      int nthreads;
+      sscanf(pargv[0],"%d",&nthreads);
+      #ifdef _OPENMP
+      omp_set_num_threads(nthreads);
+      #endif
+      nargsused = 1;
+    } 
     else {
       fprintf(stderr,"ERROR: Option %s unknown\n",option);
       if (CMDsingleDash(option))
@@ -2969,6 +2845,7 @@ printf("                  before --fsgd)\n");
 printf("   --allow-zero-dof : mostly for very special purposes\n");
 printf("   --illcond : allow ill-conditioned design matrices\n");
 printf("   --sim-done SimDoneFile : create DoneFile when simulation finished \n");
+printf("   --threads N : run N simulation iterations in parallel (with --sim)\n");
 printf("\n");
 printf("\n");
 }
@@ -3622,6 +3499,350 @@ static int SmoothSurfOrVol(MRIS *surf, MRI *mri, MRI *mask, double SmthLevel) {
 }
 
 
+/*--------------------------------------------------------------------*/
+/*!
+  \fn static int GLMSIMnWorkers(void)
+  \brief Returns the number of simulation iterations that can be run
+  at the same time. This is the number of OpenMP threads unless the
+  simulation needs code that is not thread safe (the per-voxel GLM,
+  which keeps static state, or the cluster diagnostics, which exit).
+*/
+static int GLMSIMnWorkers(void)
+{
+  int nworkers = 1, n;
+
+#ifdef _OPENMP
+  nworkers = omp_get_max_threads();
+#endif
+  if(nworkers > nsim) nworkers = nsim;
+  if(nworkers < 2 || DiagCluster) return(1);
+  if(!strcmp(csd->simtype,"mc-full") || !strcmp(csd->simtype,"perm")){
+    if(VarFWHM > 0 || IllCondOK) return(1);
+    if(mriglm->w != NULL || mriglm->npvr != 0 || mriglm->FrameMask != NULL) return(1);
+    if(mriglm->wg != NULL || mriglm->yffxvar != NULL) return(1);
+    for(n=0; n < mriglm->glm->ncontrasts; n++)
+      if(mriglm->glm->ypmfflag[n]) return(1);
+  }
+  return(nworkers);
+}
+
+/*--------------------------------------------------------------------*/
+/*!
+  \fn static GLMSIM *GLMSIMalloc(int nthworker)
+  \brief Allocates the state for one simulation worker. Worker 0 uses
+  the global mriglm and rfs. The others get a copy of the design and
+  contrasts (and of the data for mc-full) so that their fits do not
+  touch the globals. All workers share surf, which smoothing only
+  reads, and clustering uses simgraph instead of the surface.
+*/
+static GLMSIM *GLMSIMalloc(int nthworker)
+{
+  GLMSIM *sim;
+  MRIGLM *g;
+  int n;
+
+  sim = (GLMSIM *) calloc(sizeof(GLMSIM),1);
+  sim->surf = surf;
+  if(nthworker == 0){
+    sim->mriglm = mriglm;
+    sim->rfs = rfs;
+  }
+  else {
+    g = (MRIGLM *) calloc(sizeof(MRIGLM),1);
+    g->glm = GLMalloc();
+    g->glm->DoPCC = mriglm->glm->DoPCC;
+    g->glm->ReScaleX = mriglm->glm->ReScaleX;
+    g->glm->AllowZeroDOF = mriglm->glm->AllowZeroDOF;
+    g->glm->dof = mriglm->glm->dof;
+    g->glm->ncontrasts = mriglm->glm->ncontrasts;
+    for(n=0; n < mriglm->glm->ncontrasts; n++){
+      g->glm->C[n] = MatrixCopy(mriglm->glm->C[n],NULL);
+      g->glm->Cname[n] = mriglm->glm->Cname[n];
+      g->glm->UseGamma0[n] = mriglm->glm->UseGamma0[n];
+      if(mriglm->glm->gamma0[n])
+	g->glm->gamma0[n] = MatrixCopy(mriglm->glm->gamma0[n],NULL);
+    }
+    g->Xg = MatrixCopy(mriglm->Xg,NULL);
+    if(mriglm->glm->X == mriglm->Xg) g->glm->X = g->Xg; // DoPCC
+    if(!strcmp(csd->simtype,"mc-full")) g->y = MRIcopy(mriglm->y,NULL);
+    else                                g->y = mriglm->y;
+    g->mask = mriglm->mask;
+    g->ffxdof = mriglm->ffxdof;
+    sim->mriglm = g;
+
+    // RFrescale() changes the mean and stddev, the rng is not used
+    if(rfs){
+      sim->rfs = (RFS *) calloc(sizeof(RFS),1);
+      *(sim->rfs) = *rfs;
+    }
+  }
+  if(!strcmp(csd->simtype,"mc-z") || !strcmp(csd->simtype,"mc-t")){
+    for(n=0; n < mriglm->glm->ncontrasts; n++)
+      sim->zsynth[n] = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
+    sim->z    = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
+    sim->zabs = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
+  }
+  return(sim);
+}
+
+/*--------------------------------------------------------------------*/
+/*!
+  \fn static int GLMSIMdraw(GLMSIM *sim)
+  \brief Draws the random input for one iteration (noise, permutation,
+  or random field). Must be called serially and in iteration order so
+  that the random sequence matches that of a single-threaded run.
+*/
+static int GLMSIMdraw(GLMSIM *sim)
+{
+  MRIGLM *g = sim->mriglm;
+  int n, m;
+
+  if (!strcmp(csd->simtype,"mc-full")) {
+    if(! UseUniform)
+      MRIrandn(g->y->width,g->y->height,g->y->depth,g->y->nframes,0,1,g->y);
+    else
+      MRIdrand48(g->y->width,g->y->height,g->y->depth,g->y->nframes,
+		 UniformMin,UniformMax,g->y);
+  }
+  if (!strcmp(csd->simtype,"perm")) {
+    if (!OneSamplePerm) MatrixRandPermRows(XgPerm);
+    else {
+      for (n=0; n < g->y->nframes; n++) {
+	if (drand48() > 0.5) m = +1;
+	else                m = -1;
+	XgPerm->rptr[n+1][1] = m;
+      }
+    }
+    MatrixCopy(XgPerm,g->Xg);
+  }
+  if (!strcmp(csd->simtype,"mc-z") || !strcmp(csd->simtype,"mc-t")) {
+    // Synth without the mask, otherwise smoothing smears the 0s into
+    // the mask area. z or t, as needed.
+    for (n=0; n < g->glm->ncontrasts; n++)
+      RFsynth(sim->zsynth[n],rfs,g->mask);
+  }
+  return(0);
+}
+
+/*--------------------------------------------------------------------*/
+/*!
+  \fn static int GLMSIMrun(GLMSIM *sim)
+  \brief Runs one simulation iteration on the input drawn by
+  GLMSIMdraw(): fit and test (mc-full, perm) or smooth and rescale the
+  random field (mc-z, mc-t), then find the maximum cluster size and
+  maximum sig for each threshold, sign, and contrast. Results are kept
+  in sim until GLMSIMmerge(). Only changes the state in sim.
+*/
+static int GLMSIMrun(GLMSIM *sim)
+{
+  MRIGLM *g = sim->mriglm;
+  int n, nthThresh, nthSign, threshsign, cmax, rmax, smax, nClusters;
+  double thresh, threshadj, sigmax, Fmax, csize;
+  SURFCLUSTERSUM *SurfClustList;
+  VOLCLUSTER **VolClustList;
+
+  if (!strcmp(csd->simtype,"mc-full")) {
+    if(logflag) MRIlog(g->y,g->mask,-1,1,g->y);
+    if(FWHM > 0) SmoothSurfOrVol(sim->surf, g->y, g->mask, SmoothLevel);
+  }
+
+  if (!strcmp(csd->simtype,"mc-full") || !strcmp(csd->simtype,"perm")) {
+    // If variance smoothing, then need to test and fit separately
+    if (VarFWHM > 0) {
+      MRIglmFit(g);
+      SmoothSurfOrVol(sim->surf, g->rvar, g->mask, VarSmoothLevel);
+      MRIglmTest(g);
+    }
+    else MRIglmFitAndTest(g);
+  }
+
+  for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
+    for(nthSign = 0; nthSign < nSignList; nthSign++){
+      // Go through each contrast.
+      for (n=0; n < g->glm->ncontrasts; n++) {
+	thresh = ThreshList[nthThresh];
+	if(debug) printf("%2d %d %5.1f  %d %2d %5.1f\n",sim->nthsim,nthThresh,
+			 thresh,nthSign,SignList[nthSign],TimerStop(&mytimer)/1000.0);
+
+	// Change sign to abs for F-tests
+	threshsign = SignList[nthSign];
+	if(g->glm->C[n]->rows > 1) threshsign = 0;
+
+	// Adjust threshold for one- or two-sided
+	if(threshsign == 0) threshadj = thresh;
+	else threshadj = thresh - log10(2.0); // one-sided test
+
+	if (!strcmp(csd->simtype,"mc-full") || !strcmp(csd->simtype,"perm")) {
+	  sim->sig = MRIlog10(g->p[n],NULL,sim->sig,1);
+	  // If test is not ABS then apply the sign
+	  if(threshsign != 0) MRIsetSign(sim->sig,g->gamma[n],0);
+	  sigmax = MRIframeMax(sim->sig,0,g->mask,threshsign,&cmax,&rmax,&smax);
+	  // Get Fmax at sig max
+	  Fmax = MRIgetVoxVal(g->F[n],cmax,rmax,smax,0);
+	  if(threshsign != 0) Fmax = Fmax*SIGN(sigmax);
+	}
+	else {
+	  // mc-z or mc-t: smooth, rescale, compute p, compute sig
+	  // This should do the same thing as AFNI's AlphaSim
+	  // Rescale without the mask, otherwise the stuff outisde
+	  // the mask area wont get zeroed.
+	  if(nthThresh == 0 && nthSign == 0) {
+	    MRIcopy(sim->zsynth[n],sim->z);
+	    if (SmoothLevel > 0) {
+	      SmoothSurfOrVol(sim->surf, sim->z, g->mask, SmoothLevel);
+	      if(DiagCluster) {
+		sprintf(tmpstr,"./%s-zsm0.%s",g->glm->Cname[n],format);
+		printf("Saving z into %s\n",tmpstr);
+		MRIwrite(sim->z,tmpstr);
+		// Exits below
+	      }
+	      RFrescale(sim->z,sim->rfs,g->mask,sim->z);
+	    }
+	  }
+	  if(DiagCluster) {
+	    sprintf(tmpstr,"./%s-zsm1.%s",g->glm->Cname[n],format);
+	    printf("Saving z into %s\n",tmpstr);
+	    MRIwrite(sim->z,tmpstr);
+	    // Exits below
+	  }
+	  // Slightly tortured way to get the right p-values because
+	  //   RFstat2P() computes one-sided, but I handle sidedness
+	  //   during thresholding.
+	  // First, use zabs to get a two-sided pval bet 0 and 0.5
+	  sim->zabs = MRIabs(sim->z,sim->zabs);
+	  g->p[n] = RFstat2P(sim->zabs,sim->rfs,g->mask,0,g->p[n]);
+	  // Next, mult pvals by 2 to get two-sided bet 0 and 1
+	  MRIscalarMul(g->p[n],g->p[n],2);
+	  // sig = -log10(p)
+	  sim->sig = MRIlog10(g->p[n],NULL,sim->sig,1);
+	  // If test is not ABS then apply the sign
+	  if(threshsign != 0) MRIsetSign(sim->sig,sim->z,0);
+
+	  sigmax = MRIframeMax(sim->sig,0,g->mask,threshsign,&cmax,&rmax,&smax);
+	  Fmax = MRIgetVoxVal(sim->z,cmax,rmax,smax,0);
+	  if(threshsign == 0) Fmax = fabs(Fmax);
+	}
+	if(g->mask) MRImask(sim->sig,g->mask,sim->sig,0.0,0.0);
+
+	SurfClustList = NULL;
+	if(sim->surf) {
+	  // surface clustering -------------
+	  if(debug || Gdiag_no > 0) printf("Clustering on surface %lf\n",
+					   TimerStop(&mytimer)/1000.0);
+	  SurfClustList = sclustGraphClusters(simgraph,sim->sig,0,threshadj,-1,
+					      threshsign,NULL,&nClusters);
+	  csize = sclustMaxClusterArea(SurfClustList, nClusters);
+	}
+	else {
+	  // volume clustering -------------
+	  if (debug) printf("Clustering on volume\n");
+	  VolClustList = clustGetClusters(sim->sig, 0, threshadj,-1,threshsign,0,
+					  g->mask, &nClusters, NULL);
+	  csize = voxelsize*clustMaxClusterCount(VolClustList,nClusters);
+	  if (Gdiag_no > 0) clustDumpSummary(stdout,VolClustList,nClusters);
+	  clustFreeClusterList(&VolClustList,nClusters);
+	}
+	if(debug) printf("%s %d nc=%d  maxcsize=%g  sigmax=%g  Fmax=%g\n",
+			 g->glm->Cname[n],sim->nthsim,nClusters,csize,sigmax,Fmax);
+	sim->nClusters[nthThresh][nthSign][n] = nClusters;
+	sim->csize[nthThresh][nthSign][n] = csize;
+	sim->sigmax[nthThresh][nthSign][n] = sigmax;
+	sim->Fmax[nthThresh][nthSign][n] = Fmax;
+
+	if(DiagCluster) {
+	  sprintf(tmpstr,"./%s-sig.%s",g->glm->Cname[n],format);
+	  printf("Saving sig into %s and exiting ... \n",tmpstr);
+	  MRIwrite(sim->sig,tmpstr);
+	  exit(1);
+	}
+	free(SurfClustList);
+      } // contrasts
+    } // sign list
+  } // thresh list
+  return(0);
+}
+
+/*--------------------------------------------------------------------*/
+/*!
+  \fn static int GLMSIMmerge(GLMSIM *sim)
+  \brief Copies the results of one iteration into the CSDs.
+*/
+static int GLMSIMmerge(GLMSIM *sim)
+{
+  int n, nthThresh, nthSign;
+  CSD *csdn;
+
+  for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
+    for(nthSign = 0; nthSign < nSignList; nthSign++){
+      for (n=0; n < mriglm->glm->ncontrasts; n++) {
+	csdn = csdList[nthThresh][nthSign][n];
+	// Change sign to abs for F-tests
+	csdn->threshsign = SignList[nthSign];
+	if(mriglm->glm->C[n]->rows > 1) csdn->threshsign = 0;
+	csdn->nreps = sim->nthsim+1;
+	csdn->nClusters[sim->nthsim]      = sim->nClusters[nthThresh][nthSign][n];
+	csdn->MaxClusterSize[sim->nthsim] = sim->csize[nthThresh][nthSign][n];
+	csdn->MaxSig[sim->nthsim]         = sim->sigmax[nthThresh][nthSign][n];
+	csdn->MaxStat[sim->nthsim]        = sim->Fmax[nthThresh][nthSign][n];
+      }
+    }
+  }
+  return(0);
+}
+
+/*--------------------------------------------------------------------*/
+/*!
+  \fn static int GLMSIMwriteCSD(int msecFitTime)
+  \brief Writes the CSD file for each threshold, sign, and contrast.
+*/
+static int GLMSIMwriteCSD(int msecFitTime)
+{
+  int n, nthThresh, nthSign;
+  char *tmpstr2=NULL;
+  CSD *csdn;
+  FILE *fp;
+
+  for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
+    for(nthSign = 0; nthSign < nSignList; nthSign++){
+      for (n=0; n < mriglm->glm->ncontrasts; n++) {
+	csdn = csdList[nthThresh][nthSign][n];
+	strcpy(csdn->contrast,mriglm->glm->Cname[n]);
+	if(DoSimThreshLoop && (nThreshList > 1 || nSignList > 1) ){
+	  if(round(csdn->threshsign) ==  0) tmpstr2 = "abs";
+	  if(round(csdn->threshsign) == +1) tmpstr2 = "pos";
+	  if(round(csdn->threshsign) == -1) tmpstr2 = "neg";
+	  sprintf(tmpstr,"%s.th%02d.%s.j001-%s.csd",simbase,
+		  (int)round(csdn->thresh*10),tmpstr2,mriglm->glm->Cname[n]);
+	}
+	else
+	  sprintf(tmpstr,"%s-%s.csd",simbase,mriglm->glm->Cname[n]);
+	if(debug) printf("csd %s \n",tmpstr);
+	fflush(stdout);
+	fp = fopen(tmpstr,"w");
+	if (fp == NULL) {
+	  printf("ERROR: opening %s\n",tmpstr);
+	  exit(1);
+	}
+	fprintf(fp,"# ClusterSimulationData 2\n");
+	fprintf(fp,"# mri_glmfit simulation sim\n");
+	fprintf(fp,"# hostname %s\n",uts.nodename);
+	fprintf(fp,"# machine  %s\n",uts.machine);
+	fprintf(fp,"# runtime_min %g\n",msecFitTime/(1000*60.0));
+	fprintf(fp,"# FixVertexAreaFlag %d\n",MRISgetFixVertexAreaValue());
+	if (mriglm->mask) fprintf(fp,"# masking 1\n");
+	else             fprintf(fp,"# masking 0\n");
+	fprintf(fp,"# num_dof %d\n",mriglm->glm->C[n]->rows);
+	fprintf(fp,"# den_dof %g\n",mriglm->glm->dof);
+	fprintf(fp,"# SmoothLevel %g\n",SmoothLevel);
+	CSDprint(fp, csdn);
+	fclose(fp);
+	if(debug) CSDprint(stdout, csdn);
+      }
+    }
+  }
+  return(0);
+}
+
 /*--------------------------------------------------------------------*/
 int MRISmaskByLabel(MRI *y, MRIS *surf, LABEL *lb, int invflag) {
   int **crslut, *lbmask, vtxno, n, c, r, s, f;
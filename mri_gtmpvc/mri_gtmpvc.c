@@ -827,6 +827,7 @@ int main(int argc, char *argv[])
 
   printf("Freeing X\n");
   MatrixFree(&gtm->X);
+  GTMsparseFree(&gtm->Xsp);
 
   nopvc = GTMnoPVC(gtm);
   sprintf(tmpstr,"%s/nopvc.nii.gz",OutDir);
@@ -1970,7 +1971,7 @@ double GTMcostPSF(GTM *gtm)
   GTMpsfStd(gtm);
 
   GTMbuildX(gtm);
-  if(gtm->X==NULL) exit(1);
+  if(gtm->Xsp==NULL) exit(1);
 
   err=GTMsolve(gtm); 
   GTMrvarGM(gtm);
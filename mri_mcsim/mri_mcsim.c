@@ -180,7 +180,7 @@ int main(int argc, char *argv[]) {
   struct timeb  mytimer;
   LABEL *clabel;
   FILE *fp, *fpLog=NULL;
-  float **ppVal, **ppSig, **ppVal0, **ppSig0, **ppZ, **ppZ0;
+  SCG *scg;
 
   nargs = handle_version_option (argc, argv, vcid, "$Name:  $");
   if (nargs && argc - nargs == 1) exit (0);
@@ -383,18 +383,9 @@ int main(int argc, char *argv[]) {
   for(n=0; n < nFWHMList; n++) printf("%5.2f ",FWHMList[n]);
   printf("\n");
 
-  // Set up pointer to the val field
-  ppVal = (float **) calloc(surf->nvertices,sizeof(float *));
-  ppVal0 = ppVal;
-  ppSig = (float **) calloc(surf->nvertices,sizeof(float *));
-  ppSig0 = ppSig;
-  ppZ = (float **) calloc(surf->nvertices,sizeof(float *));
-  ppZ0 = ppZ;
-  for(k=0; k < surf->nvertices; k++){
-    ppVal[k] = &(surf->vertices[k].val);
-    ppSig[k] = &(MRIFseq_vox(sig,k,0,0,0));
-    ppZ[k] = &(MRIFseq_vox(z,k,0,0,0));
-  }
+  // Neighbors, vertex areas, and mask for clustering, built once
+  scg = sclustGraphAlloc(surf, mask);
+  if(scg == NULL) exit(1);
 
   // Start the simulation loop
   printf("\n\nStarting Simulation over %d Repetitions\n",nRepetitions);
@@ -456,12 +447,11 @@ int main(int argc, char *argv[]) {
 	  for(k=0; k < nmaskout; k++) MRIsetVoxVal(sig, maskoutvtxno[k],0,0,0, 0.0);
 	}
 
-	// Copy sig to vertexval
-	//MRIScopyMRI(surf, sig, 0, "val"); // MRIScopyMRI() is a little slow
-	ppVal = ppVal0;
-	ppSig = ppSig0;
-	for(k=0; k < surf->nvertices; k++) *(*ppVal++) = *(*ppSig++);
-
+	// The thresholds are clustered on the same sig map, each into its
+	// own csd, so they can be done in parallel
+#ifdef _OPENMP
+	#pragma omp parallel for schedule(dynamic,1) private(csd,threshadj,SurfClustList,nClusters,csize,csizen,cweightvtx,csizeavg)
+#endif
 	for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
 	  csd = csdList[nthFWHM][nthThresh][nthSign];
 
@@ -470,8 +460,8 @@ int main(int argc, char *argv[]) {
 	  if(csd->threshsign == 0) threshadj = csd->thresh;
 	  else threshadj = csd->thresh - log10(2.0); // one-sided test
 	  // Compute clusters
-	  SurfClustList = sclustMapSurfClusters(surf,threshadj,-1,csd->threshsign,
-						0,&nClusters,NULL);
+	  SurfClustList = sclustGraphClusters(scg,sig,0,threshadj,-1,csd->threshsign,
+					      NULL,&nClusters);
 	  // Actual area of cluster with max area
 	  csize  = sclustMaxClusterArea(SurfClustList, nClusters);
 	  // Number of vertices of cluster with max number of vertices. 
@@ -489,6 +479,7 @@ int main(int argc, char *argv[]) {
 	  csd->MaxClusterWeightVtx[nthRep] = cweightvtx;
 	  csd->MaxSig[nthRep] = sigmax;
 	  csd->MaxStat[nthRep] = zmax;
+	  if(SurfClustList) free(SurfClustList);
 	} // Sign
       } // Thresh
     } // FWHM
@@ -504,6 +495,7 @@ int main(int argc, char *argv[]) {
  finish:
 
   SaveOutput();
+  sclustGraphFree(&scg);
 
   msecTime = TimerStop(&mytimer) ;
   printf("Total Sim Time %g min (%g per rep)\n",
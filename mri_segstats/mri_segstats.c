@@ -216,6 +216,7 @@ int main(int argc, char **argv)
   MRI *tmp;
   MATRIX *vox2vox = NULL;
   double *BrainVolStats=NULL;
+  SEGSTATTABLE *segstab=NULL;
   nhits = 0;
   vol = 0;
 
@@ -776,6 +777,19 @@ int main(int argc, char **argv)
   printf("Computing statistics for each segmentation\n");
   fflush(stdout);
 
+  /* Accumulate the counts and intensity stats of all the segmentations
+     in a single pass through the volume rather than one pass per
+     segmentation. The loop below just reads from the table. */
+  if(!dontrun)
+  {
+    segstab = MRIsegStatsTable(seg, 0, (InVolFile != NULL) ? invol : NULL,
+                               segidlist0, nsegid0, UseRobust ? frame : -1);
+    if(segstab == NULL)
+    {
+      exit(1);
+    }
+  }
+
   DoContinue=0;nx=0;skip=0;n0=0;vol=0;nhits=0;c=0;min=0.0;max=0.0;range=0.0;mean=0.0;std=0.0;snr=0.0;
 #ifdef HAVE_OPENMP
 #pragma omp parallel for firstprivate(DoContinue,nx,skip,n0,vol,nhits,c,min,max,range,mean,std,snr)  schedule(guided)
@@ -815,15 +829,14 @@ int main(int argc, char **argv)
     {
       if (!mris)
       {
+        nhits = segstab->nhits[MRIsegStatsTableRow(segstab,StatSumTable[n].id)];
         if (pvvol == NULL)
         {
-          nhits = MRIsegCount(seg, StatSumTable[n].id, 0);
           vol = nhits*voxelvolume;
         }
         else
         {
           vol = MRIvoxelsInLabelWithPartialVolumeEffects(seg, pvvol, StatSumTable[n].id, NULL, NULL);
-          nhits = MRIsegCount(seg, StatSumTable[n].id, 0);
 //          nhits = nint(vol/voxelvolume);
         }
       }
@@ -861,10 +874,10 @@ int main(int argc, char **argv)
       if (nhits > 0)
       {
         if(UseRobust == 0)
-          MRIsegStats(seg, StatSumTable[n].id, invol, frame,
+          MRIsegStatsTableGet(segstab, StatSumTable[n].id, frame,
             &min, &max, &range, &mean, &std);
         else
-          MRIsegStatsRobust(seg, StatSumTable[n].id, invol, frame,
+          MRIsegStatsTableGetRobust(segstab, StatSumTable[n].id,
             &min, &max, &range, &mean, &std, RobustPct);
 
         snr = mean/std;
@@ -1366,7 +1379,8 @@ int main(int argc, char **argv)
       printf("%3d",n);
       if (n%20 == 19) printf("\n");
       fflush(stdout);
-      nvox = MRIsegFrameAvg(seg, StatSumTable[n].id, invol, favg[n]);
+      if(segstab) nvox = MRIsegStatsTableFrameAvg(segstab, StatSumTable[n].id, favg[n]);
+      else        nvox = MRIsegFrameAvg(seg, StatSumTable[n].id, invol, favg[n]);
       favgmn[n] = 0.0;
       for(f=0; f < invol->nframes; f++) {
 	if(DoFrameSum) favg[n][f] *= nvox; // Undo spatial average
@@ -1420,6 +1434,7 @@ int main(int argc, char **argv)
       MRIwrite(famri,FrameAvgVolFile);
     }
   }// Done with Frame Average
+  MRIsegStatsTableFree(&segstab);
 
 #ifdef FS_CUDA
   PrintGPUtimers();
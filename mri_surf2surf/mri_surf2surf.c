@@ -332,6 +332,9 @@ ENDHELP
 #include "cmdargs.h"
 #include "proto.h"
 #include "mri_circulars.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 int DumpSurface(MRIS *surf, char *outfile);
 MRI *MRIShksmooth(MRIS *Surf,
@@ -1263,6 +1266,15 @@ static int parse_commandline(int argc, char **argv)
       sscanf(pargv[0],"%f",&prune_thr); 
       nargsused = 1;
     }
+    else if(!strcasecmp(option, "--threads") || !strcasecmp(option, "--nthreads") ){
+      if(nargc < 1) CMDargNErr(option,1);
+      int nthreads;
+      sscanf(pargv[0],"%d",&nthreads);
+      #ifdef _OPENMP
+      omp_set_num_threads(nthreads);
+      #endif
+      nargsused = 1;
+    }
     else if (!strcasecmp(option, "--old"))UseOldSurf2Surf = 1;
     else if (!strcasecmp(option, "--new")) UseOldSurf2Surf = 0;
     else if (!strcasecmp(option, "--usehash")) {
@@ -1796,6 +1808,7 @@ static void print_usage(void)
   printf("   --seed seed : seed for synth (default is auto)\n");
   printf("   --prune - remove any voxel that is zero in any time point (for smoothing)\n");
   printf("   --no-prune - do not prune (default)\n");
+  printf("   --threads N : use N threads for the nearest-vertex search\n");
 
   printf("\n");
   printf("   --reg-diff reg2 : subtract reg2 from --reg (primarily for testing)\n");
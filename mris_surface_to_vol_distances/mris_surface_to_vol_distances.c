@@ -291,7 +291,7 @@ update_histograms(MRI_SURFACE *mris, MRI_SURFACE *mris_avg, float ***histograms,
 
       histogram[nint(volume_dist)][nint(surface_dist)]++ ;
 
-      if (mht->buckets[0][0] != NULL)
+      if (MHTgetBucketAtVoxIx(mht, 0, 0, 0) != NULL)
         DiagBreak() ;
     }
   }
@@ -28,11 +28,14 @@
 #include <stdarg.h>
 #include <sys/file.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <sys/timeb.h>
 #include <sys/time.h>
 #include <ctype.h>
 #include <dirent.h>
+#include <limits.h>
 #ifndef Darwin
 #include <malloc.h>
 #else
@@ -2951,23 +2954,569 @@ char *sdcmExtractNumarisVer(const char *e_18_1020, int *Maj, int *Min, int *MinM
 
   return(ver);
 }
+/*--------------------------------------------------------------------
+  WriteSDCMFileInfo() - writes sdcmfi as text, one string per line
+  followed by the numeric fields, such that ReadSDCMFileInfo() gets
+  back exactly the same values. Used for the ScanSiemensDCMDir()
+  index and to pass the info from the scanning processes. Returns 0
+  if everything was written.
+  *------------------------------------------------------------------*/
+#define SDFI_NSTR 12
+#define SDFI_NINT 16
+#define SDFI_NFLT 26
+#define SDFI_NDBL 6
+#define SDFI_LINELEN 4096
+
+/* pointers to the fields of sdfi, in the order they are written */
+static void sdfiFieldList(SDCMFILEINFO *sdfi, char ***str, int **ival,
+                          float **fval, double **dval)
+{
+  int n, k;
+
+  n = 0;
+  str[n++] = &sdfi->FileName;
+  str[n++] = &sdfi->PatientName;
+  str[n++] = &sdfi->StudyDate;
+  str[n++] = &sdfi->StudyTime;
+  str[n++] = &sdfi->SeriesTime;
+  str[n++] = &sdfi->AcquisitionTime;
+  str[n++] = &sdfi->PulseSequence;
+  str[n++] = &sdfi->ProtocolName;
+  str[n++] = &sdfi->PhEncDir;
+  str[n++] = &sdfi->NumarisVer;
+  str[n++] = &sdfi->ScannerModel;
+  str[n++] = &sdfi->TransferSyntaxUID;
+
+  n = 0;
+  ival[n++] = &sdfi->EchoNo;
+  ival[n++] = &sdfi->SeriesNo;
+  ival[n++] = &sdfi->ImageNo;
+  ival[n++] = &sdfi->NImageRows;
+  ival[n++] = &sdfi->NImageCols;
+  ival[n++] = &sdfi->lRepetitions;
+  ival[n++] = &sdfi->SliceArraylSize;
+  ival[n++] = &sdfi->RunNo;
+  ival[n++] = &sdfi->IsMosaic;
+  for (k = 0; k < 3; k++)
+  {
+    ival[n++] = &sdfi->VolDim[k];
+  }
+  ival[n++] = &sdfi->NFrames;
+  ival[n++] = &sdfi->nthDirection;
+  ival[n++] = &sdfi->UseSliceScaleFactor;
+  ival[n++] = &sdfi->ErrorFlag;
+
+  n = 0;
+  fval[n++] = &sdfi->FlipAngle;
+  fval[n++] = &sdfi->EchoTime;
+  fval[n++] = &sdfi->RepetitionTime;
+  fval[n++] = &sdfi->InversionTime;
+  fval[n++] = &sdfi->FieldStrength;
+  fval[n++] = &sdfi->PhEncFOV;
+  fval[n++] = &sdfi->ReadoutFOV;
+  fval[n++] = &sdfi->LargestValue;
+  for (k = 0; k < 3; k++)
+  {
+    fval[n++] = &sdfi->ImgPos[k];
+    fval[n++] = &sdfi->Vc[k];
+    fval[n++] = &sdfi->Vr[k];
+    fval[n++] = &sdfi->Vs[k];
+    fval[n++] = &sdfi->VolRes[k];
+    fval[n++] = &sdfi->VolCenter[k];
+  }
+
+  n = 0;
+  dval[n++] = &sdfi->bValue;
+  dval[n++] = &sdfi->SliceScaleFactor;
+  dval[n++] = &sdfi->bval;
+  dval[n++] = &sdfi->bvecx;
+  dval[n++] = &sdfi->bvecy;
+  dval[n++] = &sdfi->bvecz;
+}
+
+/* FreeSDCMFileInfo() leaves these to the caller */
+static void sdfiFree(SDCMFILEINFO **ppsdfi)
+{
+  if ((*ppsdfi)->ScannerModel != NULL)
+  {
+    free((*ppsdfi)->ScannerModel);
+  }
+  if ((*ppsdfi)->NumarisVer != NULL)
+  {
+    free((*ppsdfi)->NumarisVer);
+  }
+  FreeSDCMFileInfo(ppsdfi);
+}
+
+/* "!" for NULL, otherwise "=" and the string with \ and newline escaped */
+static void sdfiWriteString(FILE *fp, const char *s)
+{
+  if (s == NULL)
+  {
+    fprintf(fp,"!\n");
+    return;
+  }
+  fputc('=',fp);
+  for (; *s; s++)
+  {
+    if (*s == '\\')
+    {
+      fputs("\\\\",fp);
+    }
+    else if (*s == '\n')
+    {
+      fputs("\\n",fp);
+    }
+    else
+    {
+      fputc(*s,fp);
+    }
+  }
+  fputc('\n',fp);
+}
+
+static int sdfiReadString(FILE *fp, char **s)
+{
+  char line[SDFI_LINELEN], *p, *q;
+  int l;
+
+  *s = NULL;
+  if (fgets(line, SDFI_LINELEN, fp) == NULL)
+  {
+    return(1);
+  }
+  l = strlen(line);
+  if (l == 0 || line[l-1] != '\n')
+  {
+    return(1);
+  }
+  line[l-1] = '\0';
+  if (!strcmp(line,"!"))
+  {
+    return(0);
+  }
+  if (line[0] != '=')
+  {
+    return(1);
+  }
+  *s = (char *) calloc(l, sizeof(char));
+  for (p = line+1, q = *s; *p; p++)
+  {
+    if (p[0] == '\\' && p[1] == 'n')
+    {
+      *q++ = '\n';
+      p++;
+    }
+    else if (p[0] == '\\' && p[1] == '\\')
+    {
+      *q++ = '\\';
+      p++;
+    }
+    else
+    {
+      *q++ = *p;
+    }
+  }
+  return(0);
+}
+
+int WriteSDCMFileInfo(FILE *fp, SDCMFILEINFO *sdcmfi)
+{
+  char **str[SDFI_NSTR];
+  int *ival[SDFI_NINT];
+  float *fval[SDFI_NFLT];
+  double *dval[SDFI_NDBL];
+  int n;
+
+  sdfiFieldList(sdcmfi, str, ival, fval, dval);
+  for (n = 0; n < SDFI_NSTR; n++)
+  {
+    sdfiWriteString(fp, *str[n]);
+  }
+  for (n = 0; n < SDFI_NINT; n++)
+  {
+    fprintf(fp,"%d ",*ival[n]);
+  }
+  fprintf(fp,"\n");
+  // enough digits to get back the same float/double
+  for (n = 0; n < SDFI_NFLT; n++)
+  {
+    fprintf(fp,"%.9g ",*fval[n]);
+  }
+  fprintf(fp,"\n");
+  for (n = 0; n < SDFI_NDBL; n++)
+  {
+    fprintf(fp,"%.17g ",*dval[n]);
+  }
+  fprintf(fp,"\n");
+  return(ferror(fp) != 0);
+}
+/*--------------------------------------------------------------------
+  ReadSDCMFileInfo() - reads one SDCMFILEINFO written by
+  WriteSDCMFileInfo(). Returns NULL if the record is incomplete.
+  *------------------------------------------------------------------*/
+SDCMFILEINFO *ReadSDCMFileInfo(FILE *fp)
+{
+  SDCMFILEINFO *sdcmfi;
+  char **str[SDFI_NSTR];
+  int *ival[SDFI_NINT];
+  float *fval[SDFI_NFLT];
+  double *dval[SDFI_NDBL];
+  char line[SDFI_LINELEN];
+  int n, err = 0;
+
+  sdcmfi = (SDCMFILEINFO *) calloc(1,sizeof(SDCMFILEINFO));
+  sdfiFieldList(sdcmfi, str, ival, fval, dval);
+  for (n = 0; n < SDFI_NSTR && !err; n++)
+  {
+    err = sdfiReadString(fp, str[n]);
+  }
+  for (n = 0; n < SDFI_NINT && !err; n++)
+  {
+    err = (fscanf(fp,"%d",ival[n]) != 1);
+  }
+  for (n = 0; n < SDFI_NFLT && !err; n++)
+  {
+    err = (fscanf(fp,"%f",fval[n]) != 1);
+  }
+  for (n = 0; n < SDFI_NDBL && !err; n++)
+  {
+    err = (fscanf(fp,"%lf",dval[n]) != 1);
+  }
+  // rest of the last line
+  if (!err)
+  {
+    err = (fgets(line, SDFI_LINELEN, fp) == NULL ||
+           strspn(line," \n") != strlen(line));
+  }
+  if (err)
+  {
+    sdfiFree(&sdcmfi);
+    return(NULL);
+  }
+  return(sdcmfi);
+}
+
+/*--------------------------------------------------------------------
+  ScanSiemensDCMDir() helpers. Every file of the directory is an
+  SDCMSCANENTRY: the name, its mtime and size, whether it is Siemens
+  DICOM and, if it is, its SDCMFILEINFO. Entries are written as
+  "IsSiemens mtime size", the name and the SDCMFILEINFO.
+  *------------------------------------------------------------------*/
+typedef struct
+{
+  char *Name;
+  long MTime;
+  long long Size;
+  int IsSiemens;
+  SDCMFILEINFO *sdfi;
+}
+SDCMSCANENTRY;
+
+static int sdfiWriteScanEntry(FILE *fp, SDCMSCANENTRY *e)
+{
+  fprintf(fp,"%d %ld %lld\n",e->IsSiemens,e->MTime,e->Size);
+  sdfiWriteString(fp, e->Name);
+  if (e->IsSiemens)
+  {
+    return(WriteSDCMFileInfo(fp, e->sdfi));
+  }
+  return(ferror(fp) != 0);
+}
+
+static int sdfiReadScanEntry(FILE *fp, SDCMSCANENTRY *e)
+{
+  char line[SDFI_LINELEN];
+
+  memset(e, 0, sizeof(SDCMSCANENTRY));
+  if (fgets(line, SDFI_LINELEN, fp) == NULL ||
+      sscanf(line,"%d %ld %lld",&e->IsSiemens,&e->MTime,&e->Size) != 3)
+  {
+    return(1);
+  }
+  if (sdfiReadString(fp, &e->Name) || e->Name == NULL)
+  {
+    return(1);
+  }
+  if (e->IsSiemens)
+  {
+    e->sdfi = ReadSDCMFileInfo(fp);
+    if (e->sdfi == NULL)
+    {
+      return(1);
+    }
+  }
+  return(0);
+}
+
+static void sdfiFreeScanEntry(SDCMSCANENTRY *e)
+{
+  if (e->Name)
+  {
+    free(e->Name);
+  }
+  if (e->sdfi)
+  {
+    sdfiFree(&e->sdfi);
+  }
+}
+
+static int sdfiCompareScanEntry(const void *a, const void *b)
+{
+  return(strcmp(((const SDCMSCANENTRY *)a)->Name,
+                ((const SDCMSCANENTRY *)b)->Name));
+}
+
+/* first line of an index: the format version and the settings that
+   change what GetSDCMFileInfo() returns, so that an index made with
+   other settings is not used */
+#define SDFI_INDEX_VERSION 2
+static void sdfiScanIndexHeader(char *hdr)
+{
+  char *pc;
+  int NoSliceScale, LoadDWI;
+
+  NoSliceScale = (getenv("FS_NO_SLICE_SCALE_FACTOR") != NULL);
+  pc = getenv("FS_LOAD_DWI");
+  LoadDWI = (pc == NULL || strcmp(pc,"0") != 0);
+  sprintf(hdr,"sdcmscanindex %d %d %d\n",SDFI_INDEX_VERSION,
+          NoSliceScale,LoadDWI);
+}
+
+/* index file of directory dir: named after a hash of its path */
+static char *sdfiScanIndexFile(const char *dir)
+{
+  const char *indexdir, *pc;
+  char *fname;
+  unsigned long long hash = 14695981039346656037ULL;
+
+  indexdir = SDCMScanIndexDir;
+  if (indexdir == NULL)
+  {
+    indexdir = getenv("FS_DICOM_SCAN_INDEX");
+  }
+  if (indexdir == NULL || strlen(indexdir) == 0)
+  {
+    return(NULL);
+  }
+  for (pc = dir; *pc; pc++)
+  {
+    hash = (hash ^ (unsigned char)*pc) * 1099511628211ULL;
+  }
+  fname = (char *) calloc(strlen(indexdir)+40, sizeof(char));
+  sprintf(fname,"%s/sdcmscan.%016llx.idx",indexdir,hash);
+  return(fname);
+}
+
+/* entries of the index of dir, sorted by name, or NULL */
+static SDCMSCANENTRY *sdfiReadScanIndex(const char *indexfile,
+                                        const char *dir, int *nentries)
+{
+  SDCMSCANENTRY *entries;
+  FILE *fp;
+  char line[SDFI_LINELEN], hdr[100], *indexdir = NULL;
+  int n, err;
+
+  *nentries = 0;
+  fp = fopen(indexfile,"r");
+  if (fp == NULL)
+  {
+    return(NULL);
+  }
+  // the hash could collide, so the directory is checked
+  sdfiScanIndexHeader(hdr);
+  err = (fgets(line, SDFI_LINELEN, fp) == NULL ||
+         strcmp(line,hdr) != 0 ||
+         sdfiReadString(fp, &indexdir) || indexdir == NULL ||
+         strcmp(indexdir, dir) != 0 ||
+         fscanf(fp,"%d\n",nentries) != 1 || *nentries < 0);
+  if (indexdir)
+  {
+    free(indexdir);
+  }
+  if (err)
+  {
+    fclose(fp);
+    *nentries = 0;
+    return(NULL);
+  }
+  entries = (SDCMSCANENTRY *) calloc(MAX(*nentries,1), sizeof(SDCMSCANENTRY));
+  for (n = 0; n < *nentries; n++)
+  {
+    if (sdfiReadScanEntry(fp, &entries[n]))
+    {
+      printf("WARNING: %s is corrupt, ignoring it\n",indexfile);
+      sdfiFreeScanEntry(&entries[n]);
+      while (n--)
+      {
+        sdfiFreeScanEntry(&entries[n]);
+      }
+      free(entries);
+      fclose(fp);
+      *nentries = 0;
+      return(NULL);
+    }
+  }
+  fclose(fp);
+  qsort(entries, *nentries, sizeof(SDCMSCANENTRY), sdfiCompareScanEntry);
+  return(entries);
+}
+
+/* written to a temporary file first so that readers never see half */
+static int sdfiWriteScanIndex(const char *indexfile, const char *dir,
+                              SDCMSCANENTRY *entries, int nentries)
+{
+  FILE *fp;
+  char *tmpfile, hdr[100];
+  int n, err = 0;
+
+  tmpfile = (char *) calloc(strlen(indexfile)+20, sizeof(char));
+  sprintf(tmpfile,"%s.%d",indexfile,(int)getpid());
+  fp = fopen(tmpfile,"w");
+  if (fp == NULL)
+  {
+    printf("WARNING: could not write scan index %s\n",tmpfile);
+    free(tmpfile);
+    return(1);
+  }
+  sdfiScanIndexHeader(hdr);
+  fprintf(fp,"%s",hdr);
+  sdfiWriteString(fp, dir);
+  fprintf(fp,"%d\n",nentries);
+  for (n = 0; n < nentries && !err; n++)
+  {
+    err = sdfiWriteScanEntry(fp, &entries[n]);
+  }
+  err |= (fclose(fp) != 0);
+  if (!err)
+  {
+    err = rename(tmpfile, indexfile);
+  }
+  if (err)
+  {
+    printf("WARNING: could not write scan index %s\n",indexfile);
+    unlink(tmpfile);
+  }
+  free(tmpfile);
+  return(err);
+}
+
+/* prints the percentage done and writes it to SDCMStatusFile */
+static void sdfiScanProgress(int n, int ntotal, int *sumpct)
+{
+  FILE *fp;
+  int pct;
+
+  pct = rint(100*(n+1)/ntotal) - *sumpct;
+  if (pct >= 2)
+  {
+    *sumpct += pct;
+    fprintf(stderr,"%3d ",*sumpct);
+    fflush(stderr);
+    if (SDCMStatusFile != NULL)
+    {
+      fp = fopen(SDCMStatusFile,"w");
+      if (fp != NULL)
+      {
+        fprintf(fp,"%3d\n",*sumpct);
+        fclose(fp);
+      }
+    }
+  }
+}
+
+/* identifies and parses entries[todo[k]] for k = k0 .. k1-1, writing
+   them to fp. Only the parse of each file is done here, so that the
+   DICOM library (which keeps static state) runs in one process. */
+static int sdfiScanEntries(const char *dir, SDCMSCANENTRY *entries,
+                           int *todo, int k0, int k1, FILE *fp,
+                           int progress)
+{
+  SDCMSCANENTRY *e;
+  char tmpstr[1000];
+  int k, sumpct = 0;
+
+  for (k = k0; k < k1; k++)
+  {
+    if (progress)
+    {
+      sdfiScanProgress(k-k0, k1-k0, &sumpct);
+    }
+    e = &entries[todo[k]];
+    sprintf(tmpstr,"%s/%s", dir, e->Name);
+    e->IsSiemens = IsSiemensDICOM(tmpstr);
+    if (e->IsSiemens)
+    {
+      e->sdfi = GetSDCMFileInfo(tmpstr);
+      if (e->sdfi == NULL)
+      {
+        return(1);
+      }
+    }
+    if (sdfiWriteScanEntry(fp, e))
+    {
+      return(1);
+    }
+    if (e->sdfi)
+    {
+      sdfiFree(&e->sdfi);
+    }
+  }
+  return(0);
+}
+
+/* number of processes that parse the files */
+static int sdfiScanNProc(void)
+{
+  int nproc = SDCMScanNProc;
+  char *pc;
+
+  if (nproc < 1)
+  {
+    pc = getenv("FS_DICOM_SCAN_NPROC");
+    if (pc != NULL)
+    {
+      nproc = atoi(pc);
+    }
+  }
+  if (nproc < 1)
+  {
+    nproc = sysconf(_SC_NPROCESSORS_ONLN);
+    nproc = MIN(nproc, 8);
+  }
+  return(MAX(nproc, 1));
+}
+
 /*--------------------------------------------------------------------
   ScanSiemensDCMDir() - similar to ScanDir but returns only files that
   are Siemens DICOM Files. It also returns a pointer to an array of
   SDCMFILEINFO structures.
 
+  The files are parsed by up to SDCMScanNProc (or FS_DICOM_SCAN_NPROC,
+  default the number of cpus up to 8) processes, each taking a
+  contiguous part of the directory. Processes rather than threads
+  because the DICOM library and SiemensAsciiTagEx() keep static state.
+  If SDCMScanIndexDir (or FS_DICOM_SCAN_INDEX) is set, the info of all
+  files is kept in an index file in that directory, and files whose
+  mtime and size have not changed are not parsed again. The index is
+  not used if it was made with other FS_NO_SLICE_SCALE_FACTOR or
+  FS_LOAD_DWI settings.
+
   Author: Douglas Greve.
   Date: 09/10/2001
   *------------------------------------------------------------------*/
 SDCMFILEINFO **ScanSiemensDCMDir(const char *PathName, int *NSDCMFiles)
 {
   struct dirent **NameList;
-  int i, pathlength;
-  int NFiles;
-  char tmpstr[1000];
+  struct stat st;
+  int i, k, w, pathlength;
+  int NFiles, ntodo, nindex, nproc, nworkers, status, err;
+  char tmpstr[1000], realdir[PATH_MAX], *indexfile;
   SDCMFILEINFO **sdcmfi_list;
-  int pct, sumpct;
-  FILE *fp;
+  SDCMSCANENTRY *entries, *index, *hit, e;
+  int *todo, *k0;
+  FILE **fpw;
+  pid_t *pid;
 
   char* pname = (char *)calloc(strlen(PathName)+1, sizeof(char)) ;
   strcpy(pname, PathName) ;
@@ -2998,28 +3547,66 @@ SDCMFILEINFO **ScanSiemensDCMDir(const char *PathName, int *NSDCMFiles)
   }
   fprintf(stderr,"INFO: Found %d files in %s\n",NFiles,pname);
 
-  /* Count the number of Siemens DICOM Files */
-  fprintf(stderr,"INFO: counting Siemens Files\n");
-  (*NSDCMFiles) = 0;
+  /* Entries that are not in the index (or changed) are to be parsed */
+  if (realpath(pname, realdir) == NULL)
+  {
+    strcpy(realdir, pname);
+  }
+  indexfile = sdfiScanIndexFile(realdir);
+  index = NULL;
+  nindex = 0;
+  if (indexfile != NULL)
+  {
+    index = sdfiReadScanIndex(indexfile, realdir, &nindex);
+  }
+
+  entries = (SDCMSCANENTRY *) calloc(MAX(NFiles,1), sizeof(SDCMSCANENTRY));
+  todo = (int *) calloc(MAX(NFiles,1), sizeof(int));
+  ntodo = 0;
   for (i = 0; i < NFiles; i++)
   {
+    entries[i].Name = NameList[i]->d_name;
     sprintf(tmpstr,"%s/%s", pname, NameList[i]->d_name);
-    if (IsSiemensDICOM(tmpstr))
+    if (stat(tmpstr, &st) != 0 || S_ISDIR(st.st_mode))
     {
-      (*NSDCMFiles)++;
+      continue;
+    }
+    entries[i].MTime = (long) st.st_mtime;
+    entries[i].Size = (long long) st.st_size;
+    hit = NULL;
+    if (index != NULL)
+    {
+      hit = (SDCMSCANENTRY *) bsearch(&entries[i], index, nindex,
+                                      sizeof(SDCMSCANENTRY),
+                                      sdfiCompareScanEntry);
+    }
+    if (hit != NULL && hit->MTime == entries[i].MTime &&
+        hit->Size == entries[i].Size)
+    {
+      entries[i].IsSiemens = hit->IsSiemens;
+      entries[i].sdfi = hit->sdfi;
+      hit->sdfi = NULL;
+      if (entries[i].sdfi)
+      {
+        // the directory may have been given by another path
+        free(entries[i].sdfi->FileName);
+        entries[i].sdfi->FileName = strcpyalloc(tmpstr);
+      }
+      continue;
     }
+    todo[ntodo++] = i;
   }
-
-  fprintf(stderr,"INFO: found %d Siemens Files\n",*NSDCMFiles);
-
-  if (*NSDCMFiles == 0)
+  if (index != NULL)
   {
-    free(pname);
-    return(NULL);
+    fprintf(stderr,"INFO: %d files unchanged in index %s\n",
+            NFiles-ntodo,indexfile);
+    for (k = 0; k < nindex; k++)
+    {
+      sdfiFreeScanEntry(&index[k]);
+    }
+    free(index);
   }
 
-  sdcmfi_list = (SDCMFILEINFO **)calloc(*NSDCMFiles, sizeof(SDCMFILEINFO *));
-
   fprintf(stderr,"INFO: scanning info from Siemens Files\n");
 
   if (SDCMStatusFile != NULL)
@@ -3027,42 +3614,131 @@ SDCMFILEINFO **ScanSiemensDCMDir(const char *PathName, int *NSDCMFiles)
     fprintf(stderr,"INFO: status file is %s\n",SDCMStatusFile);
   }
 
+  /* Each worker writes its entries to a temporary file, which are
+     read back here in the order of the directory. A worker that
+     cannot be started is run in this process. */
+  nproc = sdfiScanNProc();
+  nworkers = MAX(1, MIN(nproc, ntodo/16));
+  k0 = (int *) calloc(nworkers+1, sizeof(int));
+  fpw = (FILE **) calloc(nworkers, sizeof(FILE *));
+  pid = (pid_t *) calloc(nworkers, sizeof(pid_t));
+  if (nworkers > 1)
+  {
+    fprintf(stderr,"INFO: parsing %d files in %d processes\n",ntodo,nworkers);
+  }
   fprintf(stderr,"%2d ",0);
-  sumpct = 0;
-  (*NSDCMFiles) = 0;
-  for (i = 0; i < NFiles; i++)
+  err = 0;
+  for (w = 0; w < nworkers && !err; w++)
   {
-
-    //fprintf(stderr,"%4d ",i);
-    pct = rint(100*(i+1)/NFiles) - sumpct;
-    if (pct >= 2)
+    k0[w] = (long long)ntodo*w/nworkers;
+    k0[w+1] = (long long)ntodo*(w+1)/nworkers;
+    fpw[w] = tmpfile();
+    if (fpw[w] == NULL)
     {
-      sumpct += pct;
-      fprintf(stderr,"%3d ",sumpct);
+      printf("ERROR: ScanSiemensDCMDir(): could not create temporary file\n");
+      err = 1;
+      break;
+    }
+    pid[w] = -1;
+    if (nworkers > 1)
+    {
+      fflush(stdout);
       fflush(stderr);
-      if (SDCMStatusFile != NULL)
+      pid[w] = fork();
+      if (pid[w] == 0)
       {
-        fp = fopen(SDCMStatusFile,"w");
-        if (fp != NULL)
-        {
-          fprintf(fp,"%3d\n",sumpct);
-          fclose(fp);
-        }
+        // the first worker reports the progress
+        err = sdfiScanEntries(pname, entries, todo, k0[w], k0[w+1], fpw[w],
+                              w == 0);
+        err |= (fflush(fpw[w]) != 0);
+        fflush(stdout);
+        fflush(stderr);
+        _exit(err);
       }
     }
-
-    sprintf(tmpstr,"%s/%s", pname, NameList[i]->d_name);
-    if (IsSiemensDICOM(tmpstr))
+    if (pid[w] < 0)
     {
-      sdcmfi_list[*NSDCMFiles] = GetSDCMFileInfo(tmpstr);
-      if (sdcmfi_list[*NSDCMFiles] == NULL)
+      err = sdfiScanEntries(pname, entries, todo, k0[w], k0[w+1], fpw[w],
+                            nworkers == 1);
+    }
+  }
+  for (w = 0; w < nworkers; w++)
+  {
+    if (fpw[w] == NULL)
+    {
+      continue;
+    }
+    if (pid[w] > 0)
+    {
+      if (waitpid(pid[w], &status, 0) != pid[w] ||
+          !WIFEXITED(status) || WEXITSTATUS(status) != 0)
       {
-        return(NULL);
+        err = 1;
       }
-      (*NSDCMFiles) ++;
     }
+    rewind(fpw[w]);
+    for (k = k0[w]; k < k0[w+1] && !err; k++)
+    {
+      i = todo[k];
+      if (sdfiReadScanEntry(fpw[w], &e) || strcmp(e.Name, entries[i].Name))
+      {
+        printf("ERROR: ScanSiemensDCMDir(): could not get the info of %s\n",
+               entries[i].Name);
+        sdfiFreeScanEntry(&e);
+        err = 1;
+        break;
+      }
+      entries[i].IsSiemens = e.IsSiemens;
+      entries[i].sdfi = e.sdfi;
+      free(e.Name);
+    }
+    fclose(fpw[w]);
   }
   fprintf(stderr,"\n");
+  free(k0);
+  free(fpw);
+  free(pid);
+  free(todo);
+
+  (*NSDCMFiles) = 0;
+  for (i = 0; i < NFiles; i++)
+  {
+    if (entries[i].IsSiemens)
+    {
+      (*NSDCMFiles)++;
+    }
+  }
+  if (!err)
+  {
+    fprintf(stderr,"INFO: found %d Siemens Files\n",*NSDCMFiles);
+    if (indexfile != NULL && ntodo > 0)
+    {
+      sdfiWriteScanIndex(indexfile, realdir, entries, NFiles);
+    }
+  }
+
+  sdcmfi_list = NULL;
+  if (!err && *NSDCMFiles > 0)
+  {
+    sdcmfi_list = (SDCMFILEINFO **)calloc(*NSDCMFiles, sizeof(SDCMFILEINFO *));
+  }
+  (*NSDCMFiles) = 0;
+  for (i = 0; i < NFiles; i++)
+  {
+    if (sdcmfi_list != NULL && entries[i].IsSiemens)
+    {
+      sdcmfi_list[(*NSDCMFiles)++] = entries[i].sdfi;
+    }
+    else if (entries[i].sdfi)
+    {
+      sdfiFree(&entries[i].sdfi);
+    }
+  }
+  free(entries);
+  if (indexfile != NULL)
+  {
+    free(indexfile);
+  }
 
   // free memory
   while (NFiles--)
@@ -1052,6 +1052,274 @@ MRI *MRInormWeights(MRI *w, int sqrtFlag, int invFlag, MRI *mask, MRI *wn)
 }
 
 
+/*---------------------------------------------------------------------
+  fMRIcolMajor() - copies a MATRIX into a newly allocated column-major
+  double array (element (r,c) at [(r-1) + (c-1)*rows]).
+  --------------------------------------------------------------------*/
+static double *fMRIcolMajor(const MATRIX *M)
+{
+  int r,c;
+  double *a;
+  a = (double *) calloc(sizeof(double),M->rows*M->cols);
+  for(c=1; c <= M->cols; c++)
+    for(r=1; r <= M->rows; r++)
+      a[(r-1) + (long)(c-1)*M->rows] = M->rptr[r][c];
+  return(a);
+}
+/*---------------------------------------------------------------------
+  fMRIgemm() - C = A*B for column-major double arrays. A is m-by-k,
+  B is k-by-n, C is m-by-n. Accumulates whole columns of A so that the
+  inner loop is contiguous.
+  --------------------------------------------------------------------*/
+static void fMRIgemm(int m, int n, int k, const double *A,
+                     const double *B, double *C)
+{
+  int i,j,p;
+  double b, *Cj;
+  const double *Ap;
+  for(j=0; j < n; j++){
+    Cj = &C[(long)j*m];
+    for(i=0; i < m; i++) Cj[i] = 0;
+    for(p=0; p < k; p++){
+      b = B[p + (long)j*k];
+      Ap = &A[(long)p*m];
+      for(i=0; i < m; i++) Cj[i] += Ap[i]*b;
+    }
+  }
+}
+/*---------------------------------------------------------------------
+  fMRIgemmAtB() - C = A'*B for column-major double arrays. A is
+  k-by-m, B is k-by-n, C is m-by-n. Each element is a contiguous dot
+  product, which is the efficient order when k (eg, nframes) is large.
+  --------------------------------------------------------------------*/
+static void fMRIgemmAtB(int m, int n, int k, const double *A,
+                        const double *B, double *C)
+{
+  int i,j,p;
+  double sum;
+  const double *Ai, *Bj;
+  for(j=0; j < n; j++){
+    Bj = &B[(long)j*k];
+    for(i=0; i < m; i++){
+      Ai = &A[(long)i*k];
+      sum = 0;
+      for(p=0; p < k; p++) sum += Ai[p]*Bj[p];
+      C[i + (long)j*m] = sum;
+    }
+  }
+}
+
+/*---------------------------------------------------------------------
+  MRIglmFitAndTestBatch() - same result as MRIglmFitAndTest() for the
+  case where the design matrix is the same at every voxel (no weights,
+  per-voxel regressors, or frame mask). Instead of loading and fitting
+  one voxel at a time, the voxels in the mask are packed into blocks
+  (nframes-by-nblock, column-major) and beta, yhat, eres, rvar, gamma,
+  F, p, z, and pcc are computed for the whole block with matrix-matrix
+  products against matrices that are computed once from X. Blocks are
+  distributed over threads. The output volumes must already be
+  allocated and GLMcMatrices() and GLMxMatrices() must have been run
+  on the shared X. Returns 1 (without doing anything) if the GLM is
+  not eligible, in which case the caller should fit voxel-by-voxel.
+  --------------------------------------------------------------------*/
+int MRIglmFitAndTestBatch(MRIGLM *mriglm)
+{
+  GLMMAT *glm = mriglm->glm;
+  int nc, nr, ns, nf, nbeta, nblock, nvox, c, r, s, n, k, nthvox, J;
+  int *clist, *rlist, *slist, Jmax;
+  double dof, Xcond=0;
+  double *Xb, *PT, *Cn[GLMMAT_NCONTRASTS_MAX], *iCn[GLMMAT_NCONTRASTS_MAX];
+  double *RDX[GLMMAT_NCONTRASTS_MAX], *w1[GLMMAT_NCONTRASTS_MAX];
+  double *w2[GLMMAT_NCONTRASTS_MAX];
+  MATRIX *mtmp, *RDXm;
+
+  if(mriglm->pervoxflag || mriglm->yffxvar != NULL || glm->ill_cond_flag) return(1);
+  // Global weights are applied to X and y in MRIglmLoadVox()
+  if(mriglm->wg != NULL && ! mriglm->skipweight) return(1);
+  for(n=0; n < glm->ncontrasts; n++) if(glm->ypmfflag[n]) return(1);
+
+  nc = mriglm->y->width;
+  nr = mriglm->y->height;
+  ns = mriglm->y->depth;
+  nf = mriglm->y->nframes;
+  nbeta = glm->X->cols;
+  dof = glm->dof;
+  if(mriglm->condsave) Xcond = MatrixConditionNumber(glm->XtX);
+
+  // Matrices that are the same for all voxels
+  Xb = fMRIcolMajor(glm->X);                           // nf-by-nbeta
+  mtmp = MatrixMultiplyD(glm->X,glm->iXtX,NULL);       // X*inv(X'X)
+  PT = fMRIcolMajor(mtmp);                             // beta = PT'*y
+  MatrixFree(&mtmp);
+  Jmax = nbeta;
+  for(n=0; n < glm->ncontrasts; n++){
+    if(Jmax < glm->C[n]->rows) Jmax = glm->C[n]->rows;
+    Cn[n] = fMRIcolMajor(glm->C[n]);                   // J-by-nbeta
+    iCn[n] = NULL;
+    mtmp = MatrixInverse(glm->CiXtXCt[n],NULL);
+    if(mtmp){
+      iCn[n] = fMRIcolMajor(mtmp);                     // inv(C*inv(X'X)*C')
+      MatrixFree(&mtmp);
+    }
+    RDX[n] = w1[n] = w2[n] = NULL;
+    if(glm->C[n]->rows == 1 && glm->DoPCC && glm->Dt[n] != NULL){
+      // yhatd = RD*yhat = (RD*X)*beta, so the pcc terms are linear in beta
+      RDXm  = MatrixMultiplyD(glm->RD[n],glm->X,NULL);
+      RDX[n] = fMRIcolMajor(RDXm);                     // nf-by-nbeta
+      mtmp = MatrixMultiplyD(glm->Xcdt[n],RDXm,NULL);
+      w1[n] = fMRIcolMajor(mtmp);                      // Xcd'*RD*X
+      MatrixFree(&mtmp);
+      mtmp = MatrixSum(RDXm,1,NULL);
+      w2[n] = fMRIcolMajor(mtmp);                      // sum(RD*X)
+      MatrixFree(&mtmp);
+      MatrixFree(&RDXm);
+    }
+  }
+
+  // List the voxels to process
+  clist = (int *) calloc(sizeof(int),nc*nr*ns);
+  rlist = (int *) calloc(sizeof(int),nc*nr*ns);
+  slist = (int *) calloc(sizeof(int),nc*nr*ns);
+  nvox = 0;
+  for (s=0; s < ns; s++)  {
+    for (r=0; r < nr; r++)    {
+      for (c=0; c < nc; c++)      {
+        if (mriglm->mask != NULL && MRIgetVoxVal(mriglm->mask,c,r,s,0) < 0.5) continue;
+        clist[nvox] = c;
+        rlist[nvox] = r;
+        slist[nvox] = s;
+        nvox++;
+      }
+    }
+  }
+
+  // Size the blocks so that y for a block is about 512KB
+  nblock = 65536/nf;
+  if(nblock < 16)   nblock = 16;
+  if(nblock > 1024) nblock = 1024;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel private(nthvox,n,k,J,c,r,s)
+#endif
+  {
+    double *Yb, *B, *Yhat, *G, *Yd, rvar, dtmp, F, p, z, v, a, b2, sumyd, sumyd2;
+    int nb, j, f, m, i;
+    Yb    = (double *) calloc(sizeof(double),(long)nf*nblock);
+    Yhat = (double *) calloc(sizeof(double),(long)nf*nblock);
+    Yd   = (double *) calloc(sizeof(double),(long)nf*nblock);
+    B    = (double *) calloc(sizeof(double),(long)nbeta*nblock);
+    G    = (double *) calloc(sizeof(double),(long)Jmax*nblock);
+
+#ifdef HAVE_OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+    for(nthvox = 0; nthvox < nvox; nthvox += nblock){
+      nb = nblock;
+      if(nthvox + nb > nvox) nb = nvox - nthvox;
+
+      // Pack y, then beta = inv(X'X)*X'*y, yhat = X*beta
+      for(j=0; j < nb; j++)
+        for(f=0; f < nf; f++)
+          Yb[f + (long)j*nf] = MRIgetVoxVal(mriglm->y,clist[nthvox+j],
+                                           rlist[nthvox+j],slist[nthvox+j],f);
+      fMRIgemmAtB(nbeta, nb, nf, PT, Yb, B);
+      fMRIgemm(nf, nb, nbeta, Xb, B, Yhat);
+
+      for(j=0; j < nb; j++){
+        c = clist[nthvox+j];
+        r = rlist[nthvox+j];
+        s = slist[nthvox+j];
+        rvar = 0;
+        for(f=0; f < nf; f++){
+          v = Yb[f + (long)j*nf] - Yhat[f + (long)j*nf];
+          rvar += v*v;
+          MRIsetVoxVal(mriglm->eres,c,r,s,f,v);
+          if(mriglm->yhatsave) MRIsetVoxVal(mriglm->yhat,c,r,s,f,Yhat[f + (long)j*nf]);
+        }
+        rvar /= dof;
+        if(rvar < FLT_MIN) rvar = FLT_MIN;
+        // Store rvar in Yb so the contrasts below can get at it
+        Yb[(long)j*nf] = rvar;
+        MRIsetVoxVal(mriglm->rvar,c,r,s,0,rvar);
+        for(k=0; k < nbeta; k++)
+          MRIsetVoxVal(mriglm->beta,c,r,s,k,B[k + (long)j*nbeta]);
+        if(mriglm->condsave) MRIsetVoxVal(mriglm->cond,c,r,s,0,Xcond);
+      }
+
+      for(n=0; n < glm->ncontrasts; n++){
+        // gamma = C*beta
+        J = glm->C[n]->rows;
+        fMRIgemm(J, nb, nbeta, Cn[n], B, G);
+        if(RDX[n]) fMRIgemm(nf, nb, nbeta, RDX[n], B, Yd);
+        for(j=0; j < nb; j++){
+          c = clist[nthvox+j];
+          r = rlist[nthvox+j];
+          s = slist[nthvox+j];
+          rvar = Yb[(long)j*nf];
+          if(glm->UseGamma0[n])
+            for(i=0; i < J; i++) G[i + (long)j*J] -= glm->gamma0[n]->rptr[i+1][1];
+          for(i=0; i < J; i++) MRIsetVoxVal(mriglm->gamma[n],c,r,s,i,G[i + (long)j*J]);
+          // Same as GLMtest(): F = gamma'*inv(C*inv(X'X)*C')*gamma/(rvar*J)
+          if (rvar < 2*FLT_MIN) dtmp = 1e10*J;
+          else                  dtmp = rvar*J;
+          if(J == 1) MRIsetVoxVal(mriglm->gammaVar[n],c,r,s,0,glm->CiXtXCt[n]->rptr[1][1]*dtmp);
+          F = 0; p = 1; z = 0; v = 0;
+          if(iCn[n] != NULL && rvar > FLT_MIN){
+            for(i=0; i < J; i++)
+              for(m=0; m < J; m++)
+                F += G[i + (long)j*J] * iCn[n][i + m*J] * G[m + (long)j*J];
+            F /= dtmp;
+            p = sc_cdf_fdist_Q(F,J,dof);
+            z = sc_cdf_gaussian_Qinv(p/2.0,1);
+            if(J == 1 && G[(long)j*J] < 0) z *= -1;
+            if(RDX[n]){
+              // partial correlation coefficient, see GLMtest()
+              a = 0; b2 = 0;
+              for(k=0; k < nbeta; k++){
+                a  += w1[n][k]*B[k + (long)j*nbeta];
+                b2 += w2[n][k]*B[k + (long)j*nbeta];
+              }
+              sumyd = b2;
+              sumyd2 = 0;
+              for(f=0; f < nf; f++) sumyd2 += Yd[f + (long)j*nf]*Yd[f + (long)j*nf];
+              sumyd2 += dof*rvar;
+              v = (a - glm->sumXcd[n]->rptr[1][1]*sumyd)/
+                sqrt( (glm->sumXcd2[n]->rptr[1][1] - glm->sumXcd[n]->rptr[1][1]*glm->sumXcd[n]->rptr[1][1]) *
+                      (sumyd2 - sumyd*sumyd));
+            }
+          }
+          MRIsetVoxVal(mriglm->F[n],c,r,s,0,F);
+          MRIsetVoxVal(mriglm->p[n],c,r,s,0,p);
+          MRIsetVoxVal(mriglm->z[n],c,r,s,0,z);
+          if(J == 1 && glm->DoPCC) MRIsetVoxVal(mriglm->pcc[n],c,r,s,0,v);
+        }
+      }
+    }
+    free(Yb);
+    free(Yhat);
+    free(Yd);
+    free(B);
+    free(G);
+  }
+
+  mriglm->n_ill_cond = 0;
+  free(clist);
+  free(rlist);
+  free(slist);
+  free(Xb);
+  free(PT);
+  for(n=0; n < glm->ncontrasts; n++){
+    free(Cn[n]);
+    if(iCn[n]) free(iCn[n]);
+    if(RDX[n]){
+      free(RDX[n]);
+      free(w1[n]);
+      free(w2[n]);
+    }
+  }
+  return(0);
+}
+
 /*---------------------------------------------------------------------
   MRIglmFitAndTest() - fits and tests glm on a voxel-by-voxel basis.
   There are also two other related functions, MRIglmFit() and
@@ -1135,6 +1403,9 @@ int MRIglmFitAndTest(MRIGLM *mriglm)
     }
   }
 
+  // When X is the same at all voxels, fit and test blocks of voxels at once
+  if(! mriglm->pervoxflag && MRIglmFitAndTestBatch(mriglm) == 0) return(0);
+
   //--------------------------------------------
   pctdone = 0;
   nthvox = 0;
@@ -31,6 +31,11 @@
 #include <stdlib.h>
 #include <math.h>
 #include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef _POSIX_MAPPED_FILES
+#include <sys/mman.h>
+#endif
 
 #ifdef HAVE_OPENMP
 #include <omp.h>
@@ -106,6 +111,8 @@ static int total_pruned = 0 ;
 #define DEFAULT_MAX_LABELS_PER_GCAN 4
 
 static float get_node_prior(GCA *gca, int label, int xn, int yn, int zn) ;
+static void gcaFlatFree(void *flat) ;
+static void gcaUnflatten(GCA *gca) ;
 //static int gcapBrainIsPossible(GCA_PRIOR *gcap) ;
 
 static double gcaGibbsLogPosterior(GCA *gca,
@@ -2183,7 +2190,10 @@ GCAfree(GCA **pgca)
     {
       for (z = 0 ; z < gca->node_depth ; z++)
       {
-        GCANfree(&gca->nodes[x][y][z], gca->ninputs) ;
+        if (gca->flat == NULL)  /* flat GCAs point into the file */
+        {
+          GCANfree(&gca->nodes[x][y][z], gca->ninputs) ;
+        }
       }
       free(gca->nodes[x][y]) ;
     }
@@ -2195,7 +2205,7 @@ GCAfree(GCA **pgca)
   {
     for (y = 0 ; y < gca->prior_height ; y++)
     {
-      for (z = 0 ; z < gca->prior_depth ; z++)
+      for (z = 0 ; z < gca->prior_depth && gca->flat == NULL ; z++)
       {
         free(gca->priors[x][y][z].labels) ;
         free(gca->priors[x][y][z].priors) ;
@@ -2206,6 +2216,10 @@ GCAfree(GCA **pgca)
   }
 
   free(gca->priors) ;
+  if (gca->flat)
+  {
+    gcaFlatFree(gca->flat) ;
+  }
   GCAcleanup(gca);
 
   free(gca) ;
@@ -2757,6 +2771,11 @@ GCAwrite(GCA *gca, const char *fname)
   GC1D      *gc ;
   int gzipped = 0;
 
+  if (strstr(fname, ".fgca"))
+  {
+    return(GCAwriteFlat(gca, fname)) ;
+  }
+
   if (strstr(fname, ".gcz"))
   {
     gzipped = 1;
@@ -2935,6 +2954,11 @@ GCAread(const char *fname)
   int gzipped = 0;
   int tempZNZ;
 
+  if (GCAisFlat(fname))
+  {
+    return(GCAreadFlat(fname)) ;
+  }
+
   if (strstr(fname, ".gcz"))
   {
     gzipped = 1;
@@ -3400,6 +3424,673 @@ GCAread(const char *fname)
   return(gca) ;
 }
 
+/*
+  Flat GCA layout. Everything GCAread() would otherwise allocate node by
+  node is stored in a handful of native-endian arrays addressed by byte
+  offsets in the header, so that GCAreadFlat() can map the file and
+  point the nodes and priors straight into it. Pages are only brought
+  in when a node is actually used, and a mapped atlas is shared by all
+  the processes that read it.
+*/
+#define GCA_FLAT_MAGIC      "GCAFLAT1"
+#define GCA_FLAT_BYTE_ORDER 0x01020304
+#define GCA_FLAT_ALIGN      64
+
+typedef struct
+{
+  char      magic[8] ;
+  int       byte_order ;    /* GCA_FLAT_BYTE_ORDER as written */
+  int       header_size ;   /* sizeof(GCA_FLAT_HEADER) as written */
+  float     prior_spacing, node_spacing ;
+  int       prior_width, prior_height, prior_depth ;
+  int       node_width, node_height, node_depth ;
+  int       ninputs, flags, type, max_label ;
+  double    TRs[MAX_GCA_INPUTS], FAs[MAX_GCA_INPUTS], TEs[MAX_GCA_INPUTS] ;
+  float     x_r, x_a, x_s, y_r, y_a, y_s, z_r, z_a, z_s, c_r, c_a, c_s ;
+  int       width, height, depth ;
+  float     xsize, ysize, zsize ;
+  long long ngcs ;          /* total number of node labels (GC1Ds) */
+  long long ngibbs ;        /* total number of gibbs neighbor labels */
+  long long nprior_labels ; /* total number of prior labels */
+  long long node_off ;      /* GCA_FLAT_INDEX[nodes], first is into gcs */
+  long long prior_off ;     /* GCA_FLAT_INDEX[priors] */
+  long long gc_labels_off ; /* unsigned short[ngcs] */
+  long long gc_ntraining_off ; /* int[ngcs] */
+  long long means_off ;     /* float[ngcs*ninputs] */
+  long long covars_off ;    /* float[ngcs*ninputs*(ninputs+1)/2] */
+  long long gibbs_nlabels_off ; /* short[ngcs*GIBBS_NEIGHBORHOOD] */
+  long long gibbs_first_off ;   /* long long[ngcs] */
+  long long gibbs_labels_off ;  /* unsigned short[ngibbs] */
+  long long gibbs_priors_off ;  /* float[ngibbs] */
+  long long prior_labels_off ;  /* unsigned short[nprior_labels] */
+  long long prior_probs_off ;   /* float[nprior_labels] */
+  long long ctab_off ;      /* binary colortable, 0 if none */
+  long long data_size ;     /* bytes up to the colortable */
+}
+GCA_FLAT_HEADER ;
+
+typedef struct
+{
+  int       nlabels ;
+  int       total_training ;
+  long long first ;
+}
+GCA_FLAT_INDEX ;
+
+/* bookkeeping hung off gca->flat for a GCA returned by GCAreadFlat() */
+typedef struct
+{
+  char           *base ;
+  size_t         size ;
+  int            mapped ;
+  GC1D           *gcs ;
+  unsigned short **gibbs_labels ;
+  float          **gibbs_priors ;
+}
+GCA_FLAT ;
+
+/* releases the file image of a flat GCA, mapped or read into memory */
+static void
+gcaFlatUnmap(char *base, size_t size, int mapped)
+{
+#ifdef _POSIX_MAPPED_FILES
+  if (mapped)
+    munmap(base, size) ;
+#endif
+  if (!mapped)
+    free(base) ;
+}
+
+static long long
+gcaFlatAlign(long long off)
+{
+  return(((off + GCA_FLAT_ALIGN - 1) / GCA_FLAT_ALIGN) * GCA_FLAT_ALIGN) ;
+}
+
+/* zero pad the file up to byte offset off */
+static int
+gcaFlatPad(FILE *fp, long long off)
+{
+  long long pos = ftell(fp) ;
+  for ( ; pos < off ; pos++)
+    if (fputc(0, fp) == EOF)
+      return(ERROR_BADFILE) ;
+  return(pos == off ? NO_ERROR : ERROR_BADFILE) ;
+}
+
+/*!
+  \fn int GCAisFlat(const char *fname)
+  \brief Returns 1 if fname is a GCA written by GCAwriteFlat().
+*/
+int
+GCAisFlat(const char *fname)
+{
+  FILE *fp ;
+  char magic[8] ;
+  int  isflat = 0 ;
+
+  if (strstr(fname, ".gcz"))
+    return(0) ;
+  fp = fopen(fname, "rb") ;
+  if (fp == NULL)
+    return(0) ;
+  if (fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+      !memcmp(magic, GCA_FLAT_MAGIC, sizeof(magic)))
+    isflat = 1 ;
+  fclose(fp) ;
+  return(isflat) ;
+}
+
+/*!
+  \fn int GCAwriteFlat(GCA *gca, const char *fname)
+  \brief Writes gca in the flat, offset-indexed layout read by
+  GCAreadFlat(). The arrays are written in the byte order of this
+  machine. GCAwrite() uses this for file names ending in .fgca.
+*/
+int
+GCAwriteFlat(GCA *gca, const char *fname)
+{
+  FILE            *fp ;
+  GCA_FLAT_HEADER hdr ;
+  GCA_FLAT_INDEX  idx ;
+  GCA_NODE        *gcan ;
+  GCA_PRIOR       *gcap ;
+  GC1D            *gc ;
+  int             x, y, z, n, i, ncov, nomrf ;
+  long long       nnodes, npriors, off, first ;
+
+  ncov = gca->ninputs*(gca->ninputs+1)/2 ;
+  nomrf = (gca->flags & GCA_NO_MRF) ;
+  memset(&hdr, 0, sizeof(hdr)) ;
+  memcpy(hdr.magic, GCA_FLAT_MAGIC, sizeof(hdr.magic)) ;
+  hdr.byte_order = GCA_FLAT_BYTE_ORDER ;
+  hdr.header_size = sizeof(hdr) ;
+  hdr.prior_spacing = gca->prior_spacing ;
+  hdr.node_spacing = gca->node_spacing ;
+  hdr.prior_width = gca->prior_width ;
+  hdr.prior_height = gca->prior_height ;
+  hdr.prior_depth = gca->prior_depth ;
+  hdr.node_width = gca->node_width ;
+  hdr.node_height = gca->node_height ;
+  hdr.node_depth = gca->node_depth ;
+  hdr.ninputs = gca->ninputs ;
+  hdr.flags = gca->flags ;
+  hdr.type = gca->type ;
+  hdr.max_label = gca->max_label ;
+  for (i = 0 ; i < MAX_GCA_INPUTS ; i++)
+  {
+    hdr.TRs[i] = gca->TRs[i] ;
+    hdr.FAs[i] = gca->FAs[i] ;
+    hdr.TEs[i] = gca->TEs[i] ;
+  }
+  hdr.x_r = gca->x_r ; hdr.x_a = gca->x_a ; hdr.x_s = gca->x_s ;
+  hdr.y_r = gca->y_r ; hdr.y_a = gca->y_a ; hdr.y_s = gca->y_s ;
+  hdr.z_r = gca->z_r ; hdr.z_a = gca->z_a ; hdr.z_s = gca->z_s ;
+  hdr.c_r = gca->c_r ; hdr.c_a = gca->c_a ; hdr.c_s = gca->c_s ;
+  hdr.width = gca->width ;
+  hdr.height = gca->height ;
+  hdr.depth = gca->depth ;
+  hdr.xsize = gca->xsize ;
+  hdr.ysize = gca->ysize ;
+  hdr.zsize = gca->zsize ;
+
+  // count everything so the offsets are known up front
+  for (x = 0 ; x < gca->node_width ; x++)
+    for (y = 0 ; y < gca->node_height ; y++)
+      for (z = 0 ; z < gca->node_depth ; z++)
+      {
+        gcan = &gca->nodes[x][y][z] ;
+        hdr.ngcs += gcan->nlabels ;
+        if (nomrf)
+          continue ;
+        for (n = 0 ; n < gcan->nlabels ; n++)
+          for (i = 0 ; i < GIBBS_NEIGHBORS ; i++)
+            hdr.ngibbs += gcan->gcs[n].nlabels[i] ;
+      }
+  for (x = 0 ; x < gca->prior_width ; x++)
+    for (y = 0 ; y < gca->prior_height ; y++)
+      for (z = 0 ; z < gca->prior_depth ; z++)
+        hdr.nprior_labels += gca->priors[x][y][z].nlabels ;
+
+  nnodes = (long long)gca->node_width*gca->node_height*gca->node_depth ;
+  npriors = (long long)gca->prior_width*gca->prior_height*gca->prior_depth ;
+  off = gcaFlatAlign(sizeof(hdr)) ;
+  hdr.node_off = off ;
+  off = gcaFlatAlign(off + nnodes*sizeof(GCA_FLAT_INDEX)) ;
+  hdr.prior_off = off ;
+  off = gcaFlatAlign(off + npriors*sizeof(GCA_FLAT_INDEX)) ;
+  hdr.gc_labels_off = off ;
+  off = gcaFlatAlign(off + hdr.ngcs*sizeof(unsigned short)) ;
+  hdr.gc_ntraining_off = off ;
+  off = gcaFlatAlign(off + hdr.ngcs*sizeof(int)) ;
+  hdr.means_off = off ;
+  off = gcaFlatAlign(off + hdr.ngcs*gca->ninputs*sizeof(float)) ;
+  hdr.covars_off = off ;
+  off = gcaFlatAlign(off + hdr.ngcs*ncov*sizeof(float)) ;
+  if (!nomrf)
+  {
+    hdr.gibbs_nlabels_off = off ;
+    off = gcaFlatAlign(off + hdr.ngcs*GIBBS_NEIGHBORHOOD*sizeof(short)) ;
+    hdr.gibbs_first_off = off ;
+    off = gcaFlatAlign(off + hdr.ngcs*sizeof(long long)) ;
+    hdr.gibbs_labels_off = off ;
+    off = gcaFlatAlign(off + hdr.ngibbs*sizeof(unsigned short)) ;
+    hdr.gibbs_priors_off = off ;
+    off = gcaFlatAlign(off + hdr.ngibbs*sizeof(float)) ;
+  }
+  hdr.prior_labels_off = off ;
+  off = gcaFlatAlign(off + hdr.nprior_labels*sizeof(unsigned short)) ;
+  hdr.prior_probs_off = off ;
+  off = gcaFlatAlign(off + hdr.nprior_labels*sizeof(float)) ;
+  hdr.data_size = off ;
+  hdr.ctab_off = (gca->ct ? off : 0) ;
+
+  fp = fopen(fname, "wb") ;
+  if (fp == NULL)
+    ErrorReturn(ERROR_BADPARM,
+                (ERROR_BADPARM, "GCAwriteFlat(%s): could not open file",fname)) ;
+  fwrite(&hdr, sizeof(hdr), 1, fp) ;
+
+  // node index
+  gcaFlatPad(fp, hdr.node_off) ;
+  for (first = 0, x = 0 ; x < gca->node_width ; x++)
+    for (y = 0 ; y < gca->node_height ; y++)
+      for (z = 0 ; z < gca->node_depth ; z++)
+      {
+        gcan = &gca->nodes[x][y][z] ;
+        idx.nlabels = gcan->nlabels ;
+        idx.total_training = gcan->total_training ;
+        idx.first = first ;
+        fwrite(&idx, sizeof(idx), 1, fp) ;
+        first += gcan->nlabels ;
+      }
+
+  // prior index
+  gcaFlatPad(fp, hdr.prior_off) ;
+  for (first = 0, x = 0 ; x < gca->prior_width ; x++)
+    for (y = 0 ; y < gca->prior_height ; y++)
+      for (z = 0 ; z < gca->prior_depth ; z++)
+      {
+        gcap = &gca->priors[x][y][z] ;
+        idx.nlabels = gcap->nlabels ;
+        idx.total_training = gcap->total_training ;
+        idx.first = first ;
+        fwrite(&idx, sizeof(idx), 1, fp) ;
+        first += gcap->nlabels ;
+      }
+
+  // per-gc arrays, each written in node order
+  gcaFlatPad(fp, hdr.gc_labels_off) ;
+  for (x = 0 ; x < gca->node_width ; x++)
+    for (y = 0 ; y < gca->node_height ; y++)
+      for (z = 0 ; z < gca->node_depth ; z++)
+      {
+        gcan = &gca->nodes[x][y][z] ;
+        if (gcan->nlabels)
+          fwrite(gcan->labels, sizeof(unsigned short), gcan->nlabels, fp) ;
+      }
+  gcaFlatPad(fp, hdr.gc_ntraining_off) ;
+  for (x = 0 ; x < gca->node_width ; x++)
+    for (y = 0 ; y < gca->node_height ; y++)
+      for (z = 0 ; z < gca->node_depth ; z++)
+      {
+        gcan = &gca->nodes[x][y][z] ;
+        for (n = 0 ; n < gcan->nlabels ; n++)
+          fwrite(&gcan->gcs[n].ntraining, sizeof(int), 1, fp) ;
+      }
+  gcaFlatPad(fp, hdr.means_off) ;
+  for (x = 0 ; x < gca->node_width ; x++)
+    for (y = 0 ; y < gca->node_height ; y++)
+      for (z = 0 ; z < gca->node_depth ; z++)
+      {
+        gcan = &gca->nodes[x][y][z] ;
+        for (n = 0 ; n < gcan->nlabels ; n++)
+          fwrite(gcan->gcs[n].means, sizeof(float), gca->ninputs, fp) ;
+      }
+  gcaFlatPad(fp, hdr.covars_off) ;
+  for (x = 0 ; x < gca->node_width ; x++)
+    for (y = 0 ; y < gca->node_height ; y++)
+      for (z = 0 ; z < gca->node_depth ; z++)
+      {
+        gcan = &gca->nodes[x][y][z] ;
+        for (n = 0 ; n < gcan->nlabels ; n++)
+          fwrite(gcan->gcs[n].covars, sizeof(float), ncov, fp) ;
+      }
+
+  if (!nomrf)
+  {
+    gcaFlatPad(fp, hdr.gibbs_nlabels_off) ;
+    for (x = 0 ; x < gca->node_width ; x++)
+      for (y = 0 ; y < gca->node_height ; y++)
+        for (z = 0 ; z < gca->node_depth ; z++)
+        {
+          gcan = &gca->nodes[x][y][z] ;
+          for (n = 0 ; n < gcan->nlabels ; n++)
+            fwrite(gcan->gcs[n].nlabels, sizeof(short), GIBBS_NEIGHBORHOOD, fp) ;
+        }
+    gcaFlatPad(fp, hdr.gibbs_first_off) ;
+    for (first = 0, x = 0 ; x < gca->node_width ; x++)
+      for (y = 0 ; y < gca->node_height ; y++)
+        for (z = 0 ; z < gca->node_depth ; z++)
+        {
+          gcan = &gca->nodes[x][y][z] ;
+          for (n = 0 ; n < gcan->nlabels ; n++)
+          {
+            fwrite(&first, sizeof(first), 1, fp) ;
+            for (i = 0 ; i < GIBBS_NEIGHBORS ; i++)
+              first += gcan->gcs[n].nlabels[i] ;
+          }
+        }
+    gcaFlatPad(fp, hdr.gibbs_labels_off) ;
+    for (x = 0 ; x < gca->node_width ; x++)
+      for (y = 0 ; y < gca->node_height ; y++)
+        for (z = 0 ; z < gca->node_depth ; z++)
+        {
+          gcan = &gca->nodes[x][y][z] ;
+          for (n = 0 ; n < gcan->nlabels ; n++)
+            for (i = 0 ; i < GIBBS_NEIGHBORS ; i++)
+            {
+              gc = &gcan->gcs[n] ;
+              if (gc->nlabels[i])
+                fwrite(gc->labels[i], sizeof(unsigned short), gc->nlabels[i], fp) ;
+            }
+        }
+    gcaFlatPad(fp, hdr.gibbs_priors_off) ;
+    for (x = 0 ; x < gca->node_width ; x++)
+      for (y = 0 ; y < gca->node_height ; y++)
+        for (z = 0 ; z < gca->node_depth ; z++)
+        {
+          gcan = &gca->nodes[x][y][z] ;
+          for (n = 0 ; n < gcan->nlabels ; n++)
+            for (i = 0 ; i < GIBBS_NEIGHBORS ; i++)
+            {
+              gc = &gcan->gcs[n] ;
+              if (gc->nlabels[i])
+                fwrite(gc->label_priors[i], sizeof(float), gc->nlabels[i], fp) ;
+            }
+        }
+  }
+
+  gcaFlatPad(fp, hdr.prior_labels_off) ;
+  for (x = 0 ; x < gca->prior_width ; x++)
+    for (y = 0 ; y < gca->prior_height ; y++)
+      for (z = 0 ; z < gca->prior_depth ; z++)
+      {
+        gcap = &gca->priors[x][y][z] ;
+        if (gcap->nlabels)
+          fwrite(gcap->labels, sizeof(unsigned short), gcap->nlabels, fp) ;
+      }
+  gcaFlatPad(fp, hdr.prior_probs_off) ;
+  for (x = 0 ; x < gca->prior_width ; x++)
+    for (y = 0 ; y < gca->prior_height ; y++)
+      for (z = 0 ; z < gca->prior_depth ; z++)
+      {
+        gcap = &gca->priors[x][y][z] ;
+        if (gcap->nlabels)
+          fwrite(gcap->priors, sizeof(float), gcap->nlabels, fp) ;
+      }
+  if (gcaFlatPad(fp, hdr.data_size) != NO_ERROR || ferror(fp))
+  {
+    fclose(fp) ;
+    ErrorReturn(ERROR_BADFILE,
+                (ERROR_BADFILE, "GCAwriteFlat(%s): write failed",fname)) ;
+  }
+  fclose(fp) ;
+
+  if (gca->ct)
+  {
+    znzFile file = znzopen(fname, "ab", 0) ;
+    if (znz_isnull(file))
+      ErrorReturn(ERROR_BADFILE,
+                  (ERROR_BADFILE, "GCAwriteFlat(%s): could not append colortable",
+                   fname)) ;
+    znzCTABwriteIntoBinary(gca->ct, file);
+    znzclose(file) ;
+  }
+
+  return(NO_ERROR) ;
+}
+
+/*!
+  \fn GCA *GCAreadFlat(const char *fname)
+  \brief Reads a GCA written by GCAwriteFlat(). The file is mapped
+  privately (copy-on-write) and the node labels, means, covariances,
+  gibbs priors, and prior arrays all point into the mapping, so
+  nothing is parsed or copied up front and the pages are shared with
+  other processes reading the same atlas until written. Only the node
+  and prior grids and one GC1D per node label are allocated. Values
+  may be changed in place, but the label lists of a flat GCA must not
+  be grown or freed (ie, it should not be trained or smoothed).
+  GCAfree() releases the mapping. GCAread() calls this automatically
+  for flat files.
+*/
+GCA *
+GCAreadFlat(const char *fname)
+{
+  FILE            *fp ;
+  GCA             *gca ;
+  GCA_FLAT        *flat ;
+  GCA_FLAT_HEADER *hdr ;
+  GCA_FLAT_INDEX  *nidx, *pidx ;
+  GCA_NODE        *gcan ;
+  GCA_PRIOR       *gcap ;
+  GC1D            *gc ;
+  int             x, y, z, i, ncov ;
+  long long       g, k, first, size ;
+  char            *base = NULL ;
+  int             mapped = 0 ;
+
+  fp = fopen(fname, "rb") ;
+  if (fp == NULL)
+    ErrorReturn(NULL, (ERROR_BADPARM,
+                       "GCAreadFlat(%s): could not open file", fname)) ;
+  fseek(fp, 0, SEEK_END) ;
+  size = ftell(fp) ;
+  fseek(fp, 0, SEEK_SET) ;
+  if (size < (long long)sizeof(GCA_FLAT_HEADER))
+  {
+    fclose(fp) ;
+    ErrorReturn(NULL, (ERROR_BADFILE,
+                       "GCAreadFlat(%s): file too short", fname)) ;
+  }
+
+#ifdef _POSIX_MAPPED_FILES
+  base = (char *)mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                      fileno(fp), 0) ;
+  if (base == MAP_FAILED)
+    base = NULL ;
+  else
+    mapped = 1 ;
+#endif
+  if (base == NULL)  /* no mmap, so just slurp it in */
+  {
+    base = (char *)malloc(size) ;
+    if (base == NULL || fread(base, 1, size, fp) != (size_t)size)
+    {
+      fclose(fp) ;
+      if (base) free(base) ;
+      ErrorReturn(NULL, (ERROR_BADFILE,
+                         "GCAreadFlat(%s): could not read file", fname)) ;
+    }
+  }
+  fclose(fp) ;
+
+  hdr = (GCA_FLAT_HEADER *)base ;
+  if (memcmp(hdr->magic, GCA_FLAT_MAGIC, sizeof(hdr->magic)) ||
+      hdr->byte_order != GCA_FLAT_BYTE_ORDER ||
+      hdr->header_size != sizeof(GCA_FLAT_HEADER) ||
+      hdr->data_size > size)
+  {
+    gcaFlatUnmap(base, size, mapped) ;
+    ErrorReturn(NULL, (ERROR_BADFILE,
+                       "GCAreadFlat(%s): not a flat GCA for this machine "
+                       "(wrong magic, byte order, or size)", fname)) ;
+  }
+
+  gca = gcaAllocMax(hdr->ninputs, hdr->prior_spacing, hdr->node_spacing,
+                    hdr->node_spacing*hdr->node_width,
+                    hdr->node_spacing*hdr->node_height,
+                    hdr->node_spacing*hdr->node_depth, 0, hdr->flags) ;
+  if (!gca)
+  {
+    gcaFlatUnmap(base, size, mapped) ;
+    ErrorReturn(NULL, (Gerror, NULL)) ;
+  }
+  if (gca->node_width != hdr->node_width ||
+      gca->node_height != hdr->node_height ||
+      gca->node_depth != hdr->node_depth ||
+      gca->prior_width != hdr->prior_width ||
+      gca->prior_height != hdr->prior_height ||
+      gca->prior_depth != hdr->prior_depth)
+  {
+    GCAfree(&gca) ;
+    gcaFlatUnmap(base, size, mapped) ;
+    ErrorReturn(NULL, (ERROR_BADFILE,
+                       "GCAreadFlat(%s): inconsistent node/prior grids",
+                       fname)) ;
+  }
+
+  gca->type = hdr->type ;
+  gca->max_label = hdr->max_label ;
+  for (i = 0 ; i < MAX_GCA_INPUTS ; i++)
+  {
+    gca->TRs[i] = hdr->TRs[i] ;
+    gca->FAs[i] = hdr->FAs[i] ;
+    gca->TEs[i] = hdr->TEs[i] ;
+  }
+  gca->x_r = hdr->x_r ; gca->x_a = hdr->x_a ; gca->x_s = hdr->x_s ;
+  gca->y_r = hdr->y_r ; gca->y_a = hdr->y_a ; gca->y_s = hdr->y_s ;
+  gca->z_r = hdr->z_r ; gca->z_a = hdr->z_a ; gca->z_s = hdr->z_s ;
+  gca->c_r = hdr->c_r ; gca->c_a = hdr->c_a ; gca->c_s = hdr->c_s ;
+  gca->width = hdr->width ;
+  gca->height = hdr->height ;
+  gca->depth = hdr->depth ;
+  gca->xsize = hdr->xsize ;
+  gca->ysize = hdr->ysize ;
+  gca->zsize = hdr->zsize ;
+
+  flat = (GCA_FLAT *)calloc(1, sizeof(GCA_FLAT)) ;
+  if (flat)
+  {
+    flat->base = base ;
+    flat->size = size ;
+    flat->mapped = mapped ;
+    flat->gcs = (GC1D *)calloc(hdr->ngcs+1, sizeof(GC1D)) ;
+    if (!(gca->flags & GCA_NO_MRF))
+    {
+      flat->gibbs_labels = (unsigned short **)
+        calloc(hdr->ngcs*GIBBS_NEIGHBORHOOD+1, sizeof(unsigned short *)) ;
+      flat->gibbs_priors = (float **)
+        calloc(hdr->ngcs*GIBBS_NEIGHBORHOOD+1, sizeof(float *)) ;
+    }
+  }
+  if (!flat || !flat->gcs || ((gca->flags & GCA_NO_MRF) == 0 &&
+                              (!flat->gibbs_labels || !flat->gibbs_priors)))
+  {
+    GCAfree(&gca) ;
+    if (flat)
+      gcaFlatFree(flat) ;  /* also releases the file image */
+    else
+      gcaFlatUnmap(base, size, mapped) ;
+    ErrorReturn(NULL, (ERROR_NOMEMORY,
+                       "GCAreadFlat(%s): could not allocate %lld gcs",
+                       fname, hdr->ngcs)) ;
+  }
+  gca->flat = flat ;
+
+  // point the nodes at their slice of the gc arrays
+  nidx = (GCA_FLAT_INDEX *)(base + hdr->node_off) ;
+  for (k = 0, x = 0 ; x < gca->node_width ; x++)
+    for (y = 0 ; y < gca->node_height ; y++)
+      for (z = 0 ; z < gca->node_depth ; z++, k++)
+      {
+        gcan = &gca->nodes[x][y][z] ;
+        gcan->nlabels = gcan->max_labels = nidx[k].nlabels ;
+        gcan->total_training = nidx[k].total_training ;
+        if (gcan->nlabels == 0)
+          continue ;
+        gcan->labels = (unsigned short *)(base + hdr->gc_labels_off) + nidx[k].first ;
+        gcan->gcs = flat->gcs + nidx[k].first ;
+      }
+
+  ncov = gca->ninputs*(gca->ninputs+1)/2 ;
+  for (g = 0 ; g < hdr->ngcs ; g++)
+  {
+    gc = &flat->gcs[g] ;
+    gc->means = (float *)(base + hdr->means_off) + g*gca->ninputs ;
+    gc->covars = (float *)(base + hdr->covars_off) + g*ncov ;
+    gc->ntraining = ((int *)(base + hdr->gc_ntraining_off))[g] ;
+    if (gca->flags & GCA_NO_MRF)
+      continue ;
+    gc->nlabels = (short *)(base + hdr->gibbs_nlabels_off) + g*GIBBS_NEIGHBORHOOD ;
+    gc->labels = flat->gibbs_labels + g*GIBBS_NEIGHBORHOOD ;
+    gc->label_priors = flat->gibbs_priors + g*GIBBS_NEIGHBORHOOD ;
+    first = ((long long *)(base + hdr->gibbs_first_off))[g] ;
+    for (i = 0 ; i < GIBBS_NEIGHBORS ; i++)
+    {
+      gc->labels[i] = (unsigned short *)(base + hdr->gibbs_labels_off) + first ;
+      gc->label_priors[i] = (float *)(base + hdr->gibbs_priors_off) + first ;
+      first += gc->nlabels[i] ;
+    }
+  }
+
+  pidx = (GCA_FLAT_INDEX *)(base + hdr->prior_off) ;
+  for (k = 0, x = 0 ; x < gca->prior_width ; x++)
+    for (y = 0 ; y < gca->prior_height ; y++)
+      for (z = 0 ; z < gca->prior_depth ; z++, k++)
+      {
+        gcap = &gca->priors[x][y][z] ;
+        gcap->nlabels = gcap->max_labels = pidx[k].nlabels ;
+        gcap->total_training = pidx[k].total_training ;
+        if (gcap->nlabels == 0)
+          continue ;
+        gcap->labels = (unsigned short *)(base + hdr->prior_labels_off) + pidx[k].first ;
+        gcap->priors = (float *)(base + hdr->prior_probs_off) + pidx[k].first ;
+      }
+
+  if (hdr->ctab_off > 0)
+  {
+    znzFile file = znzopen(fname, "rb", 0) ;
+    if (!znz_isnull(file))
+    {
+      znzseek(file, hdr->ctab_off, SEEK_SET) ;
+      gca->ct = znzCTABreadFromBinary(file) ;
+      znzclose(file) ;
+    }
+  }
+
+  GCAsetup(gca);
+
+  return(gca) ;
+}
+
+/* releases what GCAreadFlat() allocated and the mapping itself */
+static void
+gcaFlatFree(void *vflat)
+{
+  GCA_FLAT *flat = (GCA_FLAT *)vflat ;
+
+  free(flat->gcs) ;
+  if (flat->gibbs_labels) free(flat->gibbs_labels) ;
+  if (flat->gibbs_priors) free(flat->gibbs_priors) ;
+  gcaFlatUnmap(flat->base, flat->size, flat->mapped) ;
+  free(flat) ;
+}
+
+/* copies the node and prior arrays of a flat GCA onto the heap and
+   releases the mapping, for the paths that grow or free label lists
+   (training, label insertion, compaction) */
+static void
+gcaUnflatten(GCA *gca)
+{
+  GCA_NODE       *gcan ;
+  GCA_PRIOR      *gcap ;
+  GC1D           *gcs ;
+  unsigned short *labels ;
+  float          *priors ;
+  int            x, y, z ;
+
+  if (gca->flat == NULL)
+    return ;
+
+  for (x = 0 ; x < gca->node_width ; x++)
+    for (y = 0 ; y < gca->node_height ; y++)
+      for (z = 0 ; z < gca->node_depth ; z++)
+      {
+        gcan = &gca->nodes[x][y][z] ;
+        if (gcan->nlabels == 0)
+          continue ;
+        labels = (unsigned short *)calloc(gcan->nlabels, sizeof(unsigned short)) ;
+        if (!labels)
+          ErrorExit(ERROR_NOMEMORY, "gcaUnflatten: could not allocate node") ;
+        memmove(labels, gcan->labels, gcan->nlabels*sizeof(unsigned short)) ;
+        gcs = alloc_gcs(gcan->nlabels, gca->flags, gca->ninputs) ;
+        copy_gcs(gcan->nlabels, gcan->gcs, gcs, gca->ninputs) ;
+        gcan->labels = labels ;
+        gcan->gcs = gcs ;
+      }
+
+  for (x = 0 ; x < gca->prior_width ; x++)
+    for (y = 0 ; y < gca->prior_height ; y++)
+      for (z = 0 ; z < gca->prior_depth ; z++)
+      {
+        gcap = &gca->priors[x][y][z] ;
+        if (gcap->nlabels == 0)
+          continue ;
+        labels = (unsigned short *)calloc(gcap->nlabels, sizeof(unsigned short)) ;
+        priors = (float *)calloc(gcap->nlabels, sizeof(float)) ;
+        if (!labels || !priors)
+          ErrorExit(ERROR_NOMEMORY, "gcaUnflatten: could not allocate prior") ;
+        memmove(labels, gcap->labels, gcap->nlabels*sizeof(unsigned short)) ;
+        memmove(priors, gcap->priors, gcap->nlabels*sizeof(float)) ;
+        gcap->labels = labels ;
+        gcap->priors = priors ;
+      }
+
+  gcaFlatFree(gca->flat) ;
+  gca->flat = NULL ;
+}
+
 
 static int
 GCAupdatePrior(GCA *gca, MRI *mri, int xn, int yn, int zn, int label)
@@ -3418,6 +4109,10 @@ GCAupdatePrior(GCA *gca, MRI *mri, int xn, int yn, int zn, int label)
     DiagBreak() ;
   }
 
+  if (gca->flat)
+  {
+    gcaUnflatten(gca) ;
+  }
   gcap = &gca->priors[xn][yn][zn] ;
   if (gcap==NULL)
   {
@@ -3564,6 +4259,11 @@ GCAupdateNode(GCA *gca, MRI *mri,
                  "GCAupdateNode(%d, %d, %d, %d): label out of range",
                  xn, yn, zn, label)) ;
 
+  if (gca->flat)
+  {
+    gcaUnflatten(gca) ;
+  }
+
   if (xn == Ggca_x && yn == Ggca_y && zn == Ggca_z && label == Ggca_label)
   {
     DiagBreak() ;
@@ -8209,6 +8909,10 @@ GCAupdateNodeGibbsPriors(GCA *gca, MRI*mri, int xn, int yn, int zn,
   GCA_NODE *gcan ;
   GC1D     *gc ;
 
+  if (gca->flat)
+  {
+    gcaUnflatten(gca) ;
+  }
   gcan = &gca->nodes[xn][yn][zn] ;
 
   // look for this label
@@ -8785,6 +9489,122 @@ GCAanneal(MRI *mri_inputs, GCA *gca, MRI *mri_dst,TRANSFORM *transform,
 
 char *gca_write_fname = NULL ;
 int gca_write_iterations = 0 ;
+int gca_sequential_gibbs = 0 ;
+
+/*!
+  \fn static int gcaGibbsUpdateVoxel(...)
+  \brief One ICM update of voxel (x,y,z): relabel it with the label of
+  its prior that maximizes the neighborhood Gibbs posterior. Writes only
+  voxel (x,y,z) of mri_dst, mri_changed and mri_probs (if non-NULL), so
+  it is safe to call concurrently on voxels that are not 6-neighbors.
+  Returns 1 if the label changed.
+*/
+static int
+gcaGibbsUpdateVoxel(GCA *gca, MRI *mri_inputs, MRI *mri_dst,
+                    MRI *mri_changed, MRI *mri_fixed, MRI *mri_probs,
+                    TRANSFORM *transform, int x, int y, int z,
+                    double prior_factor)
+{
+  int      n, label, old_label ;
+  GCA_PRIOR *gcap ;
+  double   new_posterior, max_posterior ;
+
+  if (x == Ggca_x && y == Ggca_y && z == Ggca_z)
+    DiagBreak() ;
+
+  // if the label is fixed, don't do anything
+  if (mri_fixed && MRIgetVoxVal(mri_fixed, x, y, z,0))
+    return(0) ;
+
+  // if not marked, don't do anything
+  if (MRIgetVoxVal(mri_changed, x, y, z,0) == 0)
+    return(0) ;
+
+  /* find the node associated with this coordinate and classify */
+  gcap = getGCAP(gca, mri_inputs, transform, x, y, z) ;
+  // it is not in the right place
+  if (gcap==NULL)
+    return(0) ;
+
+  // only one label associated, don't do anything
+  if (gcap->nlabels == 1)
+    return(0) ;
+
+  // save the current label
+  label = old_label = nint(MRIgetVoxVal(mri_dst, x, y, z,0)) ;
+  // calculate neighborhood likelihood
+  max_posterior = GCAnbhdGibbsLogPosterior(gca, mri_dst,
+                  mri_inputs, x, y,z,transform,
+                  prior_factor);
+
+  // go through all labels at this point
+  for (n = 0 ; n < gcap->nlabels ; n++)
+  {
+    // skip the current label
+    if (gcap->labels[n] == old_label)
+      continue ;
+
+    // assign the new label
+    MRIsetVoxVal(mri_dst, x, y, z, 0,gcap->labels[n]) ;
+    // calculate neighborhood likelihood
+    new_posterior =
+      GCAnbhdGibbsLogPosterior(gca, mri_dst,
+                               mri_inputs, x, y,z,transform,
+                               prior_factor);
+    // if it is bigger than the old one, then replace the label
+    // and change max_posterior
+    if (new_posterior > max_posterior)
+    {
+      if (x == Ggca_x && y == Ggca_y && z == Ggca_z &&
+          (label == Ggca_label || old_label ==
+           Ggca_label || Ggca_label < 0))
+        fprintf(stdout,
+                "NbhdGibbsLogLikelihood at (%d, %d, %d):"
+                " old = %d (ll=%.2f) new = %d (ll=%.2f)\n",
+                x, y, z, old_label, max_posterior,
+                gcap->labels[n], new_posterior);
+
+      max_posterior = new_posterior ;
+      label = gcap->labels[n] ;
+    }
+  }
+
+  /*#ifndef __OPTIMIZE__*/
+  if (x == Ggca_x && y == Ggca_y && z == Ggca_z &&
+      (label == Ggca_label || old_label ==
+       Ggca_label || Ggca_label < 0))
+  {
+    int       xn, yn, zn ;
+    GCA_NODE *gcan ;
+
+    if (!GCAsourceVoxelToNode(gca, mri_inputs, transform,
+                              x, y, z, &xn, &yn, &zn))
+    {
+      gcan = &gca->nodes[xn][yn][zn] ;
+      printf("(%d, %d, %d): old label %s (%d), "
+             "new label %s (%d) (log(p)=%2.3f)\n",
+             x, y, z, cma_label_to_name(old_label), old_label,
+             cma_label_to_name(label), label, max_posterior) ;
+      dump_gcan(gca, gcan, stdout, 0, gcap) ;
+      if (label == Right_Caudate)
+      {
+        DiagBreak() ;
+      }
+    }
+  }
+  /*#endif*/
+
+  // if label changed, mark it as changed
+  MRIsetVoxVal(mri_changed, x, y, z, 0, label != old_label) ;
+  // assign new label
+  MRIsetVoxVal(mri_dst, x, y, z, 0, label) ;
+  if (mri_probs)
+  {
+    MRIsetVoxVal(mri_probs, x, y, z, 0, -max_posterior) ;
+  }
+  return(label != old_label) ;
+}
+
 
 #if  0
 double MAX_PRIOR_FACTOR = 1.0 ;
@@ -8804,7 +9624,7 @@ GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
     nchanged, min_changed, index, nindices, fixed ;
   short    *x_indices, *y_indices, *z_indices ;
   double   prior_factor, old_posterior, lcma = 0.0 ;
-  MRI      *mri_changed, *mri_probs /*, *mri_zero */ ;
+  MRI      *mri_changed, *mri_probs = NULL /*, *mri_zero */ ;
 
   prior_factor = min_prior_factor ;
 // fixed is the label fixed volume, e.g. wm
@@ -8960,13 +9780,16 @@ GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
         printf("writing snapshot to %s\n", fname) ;
         MRIwrite(mri_dst, fname) ;
       }
-      // probs has 0 to 255 values
-      mri_probs = GCAlabelProbabilities(mri_inputs, gca, NULL, transform) ;
-      // sorted according to ascending order of probs
-      MRIorderIndices(mri_probs, x_indices, y_indices, z_indices) ;
-      MRIfree(&mri_probs) ;
+      if (gca_sequential_gibbs)
+      {
+        // probs has 0 to 255 values
+        mri_probs = GCAlabelProbabilities(mri_inputs, gca, NULL, transform) ;
+        // sorted according to ascending order of probs
+        MRIorderIndices(mri_probs, x_indices, y_indices, z_indices) ;
+        MRIfree(&mri_probs) ;
+      }
     }
-    else
+    else if (gca_sequential_gibbs)
       // randomize the indices value ((0 -> width*height*depth)
       MRIcomputeVoxelPermutation(mri_inputs, x_indices, y_indices,
                                  z_indices) ;
@@ -8980,122 +9803,42 @@ GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
       MRIcopyHeader(mri_inputs, mri_probs) ;
     }
 
-//#ifdef HAVE_OPENMP
-//pragma omp parallel for reduction(+: nchanged)
-//#endif
-    for (index = 0 ; index < nindices ; index++)
+    if (gca_sequential_gibbs)
     {
-      int x, y, z, n, label, old_label ;
-      GCA_PRIOR *gcap ;
-      double   new_posterior, max_posterior ;
-      float    val ;
-  
-      x = x_indices[index] ; y = y_indices[index] ; z = z_indices[index] ;
-      if (x == Ggca_x && y == Ggca_y && z == Ggca_z)
-        DiagBreak() ;
-
-      // if the label is fixed, don't do anything
-      if (mri_fixed && MRIgetVoxVal(mri_fixed, x, y, z,0))
-        continue ;
-
-      // if not marked, don't do anything
-      if (MRIgetVoxVal(mri_changed, x, y, z,0) == 0)
-        continue ;
-
-      // get the grey value
-      val = MRIgetVoxVal(mri_inputs, x, y, z, 0) ;
-
-      /* find the node associated with this coordinate and classify */
-      gcap = getGCAP(gca, mri_inputs, transform, x, y, z) ;
-      // it is not in the right place
-      if (gcap==NULL)
-        continue;
-
-      // only one label associated, don't do anything
-      if (gcap->nlabels == 1)
-        continue ;
-
-      // save the current label
-      label = old_label = nint(MRIgetVoxVal(mri_dst, x, y, z,0)) ;
-      // calculate neighborhood likelihood
-      max_posterior = GCAnbhdGibbsLogPosterior(gca, mri_dst,
-                      mri_inputs, x, y,z,transform,
-                      prior_factor);
+      for (index = 0 ; index < nindices ; index++)
+        nchanged +=
+          gcaGibbsUpdateVoxel(gca, mri_inputs, mri_dst, mri_changed,
+                              mri_fixed, mri_probs, transform,
+                              x_indices[index], y_indices[index],
+                              z_indices[index], prior_factor) ;
+    }
+    else
+    {
+      int color ;
 
-      // go through all labels at this point
-      for (n = 0 ; n < gcap->nlabels ; n++)
+      /* checkerboard (red/black) ICM: the neighborhood posterior only
+         looks at the 6-connected neighbors, so all voxels of one color
+         can be updated concurrently and the result does not depend on
+         the number of threads */
+      for (color = 0 ; color < 2 ; color++)
       {
-        // skip the current label
-        if (gcap->labels[n] == old_label)
-          continue ;
-
-        // assign the new label
-        MRIsetVoxVal(mri_dst, x, y, z, 0,gcap->labels[n]) ;
-        // calculate neighborhood likelihood
-        new_posterior =
-          GCAnbhdGibbsLogPosterior(gca, mri_dst,
-                                   mri_inputs, x, y,z,transform,
-                                   prior_factor);
-        // if it is bigger than the old one, then replace the label
-        // and change max_posterior
-        if (new_posterior > max_posterior)
+#ifdef HAVE_OPENMP
+        #pragma omp parallel for schedule(dynamic) reduction(+: nchanged)
+#endif
+        for (z = 0 ; z < depth ; z++)
         {
-          if (x == Ggca_x && y == Ggca_y && z == Ggca_z &&
-              (label == Ggca_label || old_label ==
-               Ggca_label || Ggca_label < 0))
-            fprintf(stdout,
-                    "NbhdGibbsLogLikelihood at (%d, %d, %d):"
-                    " old = %d (ll=%.2f) new = %d (ll=%.2f)\n",
-                    x, y, z, old_label, max_posterior,
-                    gcap->labels[n], new_posterior);
-
-          max_posterior = new_posterior ;
-          label = gcap->labels[n] ;
-        }
-      }
-
-      /*#ifndef __OPTIMIZE__*/
-      if (x == Ggca_x && y == Ggca_y && z == Ggca_z &&
-          (label == Ggca_label || old_label ==
-           Ggca_label || Ggca_label < 0))
-      {
-        int       xn, yn, zn ;
-        GCA_NODE *gcan ;
+          int x, y ;
 
-        if (!GCAsourceVoxelToNode(gca, mri_inputs, transform,
-                                  x, y, z, &xn, &yn, &zn))
-        {
-          gcan = &gca->nodes[xn][yn][zn] ;
-          printf("(%d, %d, %d): old label %s (%d), "
-                 "new label %s (%d) (log(p)=%2.3f)\n",
-                 x, y, z, cma_label_to_name(old_label), old_label,
-                 cma_label_to_name(label), label, max_posterior) ;
-          dump_gcan(gca, gcan, stdout, 0, gcap) ;
-          if (label == Right_Caudate)
-          {
-            DiagBreak() ;
-          }
+          for (y = 0 ; y < height ; y++)
+            for (x = (y + z + color) & 1 ; x < width ; x += 2)
+            {
+              nchanged +=
+                gcaGibbsUpdateVoxel(gca, mri_inputs, mri_dst, mri_changed,
+                                    mri_fixed, mri_probs, transform,
+                                    x, y, z, prior_factor) ;
+            }
         }
       }
-      /*#endif*/
-
-      // if label changed
-      if (label != old_label)
-      {
-        nchanged++ ;
-        // mark it as changed
-        MRIsetVoxVal(mri_changed, x, y, z, 0, 1) ;
-      }
-      else
-      {
-        MRIsetVoxVal(mri_changed, x, y, z, 0, 0) ;
-      }
-      // assign new label
-      MRIsetVoxVal(mri_dst, x, y, z, 0, label) ;
-      if (mri_probs)
-      {
-        MRIsetVoxVal(mri_probs, x, y, z, 0, -max_posterior) ;
-      }
     }
     if (mri_probs)
     {
@@ -16791,7 +17534,12 @@ GCAfindClosestValidGC(GCA *gca,
   int        x, y, z, n, wsize ;
   double     dist, min_dist, det ;
   GCA_NODE   *gcan ;
-  static MATRIX     *m_cov_inv = NULL ;
+  static MATRIX     *m_cov_inv[_MAX_FS_THREADS] ;
+#ifdef HAVE_OPENMP
+  int tid = omp_get_thread_num();
+#else
+  int tid = 0;
+#endif
 
   min_dist = gca->node_width+gca->node_height+gca->node_depth ;
   wsize = 1 ;
@@ -16831,9 +17579,10 @@ GCAfindClosestValidGC(GCA *gca,
             }
             gc = &gcan->gcs[n] ;
             det = covariance_determinant(gc, gca->ninputs) ;
-            m_cov_inv =
-              load_inverse_covariance_matrix(gc, m_cov_inv, gca->ninputs) ;
-            if (m_cov_inv == NULL)
+            m_cov_inv[tid] =
+              load_inverse_covariance_matrix(gc, m_cov_inv[tid],
+                                             gca->ninputs) ;
+            if (m_cov_inv[tid] == NULL)
             {
               det = -1 ;
             }
@@ -17590,6 +18339,32 @@ GCAfreeGibbs(GCA *gca)
     return(NO_ERROR) ;  /* already done */
   }
 
+  if (gca->flat)
+  {
+    /* the gibbs arrays point into the file, so just drop them */
+    GCA_FLAT *flat = (GCA_FLAT *)gca->flat ;
+
+    for (x = 0 ; x < gca->node_width ; x++)
+      for (y = 0 ; y < gca->node_height ; y++)
+        for (z = 0 ; z < gca->node_depth ; z++)
+        {
+          gcan = &gca->nodes[x][y][z] ;
+          for (n = 0 ; n < gcan->nlabels ; n++)
+          {
+            gc = &gcan->gcs[n] ;
+            gc->nlabels = NULL ;
+            gc->labels = NULL ;
+            gc->label_priors = NULL ;
+          }
+        }
+    free(flat->gibbs_labels) ;
+    free(flat->gibbs_priors) ;
+    flat->gibbs_labels = NULL ;
+    flat->gibbs_priors = NULL ;
+    gca->flags |= GCA_NO_MRF ;
+    return(NO_ERROR) ;
+  }
+
   for (x = 0 ; x < gca->node_width ; x++)
   {
     for (y = 0 ; y < gca->node_height ; y++)
@@ -17761,10 +18536,17 @@ double
 GCAmahDist( const GC1D *gc,
             const float *vals, const int ninputs )
 {
-  static VECTOR *v_means = NULL, *v_vals = NULL ;
-  static MATRIX *m_cov = NULL, *m_cov_inv ;
+  static VECTOR *v_means_t[_MAX_FS_THREADS], *v_vals_t[_MAX_FS_THREADS] ;
+  static MATRIX *m_cov_t[_MAX_FS_THREADS], *m_cov_inv_t[_MAX_FS_THREADS] ;
+  VECTOR *v_means, *v_vals ;
+  MATRIX *m_cov, *m_cov_inv ;
   int    i ;
   double dsq ;
+#ifdef HAVE_OPENMP
+  int tid = omp_get_thread_num();
+#else
+  int tid = 0;
+#endif
 
   if (ninputs == 1)
   {
@@ -17773,6 +18555,9 @@ GCAmahDist( const GC1D *gc,
     dsq = v*v / gc->covars[0] ;
     return(dsq) ;
   }
+  // per-thread scratch so this can be called from parallel regions
+  v_means = v_means_t[tid] ; v_vals = v_vals_t[tid] ;
+  m_cov = m_cov_t[tid] ; m_cov_inv = m_cov_inv_t[tid] ;
   //printf("In GCAMahDist...ninputs = %d\n", ninputs);
   if (v_vals && ninputs != v_vals->rows)
   {
@@ -17814,6 +18599,8 @@ GCAmahDist( const GC1D *gc,
   /* v_means is now inverse(cov) * v_vals */
   dsq = VectorDot(v_vals, v_means) ;
 
+  v_means_t[tid] = v_means ; v_vals_t[tid] = v_vals ;
+  m_cov_t[tid] = m_cov ; m_cov_inv_t[tid] = m_cov_inv ;
   return(dsq);
 }
 double
@@ -25827,6 +26614,10 @@ GCA *GCAcompactify(GCA *gca)
   int i,j, k;
   double byteSaved = 0.;
 
+  if (gca->flat)
+  {
+    gcaUnflatten(gca) ;
+  }
   width = gca->prior_width;
   height = gca->prior_height;
   depth = gca->prior_depth;
@@ -30493,6 +31284,10 @@ GCAinsertLabels(GCA *gca, MRI *mri, TRANSFORM *transform, int ninsertions,
   GCA_NODE  *gcan ;
   GCA_PRIOR *gcap ;
 
+  if (gca->flat)
+  {
+    gcaUnflatten(gca) ;
+  }
   for (l = 0 ; l < ninsertions ; l++)
   {
     whalf = insert_whalf[l] ;
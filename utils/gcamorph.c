@@ -2042,9 +2042,130 @@ GCAMfreeContents(GCA_MORPH *gcam)
     free(gcam->nodes[x]) ;
   }
   free(gcam->nodes) ;
+  GCAMsoaFree(&gcam->soa) ;
   return(NO_ERROR) ;
 }
 
+/*!
+  \fn GCAM_SOA *GCAMsoaAlloc(GCA_MORPH *gcam)
+  \brief Returns the structure-of-arrays node store of the morph,
+  allocating it (or reallocating it if the node grid has changed
+  size) as needed. The contents are not initialized; use
+  GCAMsoaLoad(). The store is owned by the morph and freed by
+  GCAMfreeContents().
+*/
+GCAM_SOA *
+GCAMsoaAlloc(GCA_MORPH *gcam)
+{
+  GCAM_SOA *soa ;
+  size_t   nnodes ;
+
+  soa = gcam->soa ;
+  if (soa && soa->width == gcam->width && soa->height == gcam->height &&
+      soa->depth == gcam->depth)
+  {
+    return(soa) ;
+  }
+  GCAMsoaFree(&gcam->soa) ;
+
+  nnodes = (size_t)gcam->width * gcam->height * gcam->depth ;
+  soa = (GCAM_SOA *)calloc(1, sizeof(GCAM_SOA)) ;
+  if (soa == NULL)
+    ErrorExit(ERROR_NOMEMORY, "GCAMsoaAlloc(%d, %d, %d): could not allocate",
+              gcam->width, gcam->height, gcam->depth) ;
+  soa->width = gcam->width ;
+  soa->height = gcam->height ;
+  soa->depth = gcam->depth ;
+  // the three displacement arrays live in one block
+  soa->vx = (double *)calloc(3*nnodes+1, sizeof(double)) ;
+  soa->invalid = (char *)calloc(nnodes+1, sizeof(char)) ;
+  if (soa->vx == NULL || soa->invalid == NULL)
+    ErrorExit(ERROR_NOMEMORY, "GCAMsoaAlloc(%d, %d, %d): could not allocate",
+              gcam->width, gcam->height, gcam->depth) ;
+  soa->vy = soa->vx + nnodes ;
+  soa->vz = soa->vy + nnodes ;
+  gcam->soa = soa ;
+  return(soa) ;
+}
+
+/*!
+  \fn int GCAMsoaFree(GCAM_SOA **psoa)
+  \brief Frees a structure-of-arrays node store
+*/
+int
+GCAMsoaFree(GCAM_SOA **psoa)
+{
+  GCAM_SOA *soa = *psoa ;
+
+  *psoa = NULL ;
+  if (soa == NULL)
+  {
+    return(NO_ERROR) ;
+  }
+  free(soa->vx) ;
+  free(soa->invalid) ;
+  free(soa) ;
+  return(NO_ERROR) ;
+}
+
+/*!
+  \fn int GCAMsoaLoad(GCA_MORPH *gcam)
+  \brief Gathers the node displacements and invalid flags into the
+  structure-of-arrays store.
+*/
+int
+GCAMsoaLoad(GCA_MORPH *gcam)
+{
+  GCAM_SOA *soa ;
+  int      x ;
+
+  soa = GCAMsoaAlloc(gcam) ;
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for
+#endif
+  for (x = 0 ; x < gcam->width ; x++)
+  {
+    int   y, z ;
+    size_t i ;
+    const GCA_MORPH_NODE *gcamn ;
+
+    for (y = 0 ; y < gcam->height ; y++)
+    {
+      i = GCAM_SOA_INDEX(soa, x, y, 0) ;
+      for (z = 0 ; z < gcam->depth ; z++, i++)
+      {
+        gcamn = &gcam->nodes[x][y][z] ;
+        soa->vx[i] = gcamn->x - gcamn->origx ;
+        soa->vy[i] = gcamn->y - gcamn->origy ;
+        soa->vz[i] = gcamn->z - gcamn->origz ;
+        soa->invalid[i] = gcamn->invalid ;
+      }
+    }
+  }
+  return(NO_ERROR) ;
+}
+
+/*
+  gcamSoaNeighborLines() - index of node (xn, yn, 0) for the 3x3
+  neighboring z-lines of node line (x, y), clamped at the borders, in
+  the xk-major, yk-minor order of the neighborhood loops.
+*/
+static void
+gcamSoaNeighborLines(const GCAM_SOA *soa, int x, int y, size_t *lines)
+{
+  int xk, yk, xn, yn, n ;
+
+  for (n = 0, xk = -1 ; xk <= 1 ; xk++)
+  {
+    xn = MIN(soa->width-1, MAX(0, x+xk)) ;
+    for (yk = -1 ; yk <= 1 ; yk++, n++)
+    {
+      yn = MIN(soa->height-1, MAX(0, y+yk)) ;
+      lines[n] = GCAM_SOA_INDEX(soa, xn, yn, 0) ;
+    }
+  }
+}
+
 
 /*
   Note:  d [ I(r)' C I(r), r] = delI * C * I(r)
@@ -2123,7 +2244,7 @@ gcamLogLikelihoodTerm( GCA_MORPH *gcam,
   }
 
 #ifdef HAVE_OPENMP
-  #pragma omp parallel for firstprivate(tid,y,z,gcamn,n,norm,dx,dy,dz,vals,m_delI,m_inv_cov,v_means,v_grad) shared(gcam,mri,Gx,Gy,Gz,Gvx,Gvy,Gvz) schedule(static,1)
+  #pragma omp parallel for firstprivate(tid,y,z,gcamn,n,norm,dx,dy,dz,vals,m_delI,m_inv_cov,v_means,v_grad) shared(gcam,mri,Gx,Gy,Gz,Gvx,Gvy,Gvz) schedule(dynamic,1)
 #endif
 
   for (x = 0 ; x < gcam->width ; x++)
@@ -2426,12 +2547,12 @@ gcamLogLikelihoodEnergy( const GCA_MORPH *gcam, MRI *mri)
   double sse = 0.0;
 
 #ifndef GCAM_LLENERGY_GPU
-  double error=0.0 ;
-  int x=0, y=0, z=0;
+  double *line_sse ;
+  int xy ;
 #endif
 
 #if DEBUG_LL_SSE
-  int max_x, max_y, max_z ;
+  int max_x, max_y, max_z, x, y ;
   max_x = max_y = max_z = 0 ;
 #endif
 
@@ -2468,110 +2589,125 @@ gcamLogLikelihoodEnergy( const GCA_MORPH *gcam, MRI *mri)
 #if SHOW_EXEC_LOC
   printf( "%s: CPU call\n", __FUNCTION__ );
 #endif
+  // each z-line of nodes sums its own sse and the lines are added up
+  // in order afterwards, as in gcamSmoothnessEnergy()
+  line_sse = (double *)calloc((size_t)gcam->width*gcam->height,
+                              sizeof(double)) ;
+  if (line_sse == NULL)
+    ErrorExit(ERROR_NOMEMORY, "gcamLogLikelihoodEnergy: could not allocate "
+              "%d line sums", gcam->width*gcam->height) ;
+
 #ifdef HAVE_OPENMP
-  #pragma omp parallel for reduction (+:sse) firstprivate(y,z,error) shared(gcam,mri) schedule(static,1)
+  #pragma omp parallel for shared(gcam,mri,line_sse) schedule(dynamic,16)
 #endif
-  for (x = 0 ; x < gcam->width ; x++)
+  for (xy = 0 ; xy < gcam->width*gcam->height ; xy++)
   {
-    for (y = 0 ; y < gcam->height ; y++)
+    int    x, y, z ;
+    double error ;
+    float  vals[MAX_GCA_INPUTS] ;
+
+    x = xy / gcam->height ;
+    y = xy % gcam->height ;
+    for (z = 0 ; z < gcam->depth ; z++)
     {
-      float vals[MAX_GCA_INPUTS];
-      for (z = 0 ; z < gcam->depth ; z++)
-      {
 
-        // Debugging breakpoint
-        if (x == Gx && y == Gy && z == Gz)
-        {
-          DiagBreak();
-        }
+      // Debugging breakpoint
+      if (x == Gx && y == Gy && z == Gz)
+      {
+        DiagBreak();
+      }
 
-        // Shorthand way of accessing current node
-        const GCA_MORPH_NODE* /* const */ gcamn = &gcam->nodes[x][y][z] ;
+      // Shorthand way of accessing current node
+      const GCA_MORPH_NODE* /* const */ gcamn = &gcam->nodes[x][y][z] ;
 
-        // Don't operate on invalid nodes
-        if (gcamn->invalid == GCAM_POSITION_INVALID)
-        {
-          continue;
-        }
-        check_gcam(gcam) ;
+      // Don't operate on invalid nodes
+      if (gcamn->invalid == GCAM_POSITION_INVALID)
+      {
+        continue;
+      }
+      check_gcam(gcam) ;
 
-        // Check for ignore
-        if ( gcamn->status &
-             (GCAM_IGNORE_LIKELIHOOD|GCAM_NEVER_USE_LIKELIHOOD) )
-        {
-          continue ;
-        }
+      // Check for ignore
+      if ( gcamn->status &
+           (GCAM_IGNORE_LIKELIHOOD|GCAM_NEVER_USE_LIKELIHOOD) )
+      {
+        continue ;
+      }
 
-        /* don't use unkown nodes unless they border
-           something that's not unknown */
-        if (IS_UNKNOWN(gcamn->label) &&
-            (different_neighbor_labels(gcam, x,y,z,1) == 0) )
-        {
+      /* don't use unkown nodes unless they border
+         something that's not unknown */
+      if (IS_UNKNOWN(gcamn->label) &&
+          (different_neighbor_labels(gcam, x,y,z,1) == 0) )
+      {
 
-          continue ;
-        }
+        continue ;
+      }
 
-        check_gcam(gcam) ;
+      check_gcam(gcam) ;
 
-        // Load up the MRI values (which will do trilinear interpolation)
-        load_vals(mri, gcamn->x, gcamn->y, gcamn->z, vals, gcam->ninputs);
-        check_gcam(gcam);
+      // Load up the MRI values (which will do trilinear interpolation)
+      load_vals(mri, gcamn->x, gcamn->y, gcamn->z, vals, gcam->ninputs);
+      check_gcam(gcam);
 
-        // Compute 'error' for this node
-        if( gcamn->gc )
-        {
-          error = GCAmahDist(gcamn->gc, vals, gcam->ninputs)
-                  + log(covariance_determinant(gcamn->gc, gcam->ninputs));
-        }
-        else
+      // Compute 'error' for this node
+      if( gcamn->gc )
+      {
+        error = GCAmahDist(gcamn->gc, vals, gcam->ninputs)
+                + log(covariance_determinant(gcamn->gc, gcam->ninputs));
+      }
+      else
+      {
+        int n ;
+        // Note that the for loop sets error=0 on the first iteration
+        for (n = 0, error = 0.0 ; n < gcam->ninputs ; n++)
         {
-          int n ;
-          // Note that the for loop sets error=0 on the first iteration
-          for (n = 0, error = 0.0 ; n < gcam->ninputs ; n++)
-          {
-            error += (vals[n]*vals[n]/MIN_VAR) ;
-          }
+          error += (vals[n]*vals[n]/MIN_VAR) ;
         }
+      }
 
-        check_gcam(gcam) ;
+      check_gcam(gcam) ;
 
-        // Random output
-        if (x == Gx && y == Gy && z == Gz)
-          printf("E_like: node(%d,%d,%d) -> "
-                 "(%2.1f,%2.1f,%2.1f), target=%2.1f+-%2.1f, val=%2.1f\n",
-                 x, y, z, gcamn->x, gcamn->y, gcamn->z,
-                 gcamn->gc ? gcamn->gc->means[0] : 0.0,
-                 gcamn->gc ? sqrt(covariance_determinant
-                                  (gcamn->gc, gcam->ninputs)) : 0.0, vals[0]) ;
-
-        check_gcam(gcam) ;
+      // Random output
+      if (x == Gx && y == Gy && z == Gz)
+        printf("E_like: node(%d,%d,%d) -> "
+               "(%2.1f,%2.1f,%2.1f), target=%2.1f+-%2.1f, val=%2.1f\n",
+               x, y, z, gcamn->x, gcamn->y, gcamn->z,
+               gcamn->gc ? gcamn->gc->means[0] : 0.0,
+               gcamn->gc ? sqrt(covariance_determinant
+                                (gcamn->gc, gcam->ninputs)) : 0.0, vals[0]) ;
+
+      check_gcam(gcam) ;
 #if DEBUG_LL_SSE
-        if (last_sse[x][y][z] < (.9*error) && !FZERO(last_sse[x][y][z]))
+      if (last_sse[x][y][z] < (.9*error) && !FZERO(last_sse[x][y][z]))
+      {
+        DiagBreak() ;
+        increase = error - last_sse[x][y][z] ;
+        if (increase > max_increase)
         {
-          DiagBreak() ;
-          increase = error - last_sse[x][y][z] ;
-          if (increase > max_increase)
-          {
-            max_increase = increase ;
-            max_x = x ;
-            max_y = y ;
-            max_z = z ;
-          }
+          max_increase = increase ;
+          max_x = x ;
+          max_y = y ;
+          max_z = z ;
         }
-        last_sse[x][y][z] = (error) ;
+      }
+      last_sse[x][y][z] = (error) ;
 #endif
 
-        // Accumulate onto main variable
-        sse += (error) ;
+      // Accumulate onto this line's sum
+      line_sse[xy] += (error) ;
 
-        // Enable debugging breakpoint if not finite
-        if (!finitep(sse))
-        {
-          DiagBreak() ;
-        }
+      // Enable debugging breakpoint if not finite
+      if (!finitep(line_sse[xy]))
+      {
+        DiagBreak() ;
       }
     }
   }
+  for (xy = 0 ; xy < gcam->width*gcam->height ; xy++)
+  {
+    sse += line_sse[xy] ;
+  }
+  free(line_sse) ;
 #endif
 
 #if DEBUG_LL_SSE
@@ -2935,7 +3071,7 @@ gcamJacobianTerm(GCA_MORPH *gcam, const MRI *mri,
     }
 
 #ifdef HAVE_OPENMP
-  #pragma omp parallel for firstprivate(j,k,gcamn,dx,dy,dz,norm) shared(gcam,mri,l_jacobian,Gx,Gy,Gz,max_norm)  schedule(static,1)
+  #pragma omp parallel for firstprivate(j,k,gcamn,dx,dy,dz,norm) shared(gcam,mri,l_jacobian,Gx,Gy,Gz,max_norm)  schedule(dynamic,1)
 #endif
   for (i = 0 ; i < gcam->width ; i++)
   {
@@ -4447,102 +4583,116 @@ gcamJacobianEnergy( const GCA_MORPH *gcam, MRI *mri)
 #if SHOW_EXEC_LOC
   printf( "%s: CPU call\n", __FUNCTION__ );
 #endif
-  double          delta=0.0, ratio=0.0, exponent=0.0, thick ;
-  int             i=0, j=0, k=0, width, height, depth ;
-  GCA_MORPH_NODE *gcamn=NULL ;
+  double          thick, *line_sse ;
+  int             ij, width, height, depth ;
 
   thick = mri ? mri->thick : 1.0 ;
   width = gcam->width ;
   height = gcam->height ;
   depth = gcam->depth ;
 
+  // each k-line of nodes sums its own sse and the lines are added up
+  // in order afterwards, as in gcamSmoothnessEnergy()
+  line_sse = (double *)calloc((size_t)width*height, sizeof(double)) ;
+  if (line_sse == NULL)
+    ErrorExit(ERROR_NOMEMORY, "gcamJacobianEnergy: could not allocate "
+              "%d line sums", width*height) ;
+
   // Note sse initialised to zero here
   sse = 0.0f;
 #ifdef HAVE_OPENMP
-  #pragma omp parallel for firstprivate(j,k,gcamn,ratio,exponent,delta) shared(width,height,depth,gcam) reduction(+:sse) schedule(static,1)
+  #pragma omp parallel for shared(width,height,depth,gcam,line_sse) schedule(dynamic,16)
 #endif
-  for (i = 0 ; i < width ; i++)
+  for (ij = 0 ; ij < width*height ; ij++)
   {
-    for (j = 0 ; j < height ; j++)
+    int            i, j, k ;
+    double         delta, ratio, exponent ;
+    const GCA_MORPH_NODE *gcamn ;
+
+    i = ij / height ;
+    j = ij % height ;
+    for (k = 0 ; k < depth ; k++)
     {
-      for (k = 0 ; k < depth ; k++)
+      gcamn = &gcam->nodes[i][j][k] ;
+
+      if (gcamn->invalid)
       {
-        gcamn = &gcam->nodes[i][j][k] ;
+        continue;
+      }
 
-        if (gcamn->invalid)
+      /* scale up the area coefficient if the area of the current node is
+        close to 0 or already negative */
+      if (!FZERO(gcamn->orig_area1))
+      {
+        ratio = gcamn->area1 / gcamn->orig_area1 ;
+        exponent = -gcam->exp_k*ratio ;
+        if (exponent > MAX_EXP)
         {
-          continue;
+          delta = 0.0 ;
         }
-
-        /* scale up the area coefficient if the area of the current node is
-          close to 0 or already negative */
-        if (!FZERO(gcamn->orig_area1))
+        else
         {
-          ratio = gcamn->area1 / gcamn->orig_area1 ;
-          exponent = -gcam->exp_k*ratio ;
-          if (exponent > MAX_EXP)
-          {
-            delta = 0.0 ;
-          }
-          else
-          {
-            delta = log(1+exp(exponent)) /*   / gcam->exp_k */ ;
-          }
+          delta = log(1+exp(exponent)) /*   / gcam->exp_k */ ;
+        }
 
-          sse += delta * thick ;
+        line_sse[ij] += delta * thick ;
 
-          if (!finitep(delta) || !finitep(sse))
-          {
-            DiagBreak() ;
-          }
-
-          if (i == Gx && j == Gy && k == Gz)
-          {
-            printf("E_jaco: node(%d,%d,%d): area1=%2.4f, error=%2.3f\n",
-                   i, j, k, gcamn->area1,delta);
-          }
+        if (!finitep(delta) || !finitep(line_sse[ij]))
+        {
+          DiagBreak() ;
+        }
 
-          if (!FZERO(delta))
-          {
-            DiagBreak() ;
-          }
+        if (i == Gx && j == Gy && k == Gz)
+        {
+          printf("E_jaco: node(%d,%d,%d): area1=%2.4f, error=%2.3f\n",
+                 i, j, k, gcamn->area1,delta);
         }
 
-        if (!FZERO(gcamn->orig_area2))
+        if (!FZERO(delta))
         {
-          ratio = gcamn->area2 / gcamn->orig_area2 ;
-          exponent = -gcam->exp_k*ratio ;
+          DiagBreak() ;
+        }
+      }
 
-          if (exponent > MAX_EXP)
-          {
-            delta = MAX_EXP ;
-          }
-          else
-          {
-            delta = log(1+exp(exponent)) /*   / gcam->exp_k */ ;
-          }
+      if (!FZERO(gcamn->orig_area2))
+      {
+        ratio = gcamn->area2 / gcamn->orig_area2 ;
+        exponent = -gcam->exp_k*ratio ;
 
-          sse += delta * thick ;
+        if (exponent > MAX_EXP)
+        {
+          delta = MAX_EXP ;
+        }
+        else
+        {
+          delta = log(1+exp(exponent)) /*   / gcam->exp_k */ ;
+        }
 
-          if (!finitep(delta) || !finitep(sse))
-          {
-            DiagBreak() ;
-          }
+        line_sse[ij] += delta * thick ;
 
-          if (i == Gx && j == Gy && k == Gz)
-          {
-            printf("E_jaco: node(%d,%d,%d): area2=%2.4f, error=%2.3f\n",
-                   i, j, k, gcamn->area2,delta);
-          }
+        if (!finitep(delta) || !finitep(line_sse[ij]))
+        {
+          DiagBreak() ;
+        }
 
-          if (!FZERO(delta))
-          {
-            DiagBreak() ;
-          }
+        if (i == Gx && j == Gy && k == Gz)
+        {
+          printf("E_jaco: node(%d,%d,%d): area2=%2.4f, error=%2.3f\n",
+                 i, j, k, gcamn->area2,delta);
+        }
+
+        if (!FZERO(delta))
+        {
+          DiagBreak() ;
         }
       }
     }
   }
+  for (ij = 0 ; ij < width*height ; ij++)
+  {
+    sse += line_sse[ij] ;
+  }
+  free(line_sse) ;
 #endif
 
 
@@ -7260,11 +7410,8 @@ gcamSmoothnessTerm( GCA_MORPH *gcam,
   printf( "%s: On GPU\n", __FUNCTION__ );
   gcamSmoothnessTermGPU( gcam, l_smoothness );
 #else
-  double          vx=0.0, vy=0.0, vz=0.0, vnx=0.0, vny=0.0, vnz=0.0;
-  double          dx=0.0, dy=0.0, dz=0.0 ;
-  int             x=0, y=0, z=0, xk=0, yk=0, zk=0, xn=0, yn=0, zn=0 ;
-  int             width, height, depth, num=0 ;
-  GCA_MORPH_NODE  *gcamn=NULL, *gcamn_nbr=NULL ;
+  const GCAM_SOA  *soa ;
+  int             width, height, depth, xy ;
 
   if (DZERO(l_smoothness))
   {
@@ -7273,112 +7420,89 @@ gcamSmoothnessTerm( GCA_MORPH *gcam,
   width = gcam->width ;
   height = gcam->height ;
   depth = gcam->depth ;
+
+  // read the neighbor displacements from the SoA store, one z-line of
+  // nodes at a time. The lines differ in how many valid nodes they
+  // hold, so they are handed out in small chunks.
+  GCAMsoaLoad(gcam) ;
+  soa = gcam->soa ;
 #ifdef HAVE_OPENMP
-  #pragma omp parallel for firstprivate (y,z,gcamn,vx,vy,vz,dx,dy,dz,num,xk,xn,yk,yn,zk,zn,gcamn_nbr,vnx,vny,vnz) shared(gcam,Gx,Gy,Gz) schedule(static,1)
+  #pragma omp parallel for shared(gcam,soa,Gx,Gy,Gz) schedule(dynamic,16)
 #endif
-  for (x = 0 ; x < gcam->width ; x++)
+  for (xy = 0 ; xy < width*height ; xy++)
   {
-    for (y = 0 ; y < gcam->height ; y++)
+    int            x, y, z, zk, zn, n, num ;
+    size_t         lines[9], base, i ;
+    double         vx, vy, vz, dx, dy, dz ;
+    GCA_MORPH_NODE *gcamn ;
+
+    x = xy / height ;
+    y = xy % height ;
+    gcamSoaNeighborLines(soa, x, y, lines) ;
+    base = lines[4] ;
+    for (z = 0 ; z < depth ; z++)
     {
-      for (z = 0 ; z < gcam->depth ; z++)
+      if (x == Gx && y == Gy && z == Gz)
       {
-        if (x == Gx && y == Gy && z == Gz)
-        {
-          DiagBreak() ;
-        }
-        gcamn = &gcam->nodes[x][y][z] ;
-
-        if (gcamn->invalid == GCAM_POSITION_INVALID)
-        {
-          continue;
-        }
+        DiagBreak() ;
+      }
+      if (soa->invalid[base+z] == GCAM_POSITION_INVALID)
+      {
+        continue;
+      }
 
-        vx = gcamn->x - gcamn->origx ;
-        vy = gcamn->y - gcamn->origy ;
-        vz = gcamn->z - gcamn->origz ;
-        dx = dy = dz = 0.0f ;
-        if (x == Gx && y == Gy && z == Gz)
-          printf("l_smoo: node(%d,%d,%d): V=(%2.2f,%2.2f,%2.2f)\n",
-                 x, y, z, vx, vy, vz) ;
-        num = 0 ;
+      vx = soa->vx[base+z] ;
+      vy = soa->vy[base+z] ;
+      vz = soa->vz[base+z] ;
+      dx = dy = dz = 0.0f ;
+      if (x == Gx && y == Gy && z == Gz)
+        printf("l_smoo: node(%d,%d,%d): V=(%2.2f,%2.2f,%2.2f)\n",
+               x, y, z, vx, vy, vz) ;
+      num = 0 ;
 
-        for (xk = -1 ; xk <= 1 ; xk++)
+      for (n = 0 ; n < 9 ; n++)
+      {
+        for (zk = -1 ; zk <= 1 ; zk++)
         {
-          xn = x+xk ;
-          xn = MAX(0,xn) ;
-          xn = MIN(width-1,xn) ;
-
-          for (yk = -1 ; yk <= 1 ; yk++)
+          if (!zk && n == 4)
           {
-            yn = y+yk ;
-            yn = MAX(0,yn) ;
-            yn = MIN(height-1,yn) ;
-
-            for (zk = -1 ; zk <= 1 ; zk++)
-            {
-
-              if (!zk && !yk && !xk)
-              {
-                continue ;
-              }
-
-              zn = z+zk ;
-              zn = MAX(0,zn) ;
-              zn = MIN(depth-1,zn) ;
-
-              gcamn_nbr = &gcam->nodes[xn][yn][zn] ;
-
-              if (gcamn_nbr->invalid == GCAM_POSITION_INVALID)
-              {
-                continue;
-              }
-
-#if 0
-              if (gcamn_nbr->label != gcamn->label)
-              {
-                continue ;
-              }
-#endif
-
-              vnx = gcamn_nbr->x - gcamn_nbr->origx ;
-              vny = gcamn_nbr->y - gcamn_nbr->origy ;
-              vnz = gcamn_nbr->z - gcamn_nbr->origz ;
-
-              dx += (vnx-vx) ;
-              dy += (vny-vy) ;
-              dz += (vnz-vz) ;
+            continue ;
+          }
 
-              if ((x == Gx && y == Gy && z == Gz) &&
-                  (Gdiag & DIAG_SHOW) && DIAG_VERBOSE_ON)
-              {
-                printf("\tnode(%d,%d,%d): V=(%2.2f,%2.2f,%2.2f), "
-                       "DX=(%2.2f,%2.2f,%2.2f)\n",
-                       xn, yn, zn, vnx, vny, vnz, vnx-vx, vny-vy, vnz-vz) ;
-              }
+          zn = z+zk ;
+          zn = MAX(0,zn) ;
+          zn = MIN(depth-1,zn) ;
+          i = lines[n] + zn ;
 
-              num++ ;
-            }
+          if (soa->invalid[i] == GCAM_POSITION_INVALID)
+          {
+            continue;
           }
-        }
-        /*        num = 1 ;*/
-        if (num)
-        {
-          dx = dx * l_smoothness / num ;
-          dy = dy * l_smoothness / num ;
-          dz = dz * l_smoothness / num ;
-        }
 
-        if (x == Gx && y == Gy && z == Gz)
-        {
-          printf("l_smoo: node(%d,%d,%d): DX=(%2.2f,%2.2f,%2.2f)\n",
-                 x, y, z, dx, dy, dz) ;
+          dx += (soa->vx[i]-vx) ;
+          dy += (soa->vy[i]-vy) ;
+          dz += (soa->vz[i]-vz) ;
+          num++ ;
         }
+      }
+      /*        num = 1 ;*/
+      if (num)
+      {
+        dx = dx * l_smoothness / num ;
+        dy = dy * l_smoothness / num ;
+        dz = dz * l_smoothness / num ;
+      }
 
-        gcamn->dx += dx ;
-        gcamn->dy += dy ;
-        gcamn->dz += dz ;
-
+      if (x == Gx && y == Gy && z == Gz)
+      {
+        printf("l_smoo: node(%d,%d,%d): DX=(%2.2f,%2.2f,%2.2f)\n",
+               x, y, z, dx, dy, dz) ;
       }
+
+      gcamn = &gcam->nodes[x][y][z] ;
+      gcamn->dx += dx ;
+      gcamn->dy += dy ;
+      gcamn->dz += dz ;
     }
   }
 #endif
@@ -7494,7 +7618,7 @@ gcamElasticTerm( const GCA_MORPH *gcam, GCA_MORPH_PARMS *parms )
 }
 
 double
-gcamSmoothnessEnergy( const GCA_MORPH *gcam, const MRI *mri )
+gcamSmoothnessEnergy( GCA_MORPH *gcam, const MRI *mri )
 {
   /*!
     Computes a load of derivatives (of some description).
@@ -7527,114 +7651,108 @@ gcamSmoothnessEnergy( const GCA_MORPH *gcam, const MRI *mri )
 #if SHOW_EXEC_LOC
   printf( "%s: CPU call\n", __FUNCTION__ );
 #endif
-  double vx=0, vy=0, vz=0, vnx=0, vny=0, vnz=0, error=0, node_sse=0;
-  double dx=0, dy=0, dz=0 ;
-  int x=0, y=0, z=0, xk=0, yk=0, zk=0, xn=0, yn=0, zn=0 ;
-  int width=0, height=0, depth=0, num=0 ;
-  const GCA_MORPH_NODE  *gcamn=NULL, *gcamn_nbr=NULL ;
+  const GCAM_SOA *soa ;
+  double *line_sse ;
+  int width=0, height=0, depth=0, xy ;
 
   width = gcam->width ;
   height = gcam->height ;
   depth = gcam->depth ;
 
+  // gather the node displacements into the morph's SoA store
+  GCAMsoaLoad(gcam) ;
+  soa = gcam->soa ;
+
+  // each z-line of nodes sums its own sse and the lines are added up
+  // in order afterwards, so the result does not depend on the number
+  // of threads or on how the lines were scheduled
+  line_sse = (double *)calloc((size_t)width*height, sizeof(double)) ;
+  if (line_sse == NULL)
+    ErrorExit(ERROR_NOMEMORY, "gcamSmoothnessEnergy: could not allocate "
+              "%d line sums", width*height) ;
+
 #ifdef HAVE_OPENMP
-  #pragma omp parallel for firstprivate(y,z,vx,vy,vz,vnx,vny,vnz,error,node_sse,dx,dy,dz,xk,yk,zk,xn,yn,zn,num,gcamn,gcamn_nbr) reduction(+:sse) shared(gcam,Gx,Gy,Gz) schedule(static,1)
+  #pragma omp parallel for shared(gcam,soa,line_sse,Gx,Gy,Gz) schedule(dynamic,16)
 #endif
-  // Loop over all voxels
-  for (x = 0 ; x < gcam->width ; x++ )
+  for (xy = 0 ; xy < width*height ; xy++)
   {
-    for (y = 0 ; y < gcam->height ; y++ )
+    int    x, y, z, zk, zn, n, num ;
+    size_t lines[9], base, i ;
+    double vx, vy, vz, dx, dy, dz, error, node_sse ;
+
+    x = xy / height ;
+    y = xy % height ;
+    gcamSoaNeighborLines(soa, x, y, lines) ;
+    base = lines[4] ;
+    for (z = 0 ; z < depth ; z++)
     {
-      for (z = 0 ; z < gcam->depth ; z++ )
+      if (x == Gx && y == Gy && z == Gz)
       {
+        DiagBreak() ;
+      }
 
-        if (x == Gx && y == Gy && z == Gz)
-        {
-          DiagBreak() ;
-        }
-
-        gcamn = &gcam->nodes[x][y][z] ;
-
-        if (gcamn->invalid == GCAM_POSITION_INVALID)
-        {
-          continue;
-        }
+      if (soa->invalid[base+z] == GCAM_POSITION_INVALID)
+      {
+        continue;
+      }
 
-        // Compute differences from original
-        vx = gcamn->x - gcamn->origx ;
-        vy = gcamn->y - gcamn->origy ;
-        vz = gcamn->z - gcamn->origz ;
-        num = 0 ;
-        node_sse = 0.0 ;
+      // Compute differences from original
+      vx = soa->vx[base+z] ;
+      vy = soa->vy[base+z] ;
+      vz = soa->vz[base+z] ;
+      num = 0 ;
+      node_sse = 0.0 ;
 
-        // Loop over 3^3 voxels centred on current
-        for (xk = -1 ; xk <= 1 ; xk++)
+      // Loop over 3^3 voxels centred on current, except itself
+      for (n = 0 ; n < 9 ; n++)
+      {
+        for (zk = -1 ; zk <= 1 ; zk++)
         {
-          xn = x+xk ;
-          xn = MAX(0,xn) ;
-          xn = MIN(width-1,xn) ;
-
-          for (yk = -1 ; yk <= 1 ; yk++)
+          if (!zk && n == 4)
           {
-            yn = y+yk ;
-            yn = MAX(0,yn) ;
-            yn = MIN(height-1,yn) ;
-
-            for (zk = -1 ; zk <= 1 ; zk++)
-            {
-
-              // Don't use self
-              if (!xk && !yk && !zk)
-              {
-                continue ;
-              }
-
-              zn = z+zk ;
-              zn = MAX(0,zn) ;
-              zn = MIN(depth-1,zn) ;
+            continue ;
+          }
 
-              gcamn_nbr = &gcam->nodes[xn][yn][zn] ;
+          zn = z+zk ;
+          zn = MAX(0,zn) ;
+          zn = MIN(depth-1,zn) ;
+          i = lines[n] + zn ;
 
-              if (gcamn_nbr->invalid == GCAM_POSITION_INVALID)
-              {
-                continue;
-              }
-#if 0
-              if (gcamn_nbr->label != gcamn->label)
-              {
-                continue ;
-              }
-#endif
-              vnx = gcamn_nbr->x - gcamn_nbr->origx ;
-              vny = gcamn_nbr->y - gcamn_nbr->origy ;
-              vnz = gcamn_nbr->z - gcamn_nbr->origz ;
+          if (soa->invalid[i] == GCAM_POSITION_INVALID)
+          {
+            continue;
+          }
 
-              dx = vnx-vx ;
-              dy = vny-vy ;
-              dz = vnz - vz ;
+          dx = soa->vx[i]-vx ;
+          dy = soa->vy[i]-vy ;
+          dz = soa->vz[i]-vz ;
 
-              error = dx*dx + dy*dy + dz*dz ;
+          error = dx*dx + dy*dy + dz*dz ;
 
-              num++ ;
-              node_sse += error ;
-            }
-          }
+          num++ ;
+          node_sse += error ;
         }
+      }
 
-        /*        num = 1 ;*/
-        if (num > 0)
-        {
-          sse += node_sse/num ;
-        }
+      /*        num = 1 ;*/
+      if (num > 0)
+      {
+        line_sse[xy] += node_sse/num ;
+      }
 
-        if (x == Gx && y == Gy && z == Gz)
-        {
-          printf("E_smoo: node(%d,%d,%d) smoothness sse %2.3f (%d nbrs)\n",
-                 x, y, z, node_sse/num, num) ;
-        }
+      if (x == Gx && y == Gy && z == Gz)
+      {
+        printf("E_smoo: node(%d,%d,%d) smoothness sse %2.3f (%d nbrs)\n",
+               x, y, z, node_sse/num, num) ;
       }
     }
   }
+
+  for (xy = 0 ; xy < width*height ; xy++)
+  {
+    sse += line_sse[xy] ;
+  }
+  free(line_sse) ;
 #endif
 
   return(sse) ;
@@ -10803,7 +10921,7 @@ gcamMapTerm(GCA_MORPH *gcam, MRI *mri, MRI *mri_smooth, double l_map)
 {
   int             x=0, y=0, z=0, n=0, i=0 ;
   int     xn[_MAX_FS_THREADS], yn[_MAX_FS_THREADS], zn[_MAX_FS_THREADS];
-  int             tid;
+  int             nthreads=1, tid=0;
   double          node_prob=0.0, prob=0.0, dx=0.0, dy=0.0, dz=0.0, norm=0.0 ;
   float           vals[_MAX_FS_THREADS][MAX_GCA_INPUTS] ;
   GCA_MORPH_NODE  *gcamn=NULL ;
@@ -10817,26 +10935,38 @@ gcamMapTerm(GCA_MORPH *gcam, MRI *mri, MRI *mri_smooth, double l_map)
   {
     return(0) ;
   }
-  // 3 x ninputs
 #ifdef HAVE_OPENMP
   #pragma omp parallel
-  tid = omp_get_thread_num();
+  {
+    nthreads = omp_get_num_threads();
+  }
 #else
-  tid = 0;
+  nthreads = 1;
 #endif
 
-  m_delI[tid] = MatrixAlloc(3, gcam->ninputs, MATRIX_REAL) ;
-  // ninputs x ninputs
-  m_inv_cov[tid] = MatrixAlloc(gcam->ninputs, gcam->ninputs, MATRIX_REAL) ;
-  // ninputs x 1
-  v_means[tid] = VectorAlloc(gcam->ninputs, 1) ;
-  // 3 x 1
-  v_grad[tid] = VectorAlloc(3, MATRIX_REAL) ;
+  // each thread has its own work matrices
+  for (i=0; i<nthreads; i++)
+  {
+    // 3 x ninputs
+    m_delI[i] = MatrixAlloc(3, gcam->ninputs, MATRIX_REAL) ;
+    // ninputs x ninputs
+    m_inv_cov[i] = MatrixAlloc(gcam->ninputs, gcam->ninputs, MATRIX_REAL) ;
+    // ninputs x 1
+    v_means[i] = VectorAlloc(gcam->ninputs, 1) ;
+    // 3 x 1
+    v_grad[i] = VectorAlloc(3, MATRIX_REAL) ;
+  }
 
 #ifdef HAVE_OPENMP
-  #pragma omp parallel for firstprivate(tid,i,y,z,gcamn,gcan,gcap,n,norm,dx,dy,dz,gc,node_prob,prob) shared (gcam,Gx,Gy,Gz,mri_smooth,l_map) schedule(static,1)
+  #pragma omp parallel for firstprivate(tid,i,y,z,gcamn,gcan,gcap,n,norm,dx,dy,dz,gc,node_prob,prob) shared (gcam,Gx,Gy,Gz,mri_smooth,l_map) schedule(dynamic,1)
 #endif
   for (x = 0 ; x < gcam->width ; x++)
+  {
+#ifdef HAVE_OPENMP
+    tid = omp_get_thread_num();
+#else
+    tid = 0;
+#endif
     for (y = 0 ; y < gcam->height ; y++)
       for (z = 0 ; z < gcam->depth ; z++)
       {
@@ -10942,11 +11072,15 @@ gcamMapTerm(GCA_MORPH *gcam, MRI *mri, MRI *mri_smooth, double l_map)
           gcamn->dz += l_map * dz ;
         } //!GCA
       }
+  }
 
-  MatrixFree(&m_delI[tid]) ;
-  MatrixFree(&m_inv_cov[tid]) ;
-  VectorFree(&v_means[tid]) ;
-  VectorFree(&v_grad[tid]) ;
+  for (i=0; i<nthreads; i++)
+  {
+    MatrixFree(&m_delI[i]) ;
+    MatrixFree(&m_inv_cov[i]) ;
+    VectorFree(&v_means[i]) ;
+    VectorFree(&v_grad[i]) ;
+  }
   return(NO_ERROR) ;
 }
 
@@ -644,6 +644,7 @@ int GTMfree(GTM **pGTM)
   //MRIfree(&gtm->gtmseg);
   MRIfree(&gtm->mask);
   MatrixFree(&gtm->X);
+  GTMsparseFree(&gtm->Xsp);
   MatrixFree(&gtm->y);
   MatrixFree(&gtm->XtX);
   MatrixFree(&gtm->iXtX);
@@ -754,7 +755,9 @@ int GTMnPad(GTM *gtm)
   \brief Solves the GTM using a GLM. X must already have been created.
   Computes Xt, XtX, iXtX, beta, yhat, res, dof, rvar, kurtosis, and skew.
   Also will rescale if rescaling. Returns 1 and computes condition
-  number if matrix cannot be inverted. Otherwise returns 0.
+  number if matrix cannot be inverted. Otherwise returns 0. The
+  products with X are computed from the sparse copy (gtm->Xsp), so
+  the dense X does not need to exist (eg, when optimizing). 
 */
 int GTMsolve(GTM *gtm)
 {
@@ -762,14 +765,14 @@ int GTMsolve(GTM *gtm)
   int n,f;
   double sum;
 
-  if(gtm->X == NULL){
+  if(gtm->Xsp == NULL){
     printf("ERROR: GTMsolve(): must build design matrix first\n");
     exit(1);
   }
 
   if(! gtm->Optimizing) printf("Computing  XtX ... ");fflush(stdout);
   TimerStart(&timer);
-  gtm->XtX = MatrixMtM(gtm->X,gtm->XtX);
+  gtm->XtX = GTMsparseMtM(gtm->Xsp,gtm->XtX);
   if(! gtm->Optimizing) printf(" %4.1f sec\n",TimerStop(&timer)/1000.0);fflush(stdout);
 
   gtm->iXtX = MatrixInverse(gtm->XtX,gtm->iXtX);
@@ -779,15 +782,15 @@ int GTMsolve(GTM *gtm)
     printf("ERROR: matrix cannot be inverted, cond=%g\n",gtm->XtXcond);
     return(1);
   }
-  gtm->Xty  = MatrixAtB(gtm->X,gtm->y,gtm->Xty);
+  gtm->Xty  = GTMsparseAtB(gtm->Xsp,gtm->y,gtm->Xty);
   gtm->beta = MatrixMultiplyD(gtm->iXtX,gtm->Xty,gtm->beta);
   if(gtm->rescale) GTMrescale(gtm);
   GTMrefTAC(gtm);
   if(gtm->DoSteadyState) GTMsteadyState(gtm);
 
-  gtm->yhat = MatrixMultiplyD(gtm->X,gtm->beta,gtm->yhat);
+  gtm->yhat = GTMsparseMultiply(gtm->Xsp,gtm->beta,gtm->yhat);
   gtm->res  = MatrixSubtract(gtm->y,gtm->yhat,gtm->res);
-  gtm->dof = gtm->X->rows - gtm->X->cols;
+  gtm->dof = gtm->Xsp->rows - gtm->Xsp->cols;
   if(gtm->rvar==NULL) gtm->rvar = MatrixAlloc(1,gtm->res->cols,MATRIX_REAL);
   if(gtm->rvarUnscaled==NULL) gtm->rvarUnscaled = MatrixAlloc(1,gtm->res->cols,MATRIX_REAL);
   for(f=0; f < gtm->res->cols; f++){
@@ -802,6 +805,202 @@ int GTMsolve(GTM *gtm)
 
   return(0);
 }
+/*------------------------------------------------------------------*/
+/*
+  \fn GTMSPARSE *GTMsparseAlloc(int rows, int cols)
+  \brief Allocates a column-sparse matrix with no nonzero values.
+  Space for the values of each column is allocated when the column
+  is filled (see GTMbuildX()).
+*/
+GTMSPARSE *GTMsparseAlloc(int rows, int cols)
+{
+  GTMSPARSE *sp;
+  sp = (GTMSPARSE *) calloc(sizeof(GTMSPARSE),1);
+  sp->rows   = rows;
+  sp->cols   = cols;
+  sp->nnz    = (int *)    calloc(sizeof(int),cols);
+  sp->nalloc = (int *)    calloc(sizeof(int),cols);
+  sp->row    = (int **)   calloc(sizeof(int *),cols);
+  sp->val    = (float **) calloc(sizeof(float *),cols);
+  return(sp);
+}
+/*------------------------------------------------------------------*/
+/*
+  \fn int GTMsparseFree(GTMSPARSE **psp)
+  \brief Frees a column-sparse matrix. OK if *psp is NULL.
+*/
+int GTMsparseFree(GTMSPARSE **psp)
+{
+  GTMSPARSE *sp = *psp;
+  int j;
+  if(sp == NULL) return(0);
+  for(j=0; j < sp->cols; j++){
+    if(sp->row[j]) free(sp->row[j]);
+    if(sp->val[j]) free(sp->val[j]);
+  }
+  free(sp->row);
+  free(sp->val);
+  free(sp->nnz);
+  free(sp->nalloc);
+  free(sp);
+  *psp = NULL;
+  return(0);
+}
+/*------------------------------------------------------------------*/
+/*
+  \fn MATRIX *GTMsparseMtM(GTMSPARSE *sp, MATRIX *mout)
+  \brief Computes X'*X from the sparse columns of X. Each element of
+  the upper triangle is computed independently (in parallel) by
+  walking the rows that the two columns have in common. Columns whose
+  row ranges do not overlap (eg, segs whose bounding boxes are far
+  apart) are skipped. Products are summed in double in row order, so
+  the result is the same as MatrixMtM() on the dense X.
+*/
+MATRIX *GTMsparseMtM(GTMSPARSE *sp, MATRIX *mout)
+{
+  int n, ntot, c1, c2, *c1list, *c2list;
+
+  if(mout == NULL) mout = MatrixAlloc(sp->cols,sp->cols,MATRIX_REAL);
+  if(mout->rows != sp->cols || mout->cols != sp->cols){
+    printf("ERROR: GTMsparseMtM() mout is %d x %d, expected %d x %d\n",
+	   mout->rows,mout->cols,sp->cols,sp->cols);
+    return(NULL);
+  }
+
+  // list of the elements of the upper triangle for load balancing
+  ntot = ((sp->cols*sp->cols)+sp->cols)/2;
+  c1list = (int*)calloc(sizeof(int),ntot);
+  c2list = (int*)calloc(sizeof(int),ntot);
+  n = 0;
+  for(c1=0; c1 < sp->cols; c1++){
+    for(c2=c1; c2 < sp->cols; c2++){
+      c1list[n] = c1;
+      c2list[n] = c2;
+      n++;
+    }
+  }
+
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic,64)
+  #endif
+  for(n=0; n < ntot; n++){
+    int c1, c2, n1, n2, i1, i2, *r1, *r2;
+    float *v1, *v2;
+    double v;
+    c1 = c1list[n];
+    c2 = c2list[n];
+    n1 = sp->nnz[c1];
+    n2 = sp->nnz[c2];
+    r1 = sp->row[c1];
+    r2 = sp->row[c2];
+    v1 = sp->val[c1];
+    v2 = sp->val[c2];
+    v = 0;
+    if(n1 > 0 && n2 > 0 && r1[0] <= r2[n2-1] && r2[0] <= r1[n1-1]){
+      i1 = 0;
+      i2 = 0;
+      while(i1 < n1 && i2 < n2){
+	if(r1[i1] < r2[i2])      i1++;
+	else if(r1[i1] > r2[i2]) i2++;
+	else {
+	  v += (double)v1[i1]*v2[i2];
+	  i1++;
+	  i2++;
+	}
+      }
+    }
+    mout->rptr[c1+1][c2+1] = v;
+    mout->rptr[c2+1][c1+1] = v;
+  }
+
+  free(c1list);
+  free(c2list);
+  return(mout);
+}
+/*------------------------------------------------------------------*/
+/*
+  \fn MATRIX *GTMsparseAtB(GTMSPARSE *sp, MATRIX *B, MATRIX *mout)
+  \brief Computes X'*B from the sparse columns of X, one column of X
+  per thread. Same result as MatrixAtB() on the dense X.
+*/
+MATRIX *GTMsparseAtB(GTMSPARSE *sp, MATRIX *B, MATRIX *mout)
+{
+  int colA;
+
+  if(sp->rows != B->rows){
+    printf("ERROR: GTMsparseAtB(): dim mismatch: %d %d\n",sp->rows,B->rows);
+    return(NULL);
+  }
+  if(mout == NULL){
+    mout = MatrixAlloc(sp->cols,B->cols,MATRIX_REAL);
+    if(mout == NULL){
+      printf("ERROR: GTMsparseAtB(): could not alloc %d %d\n",sp->cols,B->cols);
+      return(NULL);
+    }
+  }
+
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic,1)
+  #endif
+  for(colA=0; colA < sp->cols; colA++){
+    int i, colB;
+    double sum;
+    for(colB=0; colB < B->cols; colB++){
+      sum = 0;
+      for(i=0; i < sp->nnz[colA]; i++)
+	sum += (double)sp->val[colA][i]*B->rptr[sp->row[colA][i]+1][colB+1];
+      mout->rptr[colA+1][colB+1] = sum;
+    }
+  }
+  return(mout);
+}
+/*------------------------------------------------------------------*/
+/*
+  \fn MATRIX *GTMsparseMultiply(GTMSPARSE *sp, MATRIX *B, MATRIX *mout)
+  \brief Computes X*B from the sparse columns of X. Each column of X
+  is scattered into a double accumulator in column order, which sums
+  each element in the same order as MatrixMultiplyD() on the dense X
+  with the native backend (not CBLAS, see MatrixSetBackend()).
+  The columns of B are done in parallel.
+*/
+MATRIX *GTMsparseMultiply(GTMSPARSE *sp, MATRIX *B, MATRIX *mout)
+{
+  int colB;
+
+  if(sp->cols != B->rows){
+    printf("ERROR: GTMsparseMultiply(): dim mismatch: %d %d\n",sp->cols,B->rows);
+    return(NULL);
+  }
+  if(mout == NULL){
+    mout = MatrixAlloc(sp->rows,B->cols,MATRIX_REAL);
+    if(mout == NULL){
+      printf("ERROR: GTMsparseMultiply(): could not alloc %d %d\n",sp->rows,B->cols);
+      return(NULL);
+    }
+  }
+  if(mout->rows != sp->rows || mout->cols != B->cols){
+    printf("ERROR: GTMsparseMultiply(): mout is %d x %d, expected %d x %d\n",
+	   mout->rows,mout->cols,sp->rows,B->cols);
+    return(NULL);
+  }
+
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic,1)
+  #endif
+  for(colB=0; colB < B->cols; colB++){
+    int j, i, r;
+    double b, *acc;
+    acc = (double *) calloc(sizeof(double),sp->rows);
+    for(j=0; j < sp->cols; j++){
+      b = B->rptr[j+1][colB+1];
+      for(i=0; i < sp->nnz[j]; i++)
+	acc[sp->row[j][i]] += (double)sp->val[j][i]*b;
+    }
+    for(r=0; r < sp->rows; r++) mout->rptr[r+1][colB+1] = acc[r];
+    free(acc);
+  }
+  return(mout);
+}
 /*-----------------------------------------------------------------*/
 /*
   \fn MRI *GTMmat2vol(GTM *gtm, MATRIX *m, MRI *vol)
@@ -1627,14 +1826,22 @@ int GTMcheckX(MATRIX *X)
 /*
   \fn int GTMbuildX(GTM *gtm)
   \brief Builds the GTM design matrix both with (X) and without (X0) PSF.  If 
-  gtm->DoVoxFracCor=1 then corrects for volume fraction effect.
+  gtm->DoVoxFracCor=1 then corrects for volume fraction effect. X is
+  also stored column-sparse in gtm->Xsp, which is what GTMsolve() uses.
+  When optimizing, only Xsp is built; the dense X and X0 (nmask x nsegs)
+  are only needed by the analyses done after the solve.
 */
 int GTMbuildX(GTM *gtm)
 {
   int nthseg,err;
   struct timeb timer;
 
-  if(gtm->X==NULL || gtm->X->rows != gtm->nmask || gtm->X->cols != gtm->nsegs){
+  if(gtm->Xsp==NULL || gtm->Xsp->rows != gtm->nmask || gtm->Xsp->cols != gtm->nsegs){
+    if(gtm->Xsp) GTMsparseFree(&gtm->Xsp);
+    gtm->Xsp = GTMsparseAlloc(gtm->nmask,gtm->nsegs);
+  }
+  if(!gtm->Optimizing && 
+     (gtm->X==NULL || gtm->X->rows != gtm->nmask || gtm->X->cols != gtm->nsegs)){
     // Alloc or realloc X
     if(gtm->X) MatrixFree(&gtm->X);
     gtm->X = MatrixAlloc(gtm->nmask,gtm->nsegs,MATRIX_REAL);
@@ -1643,7 +1850,8 @@ int GTMbuildX(GTM *gtm)
       return(1);
     }
   }
-  if(gtm->X0==NULL || gtm->X0->rows != gtm->nmask || gtm->X0->cols != gtm->nsegs){
+  if(!gtm->Optimizing && 
+     (gtm->X0==NULL || gtm->X0->rows != gtm->nmask || gtm->X0->cols != gtm->nsegs)){
     if(gtm->X0) MatrixFree(&gtm->X0);
     gtm->X0 = MatrixAlloc(gtm->nmask,gtm->nsegs,MATRIX_REAL);
     if(gtm->X0 == NULL){
@@ -1651,7 +1859,7 @@ int GTMbuildX(GTM *gtm)
       return(1);
     }
   }
-  gtm->dof = gtm->X->rows - gtm->X->cols;
+  gtm->dof = gtm->nmask - gtm->nsegs;
 
   TimerStart(&timer);
 
@@ -1660,7 +1868,8 @@ int GTMbuildX(GTM *gtm)
   #pragma omp parallel for reduction(+:err)
   #endif
   for(nthseg = 0; nthseg < gtm->nsegs; nthseg++){
-    int segid,k,c,r,s;
+    int segid,k,c,r,s,nnz,nbb;
+    float val;
     MRI *nthsegpvf=NULL,*nthsegpvfbb=NULL,*nthsegpvfbbsm=NULL,*nthsegpvfbbsmmb=NULL;
     MRI_REGION *region;
     MB2D *mb;
@@ -1712,9 +1921,19 @@ int GTMbuildX(GTM *gtm)
       nthsegpvfbbsm = nthsegpvfbbsmmb;
       MB2Dfree(&mb);
     }
+    // The sparse column can have at most one value per voxel in the BB
+    nbb = region->dx*region->dy*region->dz;
+    if(gtm->Xsp->nalloc[nthseg] < nbb){
+      if(gtm->Xsp->row[nthseg]) free(gtm->Xsp->row[nthseg]);
+      if(gtm->Xsp->val[nthseg]) free(gtm->Xsp->val[nthseg]);
+      gtm->Xsp->row[nthseg] = (int *)   calloc(sizeof(int),nbb);
+      gtm->Xsp->val[nthseg] = (float *) calloc(sizeof(float),nbb);
+      gtm->Xsp->nalloc[nthseg] = nbb;
+    }
     // Fill X, creating X in this order makes it consistent with matlab
     // Note: y must be ordered in the same way. See GTMvol2mat()
     k = 0;
+    nnz = 0;
     for(s=0; s < gtm->yvol->depth; s++){
       for(c=0; c < gtm->yvol->width; c++){
 	for(r=0; r < gtm->yvol->height; r++){
@@ -1728,18 +1947,25 @@ int GTMbuildX(GTM *gtm)
 	    gtm->X0->rptr[k][nthseg+1] = 
 	      MRIgetVoxVal(nthsegpvfbb,c-region->x,r-region->y,s-region->z,0);
 
-	  gtm->X->rptr[k][nthseg+1] = 
-	    MRIgetVoxVal(nthsegpvfbbsm,c-region->x,r-region->y,s-region->z,0);
-
+	  val = MRIgetVoxVal(nthsegpvfbbsm,c-region->x,r-region->y,s-region->z,0);
+	  if(! gtm->Optimizing) gtm->X->rptr[k][nthseg+1] = val;
+	  if(val == 0) continue;
+	  gtm->Xsp->row[nthseg][nnz] = k-1; // rows are ascending
+	  gtm->Xsp->val[nthseg][nnz] = val;
+	  nnz++;
 	}
       }
     }
+    gtm->Xsp->nnz[nthseg] = nnz;
     MRIfree(&nthsegpvf);
     MRIfree(&nthsegpvfbb);
     MRIfree(&nthsegpvfbbsm);
   }
   if(! gtm->Optimizing) printf(" Build time %6.4f, err = %d\n",TimerStop(&timer)/1000.0,err);fflush(stdout);
-  if(err) gtm->X = NULL;
+  if(err) {
+    gtm->X = NULL;
+    GTMsparseFree(&gtm->Xsp);
+  }
 
   return(0);
 
@@ -25,6 +25,8 @@
 
 
 #include <stdio.h>
+#include <string.h>
+#include <stdint.h>
 
 #include "machine.h"
 
@@ -233,89 +235,71 @@ int ByteSwapBuf(void *Buf, long int nItems, int nBytesPerItem)
 /*---------------------------------------------------------
   Name: ByteSwap2()
   Reverses the byte order of each 2-byte buffer of buf2.
-  nitems is the number of 2-byte items in buf2;
+  nitems is the number of bytes in buf2. Each item is swapped
+  as a word (instead of byte by byte) so that the compiler
+  can vectorize the loop.
   ---------------------------------------------------------*/
 int ByteSwap2(void *buf2, long int nitems)
 {
-  register char *cbuf, ctmp;
-  register long int n;
+  char *cbuf;
+  uint16_t w;
+  long int n;
 
   cbuf = (char *) buf2;
   for (n=0; n < nitems ; n+=2)
   {
-    ctmp = *cbuf;
-    *cbuf = *(cbuf+1);
-    *(cbuf+1) = ctmp;
-    cbuf += 2;
+    memcpy(&w,cbuf+n,2);
+    w = (uint16_t)((w >> 8) | (w << 8));
+    memcpy(cbuf+n,&w,2);
   }
   return(0);
 }
 /*---------------------------------------------------------
   Name: ByteSwap4()
   Reverses the byte order of each 4-byte buffer of buf4.
-  nitems is the number of 4-byte items in buf4;
+  nitems is the number of bytes in buf4. See ByteSwap2().
   ---------------------------------------------------------*/
 int ByteSwap4(void *buf4, long int nitems)
 {
-  register char *cbuf, ctmp;
-  register long int n;
+  char *cbuf;
+  uint32_t w;
+  long int n;
 
   cbuf = (char *) buf4;
   for (n=0; n < nitems ; n+=4)
   {
-
-    /* swap the first and fourth */
-    ctmp = *cbuf;
-    *cbuf = *(cbuf+3);
-    *(cbuf+3) = ctmp;
-
-    /* swap the second and third */
-    ctmp = *(cbuf+1);
-    *(cbuf+1) = *(cbuf+2);
-    *(cbuf+2) = ctmp;
-
-    cbuf += 4;
+    memcpy(&w,cbuf+n,4);
+    w = (w >> 24) | ((w >> 8) & 0x0000ff00u) |
+        ((w << 8) & 0x00ff0000u) | (w << 24);
+    memcpy(cbuf+n,&w,4);
   }
-
   return(0);
 }
 /*---------------------------------------------------------
   Name: ByteSwap8()
   Reverses the byte order of each 8-byte buffer of buf8.
-  nitems is the number of 8-byte items in buf8;
+  nitems is the number of bytes in buf8. See ByteSwap2().
   ---------------------------------------------------------*/
 int ByteSwap8(void *buf8, long int nitems)
 {
-  register char *cbuf, ctmp;
-  register long int n;
+  char *cbuf;
+  uint64_t w;
+  long int n;
 
   cbuf = (char *) buf8;
   for (n=0; n < nitems ; n+=8)
   {
-
-    /* swap the first and eigth */
-    ctmp = *cbuf;
-    *cbuf = *(cbuf+7);
-    *(cbuf+7) = ctmp;
-
-    /* swap the second and seventh */
-    ctmp = *(cbuf+1);
-    *(cbuf+1) = *(cbuf+6);
-    *(cbuf+6) = ctmp;
-
-    /* swap the third and sixth */
-    ctmp = *(cbuf+2);
-    *(cbuf+2) = *(cbuf+5);
-    *(cbuf+5) = ctmp;
-
-    /* swap the fourth and fifth */
-    ctmp = *(cbuf+3);
-    *(cbuf+3) = *(cbuf+4);
-    *(cbuf+4) = ctmp;
-
-    cbuf += 8;
+    memcpy(&w,cbuf+n,8);
+    w = ((w >> 56) & 0x00000000000000ffull) |
+        ((w >> 40) & 0x000000000000ff00ull) |
+        ((w >> 24) & 0x0000000000ff0000ull) |
+        ((w >>  8) & 0x00000000ff000000ull) |
+        ((w <<  8) & 0x000000ff00000000ull) |
+        ((w << 24) & 0x0000ff0000000000ull) |
+        ((w << 40) & 0x00ff000000000000ull) |
+        ((w << 56) & 0xff00000000000000ull);
+    memcpy(cbuf+n,&w,8);
   }
-
   return(0);
 }
 
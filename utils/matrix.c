@@ -59,6 +59,12 @@
 #ifdef _OPENMP
 #include <omp.h>
 #endif
+#ifdef HAVE_CBLAS
+#include <cblas.h>
+#ifdef I
+#undef I  // some cblas.h pull in complex.h, I is used as a name below
+#endif
+#endif
 
 // private functions
 MATRIX *MatrixCalculateEigenSystemHelper( MATRIX *m,
@@ -393,6 +399,250 @@ MatrixFree(MATRIX **pmat)
 }
 
 
+/*
+  Real products with at least MATRIX_BLOCKED_MIN_MADDS multiply-adds
+  are computed with the cache-blocked, multithreaded kernels below (or
+  with CBLAS, see MatrixSetBackend()). Smaller products use the simple
+  loops, which have no threading or allocation overhead.
+*/
+#define MATRIX_BLOCKED_MIN_MADDS (64.0*64.0*64.0)
+#define MATRIX_BLOCK_ROWS   32  // rows of m1 (and m3) per task
+#define MATRIX_BLOCK_INNER 128  // rows of m2 per block
+#define MATRIX_BLOCK_COLS  256  // cols of m2 (and m3) per block
+#define MATRIX_MTM_COLS      4  // cols of the output of MtM/AtB per task
+
+static int MatrixBackend = -1;
+
+/*!
+  \fn int MatrixSetBackend(int backend)
+  \brief Selects how large real products are computed by
+  MatrixMultiply() and MatrixMultiplyD(): MATRIX_BACKEND_NATIVE uses
+  the blocked loops in this file, which give the same result as the
+  simple loops, MATRIX_BACKEND_CBLAS uses cblas_sgemm()/cblas_dgemm()
+  if FreeSurfer was configured --with-cblas. The native backend is the
+  default so results do not depend on the BLAS library; CBLAS is used
+  if selected here or if FS_MATRIX_CBLAS is set in the environment.
+  Returns the previous backend.
+*/
+int MatrixSetBackend(int backend)
+{
+  int prev = MatrixGetBackend();
+#ifdef HAVE_CBLAS
+  MatrixBackend = backend;
+#else
+  MatrixBackend = MATRIX_BACKEND_NATIVE;
+#endif
+  return(prev);
+}
+
+/*!
+  \fn int MatrixGetBackend(void)
+  \brief Returns the backend used for large real products.
+  See MatrixSetBackend().
+*/
+int MatrixGetBackend(void)
+{
+  if(MatrixBackend < 0){
+#ifdef HAVE_CBLAS
+    if(getenv("FS_MATRIX_CBLAS") != NULL) MatrixBackend = MATRIX_BACKEND_CBLAS;
+    else                                  MatrixBackend = MATRIX_BACKEND_NATIVE;
+#else
+    MatrixBackend = MATRIX_BACKEND_NATIVE;
+#endif
+  }
+  return(MatrixBackend);
+}
+
+/*
+  m3 = m1*m2 for real matrices with double accumulation. Each task
+  computes a block of rows of m3, one block of columns at a time, by
+  adding rows of m2 (in blocks that stay in cache) scaled by the
+  elements of m1 into a double accumulator. Every element is still the
+  sum of m1[r][i]*m2[i][c] over i in increasing order, so the result
+  is the same as the simple loop in MatrixMultiplyD().
+*/
+static void MatrixMultiplyBlockedD(const MATRIX *m1, const MATRIX *m2, MATRIX *m3)
+{
+  int rows = m3->rows, cols = m3->cols, inner = m1->cols, row0;
+
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic,1)
+  #endif
+  for(row0 = 1; row0 <= rows; row0 += MATRIX_BLOCK_ROWS){
+    int row1, col0, ncols, i0, i1, row, col, i;
+    double *acc, *a;
+    float v1, *r2, *r3;
+
+    row1 = MIN(row0+MATRIX_BLOCK_ROWS-1, rows);
+    acc = (double *)calloc(MATRIX_BLOCK_ROWS*MATRIX_BLOCK_COLS, sizeof(double));
+    for(col0 = 1; col0 <= cols; col0 += MATRIX_BLOCK_COLS){
+      ncols = MIN(MATRIX_BLOCK_COLS, cols-col0+1);
+      memset(acc, 0, MATRIX_BLOCK_ROWS*MATRIX_BLOCK_COLS*sizeof(double));
+      for(i0 = 1; i0 <= inner; i0 += MATRIX_BLOCK_INNER){
+        i1 = MIN(i0+MATRIX_BLOCK_INNER-1, inner);
+        for(row = row0; row <= row1; row++){
+          a = &acc[(row-row0)*MATRIX_BLOCK_COLS];
+          for(i = i0; i <= i1; i++){
+            v1 = m1->rptr[row][i];
+            r2 = &m2->rptr[i][col0];
+            for(col = 0; col < ncols; col++) a[col] += (double)v1 * r2[col];
+          }
+        }
+      }
+      for(row = row0; row <= row1; row++){
+        a = &acc[(row-row0)*MATRIX_BLOCK_COLS];
+        r3 = &m3->rptr[row][col0];
+        for(col = 0; col < ncols; col++) r3[col] = a[col];
+      }
+    }
+    free(acc);
+  }
+}
+
+/*
+  Same as MatrixMultiplyBlockedD() but accumulates in float, which
+  gives the same result as the simple loop in MatrixMultiply().
+*/
+static void MatrixMultiplyBlocked(const MATRIX *m1, const MATRIX *m2, MATRIX *m3)
+{
+  int rows = m3->rows, cols = m3->cols, inner = m1->cols, row0;
+
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic,1)
+  #endif
+  for(row0 = 1; row0 <= rows; row0 += MATRIX_BLOCK_ROWS){
+    int row1, col0, ncols, i0, i1, row, col, i;
+    float *acc, *a;
+    float v1, *r2, *r3;
+
+    row1 = MIN(row0+MATRIX_BLOCK_ROWS-1, rows);
+    acc = (float *)calloc(MATRIX_BLOCK_ROWS*MATRIX_BLOCK_COLS, sizeof(float));
+    for(col0 = 1; col0 <= cols; col0 += MATRIX_BLOCK_COLS){
+      ncols = MIN(MATRIX_BLOCK_COLS, cols-col0+1);
+      memset(acc, 0, MATRIX_BLOCK_ROWS*MATRIX_BLOCK_COLS*sizeof(float));
+      for(i0 = 1; i0 <= inner; i0 += MATRIX_BLOCK_INNER){
+        i1 = MIN(i0+MATRIX_BLOCK_INNER-1, inner);
+        for(row = row0; row <= row1; row++){
+          a = &acc[(row-row0)*MATRIX_BLOCK_COLS];
+          for(i = i0; i <= i1; i++){
+            v1 = m1->rptr[row][i];
+            r2 = &m2->rptr[i][col0];
+            for(col = 0; col < ncols; col++) a[col] += v1 * r2[col];
+          }
+        }
+      }
+      for(row = row0; row <= row1; row++){
+        a = &acc[(row-row0)*MATRIX_BLOCK_COLS];
+        r3 = &m3->rptr[row][col0];
+        for(col = 0; col < ncols; col++) r3[col] = a[col];
+      }
+    }
+    free(acc);
+  }
+}
+
+/*
+  m3 = m1*m2 for real matrices when m1 has 3 or 4 columns (3x3 and
+  4x4 transforms, and 4xN arrays of homogeneous points). The inner
+  product is unrolled but summed in the same order as the simple
+  loops. Double accumulation if dbl, otherwise float.
+*/
+static void MatrixMultiply34(const MATRIX *m1, const MATRIX *m2, MATRIX *m3, int dbl)
+{
+  int row, col, cols = m3->cols;
+  float a1, a2, a3, a4, *b1, *b2, *b3, *b4, *r3;
+
+  b1 = m2->rptr[1];
+  b2 = m2->rptr[2];
+  b3 = m2->rptr[3];
+  for(row = 1; row <= m3->rows; row++){
+    a1 = m1->rptr[row][1];
+    a2 = m1->rptr[row][2];
+    a3 = m1->rptr[row][3];
+    r3 = m3->rptr[row];
+    if(m1->cols == 3){
+      if(dbl)
+        for(col = 1; col <= cols; col++)
+          r3[col] = 0.0 + (double)a1*b1[col] + (double)a2*b2[col] + (double)a3*b3[col];
+      else
+        for(col = 1; col <= cols; col++)
+          r3[col] = 0.0f + a1*b1[col] + a2*b2[col] + a3*b3[col];
+    }
+    else {
+      a4 = m1->rptr[row][4];
+      b4 = m2->rptr[4];
+      if(dbl)
+        for(col = 1; col <= cols; col++)
+          r3[col] = 0.0 + (double)a1*b1[col] + (double)a2*b2[col] + (double)a3*b3[col]
+            + (double)a4*b4[col];
+      else
+        for(col = 1; col <= cols; col++)
+          r3[col] = 0.0f + a1*b1[col] + a2*b2[col] + a3*b3[col] + a4*b4[col];
+    }
+  }
+}
+
+#ifdef HAVE_CBLAS
+/*
+  m3 = m1*m2 for real matrices with CBLAS. MATRIX data is stored
+  row-major and contiguously (see MatrixAlloc()), so it can be passed
+  directly. With dbl the matrices are copied to double and multiplied
+  with cblas_dgemm(), otherwise cblas_sgemm() works in place.
+*/
+static void MatrixMultiplyCBLAS(const MATRIX *m1, const MATRIX *m2, MATRIX *m3, int dbl)
+{
+  int n1, n2, n3, n;
+  double *d1, *d2, *d3;
+
+  if(! dbl){
+    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
+                m3->rows, m3->cols, m1->cols, 1.0f,
+                &m1->rptr[1][1], m1->cols, &m2->rptr[1][1], m2->cols,
+                0.0f, &m3->rptr[1][1], m3->cols);
+    return;
+  }
+  n1 = m1->rows*m1->cols;
+  n2 = m2->rows*m2->cols;
+  n3 = m3->rows*m3->cols;
+  d1 = (double *)calloc(n1, sizeof(double));
+  d2 = (double *)calloc(n2, sizeof(double));
+  d3 = (double *)calloc(n3, sizeof(double));
+  for(n = 0; n < n1; n++) d1[n] = m1->rptr[1][n+1];
+  for(n = 0; n < n2; n++) d2[n] = m2->rptr[1][n+1];
+  cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
+              m3->rows, m3->cols, m1->cols, 1.0,
+              d1, m1->cols, d2, m2->cols, 0.0, d3, m3->cols);
+  for(n = 0; n < n3; n++) m3->rptr[1][n+1] = d3[n];
+  free(d1);
+  free(d2);
+  free(d3);
+}
+#endif
+
+/*
+  Computes the real product m3 = m1*m2 with the fastest method for its
+  size. Returns 0 if the product was computed, 1 if the caller should
+  use its simple loop.
+*/
+static int MatrixMultiplyFast(const MATRIX *m1, const MATRIX *m2, MATRIX *m3, int dbl)
+{
+  if(m1->cols == 3 || m1->cols == 4){
+    MatrixMultiply34(m1, m2, m3, dbl);
+    return(0);
+  }
+  if((double)m3->rows*m3->cols*m1->cols < MATRIX_BLOCKED_MIN_MADDS) return(1);
+#ifdef HAVE_CBLAS
+  if(MatrixGetBackend() == MATRIX_BACKEND_CBLAS){
+    MatrixMultiplyCBLAS(m1, m2, m3, dbl);
+    return(0);
+  }
+#endif
+  if(dbl) MatrixMultiplyBlockedD(m1, m2, m3);
+  else    MatrixMultiplyBlocked(m1, m2, m3);
+  return(0);
+}
+
+
 /*!
   \fn MATRIX *MatrixMultiplyD( const MATRIX *m1, const MATRIX *m2, MATRIX *m3)
   \brief Multiplies two matrices. The accumulation is done with double,
@@ -455,7 +705,11 @@ MATRIX *MatrixMultiplyD( const MATRIX *m1, const MATRIX *m2, MATRIX *m3)
   m1_cols = m1->cols ;
 
   /* twitzel modified here */
-  if((m1->type == MATRIX_REAL) && (m2->type == MATRIX_REAL)) {
+  if((m1->type == MATRIX_REAL) && (m2->type == MATRIX_REAL) &&
+     MatrixMultiplyFast(m1, m2, m3, 1) == 0) {
+    // done
+  }
+  else if((m1->type == MATRIX_REAL) && (m2->type == MATRIX_REAL)) {
     for(row = 1 ; row <= rows ; row++)  {
       r3 = &m3->rptr[row][1] ;
       for (col = 1 ; col <= cols ; col++){
@@ -594,7 +848,12 @@ MATRIX *MatrixMultiply( const MATRIX *m1, const MATRIX *m2, MATRIX *m3)
   m1_cols = m1->cols ;
 
   /* twitzel modified here */
-  if ((m1->type == MATRIX_REAL) && (m2->type == MATRIX_REAL))
+  if ((m1->type == MATRIX_REAL) && (m2->type == MATRIX_REAL) &&
+      MatrixMultiplyFast(m1, m2, m3, 0) == 0)
+  {
+    // done
+  }
+  else if ((m1->type == MATRIX_REAL) && (m2->type == MATRIX_REAL))
   {
     for (row = 1 ; row <= rows ; row++)
     {
@@ -4433,15 +4692,15 @@ MatrixRMS(MATRIX *m1, MATRIX *m2)
 /*
   \fn MATRIX *MatrixMtM(MATRIX *m, MATRIX *mout)
   \brief Efficiently computes M'*M. There are several optimizations:
-  (1) exploits symmetry, (2) exploits sparsity, and (3) creates a LUT
-  (which requires some resident storage). The LUT allows for better
-  load balancing when parallelizing with Open MP (makes it almost 2x
-  faster).
+  (1) exploits symmetry, (2) exploits sparsity, and (3) streams
+  through the rows of M, which are contiguous, instead of down its
+  columns. Each OpenMP task accumulates (in double) a few rows of the
+  upper triangle, adding the products of each row of M in turn, so
+  every element is summed in row order as before.
  */
 MATRIX *MatrixMtM(MATRIX *m, MATRIX *mout)
 {
-  int c1,c2,n,rows,cols;
-  static int *c1list=NULL,*c2list=NULL,ntot=0;
+  int c1,rows,cols;
 
   if(mout == NULL)
     mout = MatrixAlloc(m->cols,m->cols,MATRIX_REAL);
@@ -4457,48 +4716,36 @@ MATRIX *MatrixMtM(MATRIX *m, MATRIX *mout)
   rows = m->rows;
   cols = m->cols;
 
-  if(ntot==0){
-    // create a lookup table that maps n to c1 and c2
-    if(ntot != ((cols*cols)+cols)/2){
-      if(c1list) free(c1list);
-      if(c2list) free(c2list);
-    }
-    ntot = ((cols*cols)+cols)/2;
-    if(Gdiag_no > 0) printf("MatrixMtM: Alloc rows=%d cols=%d ntot=%d\n",rows,cols,ntot);
-    c1list = (int*)calloc(sizeof(int),ntot);
-    c2list = (int*)calloc(sizeof(int),ntot);
-    n = 0;
-    for(c1=1; c1 <= cols; c1++){
-      for(c2=c1; c2 <= cols; c2++){
-	c1list[n] = c1;
-	c2list[n] = c2;
-	n++;
-      }
-    }
-  }
-
-
-  /* Loop over the number of distinct elements in the symetric matrix. Using
-     the LUT created above is better for load balancing.  */
+  /* Tasks near the top of the triangle have more columns to do, so
+     they are handed out dynamically. */
   #ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(c1list,c2list,ntot,cols,rows,mout,m)
+  #pragma omp parallel for schedule(dynamic,1) \
+    if((double)rows*cols*cols >= MATRIX_BLOCKED_MIN_MADDS)
   #endif
-  for(n=0; n < ntot; n++){
-    double v,v1,v2;
-    int c1,c2,r;
-    c1 = c1list[n];
-    c2 = c2list[n];
-    v = 0;
+  for(c1=1; c1 <= cols; c1 += MATRIX_MTM_COLS){
+    int c1max,c,c2,r;
+    double v1,*acc,*a;
+    float *row;
+    c1max = MIN(c1+MATRIX_MTM_COLS-1, cols);
+    acc = (double *)calloc(MATRIX_MTM_COLS*cols, sizeof(double));
     for(r=1; r <= rows; r++){
-      v1 = m->rptr[r][c1];
-      if(v1==0) continue;
-      v2 = m->rptr[r][c2];
-      if(v2==0) continue;
-      v += v1*v2;
-      continue;
-    } // row
-    mout->rptr[c1][c2] = v;
-    mout->rptr[c2][c1] = v;
+      row = m->rptr[r];
+      for(c=c1; c <= c1max; c++){
+        v1 = row[c];
+        if(v1==0) continue;
+        a = &acc[(c-c1)*cols];
+        // adding 0 for a zero in the row leaves the sum unchanged
+        for(c2=c; c2 <= cols; c2++)
+          a[c2-1] += (row[c2] != 0 ? v1*row[c2] : 0.0);
+      }
+    }
+    for(c=c1; c <= c1max; c++){
+      for(c2=c; c2 <= cols; c2++){
+        mout->rptr[c][c2] = acc[(c-c1)*cols+c2-1];
+        mout->rptr[c2][c] = acc[(c-c1)*cols+c2-1];
+      }
+    }
+    free(acc);
   }
 
   if(0){
@@ -4605,11 +4852,12 @@ MATRIX *MatrixKurtosis(MATRIX *y, MATRIX *k)
   \fn MATRIX *MatrixAtB(MATRIX *A, MATRIX *B, MATRIX *mout)
   \brief Computes A'*B without computing or allocating A'
   explicitly. This can be helpful whan A is a large matrix.
-  Accumlates using double. OpenMP capable.
+  Accumlates using double. OpenMP capable. Like MatrixMtM(), each task
+  does a few columns of A and streams through the rows of A and B.
  */
 MATRIX *MatrixAtB(MATRIX *A, MATRIX *B, MATRIX *mout)
 {
-  int colA;
+  int colA, ncolA;
 
   if(A->rows != B->rows){
     printf("ERROR: MatrixAtB(): dim mismatch: %d %d\n",A->rows,B->rows);
@@ -4623,18 +4871,31 @@ MATRIX *MatrixAtB(MATRIX *A, MATRIX *B, MATRIX *mout)
     }
   }
 
+  // enough columns of A per task to keep the inner loops busy when B is thin
+  ncolA = MAX(MATRIX_MTM_COLS, 64/MAX(B->cols,1));
+
   #ifdef _OPENMP
-  #pragma omp parallel for 
+  #pragma omp parallel for schedule(dynamic,1) \
+    if((double)A->rows*A->cols*B->cols >= MATRIX_BLOCKED_MIN_MADDS)
   #endif
-  for(colA=0; colA < A->cols; colA++){
-    int row, colB;
-    double sum;
-    for(colB=0; colB < B->cols; colB++){
-      sum = 0;
-      for(row=0; row < A->rows; row++)
-	sum += (double)A->rptr[row+1][colA+1]*B->rptr[row+1][colB+1];
-      mout->rptr[colA+1][colB+1] = sum;
+  for(colA=1; colA <= A->cols; colA += ncolA){
+    int colAmax, c, row, colB;
+    double v, *acc, *a;
+    float *rowB;
+    colAmax = MIN(colA+ncolA-1, A->cols);
+    acc = (double *)calloc(ncolA*B->cols, sizeof(double));
+    for(row=1; row <= A->rows; row++){
+      rowB = &B->rptr[row][1];
+      for(c=colA; c <= colAmax; c++){
+	v = A->rptr[row][c];
+	a = &acc[(c-colA)*B->cols];
+	for(colB=0; colB < B->cols; colB++) a[colB] += v*rowB[colB];
+      }
     }
+    for(c=colA; c <= colAmax; c++)
+      for(colB=0; colB < B->cols; colB++)
+	mout->rptr[c][colB+1] = acc[(c-colA)*B->cols+colB];
+    free(acc);
   }
 
   if(0){
@@ -1478,6 +1478,10 @@ MRIlinearScale(MRI *mri_src, MRI *mri_dst, float scale, float offset,
   if (!mri_dst)
     mri_dst = MRIclone(mri_src, NULL) ;
 
+  if (MRItypedLinearScale(mri_src, mri_dst, scale, offset, only_nonzero) ==
+      NO_ERROR)
+    return(mri_dst) ;
+
   for (frame = 0 ; frame < mri_src->nframes ; frame++)
   {
     for (z = 0 ; z < depth ; z++)
@@ -1552,6 +1556,9 @@ MRIscalarMul(MRI *mri_src, MRI *mri_dst, float scalar)
   if (!mri_dst)
     mri_dst = MRIclone(mri_src, NULL) ;
 
+  if (MRItypedScalarMul(mri_src, mri_dst, scalar) == NO_ERROR)
+    return(mri_dst) ;
+
   for (frame = 0 ; frame < mri_src->nframes ; frame++)
   {
     for (z = 0 ; z < depth ; z++)
@@ -4689,6 +4696,9 @@ MRIthreshold(MRI *mri_src, MRI *mri_dst, float threshold)
   if (!mri_dst)
     mri_dst = MRIclone(mri_src, NULL) ;
 
+  if (MRItypedThreshold(mri_src, mri_dst, threshold) == NO_ERROR)
+    return(mri_dst) ;
+
   width = mri_src->width ;
   height = mri_src->height ;
   depth = mri_src->depth ;
@@ -5047,6 +5057,10 @@ MRIbinarize(MRI *mri_src, MRI *mri_dst, float threshold, float low_val,
   if (!mri_dst)
     mri_dst = MRIclone(mri_src, NULL) ;
 
+  if (MRItypedBinarize(mri_src, mri_dst, threshold, low_val, hi_val) ==
+      NO_ERROR)
+    return(mri_dst) ;
+
   width = mri_src->width ; height = mri_src->height ; depth = mri_src->depth ;
 
   for (f = 0 ; f < mri_src->nframes ; f++)
@@ -12383,19 +12397,127 @@ MRIlinearTransform(MRI *mri_src, MRI *mri_dst, MATRIX *mA)
   mri_dst = MRIlinearTransformInterp(mri_src, mri_dst, mA, SAMPLE_TRILINEAR);
   return(mri_dst);
 }
+/*-------------------------------------------------------------------
+  mriSampleAffineRow() - samples one frame of src at the n points
+  (xs[i],ys[i],zs[i]) with nearest or trilinear interpolation. Gives
+  the same values as MRIsampleVolumeFrameType(), but the geometry
+  (bounds, clamping, weights) is computed for the whole row first and
+  the voxel type is switched on once per row instead of once per
+  voxel. Only UCHAR, SHORT, INT, and FLOAT sources are handled; see
+  mriAffineRowTypeOk(). The scratch arrays must hold n elements.
+  ------------------------------------------------------------------*/
+static int mriAffineRowTypeOk(const MRI *mri)
+{
+  return(mri->type == MRI_UCHAR || mri->type == MRI_SHORT ||
+         mri->type == MRI_INT   || mri->type == MRI_FLOAT) ;
+}
+
+#define MRI_AFFINE_TRILIN(VOX, mri, f, i)                            \
+  ( (1.0-wx[i]) * (1.0-wy[i]) * (1.0-wz[i]) * (double)VOX(mri, xm[i], ym[i], zm[i], f) + \
+    (1.0-wx[i]) * (1.0-wy[i]) * wz[i]       * (double)VOX(mri, xm[i], ym[i], zp[i], f) + \
+    (1.0-wx[i]) * wy[i]       * (1.0-wz[i]) * (double)VOX(mri, xm[i], yp[i], zm[i], f) + \
+    (1.0-wx[i]) * wy[i]       * wz[i]       * (double)VOX(mri, xm[i], yp[i], zp[i], f) + \
+    wx[i]       * (1.0-wy[i]) * (1.0-wz[i]) * (double)VOX(mri, xp[i], ym[i], zm[i], f) + \
+    wx[i]       * (1.0-wy[i]) * wz[i]       * (double)VOX(mri, xp[i], ym[i], zp[i], f) + \
+    wx[i]       * wy[i]       * (1.0-wz[i]) * (double)VOX(mri, xp[i], yp[i], zm[i], f) + \
+    wx[i]       * wy[i]       * wz[i]       * (double)VOX(mri, xp[i], yp[i], zp[i], f) )
+
+#define MRI_AFFINE_ROW(VOX, mri, f)                                  \
+  for (i = 0 ; i < n ; i++)                                          \
+  {                                                                  \
+    if (mode[i] == 0)                                                \
+      vals[i] = mri->outside_val ;                                   \
+    else if (mode[i] == 1)                                           \
+      vals[i] = (float)VOX(mri, xm[i], ym[i], zm[i], f) ;            \
+    else                                                             \
+      vals[i] = MRI_AFFINE_TRILIN(VOX, mri, f, i) ;                  \
+  }
+
+static void
+mriSampleAffineRow(const MRI *mri, int frame, int InterpMethod, int n,
+                   const double *xs, const double *ys, const double *zs,
+                   int *mode, int *xm, int *ym, int *zm,
+                   int *xp, int *yp, int *zp,
+                   double *wx, double *wy, double *wz, double *vals)
+{
+  int    i, width, height, depth ;
+  double x, y, z ;
+
+  width  = mri->width ;
+  height = mri->height ;
+  depth  = mri->depth ;
+
+  /* Geometry: mode 0 is outside, 1 is nearest (xm,ym,zm), and 2 is
+     trilinear with w weighting the p neighbor. This follows
+     MRIsampleVolumeFrameType() and MRIsampleVolumeFrame() exactly. */
+  for (i = 0 ; i < n ; i++)
+  {
+    x = xs[i] ;
+    y = ys[i] ;
+    z = zs[i] ;
+    if (MRIindexNotInVolume(mri, x, y, z) == 1)
+    {
+      mode[i] = 0 ;
+      continue ;
+    }
+    if (InterpMethod == SAMPLE_NEAREST ||
+        (FEQUAL((int)x,x) && FEQUAL((int)y,y) && FEQUAL((int)z, z)))
+    {
+      mode[i] = 1 ;
+      xm[i] = MIN(MAX(nint(x), 0), width-1) ;
+      ym[i] = MIN(MAX(nint(y), 0), height-1) ;
+      zm[i] = MIN(MAX(nint(z), 0), depth-1) ;
+      continue ;
+    }
+    if (x >= width)  x = width - 1.0 ;
+    if (y >= height) y = height - 1.0 ;
+    if (z >= depth)  z = depth - 1.0 ;
+    if (x < 0.0) x = 0.0 ;
+    if (y < 0.0) y = 0.0 ;
+    if (z < 0.0) z = 0.0 ;
+    mode[i] = 2 ;
+    xm[i] = (int)x ;
+    ym[i] = (int)y ;
+    zm[i] = (int)z ;
+    xp[i] = MIN(width-1, xm[i]+1) ;
+    yp[i] = MIN(height-1, ym[i]+1) ;
+    zp[i] = MIN(depth-1, zm[i]+1) ;
+    wx[i] = x - (float)xm[i] ;
+    wy[i] = y - (float)ym[i] ;
+    wz[i] = z - (float)zm[i] ;
+  }
+
+  switch (mri->type)
+  {
+  case MRI_UCHAR:
+    MRI_AFFINE_ROW(MRIseq_vox, mri, frame) ;
+    break ;
+  case MRI_SHORT:
+    MRI_AFFINE_ROW(MRISseq_vox, mri, frame) ;
+    break ;
+  case MRI_INT:
+    MRI_AFFINE_ROW(MRIIseq_vox, mri, frame) ;
+    break ;
+  case MRI_FLOAT:
+    MRI_AFFINE_ROW(MRIFseq_vox, mri, frame) ;
+    break ;
+  }
+}
 /*-------------------------------------------------------------------
   MRIlinearTransformInterp() Perform linear coordinate transformation
   x' = Ax on the MRI image mri_src into mri_dst using the specified
-  interpolation method. A is a voxel-to-voxel transform.
+  interpolation method. A is a voxel-to-voxel transform. The source
+  coordinate is stepped along each row rather than recomputed with a
+  matrix multiply, each row is sampled with mriSampleAffineRow() (one
+  type switch per row), and slices are spread over threads.
   ------------------------------------------------------------------*/
 MRI *
 MRIlinearTransformInterp(MRI *mri_src, MRI *mri_dst, MATRIX *mA,
                          int InterpMethod)
 {
-  int    y1, y2, y3, width, height, depth,frame ;
-  VECTOR *v_X, *v_Y ;   /* original and transformed coordinate systems */
+  int    y3, width, height, depth, fastrow ;
   MATRIX *mAinv ;     /* inverse of mA */
-  double   val, x1, x2, x3 ;
+  double a[3][4] ;
 
   if (InterpMethod != SAMPLE_NEAREST &&
       InterpMethod != SAMPLE_TRILINEAR &&
@@ -12425,88 +12547,85 @@ MRIlinearTransformInterp(MRI *mri_src, MRI *mri_dst, MATRIX *mA,
   if (InterpMethod == SAMPLE_CUBIC_BSPLINE)
     bspline = MRItoBSpline(mri_src,NULL,3);
 
+  for (y3 = 0 ; y3 < 3 ; y3++)
+  {
+    a[y3][0] = *MATRIX_RELT(mAinv, y3+1, 1) ;
+    a[y3][1] = *MATRIX_RELT(mAinv, y3+1, 2) ;
+    a[y3][2] = *MATRIX_RELT(mAinv, y3+1, 3) ;
+    a[y3][3] = *MATRIX_RELT(mAinv, y3+1, 4) ;
+  }
+  MatrixFree(&mAinv) ;
+
   width  = mri_dst->width ;
   height = mri_dst->height ;
   depth  = mri_dst->depth ;
-  v_X = VectorAlloc(4, MATRIX_REAL) ;  /* input (src) coordinates */
-  v_Y = VectorAlloc(4, MATRIX_REAL) ;  /* transformed (dst) coordinates */
+  fastrow = ((InterpMethod == SAMPLE_NEAREST || InterpMethod == SAMPLE_TRILINEAR)
+             && mriAffineRowTypeOk(mri_src)) ;
 
-  v_Y->rptr[4][1] = 1.0f ;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic) if(depth > 1)
+#endif
   for (y3 = 0 ; y3 < depth ; y3++)
   {
-    V3_Z(v_Y) = y3 ;
+    int    y1, y2, frame, *mode, *xm, *ym, *zm, *xp, *yp, *zp ;
+    double *xs, *ys, *zs, *wx, *wy, *wz, *vals, val ;
+
+    xs   = (double *)calloc(7*width, sizeof(double)) ;
+    ys   = xs + width ;
+    zs   = ys + width ;
+    wx   = zs + width ;
+    wy   = wx + width ;
+    wz   = wy + width ;
+    vals = wz + width ;
+    mode = (int *)calloc(7*width, sizeof(int)) ;
+    xm   = mode + width ;
+    ym   = xm + width ;
+    zm   = ym + width ;
+    xp   = zm + width ;
+    yp   = xp + width ;
+    zp   = yp + width ;
+
     for (y2 = 0 ; y2 < height ; y2++)
     {
-      V3_Y(v_Y) = y2 ;
+      // source coords of this row; only y1 changes along it
+      double x10 = a[0][1]*y2 + a[0][2]*y3 + a[0][3] ;
+      double x20 = a[1][1]*y2 + a[1][2]*y3 + a[1][3] ;
+      double x30 = a[2][1]*y2 + a[2][2]*y3 + a[2][3] ;
       for (y1 = 0 ; y1 < width ; y1++)
       {
-        V3_X(v_Y) = y1 ;
-        MatrixMultiply(mAinv, v_Y, v_X) ;
-
-        x1 = V3_X(v_X) ;
-        x2 = V3_Y(v_X) ;
-        x3 = V3_Z(v_X) ;
-
-        if (nint(y1) == Gx && nint(y2) == Gy && nint(y3) == Gz)
-          DiagBreak() ;
-        if (nint(x1) == Gx && nint(x2) == Gy && nint(x3) == Gz)
-        {
-#if 0
-          fprintf
-          (stderr,
-           "(%2.1f, %2.1f, %2.1f) --> (%2.1f, %2.1f, %2.1f)\n",
-           (float)x1, (float)x2, (float)x3,
-           (float)y1, (float)y2, (float)y3) ;
-#endif
-          DiagBreak() ;
-        }
+        xs[y1] = x10 + a[0][0]*y1 ;
+        ys[y1] = x20 + a[1][0]*y1 ;
+        zs[y1] = x30 + a[2][0]*y1 ;
+      }
+      if (y2 == Gy && y3 == Gz && Gx >= 0 && Gx < width)
+        DiagBreak() ;
 
-        //MRIsampleVolume(mri_src, x1, x2, x3, &val);
-        for (frame = 0 ; frame < mri_src->nframes ; frame++)
+      for (frame = 0 ; frame < mri_src->nframes ; frame++)
+      {
+        if (fastrow)
+          mriSampleAffineRow(mri_src, frame, InterpMethod, width, xs, ys, zs,
+                             mode, xm, ym, zm, xp, yp, zp, wx, wy, wz, vals) ;
+        for (y1 = 0 ; y1 < width ; y1++)
         {
-          if (InterpMethod == SAMPLE_CUBIC_BSPLINE)
+          if (fastrow)
+            val = vals[y1] ;
+          else if (InterpMethod == SAMPLE_CUBIC_BSPLINE)
             // recommended to externally call this and keep mri_coeff
             // if image is resampled often (e.g. in registration algo)
-            MRIsampleBSpline(bspline, x1, x2, x3, frame, &val);
+            MRIsampleBSpline(bspline, xs[y1], ys[y1], zs[y1], frame, &val);
           else
-            MRIsampleVolumeFrameType(mri_src, x1, x2, x3, 
+            MRIsampleVolumeFrameType(mri_src, xs[y1], ys[y1], zs[y1],
                                      frame, InterpMethod, &val);
 
           // will clip the val according to mri_dst type:
           MRIsetVoxVal(mri_dst, y1, y2, y3, frame, val) ;
-
-#if 0
-          // if this gets ever enabled, don't forget to clip val to type...
-          switch (mri_dst->type)
-          {
-          case MRI_UCHAR:
-            MRIvox(mri_dst,y1,y2,y3) = (BUFTYPE)nint(val) ;
-          break ;
-          case MRI_SHORT:
-            MRISvox(mri_dst,y1,y2,y3) = (short)nint(val) ;
-            break ;
-          case MRI_FLOAT:
-            MRIFvox(mri_dst,y1,y2,y3) = (float)(val) ;
-            break ;
-          case MRI_INT:
-            MRIIvox(mri_dst,y1,y2,y3) = nint(val) ;
-            break ;
-          default:
-            ErrorReturn(NULL,
-                        (ERROR_UNSUPPORTED,
-                         "MRIlinearTransform: unsupported dst type %d",
-                         mri_dst->type)) ;
-            break ;
-          }
-#endif
         }
       }
     }
+    free(xs) ;
+    free(mode) ;
   }
   if (bspline) MRIfreeBSpline(&bspline);
-  MatrixFree(&v_X) ;
-  MatrixFree(&mAinv) ;
-  MatrixFree(&v_Y) ;
 
   mri_dst->ras_good_flag = 1;
 
@@ -18725,6 +18844,10 @@ MRIaverageFrames(MRI *mri_src, MRI *mri_dst, int start_frame, int end_frame)
 
   mri_dst = MRIalloc(mri_src->width, mri_src->height, mri_src->depth, MRI_FLOAT) ;
   MRIcopyHeader(mri_src, mri_dst) ;
+  if (MRItypedAverageFrames(mri_src, mri_dst, start_frame, end_frame) ==
+      NO_ERROR)
+    return(mri_dst) ;
+
   nframes = end_frame - start_frame + 1 ;
   for (x = 0 ; x < mri_src->width ; x++)
     for (y = 0 ; y < mri_src->height ; y++)
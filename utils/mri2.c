@@ -44,6 +44,7 @@
 #include "chronometer.h"
 #include "region.h"
 #include "fmriutils.h"
+#include "utils.h"
 
 //#define MRI2_TIMERS
 
@@ -3036,78 +3037,31 @@ int *MRIsegIdList(MRI *seg, int *nlist, int frame)
 /* ----------------------------------------------------------*/
 /*!
   \fn double *MRIsegDice(MRI *seg1, MRI *seg2, int *nsegs, int **segidlist)
-  \brief Computes dice coefficient for each segmentation. seg1 and seg2
-  should have the same number of segs. Note: to get the name of
+  \brief Computes dice coefficient for each segmentation found in
+  either seg1 or seg2 (first frame). The counts come from a single
+  pass with MRIsegOverlap(). Note: to get the name of
   the seg, CTABcopyName(ctab,segidlist[k],tmpstr,sizeof(tmpstr));
 */
 double *MRIsegDice(MRI *seg1, MRI *seg2, int *nsegs, int **segidlist)
 {
-  int k,c,r,s,id1,id2,k1=0,k2=0;
-  int nsegid1, *segidlist1;
-  int nsegid2, *segidlist2;
-  int *n1, *n2, *n12;
+  SEGOVERLAP *ov;
   double *dice;
-  *nsegs = -1;
-
-  // Extract a unique, sorted list of the ids
-  segidlist1 = MRIsegIdList(seg1, &nsegid1,0);
-  segidlist2 = MRIsegIdList(seg1, &nsegid2,0);
-
-  if (nsegid1 != nsegid2)
-  {
-    printf("ERROR: MRIsegDice(): nsegs do not match %d %d\n",
-           nsegid1,nsegid2);
-    return(NULL);
-  }
-  printf("MRIsegDice(): found %d segs\n",nsegid1);
-  *nsegs = nsegid1;
+  int k;
 
-  n1  = (int *) calloc(nsegid1,sizeof(int));
-  n2  = (int *) calloc(nsegid1,sizeof(int));
-  n12 = (int *) calloc(nsegid1,sizeof(int));
-
-  for (c=0; c < seg1->width; c++)
+  *nsegs = -1;
+  ov = MRIsegOverlap(seg1, seg2, NULL, 0);
+  if(ov == NULL) return(NULL);
+  printf("MRIsegDice(): found %d segs\n",ov->nsegs);
+  *nsegs = ov->nsegs;
+
+  dice  = (double *) calloc(ov->nsegs+1,sizeof(double));
+  *segidlist = (int *) calloc(ov->nsegs+1,sizeof(int));
+  for (k=0; k < ov->nsegs; k++)
   {
-    for (r=0; r < seg1->height; r++)
-    {
-      for (s=0; s < seg1->depth; s++)
-      {
-        // segid for 1st seg vol
-        id1 = MRIgetVoxVal(seg1,c,r,s,0);
-        for (k=0; k < nsegid1; k++)
-        {
-          if (id1 == segidlist1[k])
-          {
-            k1 = k;
-            break;
-          }
-        }
-        // segid for 2nd seg vol
-        id2 = MRIgetVoxVal(seg2,c,r,s,0);
-        for (k=0; k < nsegid2; k++)
-        {
-          if (id2 == segidlist2[k])
-          {
-            k2 = k;
-            break;
-          }
-        }
-        n1[k1]++;
-        n2[k2]++;
-        if (id1 == id2) n12[k1]++;
-      }
-    }
+    (*segidlist)[k] = ov->segidlist[k];
+    dice[k] = (double)ov->n12[k]/((ov->n1[k]+ov->n2[k])/2.0);
   }
-
-  dice  = (double *) calloc(nsegid1,sizeof(double));
-  for (k=0; k < nsegid1; k++)
-    dice[k] = (double)n12[k]/((n1[k]+n2[k])/2.0);
-
-  free(n1);
-  free(n2);
-  free(n12);
-  free(segidlist2);
-  *segidlist = segidlist1;
+  MRIsegOverlapFree(&ov);
 
   return(dice);
 }
@@ -4074,6 +4028,708 @@ int MRIsegFrameAvg(MRI *seg, int segid, MRI *mri, double *favg)
 
   return(nvoxels);
 }
+/* Copies row r of slice s of frame f into vals as the floats that
+   MRIgetVoxVal() would return, reading through a pointer of the voxel
+   type instead of switching on the type for every voxel. */
+static void segStatsGetRow(MRI *mri, int r, int s, int f, float *vals)
+{
+  int c;
+
+  switch(mri->type){
+  case MRI_UCHAR:{
+    BUFTYPE *p = &MRIseq_vox(mri,0,r,s,f);
+    for(c=0; c < mri->width; c++) vals[c] = (float)p[c];
+    break;
+  }
+  case MRI_SHORT:{
+    short *p = &MRISseq_vox(mri,0,r,s,f);
+    for(c=0; c < mri->width; c++) vals[c] = (float)p[c];
+    break;
+  }
+  case MRI_INT:{
+    int *p = &MRIIseq_vox(mri,0,r,s,f);
+    for(c=0; c < mri->width; c++) vals[c] = (float)p[c];
+    break;
+  }
+  case MRI_LONG:{
+    long32 *p = &MRILseq_vox(mri,0,r,s,f);
+    for(c=0; c < mri->width; c++) vals[c] = (float)p[c];
+    break;
+  }
+  case MRI_FLOAT:{
+    float *p = &MRIFseq_vox(mri,0,r,s,f);
+    for(c=0; c < mri->width; c++) vals[c] = p[c];
+    break;
+  }
+  default:
+    for(c=0; c < mri->width; c++) vals[c] = MRIgetVoxVal(mri,c,r,s,f);
+    break;
+  }
+}
+/*------------------------------------------------------------*/
+/*!
+  \fn SEGSTATTABLE *MRIsegStatsTable(MRI *seg, int segframe, MRI *mri,
+			       const int *segidlist, int nsegs, int robustframe)
+  \brief Computes the number of voxels and the min, max, sum, and sum
+  of squares of every frame of mri in every segmentation of segidlist
+  in a single pass through the volume (instead of one pass per
+  segmentation as with MRIsegCount(), MRIsegStats(), and
+  MRIsegFrameAvg()). If segidlist is NULL, all the ids found in the
+  given frame of seg are used. mri may be NULL, in which case only the
+  counts are computed. If robustframe >= 0, the values of that frame
+  are also kept (sorted) for each segmentation so that
+  MRIsegStatsTableGetRobust() can stand in for MRIsegStatsRobust().
+  Slices are spread over threads, each with its own accumulators,
+  which are merged in thread order. Use MRIsegStatsTableGet() and
+  friends to extract the stats by segid.
+*/
+SEGSTATTABLE *MRIsegStatsTable(MRI *seg, int segframe, MRI *mri,
+			       const int *segidlist, int nsegs, int robustframe)
+{
+  SEGSTATTABLE *table;
+  int *idlist=NULL, *cursor, *rowlist, n, k, c, r, s, row, idmin, idmax;
+  int nframes, nacc, nthreads, tid;
+  int **tnhits, **trowlist;
+  float **trowvals, *rowvals;
+  double **tmin, **tmax, **tsum, **tsum2;
+
+  if(mri && MRIdimMismatch(seg,mri,0)){
+    printf("ERROR: MRIsegStatsTable(): dimension mismatch between seg and input\n");
+    return(NULL);
+  }
+  if(mri && robustframe >= mri->nframes){
+    printf("ERROR: MRIsegStatsTable(): robust frame %d, input only has %d frames\n",
+	   robustframe,mri->nframes);
+    return(NULL);
+  }
+
+  if(segidlist == NULL){
+    idlist = MRIsegIdList(seg, &nsegs, segframe);
+    segidlist = idlist;
+  }
+
+  table = (SEGSTATTABLE *) calloc(sizeof(SEGSTATTABLE),1);
+  table->nsegs = nsegs;
+  table->nframes = (mri ? mri->nframes : 0);
+  table->robustframe = (mri ? robustframe : -1);
+  table->segidlist = (int *) calloc(sizeof(int),nsegs+1);
+  for(n=0; n < nsegs; n++) table->segidlist[n] = segidlist[n];
+  if(idlist) free(idlist);
+
+  /* Build a direct segid-to-row lookup table so that each voxel costs
+     one index rather than a search. The id range is usually small
+     (eg, < 15000 for aparc+aseg); if it is not, fall back to a linear
+     search in MRIsegStatsTableRow(). Repeated ids map to the first row.*/
+  idmin = idmax = 0;
+  for(n=0; n < nsegs; n++){
+    if(n == 0 || idmin > table->segidlist[n]) idmin = table->segidlist[n];
+    if(n == 0 || idmax < table->segidlist[n]) idmax = table->segidlist[n];
+  }
+  if(nsegs > 0 && (double)idmax-idmin < (1<<24)){
+    table->lutmin = idmin;
+    table->nlut = idmax-idmin+1;
+    table->lut = (int *) calloc(sizeof(int),table->nlut);
+    for(k=0; k < table->nlut; k++) table->lut[k] = -1;
+    for(n=nsegs-1; n >= 0; n--) table->lut[table->segidlist[n]-idmin] = n;
+  }
+
+  nframes = table->nframes;
+  nacc = nsegs*nframes;
+  table->nhits = (int *)    calloc(sizeof(int),nsegs+1);
+  table->min   = (double *) calloc(sizeof(double),nacc+1);
+  table->max   = (double *) calloc(sizeof(double),nacc+1);
+  table->sum   = (double *) calloc(sizeof(double),nacc+1);
+  table->sum2  = (double *) calloc(sizeof(double),nacc+1);
+
+#ifdef HAVE_OPENMP
+  nthreads = omp_get_max_threads();
+#else
+  nthreads = 1;
+#endif
+  tnhits   = (int **)    calloc(sizeof(int *),nthreads);
+  trowlist = (int **)    calloc(sizeof(int *),nthreads);
+  trowvals = (float **)  calloc(sizeof(float *),nthreads);
+  tmin     = (double **) calloc(sizeof(double *),nthreads);
+  tmax     = (double **) calloc(sizeof(double *),nthreads);
+  tsum     = (double **) calloc(sizeof(double *),nthreads);
+  tsum2    = (double **) calloc(sizeof(double *),nthreads);
+  for(tid=0; tid < nthreads; tid++){
+    tnhits[tid]   = (int *)    calloc(sizeof(int),nsegs+1);
+    trowlist[tid] = (int *)    calloc(sizeof(int),seg->width);
+    trowvals[tid] = (float *)  calloc(sizeof(float),seg->width);
+    tmin[tid]     = (double *) calloc(sizeof(double),nacc+1);
+    tmax[tid]     = (double *) calloc(sizeof(double),nacc+1);
+    tsum[tid]     = (double *) calloc(sizeof(double),nacc+1);
+    tsum2[tid]    = (double *) calloc(sizeof(double),nacc+1);
+    for(k=0; k < nacc; k++){
+      tmin[tid][k] = +DBL_MAX;
+      tmax[tid][k] = -DBL_MAX;
+    }
+  }
+
+  /* Walk the volume in storage order (column fastest). The rows of
+     the current line are looked up once and then reused for each
+     frame, so each frame is read contiguously, a line at a time.*/
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) private(c,r,n,k,row,tid)
+#endif
+  for(s=0; s < seg->depth; s++){
+    int f, *rowlist, *nhits;
+    float *vals;
+    double val, *min, *max, *sum, *sum2;
+    tid = 0;
+#ifdef HAVE_OPENMP
+    tid = omp_get_thread_num();
+#endif
+    rowlist = trowlist[tid];
+    vals = trowvals[tid];
+    nhits = tnhits[tid];
+    min  = tmin[tid];
+    max  = tmax[tid];
+    sum  = tsum[tid];
+    sum2 = tsum2[tid];
+    for(r=0; r < seg->height; r++){
+      segStatsGetRow(seg,r,s,segframe,vals);
+      for(c=0; c < seg->width; c++){
+	row = MRIsegStatsTableRow(table,(int)vals[c]);
+	rowlist[c] = row;
+	if(row >= 0) nhits[row]++;
+      }
+      for(f=0; f < nframes; f++){
+	segStatsGetRow(mri,r,s,f,vals);
+	for(c=0; c < seg->width; c++){
+	  row = rowlist[c];
+	  if(row < 0) continue;
+	  val = vals[c];
+	  k = row*nframes + f;
+	  if(min[k] > val) min[k] = val;
+	  if(max[k] < val) max[k] = val;
+	  sum[k]  += val;
+	  sum2[k] += (val*val);
+	}
+      }
+    }
+  }
+
+  // Merge the per-thread accumulators in a fixed order
+  for(k=0; k < nacc; k++){
+    table->min[k] = +DBL_MAX;
+    table->max[k] = -DBL_MAX;
+  }
+  for(tid=0; tid < nthreads; tid++){
+    for(n=0; n < nsegs; n++) table->nhits[n] += tnhits[tid][n];
+    for(k=0; k < nacc; k++){
+      if(table->min[k] > tmin[tid][k]) table->min[k] = tmin[tid][k];
+      if(table->max[k] < tmax[tid][k]) table->max[k] = tmax[tid][k];
+      table->sum[k]  += tsum[tid][k];
+      table->sum2[k] += tsum2[tid][k];
+    }
+    free(tnhits[tid]);
+    free(trowlist[tid]);
+    free(trowvals[tid]);
+    free(tmin[tid]);
+    free(tmax[tid]);
+    free(tsum[tid]);
+    free(tsum2[tid]);
+  }
+  free(tnhits);
+  free(trowlist);
+  free(trowvals);
+  free(tmin);
+  free(tmax);
+  free(tsum);
+  free(tsum2);
+  // Empty segmentations get 0 for min and max, as in MRIsegStats()
+  for(n=0; n < nsegs; n++){
+    if(table->nhits[n] > 0) continue;
+    for(k=n*nframes; k < (n+1)*nframes; k++){
+      table->min[k] = 0;
+      table->max[k] = 0;
+    }
+  }
+
+  if(table->robustframe < 0) return(table);
+
+  /* Keep the values of the robust frame for each segmentation. The
+     counts are known now, so a second pass just drops each value
+     into its slot. Each list is then sorted independently.*/
+  table->vlist = (float **) calloc(sizeof(float *),nsegs+1);
+  for(n=0; n < nsegs; n++)
+    table->vlist[n] = (float *) calloc(sizeof(float),table->nhits[n]+1);
+  cursor = (int *) calloc(sizeof(int),nsegs+1);
+  rowlist = (int *) calloc(sizeof(int),seg->width);
+  rowvals = (float *) calloc(sizeof(float),seg->width);
+  for(s=0; s < seg->depth; s++){
+    for(r=0; r < seg->height; r++){
+      segStatsGetRow(seg,r,s,segframe,rowvals);
+      for(c=0; c < seg->width; c++)
+	rowlist[c] = MRIsegStatsTableRow(table,(int)rowvals[c]);
+      segStatsGetRow(mri,r,s,robustframe,rowvals);
+      for(c=0; c < seg->width; c++){
+	row = rowlist[c];
+	if(row < 0) continue;
+	table->vlist[row][cursor[row]] = rowvals[c];
+	cursor[row]++;
+      }
+    }
+  }
+  free(cursor);
+  free(rowlist);
+  free(rowvals);
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for(n=0; n < nsegs; n++)
+    qsort((void *) table->vlist[n], table->nhits[n], sizeof(float), compare_floats);
+
+  return(table);
+}
+/*------------------------------------------------------------*/
+/*!
+  \fn int MRIsegStatsTableFree(SEGSTATTABLE **ptable)
+  \brief Frees a table created by MRIsegStatsTable().
+*/
+int MRIsegStatsTableFree(SEGSTATTABLE **ptable)
+{
+  SEGSTATTABLE *table = *ptable;
+  int n;
+
+  if(table == NULL) return(0);
+  if(table->vlist){
+    for(n=0; n < table->nsegs; n++) free(table->vlist[n]);
+    free(table->vlist);
+  }
+  free(table->segidlist);
+  free(table->nhits);
+  free(table->min);
+  free(table->max);
+  free(table->sum);
+  free(table->sum2);
+  if(table->lut) free(table->lut);
+  free(table);
+  *ptable = NULL;
+  return(0);
+}
+/*------------------------------------------------------------*/
+/*!
+  \fn int MRIsegStatsTableRow(const SEGSTATTABLE *table, int segid)
+  \brief Returns the row of the table for the given segid or -1 if
+  the segid is not in the table.
+*/
+int MRIsegStatsTableRow(const SEGSTATTABLE *table, int segid)
+{
+  int n;
+  if(table->lut){
+    if(segid < table->lutmin || segid >= table->lutmin + table->nlut) return(-1);
+    return(table->lut[segid - table->lutmin]);
+  }
+  for(n=0; n < table->nsegs; n++)
+    if(table->segidlist[n] == segid) return(n);
+  return(-1);
+}
+/*------------------------------------------------------------*/
+/*!
+  \fn int MRIsegStatsTableGet(const SEGSTATTABLE *table, int segid, int frame,
+			float *min, float *max, float *range,
+			float *mean, float *std)
+  \brief Same output as MRIsegStats() but taken from a table computed
+  with MRIsegStatsTable(). Returns the number of voxels in the segid
+  (0 if the segid is not in the table).
+*/
+int MRIsegStatsTableGet(const SEGSTATTABLE *table, int segid, int frame,
+			float *min, float *max, float *range,
+			float *mean, float *std)
+{
+  int row, k, nvoxels;
+  double sum, sum2;
+
+  *min = 0;
+  *max = 0;
+  *range = 0;
+  *mean = 0;
+  *std = 0;
+  row = MRIsegStatsTableRow(table,segid);
+  if(row < 0) return(0);
+  nvoxels = table->nhits[row];
+  if(frame < 0 || frame >= table->nframes || nvoxels == 0) return(nvoxels);
+
+  k = row*table->nframes + frame;
+  sum  = table->sum[k];
+  sum2 = table->sum2[k];
+  *min = table->min[k];
+  *max = table->max[k];
+  *range = *max - *min;
+  *mean = sum/nvoxels;
+  if (nvoxels > 1)
+    *std = sqrt(((nvoxels)*(*mean)*(*mean) - 2*(*mean)*sum + sum2)/
+                (nvoxels-1));
+  return(nvoxels);
+}
+/*------------------------------------------------------------*/
+/*!
+  \fn int MRIsegStatsTableGetRobust(const SEGSTATTABLE *table, int segid,
+			      float *min, float *max, float *range,
+			      float *mean, float *std, float Pct)
+  \brief Same output as MRIsegStatsRobust() for the robust frame of
+  the table. The table must have been computed with robustframe >= 0.
+  Returns the number of voxels used.
+*/
+int MRIsegStatsTableGetRobust(const SEGSTATTABLE *table, int segid,
+			      float *min, float *max, float *range,
+			      float *mean, float *std, float Pct)
+{
+  int row, nvoxels, k, m;
+  double val, sum, sum2;
+  float *vlist;
+
+  *min = 0;
+  *max = 0;
+  *range = 0;
+  *mean = 0;
+  *std = 0;
+  if(table->vlist == NULL){
+    printf("ERROR: MRIsegStatsTableGetRobust(): table has no robust frame\n");
+    return(0);
+  }
+  row = MRIsegStatsTableRow(table,segid);
+  if(row < 0) return(0);
+  nvoxels = table->nhits[row];
+  if(nvoxels == 0) return(0);
+  vlist = table->vlist[row];
+
+  // Compute stats excluding Pct of the values from each end
+  sum  = 0;
+  sum2 = 0;
+  m = 0;
+  for(k=0; k < nvoxels; k++){
+    if(k < Pct*nvoxels/100.0)       continue;
+    if(k > (100-Pct)*nvoxels/100.0) continue;
+    val = vlist[k];
+    if(m == 0){
+      *min = val;
+      *max = val;
+    }
+    if (*min > val) *min = val;
+    if (*max < val) *max = val;
+    sum  += val;
+    sum2 += (val*val);
+    m = m + 1;
+  }
+
+  *range = *max - *min;
+  *mean = sum/m;
+  if(m > 1)
+    *std = sqrt(((m)*(*mean)*(*mean) - 2*(*mean)*sum + sum2)/
+                (m-1));
+  else *std = 0.0;
+  return(m);
+}
+/*------------------------------------------------------------*/
+/*!
+  \fn int MRIsegStatsTableFrameAvg(const SEGSTATTABLE *table, int segid, double *favg)
+  \brief Same output as MRIsegFrameAvg() but taken from a table computed
+  with MRIsegStatsTable(). favg must have table->nframes elements.
+*/
+int MRIsegStatsTableFrameAvg(const SEGSTATTABLE *table, int segid, double *favg)
+{
+  int row, f, nvoxels;
+
+  for(f=0; f < table->nframes; f++) favg[f] = 0;
+  row = MRIsegStatsTableRow(table,segid);
+  if(row < 0) return(0);
+  nvoxels = table->nhits[row];
+  if(nvoxels == 0) return(0);
+  for(f=0; f < table->nframes; f++)
+    favg[f] = table->sum[row*table->nframes + f]/nvoxels;
+  return(nvoxels);
+}
+/*------------------------------------------------------------*/
+/* Open-addressing hash of (id1,id2) -> voxel count used by
+   MRIsegOverlap(). A slot is empty when its count is 0. */
+typedef struct
+{
+  int nslots, nused;
+  int *id1, *id2, *count;
+} SEGPAIRHASH;
+
+static void segPairHashInit(SEGPAIRHASH *h, int nslots)
+{
+  h->nslots = nslots;
+  h->nused = 0;
+  h->id1   = (int *) calloc(sizeof(int),nslots);
+  h->id2   = (int *) calloc(sizeof(int),nslots);
+  h->count = (int *) calloc(sizeof(int),nslots);
+}
+static void segPairHashFree(SEGPAIRHASH *h)
+{
+  free(h->id1);
+  free(h->id2);
+  free(h->count);
+}
+static int segPairHashSlot(const SEGPAIRHASH *h, int id1, int id2)
+{
+  unsigned int k;
+  k = ((unsigned int)id1*2654435761u) ^ ((unsigned int)id2*40503u);
+  k = (k ^ (k >> 15)) & (h->nslots-1);
+  while(h->count[k] != 0 && (h->id1[k] != id1 || h->id2[k] != id2))
+    k = (k+1) & (h->nslots-1);
+  return((int)k);
+}
+static void segPairHashAdd(SEGPAIRHASH *h, int id1, int id2, int n)
+{
+  SEGPAIRHASH big;
+  int k, j;
+
+  k = segPairHashSlot(h,id1,id2);
+  if(h->count[k] != 0){
+    h->count[k] += n;
+    return;
+  }
+  h->id1[k] = id1;
+  h->id2[k] = id2;
+  h->count[k] = n;
+  h->nused++;
+  if(2*h->nused < h->nslots) return;
+  // Over half full, so rehash into twice as many slots
+  segPairHashInit(&big,2*h->nslots);
+  for(j=0; j < h->nslots; j++){
+    if(h->count[j] == 0) continue;
+    k = segPairHashSlot(&big,h->id1[j],h->id2[j]);
+    big.id1[k] = h->id1[j];
+    big.id2[k] = h->id2[j];
+    big.count[k] = h->count[j];
+  }
+  big.nused = h->nused;
+  segPairHashFree(h);
+  *h = big;
+}
+static int compare_segpairs(const void *v1, const void *v2)
+{
+  const int *p1 = (const int *)v1, *p2 = (const int *)v2;
+  if(p1[0] != p2[0]) return(p1[0] < p2[0] ? -1 : +1);
+  if(p1[1] != p2[1]) return(p1[1] < p2[1] ? -1 : +1);
+  return(0);
+}
+/*------------------------------------------------------------*/
+/*!
+  \fn SEGOVERLAP *MRIsegOverlap(MRI *seg1, MRI *seg2, MRI *mask, int frame)
+  \brief Computes the joint label histogram (confusion matrix) of two
+  segmentations in a single pass through the volume. Only the (id1,id2)
+  pairs that actually occur are stored, so the cost does not depend on
+  the range of the ids. Voxel values are truncated to int as in
+  MRIsegIdList(). If frame < 0, all frames are accumulated (the two
+  segs must then have the same number of frames). If mask is non-NULL,
+  only voxels where the first frame of the mask is > 0.5 are counted.
+  The per-segid counts (n1, n2, n12) are derived from the pairs over
+  the union of the ids in both segs, so Dice, Jaccard, and volume
+  differences for every label come from the same pass. Slices are
+  spread over threads, each with its own hash of pairs.
+*/
+SEGOVERLAP *MRIsegOverlap(MRI *seg1, MRI *seg2, MRI *mask, int frame)
+{
+  SEGOVERLAP *ov;
+  SEGPAIRHASH *thash, all;
+  int nthreads, tid, n, k, s, f0, f1, *pairs, *idlist;
+
+  if(MRIdimMismatch(seg1,seg2,0)){
+    printf("ERROR: MRIsegOverlap(): dimension mismatch between segs\n");
+    return(NULL);
+  }
+  if(mask && MRIdimMismatch(seg1,mask,0)){
+    printf("ERROR: MRIsegOverlap(): dimension mismatch between seg and mask\n");
+    return(NULL);
+  }
+  if(frame < 0){
+    if(seg1->nframes != seg2->nframes){
+      printf("ERROR: MRIsegOverlap(): frame mismatch %d %d\n",
+	     seg1->nframes,seg2->nframes);
+      return(NULL);
+    }
+    f0 = 0;
+    f1 = seg1->nframes;
+  }
+  else {
+    if(frame >= seg1->nframes || frame >= seg2->nframes){
+      printf("ERROR: MRIsegOverlap(): frame %d out of range\n",frame);
+      return(NULL);
+    }
+    f0 = frame;
+    f1 = frame+1;
+  }
+
+#ifdef HAVE_OPENMP
+  nthreads = omp_get_max_threads();
+#else
+  nthreads = 1;
+#endif
+  thash = (SEGPAIRHASH *) calloc(sizeof(SEGPAIRHASH),nthreads);
+  for(tid=0; tid < nthreads; tid++) segPairHashInit(&thash[tid],1024);
+
+  /* Runs of the same pair are common (most voxels are background or
+     agree with their neighbor), so consecutive hits are counted
+     locally and only added to the hash when the pair changes. */
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic) private(tid)
+#endif
+  for(s=0; s < seg1->depth; s++){
+    int c, r, f, id1, id2, prev1=0, prev2=0, nrun=0;
+    SEGPAIRHASH *h;
+    tid = 0;
+#ifdef HAVE_OPENMP
+    tid = omp_get_thread_num();
+#endif
+    h = &thash[tid];
+    for(f=f0; f < f1; f++){
+      for(r=0; r < seg1->height; r++){
+	for(c=0; c < seg1->width; c++){
+	  if(mask && MRIgetVoxVal(mask,c,r,s,0) < 0.5) continue;
+	  id1 = (int)MRIgetVoxVal(seg1,c,r,s,f);
+	  id2 = (int)MRIgetVoxVal(seg2,c,r,s,f);
+	  if(nrun > 0 && id1 == prev1 && id2 == prev2){
+	    nrun++;
+	    continue;
+	  }
+	  if(nrun > 0) segPairHashAdd(h,prev1,prev2,nrun);
+	  prev1 = id1;
+	  prev2 = id2;
+	  nrun = 1;
+	}
+      }
+    }
+    if(nrun > 0) segPairHashAdd(h,prev1,prev2,nrun);
+  }
+
+  // Merge the per-thread hashes
+  segPairHashInit(&all,1024);
+  for(tid=0; tid < nthreads; tid++){
+    for(k=0; k < thash[tid].nslots; k++)
+      if(thash[tid].count[k] != 0)
+	segPairHashAdd(&all,thash[tid].id1[k],thash[tid].id2[k],thash[tid].count[k]);
+    segPairHashFree(&thash[tid]);
+  }
+  free(thash);
+
+  // Pull out the pairs and sort by id1 then id2
+  pairs = (int *) calloc(sizeof(int),3*all.nused+1);
+  n = 0;
+  for(k=0; k < all.nslots; k++){
+    if(all.count[k] == 0) continue;
+    pairs[3*n+0] = all.id1[k];
+    pairs[3*n+1] = all.id2[k];
+    pairs[3*n+2] = all.count[k];
+    n++;
+  }
+  segPairHashFree(&all);
+  qsort(pairs, n, 3*sizeof(int), compare_segpairs);
+
+  ov = (SEGOVERLAP *) calloc(sizeof(SEGOVERLAP),1);
+  ov->npairs = n;
+  ov->id1   = (int *) calloc(sizeof(int),n+1);
+  ov->id2   = (int *) calloc(sizeof(int),n+1);
+  ov->count = (int *) calloc(sizeof(int),n+1);
+  idlist    = (int *) calloc(sizeof(int),2*n+1);
+  for(k=0; k < n; k++){
+    ov->id1[k]   = pairs[3*k+0];
+    ov->id2[k]   = pairs[3*k+1];
+    ov->count[k] = pairs[3*k+2];
+    idlist[2*k+0] = ov->id1[k];
+    idlist[2*k+1] = ov->id2[k];
+  }
+  free(pairs);
+
+  // Per-segid marginals over the union of the ids
+  ov->segidlist = unqiue_int_list(idlist, 2*n, &ov->nsegs);
+  free(idlist);
+  ov->n1  = (int *) calloc(sizeof(int),ov->nsegs+1);
+  ov->n2  = (int *) calloc(sizeof(int),ov->nsegs+1);
+  ov->n12 = (int *) calloc(sizeof(int),ov->nsegs+1);
+  for(k=0; k < n; k++){
+    ov->n1[MRIsegOverlapRow(ov,ov->id1[k])] += ov->count[k];
+    ov->n2[MRIsegOverlapRow(ov,ov->id2[k])] += ov->count[k];
+    if(ov->id1[k] == ov->id2[k])
+      ov->n12[MRIsegOverlapRow(ov,ov->id1[k])] += ov->count[k];
+  }
+
+  return(ov);
+}
+/*------------------------------------------------------------*/
+/*!
+  \fn int MRIsegOverlapFree(SEGOVERLAP **pov)
+  \brief Frees a table created by MRIsegOverlap().
+*/
+int MRIsegOverlapFree(SEGOVERLAP **pov)
+{
+  SEGOVERLAP *ov = *pov;
+  if(ov == NULL) return(0);
+  free(ov->id1);
+  free(ov->id2);
+  free(ov->count);
+  free(ov->segidlist);
+  free(ov->n1);
+  free(ov->n2);
+  free(ov->n12);
+  free(ov);
+  *pov = NULL;
+  return(0);
+}
+/*------------------------------------------------------------*/
+/*!
+  \fn int MRIsegOverlapRow(const SEGOVERLAP *ov, int segid)
+  \brief Returns the index of segid in ov->segidlist (and so in n1,
+  n2, and n12) or -1 if segid is in neither seg.
+*/
+int MRIsegOverlapRow(const SEGOVERLAP *ov, int segid)
+{
+  int lo = 0, hi = ov->nsegs-1, mid;
+  while(lo <= hi){
+    mid = (lo+hi)/2;
+    if(ov->segidlist[mid] == segid) return(mid);
+    if(ov->segidlist[mid] < segid) lo = mid+1;
+    else                           hi = mid-1;
+  }
+  return(-1);
+}
+/*------------------------------------------------------------*/
+/*!
+  \fn int MRIsegOverlapCount(const SEGOVERLAP *ov, int id1, int id2)
+  \brief Returns the number of voxels labeled id1 in the first seg
+  and id2 in the second, ie, one element of the confusion matrix.
+*/
+int MRIsegOverlapCount(const SEGOVERLAP *ov, int id1, int id2)
+{
+  int lo = 0, hi = ov->npairs-1, mid;
+  while(lo <= hi){
+    mid = (lo+hi)/2;
+    if(ov->id1[mid] == id1 && ov->id2[mid] == id2) return(ov->count[mid]);
+    if(ov->id1[mid] < id1 || (ov->id1[mid] == id1 && ov->id2[mid] < id2)) lo = mid+1;
+    else hi = mid-1;
+  }
+  return(0);
+}
+/*------------------------------------------------------------*/
+/*!
+  \fn double MRIsegOverlapDice(const SEGOVERLAP *ov, int segid)
+  \brief Dice coefficient 2*n12/(n1+n2) of segid. Returns 0 if the
+  segid is in neither seg.
+*/
+double MRIsegOverlapDice(const SEGOVERLAP *ov, int segid)
+{
+  int row = MRIsegOverlapRow(ov,segid);
+  if(row < 0) return(0);
+  return(2.0*ov->n12[row]/((double)ov->n1[row]+ov->n2[row]));
+}
+/*------------------------------------------------------------*/
+/*!
+  \fn double MRIsegOverlapJaccard(const SEGOVERLAP *ov, int segid)
+  \brief Jaccard coefficient n12/(n1+n2-n12) of segid. Returns 0 if
+  the segid is in neither seg.
+*/
+double MRIsegOverlapJaccard(const SEGOVERLAP *ov, int segid)
+{
+  int row = MRIsegOverlapRow(ov,segid);
+  if(row < 0) return(0);
+  return((double)ov->n12[row]/((double)ov->n1[row]+ov->n2[row]-ov->n12[row]));
+}
 
 MRI *
 MRImask_with_T2_and_aparc_aseg(MRI *mri_src, MRI *mri_dst, MRI *mri_T2, MRI *mri_aparc_aseg, float T2_thresh, int mm_from_exterior)
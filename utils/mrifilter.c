@@ -2953,6 +2953,49 @@ MRIstdNonzero(MRI *mri_src, MRI*mri_dst, MRI *mri_mean, int wsize)
 }
 
 
+#ifndef FS_CUDA
+/*-----------------------------------------------------
+  mriConvolveGaussianFloat() - the MRI_FLOAT case of
+  MRIconvolveGaussian(). Each frame is convolved src -> tmp (x),
+  tmp -> dst (y), dst -> tmp (z) and copied back row by row, so only
+  a single-frame scratch volume is needed. The source frame is read
+  only by the x pass, so src and dst may be the same volume without
+  making a copy of it.
+------------------------------------------------------*/
+static MRI *
+mriConvolveGaussianFloat(MRI *mri_src, MRI *mri_dst, float *kernel, int klen)
+{
+  int  frame, y, z, nstep ;
+  MRI  *mtmp ;
+
+  mtmp = MRIalloc(mri_src->width, mri_src->height, mri_src->depth, MRI_FLOAT) ;
+  if (mtmp == NULL)
+    ErrorExit(ERROR_NOMEMORY,
+              "mriConvolveGaussianFloat: could not allocate scratch volume") ;
+
+  nstep = (global_progress_range[0]-global_progress_range[1]) / mri_src->nframes;
+  for (frame = 0 ; frame < mri_src->nframes ; frame++)
+  {
+    global_progress_range[1] =  global_progress_range[0] + nstep/3;
+    MRIconvolve1d(mri_src, mtmp, kernel, klen, MRI_WIDTH, frame, 0) ;
+    global_progress_range[0] += nstep/3;
+    global_progress_range[1] += nstep/3;
+    MRIconvolve1d(mtmp, mri_dst, kernel, klen, MRI_HEIGHT, 0, frame) ;
+    global_progress_range[0] += nstep/3;
+    global_progress_range[1] += nstep/3;
+    MRIconvolve1d(mri_dst, mtmp, kernel, klen, MRI_DEPTH, frame, 0) ;
+    for (z = 0 ; z < mri_src->depth ; z++)
+      for (y = 0 ; y < mri_src->height ; y++)
+        memmove(&MRIFseq_vox(mri_dst, 0, y, z, frame),
+                &MRIFvox(mtmp, 0, y, z), mri_src->width*sizeof(float)) ;
+    global_progress_range[0] = global_progress_range[1];
+  }
+  MRIfree(&mtmp) ;
+  MRIcopyHeader(mri_src, mri_dst) ;
+  return(mri_dst) ;
+}
+#endif
+
 /*-----------------------------------------------------
 MRIconvolveGaussian() - see also MRIgaussianSmooth();
 ------------------------------------------------------*/
@@ -3002,6 +3045,11 @@ MRIconvolveGaussian(MRI *mri_src, MRI *mri_dst, MRI *mri_gaussian)
 
   mri_dst = MRIconvolveGaussian_cuda( mri_src, mri_dst, kernel, klen );
 #else
+  if (mri_src->type == MRI_FLOAT && width > 1 && height > 1 && depth > 1)
+  {
+    return(mriConvolveGaussianFloat(mri_src, mri_dst, kernel, klen)) ;
+  }
+
   if (mri_dst == mri_src)
   {
     mri_tmp = mri_dst = MRIclone(mri_src, NULL) ;
@@ -3539,26 +3587,28 @@ MRIconvolve1d(MRI *mri_src, MRI *mri_dst, float *k, int len, int axis,
       break ;
     case MRI_HEIGHT:
 #ifdef HAVE_OPENMP
-      #pragma omp parallel for firstprivate(y,x,foutPix,ki,i,total) shared(depth,height,width,len,halflen,mri_dst,src_frame,dst_frame,xi,yi,zi) schedule(static,1)
+      #pragma omp parallel for firstprivate(y,x,inBase,foutPix,i,total) shared(depth,height,width,len,halflen,mri_src,mri_dst,src_frame,dst_frame,k,xi,yi,zi) schedule(static,1)
 #endif
       for (z = 0 ; z < depth ; z++)
       {
         for (y = 0 ; y < height ; y++)
         {
+          /* add in one source row per tap, so that the inner loop runs
+             along contiguous rows and vectorizes. Each voxel still sums
+             its taps in kernel order. */
           foutPix = &MRIFseq_vox(mri_dst, 0, y, z, dst_frame) ;
           for (x = 0 ; x < width ; x++)
           {
-            if (x == Gx && y == Gy && z == Gz)
+            foutPix[x] = 0.0f ;
+          }
+          for (i = 0 ; i < len ; i++)
+          {
+            inBase = &MRIseq_vox(mri_src, 0, yi[y+i-halflen], z, src_frame) ;
+            total = k[i] ;
+            for (x = 0 ; x < width ; x++)
             {
-              DiagBreak() ;
+              foutPix[x] += total * (float)inBase[x] ;
             }
-            total = 0.0f ;
-
-            for (ki = k, i = 0 ; i < len ; i++)
-              total += *ki++ *
-                       (float)(MRIseq_vox(mri_src, x,yi[y+i-halflen],z, src_frame));
-
-            *foutPix++ = total ;
           }
         }
         exec_progress_callback(z, depth, 0, 1);
@@ -3566,22 +3616,28 @@ MRIconvolve1d(MRI *mri_src, MRI *mri_dst, float *k, int len, int axis,
       break ;
     case MRI_DEPTH:
 #ifdef HAVE_OPENMP
-      #pragma omp parallel for firstprivate(y,x,foutPix,ki,i,total) shared(depth,height,width,len,halflen,mri_dst,src_frame,dst_frame,xi,yi,zi) schedule(static,1)
+      #pragma omp parallel for firstprivate(y,x,inBase,foutPix,i,total) shared(depth,height,width,len,halflen,mri_src,mri_dst,src_frame,dst_frame,k,xi,yi,zi) schedule(static,1)
 #endif
       for (z = 0 ; z < depth ; z++)
       {
         for (y = 0 ; y < height ; y++)
         {
+          /* add in one source row per tap, so that the inner loop runs
+             along contiguous rows and vectorizes. Each voxel still sums
+             its taps in kernel order. */
           foutPix = &MRIFseq_vox(mri_dst, 0, y, z, dst_frame) ;
           for (x = 0 ; x < width ; x++)
           {
-            total = 0.0f ;
-
-            for (ki = k, i = 0 ; i < len ; i++)
-              total += *ki++ *
-                       (float)(MRIseq_vox(mri_src, x,y,zi[z+i-halflen], src_frame));
-
-            *foutPix++ = total ;
+            foutPix[x] = 0.0f ;
+          }
+          for (i = 0 ; i < len ; i++)
+          {
+            inBase = &MRIseq_vox(mri_src, 0, y, zi[z+i-halflen], src_frame) ;
+            total = k[i] ;
+            for (x = 0 ; x < width ; x++)
+            {
+              foutPix[x] += total * (float)inBase[x] ;
+            }
           }
         }
         exec_progress_callback(z, depth, 0, 1);
@@ -3623,27 +3679,28 @@ MRIconvolve1d(MRI *mri_src, MRI *mri_dst, float *k, int len, int axis,
       break ;
     case MRI_HEIGHT:
 #ifdef HAVE_OPENMP
-      #pragma omp parallel for firstprivate(y,x,foutPix,ki,i,total) shared(depth,height,width,len,halflen,mri_dst,src_frame,dst_frame,xi,yi,zi) schedule(static,1)
+      #pragma omp parallel for firstprivate(y,x,inBase_f,foutPix,i,total) shared(depth,height,width,len,halflen,mri_src,mri_dst,src_frame,dst_frame,k,xi,yi,zi) schedule(static,1)
 #endif
       for (z = 0 ; z < depth ; z++)
       {
         for (y = 0 ; y < height ; y++)
         {
+          /* add in one source row per tap, so that the inner loop runs
+             along contiguous rows and vectorizes. Each voxel still sums
+             its taps in kernel order. */
           foutPix = &MRIFseq_vox(mri_dst, 0, y, z, dst_frame) ;
           for (x = 0 ; x < width ; x++)
           {
-            total = 0.0f ;
-
-            if (x == Gx && y == Gy && z == Gz)
+            foutPix[x] = 0.0f ;
+          }
+          for (i = 0 ; i < len ; i++)
+          {
+            inBase_f = &MRIFseq_vox(mri_src, 0, yi[y+i-halflen], z, src_frame) ;
+            total = k[i] ;
+            for (x = 0 ; x < width ; x++)
             {
-              DiagBreak() ;
+              foutPix[x] += total * inBase_f[x] ;
             }
-
-            for (ki = k, i = 0 ; i < len ; i++)
-              total += *ki++ *
-                       MRIFseq_vox(mri_src, x,yi[y+i-halflen],z, src_frame);
-
-            *foutPix++ = total ;
           }
         }
         exec_progress_callback(z, depth, 0, 1);
@@ -3651,22 +3708,28 @@ MRIconvolve1d(MRI *mri_src, MRI *mri_dst, float *k, int len, int axis,
       break ;
     case MRI_DEPTH:
 #ifdef HAVE_OPENMP
-      #pragma omp parallel for firstprivate(y,x,foutPix,ki,i,total) shared(depth,height,width,len,halflen,mri_dst,src_frame,dst_frame,xi,yi,zi) schedule(static,1)
+      #pragma omp parallel for firstprivate(y,x,inBase_f,foutPix,i,total) shared(depth,height,width,len,halflen,mri_src,mri_dst,src_frame,dst_frame,k,xi,yi,zi) schedule(static,1)
 #endif
       for (z = 0 ; z < depth ; z++)
       {
         for (y = 0 ; y < height ; y++)
         {
+          /* add in one source row per tap, so that the inner loop runs
+             along contiguous rows and vectorizes. Each voxel still sums
+             its taps in kernel order. */
           foutPix = &MRIFseq_vox(mri_dst, 0, y, z, dst_frame) ;
           for (x = 0 ; x < width ; x++)
           {
-            total = 0.0f ;
-
-            for (ki = k, i = 0 ; i < len ; i++)
-              total += *ki++ *
-                       MRIFseq_vox(mri_src, x,y,zi[z+i-halflen], src_frame);
-
-            *foutPix++ = total ;
+            foutPix[x] = 0.0f ;
+          }
+          for (i = 0 ; i < len ; i++)
+          {
+            inBase_f = &MRIFseq_vox(mri_src, 0, y, zi[z+i-halflen], src_frame) ;
+            total = k[i] ;
+            for (x = 0 ; x < width ; x++)
+            {
+              foutPix[x] += total * inBase_f[x] ;
+            }
           }
         }
         exec_progress_callback(z, depth, 0, 1);
@@ -12663,18 +12663,85 @@ znzTAGreadMRIframes(znzFile fp, MRI *mri, long len)
 // declare function pointer
 //static int (*myclose)(FILE *stream);
 
+/*!
+  \fn static void mghSwapBytes(void *buf, long nbytes, int bpv)
+  \brief Converts nbytes of big-endian mgh voxel data in buf to host
+  order in place. bpv is the number of bytes per voxel.
+*/
+static void mghSwapBytes(void *buf, long nbytes, int bpv)
+{
+  switch (bpv)
+  {
+  case 2:
+    ByteSwap2(buf, nbytes) ;
+    break ;
+  case 4:
+    ByteSwap4(buf, nbytes) ;
+    break ;
+  case 8:
+    ByteSwap8(buf, nbytes) ;
+    break ;
+  }
+}
+
+/*
+  mghReadFrames() - reads nframes frames of voxel data from the
+  current position of an mgh/mgz file into frames dst_frame,
+  dst_frame+1, ... of mri. Each slice is read straight into the
+  volume (no temp buffer) and the bytes of the whole slice are
+  reordered at once.
+*/
+static int
+mghReadFrames(znzFile fp, MRI *mri, int dst_frame, int nframes, int bpv,
+              const char *fname)
+{
+  int frame, y, z, k, bytes, rowbytes, contig, nread ;
+
+  rowbytes = mri->width * bpv ;
+  bytes = rowbytes * mri->height ;  /* bytes per slice */
+  for (frame = dst_frame ; frame < dst_frame+nframes ; frame++)
+  {
+    for (z = 0 ; z < mri->depth ; z++)
+    {
+      k = z + frame*mri->depth ;
+      contig = (mri->slices[k][mri->height-1] ==
+                mri->slices[k][0] + (size_t)(mri->height-1)*rowbytes) ;
+      if (contig)
+        nread = ((int)znzread(mri->slices[k][0], sizeof(char), bytes, fp)
+                 == bytes) ;
+      else // rows are not contiguous, read one row at a time
+        for (nread = 1, y = 0 ; nread && y < mri->height ; y++)
+          nread = ((int)znzread(mri->slices[k][y], sizeof(char), rowbytes, fp)
+                   == rowbytes) ;
+      if (!nread)
+        ErrorReturn
+        (ERROR_BADFILE,
+         (ERROR_BADFILE,
+          "mghRead(%s): could not read %d bytes at slice %d",
+          fname, bytes, z)) ;
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+      if (contig)
+        mghSwapBytes(mri->slices[k][0], bytes, bpv) ;
+      else
+        for (y = 0 ; y < mri->height ; y++)
+          mghSwapBytes(mri->slices[k][y], rowbytes, bpv) ;
+#endif
+      exec_progress_callback(z, mri->depth, frame-dst_frame, nframes);
+    }
+  }
+  return(NO_ERROR) ;
+}
+
 static MRI *
 mghRead(const char *fname, int read_volume, int frame)
 {
   MRI  *mri ;
   znzFile fp;
-  int   start_frame, end_frame, width, height, depth, nframes, type, x, y, z,
-  bpv, dof, bytes, version, ival, unused_space_size, good_ras_flag, i ;
-  BUFTYPE *buf ;
+  int   start_frame, end_frame, width, height, depth, nframes, type,
+  bpv, dof, version, unused_space_size, good_ras_flag ;
   char   unused_buf[UNUSED_SPACE_SIZE+1] ;
   float  fval, xsize, ysize, zsize, x_r, x_a, x_s, y_r, y_a, y_s,
   z_r, z_a, z_s, c_r, c_a, c_s, xfov, yfov, zfov ;
-  short  sval ;
   //  int tag_data_size;
   char *ext;
   int gzipped=0;
@@ -12785,38 +12852,21 @@ mghRead(const char *fname, int read_volume, int frame)
     nframes = 9 ;
     break ;
   }
-  bytes = width * height * bpv ;  /* bytes per slice */
   if (!read_volume)
   {
     mri = MRIallocHeader(width, height, depth, type, nframes) ;
     mri->dof = dof ;
     mri->nframes = nframes ;
-    if (gzipped)
-    { // pipe cannot seek
-      long count, total_bytes;
-      uchar buf[STRLEN] ;
-
-      total_bytes = (long)mri->nframes*width*height*depth*bpv ;
-      for (count=0; count < total_bytes-STRLEN; count += STRLEN)
-        znzread(buf, STRLEN, 1, fp);
-      znzread(buf, total_bytes-count, 1, fp) ;
-    }
-    else
-      znzseek(fp, (long)mri->nframes*width*height*depth*bpv, SEEK_CUR) ;
+    // gzseek() inflates forward in large blocks for .mgz
+    znzseek(fp, (long)mri->nframes*width*height*depth*bpv, SEEK_CUR) ;
   }
   else
   {
     if (frame >= 0)
     {
       start_frame = end_frame = frame ;
-      if (gzipped)
-      { // pipe cannot seek
-        long count;
-        for (count=0; count < (long)frame*width*height*depth*bpv; count++)
-          znzgetc(fp);
-      }
-      else
-        znzseek(fp, (long)frame*width*height*depth*bpv, SEEK_CUR) ;
+      // gzseek() inflates forward in large blocks for .mgz
+      znzseek(fp, (long)frame*width*height*depth*bpv, SEEK_CUR) ;
       nframes = 1 ;
     }
     else
@@ -12832,71 +12882,30 @@ mghRead(const char *fname, int read_volume, int frame)
       if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON)
         fprintf(stderr, "read %d frames\n", nframes);
     }
-    buf = (BUFTYPE *)calloc(bytes, sizeof(BUFTYPE)) ;
+    switch (type)
+    {
+    case MRI_UCHAR:
+    case MRI_SHORT:
+    case MRI_INT:
+    case MRI_FLOAT:
+    case MRI_TENSOR:
+      break ;
+    default:
+      znzclose(fp);
+      errno = 0;
+      ErrorReturn(NULL,
+                  (ERROR_UNSUPPORTED, "mghRead: unsupported type %d",
+                   type)) ;
+    }
     mri = MRIallocSequence(width, height, depth, type, nframes) ;
     mri->dof = dof ;
-    for (frame = start_frame ; frame <= end_frame ; frame++)
+    if (mghReadFrames(fp, mri, 0, end_frame-start_frame+1, bpv, fname)
+        != NO_ERROR)
     {
-      for (z = 0 ; z < depth ; z++)
-      {
-        if ((int)znzread(buf, sizeof(char), bytes, fp) != bytes)
-        {
-          // fclose(fp) ;
-          znzclose(fp);
-          free(buf) ;
-          ErrorReturn
-          (NULL,
-           (ERROR_BADFILE,
-            "mghRead(%s): could not read %d bytes at slice %d",
-            fname, bytes, z)) ;
-        }
-        switch (type)
-        {
-        case MRI_INT:
-          for (i = y = 0 ; y < height ; y++)
-          {
-            for (x = 0 ; x < width ; x++, i++)
-            {
-              ival = orderIntBytes(((int *)buf)[i]) ;
-              MRIIseq_vox(mri,x,y,z,frame-start_frame) = ival ;
-            }
-          }
-          break ;
-        case MRI_SHORT:
-          for (i = y = 0 ; y < height ; y++)
-          {
-            for (x = 0 ; x < width ; x++, i++)
-            {
-              sval = orderShortBytes(((short *)buf)[i]) ;
-              MRISseq_vox(mri,x,y,z,frame-start_frame) = sval ;
-            }
-          }
-          break ;
-        case MRI_TENSOR:
-        case MRI_FLOAT:
-          for (i = y = 0 ; y < height ; y++)
-          {
-            for (x = 0 ; x < width ; x++, i++)
-            {
-              fval = orderFloatBytes(((float *)buf)[i]) ;
-              MRIFseq_vox(mri,x,y,z,frame-start_frame) = fval ;
-            }
-          }
-          break ;
-        case MRI_UCHAR:
-          local_buffer_to_image(buf, mri, z, frame-start_frame) ;
-          break ;
-        default:
-          errno = 0;
-          ErrorReturn(NULL,
-                      (ERROR_UNSUPPORTED, "mghRead: unsupported type %d",
-                       mri->type)) ;
-          break ;
-        }
-        exec_progress_callback(z, depth, frame-start_frame, end_frame-start_frame+1);
-      }
+      znzclose(fp);
+      MRIfree(&mri) ;
+      return(NULL) ;
     }
-    if (buf) free(buf) ;
   }
 
   if (good_ras_flag > 0)
@@ -13073,75 +13082,23 @@ mghRead(const char *fname, int read_volume, int frame)
   return(mri) ;
 }
 
+/*
+  mghWriteHeader() - writes the mgh header of mri, giving the number
+  of frames as nframes.
+  WARNING - adding or removing anything before nframes will
+  cause mghAppend to fail.
+*/
 static int
-mghWrite(MRI *mri, const char *fname, int frame)
+mghWriteHeader(znzFile fp, MRI *mri, int nframes)
 {
-  znzFile fp;
-  int   ival, start_frame, end_frame, x, y, z, width, height, depth,
-  unused_space_size, flen ;
+  int   unused_space_size ;
   char  buf[UNUSED_SPACE_SIZE+1] ;
-  float fval ;
-  short sval ;
-  int gzipped = 0;
-  char *ext;
 
-  if (frame >= 0)
-    start_frame = end_frame = frame ;
-  else
-  {
-    start_frame = 0 ;
-    end_frame = mri->nframes-1 ;
-  }
-  ////////////////////////////////////////////////////////////
-  ext = strrchr(fname, '.') ;
-  int valid_ext = 0;
-  if (ext)
-  {
-    ++ext;
-    // if mgz, then it is compressed
-    if (!stricmp(ext, "mgz") || strstr(fname, "mgh.gz"))
-    {
-      gzipped = 1;
-      valid_ext = 1;
-    }
-    else if (!stricmp(ext, "mgh"))
-    {
-      valid_ext = 1;
-    }
-  }
-  if ( valid_ext )
-  {
-    fp = znzopen(fname, "wb", gzipped) ;
-    if (znz_isnull(fp))
-    {
-      errno = 0;
-      ErrorReturn
-          (ERROR_BADPARM,
-           (ERROR_BADPARM,"mghWrite(%s, %d): could not open file",
-            fname, frame)) ;
-    }
-  }
-  else
-  {
-    errno = 0;
-    ErrorReturn(ERROR_BADPARM,
-                (ERROR_BADPARM,"mghWrite: filename '%s' "
-                 "needs to have an extension of .mgh or .mgz",
-                 fname)) ;
-  }
-
-  /* WARNING - adding or removing anything before nframes will
-     cause mghAppend to fail.
-  */
-  width = mri->width ;
-  height = mri->height ;
-  depth = mri->depth ;
-  //printf("(w,h,d) = (%d,%d,%d)\n", width, height, depth);
   znzwriteInt(MGH_VERSION, fp) ;
   znzwriteInt(mri->width, fp) ;
   znzwriteInt(mri->height, fp) ;
   znzwriteInt(mri->depth, fp) ;
-  znzwriteInt(mri->nframes, fp) ;
+  znzwriteInt(nframes, fp) ;
   znzwriteInt(mri->type, fp) ;
   znzwriteInt(mri->dof, fp) ;
 
@@ -13172,7 +13129,24 @@ mghWrite(MRI *mri, const char *fname, int frame)
   /* so stuff can be added to the header in the future */
   memset(buf, 0, UNUSED_SPACE_SIZE*sizeof(char)) ;
   znzwrite(buf, sizeof(char), unused_space_size, fp) ;
+  return(NO_ERROR) ;
+}
+
+/*
+  mghWriteFrames() - writes the voxel data of frames start_frame
+  to end_frame of mri.
+*/
+static int
+mghWriteFrames(znzFile fp, MRI *mri, int start_frame, int end_frame,
+               const char *fname)
+{
+  int   ival, frame, x, y, z, width, height, depth ;
+  float fval ;
+  short sval ;
 
+  width = mri->width ;
+  height = mri->height ;
+  depth = mri->depth ;
   for (frame = start_frame ; frame <= end_frame ; frame++)
   {
     for (z = 0 ; z < depth ; z++)
@@ -13237,6 +13211,18 @@ mghWrite(MRI *mri, const char *fname, int frame)
     }
   }
 
+  return(NO_ERROR) ;
+}
+
+/*
+  mghWriteTail() - writes the scan parameters and tags that follow the
+  voxel data
+*/
+static int
+mghWriteTail(znzFile fp, MRI *mri)
+{
+  int   flen ;
+
   znzwriteFloat(mri->tr, fp) ;
   znzwriteFloat(mri->flip_angle, fp) ;
   znzwriteFloat(mri->te, fp) ;
@@ -13289,7 +13275,70 @@ mghWrite(MRI *mri, const char *fname, int frame)
                   mri->cmdlines[i],
                   strlen(mri->cmdlines[i])+1) ;
   }
+  return(NO_ERROR) ;
+}
 
+static int
+mghWrite(MRI *mri, const char *fname, int frame)
+{
+  znzFile fp;
+  int   start_frame, end_frame, err ;
+  int gzipped = 0;
+  char *ext;
+
+  if (frame >= 0)
+    start_frame = end_frame = frame ;
+  else
+  {
+    start_frame = 0 ;
+    end_frame = mri->nframes-1 ;
+  }
+  ////////////////////////////////////////////////////////////
+  ext = strrchr(fname, '.') ;
+  int valid_ext = 0;
+  if (ext)
+  {
+    ++ext;
+    // if mgz, then it is compressed
+    if (!stricmp(ext, "mgz") || strstr(fname, "mgh.gz"))
+    {
+      gzipped = 1;
+      valid_ext = 1;
+    }
+    else if (!stricmp(ext, "mgh"))
+    {
+      valid_ext = 1;
+    }
+  }
+  if ( valid_ext )
+  {
+    fp = znzopen(fname, "wb", gzipped) ;
+    if (znz_isnull(fp))
+    {
+      errno = 0;
+      ErrorReturn
+          (ERROR_BADPARM,
+           (ERROR_BADPARM,"mghWrite(%s, %d): could not open file",
+            fname, frame)) ;
+    }
+  }
+  else
+  {
+    errno = 0;
+    ErrorReturn(ERROR_BADPARM,
+                (ERROR_BADPARM,"mghWrite: filename '%s' "
+                 "needs to have an extension of .mgh or .mgz",
+                 fname)) ;
+  }
+
+  mghWriteHeader(fp, mri, mri->nframes) ;
+  err = mghWriteFrames(fp, mri, start_frame, end_frame, fname) ;
+  if (err != NO_ERROR)
+  {
+    znzclose(fp);
+    return(err) ;
+  }
+  mghWriteTail(fp, mri) ;
 
   // fclose(fp) ;
   znzclose(fp);
@@ -13297,6 +13346,317 @@ mghWrite(MRI *mri, const char *fname, int frame)
   return(NO_ERROR) ;
 }
 
+/*
+  mghStreamOpen() - opens an .mgh/.mgz file for MRIframeStream*(),
+  returns a null znzFile if the name does not have an mgh extension
+  or a '#' frame selector.
+*/
+static znzFile
+mghStreamOpen(const char *fname, const char *mode)
+{
+  char *ext ;
+  int  gzipped ;
+
+  if (strchr(fname, '#'))
+    return(NULL) ;
+  ext = strrchr(fname, '.') ;
+  if (ext == NULL)
+    return(NULL) ;
+  ext++ ;
+  if (!stricmp(ext, "mgz") || strstr(fname, "mgh.gz"))
+    gzipped = 1 ;
+  else if (!stricmp(ext, "mgh"))
+    gzipped = 0 ;
+  else
+    return(NULL) ;
+  return(znzopen(fname, mode, gzipped)) ;
+}
+
+static int
+mghStreamBytesPerVoxel(int type)
+{
+  switch (type)
+  {
+  case MRI_UCHAR:
+    return(sizeof(char)) ;
+  case MRI_SHORT:
+    return(sizeof(short)) ;
+  case MRI_INT:
+    return(sizeof(int)) ;
+  case MRI_FLOAT:
+    return(sizeof(float)) ;
+  default:
+    return(0) ;
+  }
+}
+
+/*!
+  \fn MRI_FRAME_STREAM *MRIframeStreamOpenRead(const char *fname)
+  \brief Opens a volume for reading its frames a few at a time with
+  MRIframeStreamRead(). fs->mri holds the header of the whole volume
+  (fs->nframes frames, no voxel data). .mgh and .mgz files are read
+  sequentially from disk, so only the frames asked for are in memory.
+  Other formats are read whole on open and the frames are handed out
+  from the copy in memory.
+*/
+MRI_FRAME_STREAM *
+MRIframeStreamOpenRead(const char *fname)
+{
+  MRI_FRAME_STREAM *fs ;
+  znzFile          fp ;
+  int              hdr[7], n ;
+
+  if (strlen(fname) >= STRLEN)
+    ErrorReturn(NULL, (ERROR_BADPARM, "MRIframeStreamOpenRead(%s): file name too long",
+                       fname)) ;
+  fs = (MRI_FRAME_STREAM *)calloc(1, sizeof(MRI_FRAME_STREAM)) ;
+  if (fs == NULL)
+    ErrorExit(ERROR_NOMEMORY, "MRIframeStreamOpenRead(%s): could not allocate",
+              fname) ;
+  strcpy(fs->fname, fname) ;
+  fs->mri = MRIreadHeader(fname, MRI_VOLUME_TYPE_UNKNOWN) ;
+  if (fs->mri == NULL)
+  {
+    free(fs) ;
+    return(NULL) ;
+  }
+  fs->nframes = fs->mri->nframes ;
+
+  fp = NULL ;
+  if (mri_identify(fname) == MRI_MGH_FILE &&
+      mghStreamBytesPerVoxel(fs->mri->type) > 0)
+    fp = mghStreamOpen(fname, "rb") ;
+  if (!znz_isnull(fp))
+  {
+    // version, width, height, depth, nframes, type, dof
+    for (n = 0 ; n < 7 ; n++)
+      hdr[n] = znzreadInt(fp) ;
+    if (hdr[1] != fs->mri->width || hdr[2] != fs->mri->height ||
+        hdr[3] != fs->mri->depth || hdr[4] != fs->nframes ||
+        hdr[5] != fs->mri->type)
+    {
+      znzclose(fp) ;
+      MRIfree(&fs->mri) ;
+      free(fs) ;
+      ErrorReturn(NULL, (ERROR_BADFILE,
+                         "MRIframeStreamOpenRead(%s): inconsistent header",
+                         fname)) ;
+    }
+    // the rest of the header is a fixed size
+    znzseek(fp, UNUSED_SPACE_SIZE, SEEK_CUR) ;
+    fs->fp = fp ;
+  }
+  else
+  {
+    fs->mri_all = MRIread(fname) ;
+    if (fs->mri_all == NULL)
+    {
+      MRIfree(&fs->mri) ;
+      free(fs) ;
+      return(NULL) ;
+    }
+  }
+  return(fs) ;
+}
+
+/*!
+  \fn MRI *MRIframeStreamAlloc(MRI_FRAME_STREAM *fs, int nframes)
+  \brief Allocates a volume of nframes frames with the geometry, type
+  and header of the stream, to be filled by MRIframeStreamRead() (or
+  passed to MRIframeStreamWrite()). The same volume can be reused for
+  every call.
+*/
+MRI *
+MRIframeStreamAlloc(MRI_FRAME_STREAM *fs, int nframes)
+{
+  MRI *mri ;
+
+  mri = MRIallocSequence(fs->mri->width, fs->mri->height, fs->mri->depth,
+                         fs->mri->type, nframes) ;
+  if (mri == NULL)
+    return(NULL) ;
+  MRIcopyHeader(fs->mri, mri) ;
+  return(mri) ;
+}
+
+/*!
+  \fn int MRIframeStreamRead(MRI_FRAME_STREAM *fs, MRI *mri, int nframes)
+  \brief Reads the next nframes frames of the stream (or however many
+  are left) into frames 0, 1, ... of mri, which must have the
+  geometry and type of the stream (see MRIframeStreamAlloc()).
+  Returns the number of frames read, 0 at the end of the volume and
+  -1 on error.
+*/
+int
+MRIframeStreamRead(MRI_FRAME_STREAM *fs, MRI *mri, int nframes)
+{
+  int n, frame ;
+
+  if (fs->writing)
+    ErrorReturn(-1, (ERROR_BADPARM,
+                     "MRIframeStreamRead(%s): stream is open for writing",
+                     fs->fname)) ;
+  if (mri->width != fs->mri->width || mri->height != fs->mri->height ||
+      mri->depth != fs->mri->depth || mri->type != fs->mri->type)
+    ErrorReturn(-1, (ERROR_BADPARM,
+                     "MRIframeStreamRead(%s): volume does not match stream",
+                     fs->fname)) ;
+  n = MIN(nframes, fs->nframes - fs->frame) ;
+  n = MIN(n, mri->nframes) ;
+  if (n <= 0)
+    return(0) ;
+
+  if (fs->fp)
+  {
+    if (mghReadFrames(fs->fp, mri, 0, n, mghStreamBytesPerVoxel(mri->type),
+                      fs->fname) != NO_ERROR)
+      return(-1) ;
+  }
+  else
+  {
+    for (frame = 0 ; frame < n ; frame++)
+      MRIcopyFrame(fs->mri_all, mri, fs->frame+frame, frame) ;
+  }
+  fs->frame += n ;
+  return(n) ;
+}
+
+/*!
+  \fn MRI_FRAME_STREAM *MRIframeStreamOpenWrite(const char *fname, MRI *mri_template, int nframes)
+  \brief Opens a volume of nframes frames for writing a few frames at
+  a time with MRIframeStreamWrite(). The geometry, type and header
+  come from mri_template. .mgh and .mgz files are written as the
+  frames come in. Other formats are collected in memory and written
+  by MRIframeStreamClose().
+*/
+MRI_FRAME_STREAM *
+MRIframeStreamOpenWrite(const char *fname, MRI *mri_template, int nframes)
+{
+  MRI_FRAME_STREAM *fs ;
+  znzFile          fp ;
+
+  if (strlen(fname) >= STRLEN)
+    ErrorReturn(NULL, (ERROR_BADPARM, "MRIframeStreamOpenWrite(%s): file name too long",
+                       fname)) ;
+  fs = (MRI_FRAME_STREAM *)calloc(1, sizeof(MRI_FRAME_STREAM)) ;
+  if (fs == NULL)
+    ErrorExit(ERROR_NOMEMORY, "MRIframeStreamOpenWrite(%s): could not allocate",
+              fname) ;
+  strcpy(fs->fname, fname) ;
+  fs->writing = 1 ;
+  fs->nframes = nframes ;
+  fs->mri = MRIallocHeader(mri_template->width, mri_template->height,
+                           mri_template->depth, mri_template->type, nframes) ;
+  MRIcopyHeader(mri_template, fs->mri) ;
+
+  fp = NULL ;
+  if (mri_identify(fname) == MRI_MGH_FILE &&
+      mghStreamBytesPerVoxel(fs->mri->type) > 0)
+    fp = mghStreamOpen(fname, "wb") ;
+  if (!znz_isnull(fp))
+  {
+    mghWriteHeader(fp, fs->mri, nframes) ;
+    fs->fp = fp ;
+  }
+  else
+  {
+    fs->mri_all = MRIallocSequence(fs->mri->width, fs->mri->height,
+                                   fs->mri->depth, fs->mri->type, nframes) ;
+    if (fs->mri_all == NULL)
+    {
+      MRIfree(&fs->mri) ;
+      free(fs) ;
+      return(NULL) ;
+    }
+    MRIcopyHeader(fs->mri, fs->mri_all) ;
+  }
+  return(fs) ;
+}
+
+/*!
+  \fn int MRIframeStreamWrite(MRI_FRAME_STREAM *fs, MRI *mri, int nframes)
+  \brief Appends frames 0 to nframes-1 of mri to the stream. mri must
+  have the geometry and type of the stream.
+*/
+int
+MRIframeStreamWrite(MRI_FRAME_STREAM *fs, MRI *mri, int nframes)
+{
+  int frame, err ;
+
+  if (!fs->writing)
+    ErrorReturn(ERROR_BADPARM,
+                (ERROR_BADPARM,
+                 "MRIframeStreamWrite(%s): stream is open for reading",
+                 fs->fname)) ;
+  if (mri->width != fs->mri->width || mri->height != fs->mri->height ||
+      mri->depth != fs->mri->depth || mri->type != fs->mri->type ||
+      nframes > mri->nframes)
+    ErrorReturn(ERROR_BADPARM,
+                (ERROR_BADPARM,
+                 "MRIframeStreamWrite(%s): volume does not match stream",
+                 fs->fname)) ;
+  if (fs->frame + nframes > fs->nframes)
+    ErrorReturn(ERROR_BADPARM,
+                (ERROR_BADPARM,
+                 "MRIframeStreamWrite(%s): %d frames is more than the %d "
+                 "the stream was opened for", fs->fname, fs->frame+nframes,
+                 fs->nframes)) ;
+
+  if (fs->fp)
+  {
+    err = mghWriteFrames(fs->fp, mri, 0, nframes-1, fs->fname) ;
+    if (err != NO_ERROR)
+      return(err) ;
+  }
+  else
+  {
+    for (frame = 0 ; frame < nframes ; frame++)
+      MRIcopyFrame(mri, fs->mri_all, frame, fs->frame+frame) ;
+  }
+  fs->frame += nframes ;
+  return(NO_ERROR) ;
+}
+
+/*!
+  \fn int MRIframeStreamClose(MRI_FRAME_STREAM **pfs)
+  \brief Closes a frame stream. A stream open for writing is finished
+  here (the header tail, or the whole volume for formats that are not
+  streamed); it is an error if fewer frames were written than it was
+  opened for.
+*/
+int
+MRIframeStreamClose(MRI_FRAME_STREAM **pfs)
+{
+  MRI_FRAME_STREAM *fs ;
+  int              err = NO_ERROR ;
+
+  fs = *pfs ;
+  *pfs = NULL ;
+  if (fs == NULL)
+    return(NO_ERROR) ;
+
+  if (fs->writing && fs->frame != fs->nframes)
+  {
+    ErrorPrintf(ERROR_BADFILE, "MRIframeStreamClose(%s): %d of %d frames "
+                "written", fs->fname, fs->frame, fs->nframes) ;
+    err = ERROR_BADFILE ;
+  }
+  if (fs->fp)
+  {
+    if (fs->writing)
+      mghWriteTail(fs->fp, fs->mri) ;
+    znzclose(fs->fp) ;
+  }
+  else if (fs->writing && err == NO_ERROR)
+    err = MRIwrite(fs->mri_all, fs->fname) ;
+
+  if (fs->mri_all)
+    MRIfree(&fs->mri_all) ;
+  MRIfree(&fs->mri) ;
+  free(fs) ;
+  return(err) ;
+}
+
 /*!
 \fn MRI *MRIreorder4(MRI *mri, int order[4])
 \brief Can reorders all 4 dimensions. Just copies old header to new.
@@ -2761,6 +2761,9 @@ MRImask(MRI *mri_src, MRI *mri_mask, MRI *mri_dst, int mask, float out_val)
     (NULL,
      (ERROR_UNSUPPORTED, "MRImask: src and dst must be same type")) ;
 
+  if (MRItypedMask(mri_src, mri_mask, mri_dst, mask, out_val) == NO_ERROR)
+    return(mri_dst) ;
+
   for (z = 0 ; z < depth ; z++)
   {
     for (y = 0 ; y < height ; y++)
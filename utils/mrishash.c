@@ -50,6 +50,10 @@
 
 #include "mrishash.h"
 
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
 //==================================================================
 // Local macros
 //==================================================================
@@ -138,6 +142,11 @@ static void mhtVertex2xyz_double(VERTEX * vtx,
 static void mhtVertex2Ptxyz_double(VERTEX * vtx, int which, Ptdbl_t *pt);
 static void mhtVertex2array3_double(VERTEX * vtx, int which, double *array3);
 
+static MHTS *mhtFindSlot(MRIS_HASH_TABLE *mht, int xv, int yv, int zv);
+static MHBT *mhtFindBucket(MRIS_HASH_TABLE *mht, int xv, int yv, int zv);
+static MHBT *mhtAllocBucket(MRIS_HASH_TABLE *mht, int xv, int yv, int zv);
+static int   mhtBucketStats(MRIS_HASH_TABLE *mht, const char *caller);
+
 static int mhtAddFaceOrVertexAtCoords(MRIS_HASH_TABLE *mht,
                                       float x, float y, float z,
                                       int forvnum);
@@ -211,8 +220,6 @@ MRIS_HASH_TABLE * MHTfillTableAtResolution(
 {
   int     fno ;
   FACE    *f ;
-  int     xv, yv, zv ;
-  MHBT    *bucket ;
   static int ncalls = 0 ;
 
   mhtStoreFaceCentroids(mris, which) ;
@@ -229,14 +236,6 @@ MRIS_HASH_TABLE * MHTfillTableAtResolution(
               __MYFUNCTION__) ;
   }
 
-  for (xv = 0 ; xv < TABLE_SIZE ; xv++)
-  {
-    for (yv = 0 ; yv < TABLE_SIZE ; yv++)
-    {
-      mht->buckets[xv][yv] = NULL ;
-    }
-  }
-
   //--------------------------------------
   // Capture data from caller and surface
   //--------------------------------------
@@ -258,55 +257,7 @@ MRIS_HASH_TABLE * MHTfillTableAtResolution(
   // Diagnostics
   //-------------------------------------------
   if ((Gdiag & DIAG_SHOW) && !ncalls)
-  {
-    double mean, var, v, n ;
-    int    mx ;
-
-    n = mean = 0.0 ;
-    mx = -1 ;
-    for (xv = 0 ; xv < TABLE_SIZE ; xv++)
-    {
-      for (yv = 0 ; yv < TABLE_SIZE ; yv++)
-      {
-        for (zv = 0 ; zv < TABLE_SIZE ; zv++)
-        {
-          if (!mht->buckets[xv][yv] || !mht->buckets[xv][yv][zv])
-            continue ;
-          bucket = mht->buckets[xv][yv][zv] ;
-          if (bucket->nused)
-          {
-            mean += bucket->nused ;
-            n++ ;
-          }
-          if (bucket->nused > mx)
-            mx = bucket->nused ;
-        }
-      }
-    }
-    mean /= n ;
-    var = 0.0 ;
-    for (xv = 0 ; xv < TABLE_SIZE ; xv++)
-    {
-      for (yv = 0 ; yv < TABLE_SIZE ; yv++)
-      {
-        if (!mht->buckets[xv][yv])
-          continue ;
-        for (zv = 0 ; zv < TABLE_SIZE ; zv++)
-        {
-          bucket = mht->buckets[xv][yv][zv] ;
-          if (bucket && bucket->nused)
-          {
-            v = mean - bucket->nused ;
-            var += v*v ;
-          }
-        }
-      }
-    }
-    var /= (n-1) ;
-    if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON)
-      fprintf(stderr, "%s buckets: mean = %2.1f +- %2.2f, max = %d\n",
-              __MYFUNCTION__, mean, sqrt(var), mx) ;
-  }
+    mhtBucketStats(mht, __MYFUNCTION__) ;
   ncalls++ ;
   return(mht) ;
 }
@@ -616,9 +567,7 @@ MRIS_HASH_TABLE *MHTfillVertexTableRes(
 //---------------------------------------------------------
 {
   int     vno ;
-  int     xv, yv, zv ;
   float   x=0.0, y=0.0, z=0.0;
-  MHBT    *bucket ;
   VERTEX  *v ;
   static int ncalls = 0 ;
 
@@ -633,14 +582,6 @@ MRIS_HASH_TABLE *MHTfillVertexTableRes(
     ErrorExit(ERROR_NO_MEMORY,
               "%s: could not allocate hash table.\n", __MYFUNCTION__ ) ;
 
-  for (xv = 0 ; xv < TABLE_SIZE ; xv++)
-  {
-    for (yv = 0 ; yv < TABLE_SIZE ; yv++)
-    {
-      mht->buckets[xv][yv] = NULL ;
-    }
-  }
-
   //--------------------------------------
   // Capture data from caller and surface
   //--------------------------------------
@@ -662,58 +603,9 @@ MRIS_HASH_TABLE *MHTfillVertexTableRes(
 
   //-------------------------------------------
   // Diagnostics
-  // Not modified from 1.27
   //-------------------------------------------
   if ((Gdiag & DIAG_SHOW) && !ncalls)
-  {
-    double mean, var, v, n ;
-    int    mx ;
-
-    n = mean = 0.0 ;
-    mx = -1 ;
-    for (xv = 0 ; xv < TABLE_SIZE ; xv++)
-    {
-      for (yv = 0 ; yv < TABLE_SIZE ; yv++)
-      {
-        for (zv = 0 ; zv < TABLE_SIZE ; zv++)
-        {
-          if (!mht->buckets[xv][yv] || !mht->buckets[xv][yv][zv])
-            continue ;
-          bucket = mht->buckets[xv][yv][zv] ;
-          if (bucket->nused)
-          {
-            mean += bucket->nused ;
-            n++ ;
-          }
-          if (bucket->nused > mx)
-            mx = bucket->nused ;
-        }
-      }
-    }
-    mean /= n ;
-    var = 0.0 ;
-    for (xv = 0 ; xv < TABLE_SIZE ; xv++)
-    {
-      for (yv = 0 ; yv < TABLE_SIZE ; yv++)
-      {
-        if (!mht->buckets[xv][yv])
-          continue ;
-        for (zv = 0 ; zv < TABLE_SIZE ; zv++)
-        {
-          bucket = mht->buckets[xv][yv][zv] ;
-          if (bucket && bucket->nused)
-          {
-            v = mean - bucket->nused ;
-            var += v*v ;
-          }
-        }
-      }
-    }
-    var /= (n-1) ;
-    if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON)
-      fprintf(stderr, "%s buckets: mean = %2.1f +- %2.2f, max = %d\n",
-              __MYFUNCTION__, mean, sqrt(var), mx) ;
-  }
+    mhtBucketStats(mht, __MYFUNCTION__) ;
   ncalls++ ;
   return(mht) ;
 }
@@ -754,25 +646,9 @@ static int mhtAddFaceOrVertexAtVoxIx(MRIS_HASH_TABLE *mht,
   //-----------------------------------------------
   // Allocate space if needed
   //-----------------------------------------------
-  // 1. Allocate a 1-D array at buckets[xv][yv]
-  if (!mht->buckets[xv][yv])
-  {
-    mht->buckets[xv][yv] = (MHBT **)calloc(TABLE_SIZE, sizeof(MHBT *)) ;
-    if (!mht->buckets[xv][yv])
-      ErrorExit(ERROR_NO_MEMORY,
-                "%s: could not allocate slice.",  __MYFUNCTION__) ;
-  }
-  // 2. Allocate a bucket at buckets[xv][yv][zv]
-  bucket = mht->buckets[xv][yv][zv] ;
-  if (!bucket)
-  {
-    mht->buckets[xv][yv][zv] = bucket = (MHBT *)calloc(1, sizeof(MHBT)) ;
-    if (!bucket)
-      ErrorExit(ERROR_NOMEMORY,
-                "%s couldn't allocate bucket.\n",
-                __MYFUNCTION__) ;
-  }
-  // 3. Allocate a bucket at buckets[xv][yv][zv]
+  // 1. Find or allocate the bucket at (xv,yv,zv)
+  bucket = mhtAllocBucket(mht, xv, yv, zv) ;
+  // 2. Allocate bins in the bucket
   if (!bucket->max_bins)   /* nothing in this bucket yet - allocate bins */
   {
     bucket->max_bins = 4 ;
@@ -866,9 +742,7 @@ static int mhtRemoveFaceOrVertexAtVoxIx(MRIS_HASH_TABLE *mht,
   if (zv >= TABLE_SIZE)
     zv  = TABLE_SIZE-1 ;
 
-  if (!mht->buckets[xv][yv])
-    return(NO_ERROR) ;        // no bucket at such coordinates
-  bucket = mht->buckets[xv][yv][zv] ;
+  bucket = mhtFindBucket(mht, xv, yv, zv) ;
   if (!bucket)
     return(NO_ERROR) ;       // no bucket at such coordinates
 
@@ -1074,9 +948,9 @@ static int mhtDoesFaceVoxelListIntersect(
     // succeed, given that the same info was just used to put xv,yv,zv
     // into voxlist as was used to put faces into mht buckets.
     //----------------------------------------------------------
-    if (!mht->buckets[xv][yv])
+    if (!mhtFindSlot(mht, xv, yv, -1))
       return(0) ;
-    bucket = mht->buckets[xv][yv][zv] ;
+    bucket = mhtFindBucket(mht, xv, yv, zv) ;
     if (!bucket)
       continue ;
 
@@ -1225,11 +1099,18 @@ void mhtFindCommonSanityCheck(MRIS_HASH_TABLE *mht, MRI_SURFACE *mris)
 
 //------------------------------------------
 // Simple instrumentation
+// These are per-thread so that the find functions, which only read
+// the mht and surface, can be called concurrently. MHTfindReportCounts
+// reports on the last find done by the calling thread.
 //------------------------------------------
 int FindBucketsChecked_Count;
 int FindBucketsPresent_Count;
 int VertexNumFoundByMHT;  /* 2007-07-30 GW: Added to allow diagnostics even 
                              with fallback-to-brute-force */
+#ifdef HAVE_OPENMP
+#pragma omp threadprivate(FindBucketsChecked_Count, FindBucketsPresent_Count, \
+                          VertexNumFoundByMHT)
+#endif
 
 void MHTfindReportCounts(int * BucketsChecked, 
                          int * BucketsPresent, 
@@ -2218,6 +2099,116 @@ int MHTfindClosestVertexNo(MRIS_HASH_TABLE *mht,
   return vtxnum;
 }
 
+/*--------------------------------------------------------------------
+  MHTfindClosestVertexNoBatch()
+  Batched, multi-threaded version of MHTfindClosestVertexNo() for
+  npoints probe points xyz[3*n+0..2] (given in the coordinates the
+  mht was built with). Unlike MHTfindClosestVertexNo(), points for
+  which the hash search does not find a vertex fall back to a brute
+  force search, so every vtxnos[n] is set unless the surface is empty.
+  min_dists may be NULL.
+  --------------------------------------------------------------------*/
+int MHTfindClosestVertexNoBatch(MRIS_HASH_TABLE *mht,
+                                MRI_SURFACE *mris,
+                                int npoints, const float *xyz,
+                                int *vtxnos, float *min_dists)
+{
+  int n ;
+
+  mhtFindCommonSanityCheck(mht, mris);
+
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for schedule(guided)
+#endif
+  for (n = 0 ; n < npoints ; n++)
+  {
+    int    vtxnum ;
+    double dist ;
+    float  fdist ;
+
+    MHTfindClosestVertexGeneric(mht, mris,
+                                xyz[3*n], xyz[3*n+1], xyz[3*n+2],
+                                1000,
+                                1,  // max_mhts: search out to 3 x 3 x 3
+                                NULL, &vtxnum, &dist);
+    fdist = dist ;
+    if (vtxnum < 0)
+      vtxnum = mhtBruteForceClosestVertex(mris,
+                                          xyz[3*n], xyz[3*n+1], xyz[3*n+2],
+                                          mht->which_vertices, &fdist);
+    vtxnos[n] = vtxnum ;
+    if (min_dists)
+      min_dists[n] = fdist ;
+  }
+  return(NO_ERROR) ;
+}
+
+/*--------------------------------------------------------------------
+  MHTfindClosestVertexGenericBatch()
+  Runs MHTfindClosestVertexGeneric() for npoints probe points
+  xyz[3*n+0..2] in parallel. vtxnums[n] is -1 if nothing was found
+  within range. vtx_distances may be NULL.
+  --------------------------------------------------------------------*/
+int MHTfindClosestVertexGenericBatch(MRIS_HASH_TABLE *mht,
+                                     MRI_SURFACE *mris,
+                                     int npoints, const float *xyz,
+                                     double in_max_distance_mm,
+                                     int in_max_mhts,
+                                     int *vtxnums, double *vtx_distances)
+{
+  int n ;
+
+  mhtFindCommonSanityCheck(mht, mris);
+
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for schedule(guided)
+#endif
+  for (n = 0 ; n < npoints ; n++)
+  {
+    double dist ;
+    MHTfindClosestVertexGeneric(mht, mris,
+                                xyz[3*n], xyz[3*n+1], xyz[3*n+2],
+                                in_max_distance_mm, in_max_mhts,
+                                NULL, &vtxnums[n], &dist);
+    if (vtx_distances)
+      vtx_distances[n] = dist ;
+  }
+  return(NO_ERROR) ;
+}
+
+/*--------------------------------------------------------------------
+  MHTfindClosestFaceGenericBatch()
+  Runs MHTfindClosestFaceGeneric() for npoints probe points
+  xyz[3*n+0..2] in parallel. fnos[n] is -1 if nothing was found
+  within range. face_distances may be NULL.
+  --------------------------------------------------------------------*/
+int MHTfindClosestFaceGenericBatch(MRIS_HASH_TABLE *mht,
+                                   MRI_SURFACE *mris,
+                                   int npoints, const float *xyz,
+                                   double in_max_distance_mm,
+                                   int in_max_mhts,
+                                   int project_into_face,
+                                   int *fnos, double *face_distances)
+{
+  int n ;
+
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for schedule(guided)
+#endif
+  for (n = 0 ; n < npoints ; n++)
+  {
+    double dist ;
+    MHTfindClosestFaceGeneric(mht, mris,
+                              xyz[3*n], xyz[3*n+1], xyz[3*n+2],
+                              in_max_distance_mm, in_max_mhts,
+                              project_into_face,
+                              NULL, &fnos[n], &dist);
+    if (face_distances)
+      face_distances[n] = dist ;
+  }
+  return(NO_ERROR) ;
+}
+
 /*---------------------------------------------------------------
   MHTfindClosestVertexInTable
   Returns vertex from mris & mht that's closest to provided coordinates.
@@ -2429,7 +2420,7 @@ int MHTfree(MRIS_HASH_TABLE **pmht)
 //----------------------------------
 {
   MRIS_HASH_TABLE  *mht ;
-  int              xv, yv, zv ;
+  int              i ;
 
   if (!(*pmht)) // avoid crash if not initialized, or nulled previously
     return(NO_ERROR) ;
@@ -2437,24 +2428,16 @@ int MHTfree(MRIS_HASH_TABLE **pmht)
   mht = *pmht ;
   *pmht = NULL ;  // sets pointer to null to signal free'ed
 
-  for (xv = 0 ; xv < TABLE_SIZE ; xv++)
+  for (i = 0 ; i < mht->nslots ; i++)
   {
-    for (yv = 0 ; yv < TABLE_SIZE ; yv++)
-    {
-      if (!mht->buckets[xv][yv])
-        continue ;
-      for (zv = 0 ; zv < TABLE_SIZE ; zv++)
-      {
-        if (mht->buckets[xv][yv][zv])
-        {
-          if (mht->buckets[xv][yv][zv]->bins)
-            free(mht->buckets[xv][yv][zv]->bins) ;
-          free(mht->buckets[xv][yv][zv]) ;
-        }
-      }
-      free(mht->buckets[xv][yv]) ;
-    }
+    if (mht->slots[i].xv < 0 || !mht->slots[i].bucket)
+      continue ;
+    if (mht->slots[i].bucket->bins)
+      free(mht->slots[i].bucket->bins) ;
+    free(mht->slots[i].bucket) ;
   }
+  if (mht->slots)
+    free(mht->slots) ;
   free(mht) ;
   return(NO_ERROR) ;
 }
@@ -2714,13 +2697,179 @@ MHBT * MHTgetBucketAtVoxIx(MRIS_HASH_TABLE *mht, int xv, int yv, int zv)
   if (!mht)
     return(NULL);
 
-  if (!mht->buckets[xv][yv])
+  bucket = mhtFindBucket(mht, xv, yv, zv) ;
+  return(bucket) ;
+}
+
+//=================================================================
+// Bucket lookup
+//=================================================================
+
+// Linear probing hash of a voxel index into a table of 2^n slots
+#define MHT_HASH_VOXIX(xv,yv,zv) \
+  ((unsigned int)(xv)*73856093u ^ (unsigned int)(yv)*19349663u ^ \
+   (unsigned int)(zv)*83492791u)
+
+/*-----------------------------------------------------------------
+  mhtFindSlot
+  Returns the slot of voxel index (xv,yv,zv), or NULL if nothing has
+  been added there. zv = -1 finds the slot of column (xv,yv). The
+  index must be within [0,TABLE_SIZE).
+  -----------------------------------------------------------------*/
+static MHTS *mhtFindSlot(MRIS_HASH_TABLE *mht, int xv, int yv, int zv)
+{
+  unsigned int  mask, h ;
+  MHTS         *slot ;
+
+  if (!mht->nslots)
     return(NULL) ;
+  mask = mht->nslots-1 ;
+  for (h = MHT_HASH_VOXIX(xv,yv,zv) & mask ; ; h = (h+1) & mask)
+  {
+    slot = &mht->slots[h] ;
+    if (slot->xv < 0)
+      return(NULL) ;
+    if (slot->xv == xv && slot->yv == yv && slot->zv == zv)
+      return(slot) ;
+  }
+}
+
+/*-----------------------------------------------------------------
+  mhtFindBucket
+  Returns the bucket at voxel index (xv,yv,zv), or NULL if nothing
+  has been added there. The index must be within [0,TABLE_SIZE).
+  -----------------------------------------------------------------*/
+static MHBT *mhtFindBucket(MRIS_HASH_TABLE *mht, int xv, int yv, int zv)
+{
+  MHTS *slot ;
 
-  bucket = mht->buckets[xv][yv][zv] ;
+  slot = mhtFindSlot(mht, xv, yv, zv) ;
+  return(slot ? slot->bucket : NULL) ;
+}
+
+/*-----------------------------------------------------------------
+  mhtInsertSlot
+  Puts bucket in the slot of (xv,yv,zv), which must not be in the
+  table yet, growing the table to keep it at most half full.
+  -----------------------------------------------------------------*/
+static void mhtInsertSlot(MRIS_HASH_TABLE *mht, int xv, int yv, int zv,
+                          MHBT *bucket)
+{
+  unsigned int  mask, h ;
+  MHTS         *slot ;
+
+  if (2*(mht->nbuckets+mht->ncolumns+1) > mht->nslots)
+  {
+    MHTS *oldslots = mht->slots ;
+    int   i, noldslots = mht->nslots ;
+
+    mht->nslots = noldslots ? 2*noldslots : 4096 ;
+    mht->slots = (MHTS *)malloc(mht->nslots*sizeof(MHTS)) ;
+    if (!mht->slots)
+      ErrorExit(ERROR_NO_MEMORY,
+                "%s: could not allocate %d slots.\n",
+                __MYFUNCTION__, mht->nslots) ;
+    for (i = 0 ; i < mht->nslots ; i++)
+      mht->slots[i].xv = -1 ;
+    mask = mht->nslots-1 ;
+    for (i = 0 ; i < noldslots ; i++)
+    {
+      if (oldslots[i].xv < 0)
+        continue ;
+      h = MHT_HASH_VOXIX(oldslots[i].xv,oldslots[i].yv,oldslots[i].zv) & mask;
+      while (mht->slots[h].xv >= 0)
+        h = (h+1) & mask ;
+      mht->slots[h] = oldslots[i] ;
+    }
+    if (oldslots)
+      free(oldslots) ;
+  }
+
+  mask = mht->nslots-1 ;
+  for (h = MHT_HASH_VOXIX(xv,yv,zv) & mask ; mht->slots[h].xv >= 0 ;
+       h = (h+1) & mask)
+    ;
+  slot = &mht->slots[h] ;
+  slot->xv = xv ;
+  slot->yv = yv ;
+  slot->zv = zv ;
+  slot->bucket = bucket ;
+  if (bucket)
+    mht->nbuckets++ ;
+  else
+    mht->ncolumns++ ;
+}
+
+/*-----------------------------------------------------------------
+  mhtAllocBucket
+  Returns the bucket at voxel index (xv,yv,zv), allocating it (and
+  the slot of its column) if needed. Buckets are never removed until
+  MHTfree, so there are no deleted slots to deal with.
+  -----------------------------------------------------------------*/
+static MHBT *mhtAllocBucket(MRIS_HASH_TABLE *mht, int xv, int yv, int zv)
+{
+  MHBT         *bucket ;
+
+  bucket = mhtFindBucket(mht, xv, yv, zv) ;
+  if (bucket)
+    return(bucket) ;
+
+  bucket = (MHBT *)calloc(1, sizeof(MHBT)) ;
+  if (!bucket)
+    ErrorExit(ERROR_NOMEMORY,
+              "%s couldn't allocate bucket.\n",
+              __MYFUNCTION__) ;
+  mhtInsertSlot(mht, xv, yv, zv, bucket) ;
+  if (!mhtFindSlot(mht, xv, yv, -1))
+    mhtInsertSlot(mht, xv, yv, -1, NULL) ;
   return(bucket) ;
 }
 
+/*-----------------------------------------------------------------
+  mhtBucketStats
+  Prints the mean, std and max number of entries per used bucket
+  -----------------------------------------------------------------*/
+static int mhtBucketStats(MRIS_HASH_TABLE *mht, const char *caller)
+{
+  double mean, var, v, n ;
+  int    i, mx ;
+  MHBT   *bucket ;
+
+  n = mean = 0.0 ;
+  mx = -1 ;
+  for (i = 0 ; i < mht->nslots ; i++)
+  {
+    if (mht->slots[i].xv < 0 || !mht->slots[i].bucket)
+      continue ;
+    bucket = mht->slots[i].bucket ;
+    if (bucket->nused)
+    {
+      mean += bucket->nused ;
+      n++ ;
+    }
+    if (bucket->nused > mx)
+      mx = bucket->nused ;
+  }
+  mean /= n ;
+  var = 0.0 ;
+  for (i = 0 ; i < mht->nslots ; i++)
+  {
+    if (mht->slots[i].xv < 0 || !mht->slots[i].bucket)
+      continue ;
+    bucket = mht->slots[i].bucket ;
+    if (bucket->nused)
+    {
+      v = mean - bucket->nused ;
+      var += v*v ;
+    }
+  }
+  var /= (n-1) ;
+  if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON)
+    fprintf(stderr, "%s buckets: mean = %2.1f +- %2.2f, max = %d\n",
+            caller, mean, sqrt(var), mx) ;
+  return(NO_ERROR) ;
+}
+
 /*------------------------------------------------
   MH_gw_version
   Confidence check that correct version of code is
@@ -2050,11 +2050,202 @@ MRISfree(MRI_SURFACE **pmris)
   {
     MatrixFree(&mris->m_sras2vox) ;
   }
+  if (mris->soa)
+  {
+    MRISsoaFree(&mris->soa) ;
+  }
 
   free(mris) ;
   return(NO_ERROR) ;
 }
 
+/*!
+  \fn MRIS_SOA *MRISsoaAlloc(MRI_SURFACE *mris)
+  \brief Returns the structure-of-arrays vertex store of the surface,
+  allocating it (or reallocating it if the number of vertices has
+  changed) as needed. The contents are not initialized; use
+  MRISsoaLoad(). The store is owned by the surface and freed by
+  MRISfree().
+*/
+MRIS_SOA *MRISsoaAlloc(MRI_SURFACE *mris)
+{
+  MRIS_SOA *soa ;
+  int nv ;
+
+  if (mris->soa && mris->soa->nvertices == mris->nvertices)
+    return(mris->soa) ;
+  if (mris->soa)
+    MRISsoaFree(&mris->soa) ;
+
+  nv = mris->nvertices ;
+  soa = (MRIS_SOA *) calloc(1, sizeof(MRIS_SOA)) ;
+  if (soa == NULL)
+    ErrorExit(ERROR_NOMEMORY, "MRISsoaAlloc(%d): could not allocate", nv) ;
+  soa->nvertices = nv ;
+  // one block for the 12 float arrays, each padded to a multiple of 16
+  // floats so that they do not share cache lines
+  {
+    int k, nvpad = (nv + 15) & ~15 ;
+    float *block, **arrays[12] ;
+    arrays[0]  = &soa->x ;  arrays[1]  = &soa->y ;  arrays[2]  = &soa->z ;
+    arrays[3]  = &soa->nx ; arrays[4]  = &soa->ny ; arrays[5]  = &soa->nz ;
+    arrays[6]  = &soa->dx ; arrays[7]  = &soa->dy ; arrays[8]  = &soa->dz ;
+    arrays[9]  = &soa->tx ; arrays[10] = &soa->ty ; arrays[11] = &soa->tz ;
+    block = (float *) calloc((size_t)12*nvpad+1, sizeof(float)) ;
+    if (block == NULL)
+      ErrorExit(ERROR_NOMEMORY, "MRISsoaAlloc(%d): could not allocate", nv) ;
+    for (k = 0 ; k < 12 ; k++)
+      *arrays[k] = block + (size_t)k*nvpad ;
+  }
+  soa->nnbrs   = (int *)  calloc(nv+1, sizeof(int)) ;
+  soa->ripflag = (char *) calloc(nv+1, sizeof(char)) ;
+  if (soa->nnbrs == NULL || soa->ripflag == NULL)
+    ErrorExit(ERROR_NOMEMORY, "MRISsoaAlloc(%d): could not allocate", nv) ;
+  mris->soa = soa ;
+  return(soa) ;
+}
+
+/*!
+  \fn int MRISsoaFree(MRIS_SOA **psoa)
+  \brief Frees a structure-of-arrays vertex store
+*/
+int MRISsoaFree(MRIS_SOA **psoa)
+{
+  MRIS_SOA *soa = *psoa ;
+
+  *psoa = NULL ;
+  if (soa == NULL)
+    return(NO_ERROR) ;
+  free(soa->x) ;  // all the float arrays live in one block
+  free(soa->nnbrs) ;
+  free(soa->ripflag) ;
+  free(soa) ;
+  return(NO_ERROR) ;
+}
+
+/*!
+  \fn int MRISsoaLoad(MRI_SURFACE *mris, int which)
+  \brief Gathers vertex fields into the structure-of-arrays store.
+  which is an OR of MRIS_SOA_POSITIONS (x,y,z), MRIS_SOA_NORMALS
+  (nx,ny,nz) and MRIS_SOA_GRADIENT (dx,dy,dz). The ripflag is
+  always loaded.
+*/
+int MRISsoaLoad(MRI_SURFACE *mris, int which)
+{
+  MRIS_SOA *soa ;
+  int vno ;
+
+  soa = MRISsoaAlloc(mris) ;
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for
+#endif
+  for (vno = 0 ; vno < mris->nvertices ; vno++)
+  {
+    const VERTEX *v = &mris->vertices[vno] ;
+    soa->ripflag[vno] = v->ripflag ;
+    if (which & MRIS_SOA_POSITIONS)
+    {
+      soa->x[vno] = v->x ; soa->y[vno] = v->y ; soa->z[vno] = v->z ;
+    }
+    if (which & MRIS_SOA_NORMALS)
+    {
+      soa->nx[vno] = v->nx ; soa->ny[vno] = v->ny ; soa->nz[vno] = v->nz ;
+    }
+    if (which & MRIS_SOA_GRADIENT)
+    {
+      soa->dx[vno] = v->dx ; soa->dy[vno] = v->dy ; soa->dz[vno] = v->dz ;
+    }
+  }
+  return(NO_ERROR) ;
+}
+
+/*!
+  \fn int MRISsoaStore(MRI_SURFACE *mris, int which)
+  \brief Scatters fields of the structure-of-arrays store back into
+  the unripped vertices. See MRISsoaLoad() for which.
+*/
+int MRISsoaStore(MRI_SURFACE *mris, int which)
+{
+  MRIS_SOA *soa = mris->soa ;
+  int vno ;
+
+  if (soa == NULL || soa->nvertices != mris->nvertices)
+  {
+    printf("ERROR: MRISsoaStore(): SoA store not loaded\n") ;
+    return(1) ;
+  }
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for
+#endif
+  for (vno = 0 ; vno < mris->nvertices ; vno++)
+  {
+    VERTEX *v = &mris->vertices[vno] ;
+    if (v->ripflag)
+      continue ;
+    if (which & MRIS_SOA_POSITIONS)
+    {
+      v->x = soa->x[vno] ; v->y = soa->y[vno] ; v->z = soa->z[vno] ;
+    }
+    if (which & MRIS_SOA_NORMALS)
+    {
+      v->nx = soa->nx[vno] ; v->ny = soa->ny[vno] ; v->nz = soa->nz[vno] ;
+    }
+    if (which & MRIS_SOA_GRADIENT)
+    {
+      v->dx = soa->dx[vno] ; v->dy = soa->dy[vno] ; v->dz = soa->dz[vno] ;
+    }
+  }
+  return(NO_ERROR) ;
+}
+
+/*!
+  \fn static MRIS_SOA *mrisSoaNeighborOffsets(MRI_SURFACE *mris)
+  \brief Loads the current positions into the SoA store and computes,
+  for each unripped vertex, the sum of the offsets to its unripped
+  1-neighbors (tx,ty,tz) and the number of such neighbors (nnbrs).
+  This is the common core of the spring terms. The sums are
+  accumulated in the same order as the per-term loops did so the
+  results are unchanged.
+*/
+static MRIS_SOA *mrisSoaNeighborOffsets(MRI_SURFACE *mris)
+{
+  MRIS_SOA *soa ;
+  int vno ;
+
+  MRISsoaLoad(mris, MRIS_SOA_POSITIONS) ;
+  soa = mris->soa ;
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for schedule(static)
+#endif
+  for (vno = 0 ; vno < mris->nvertices ; vno++)
+  {
+    const int *pnb ;
+    int   m, n, vnum ;
+    float x, y, z, sx, sy, sz ;
+
+    if (soa->ripflag[vno])
+      continue ;
+    x = soa->x[vno] ; y = soa->y[vno] ; z = soa->z[vno] ;
+    pnb  = mris->vertices[vno].v ;
+    vnum = mris->vertices[vno].vnum ;
+    sx = sy = sz = 0.0 ;
+    n = 0 ;
+    for (m = 0 ; m < vnum ; m++)
+    {
+      int vnb = pnb[m] ;
+      if (soa->ripflag[vnb])
+        continue ;
+      sx += soa->x[vnb] - x ;
+      sy += soa->y[vnb] - y ;
+      sz += soa->z[vnb] - z ;
+      n++ ;
+    }
+    soa->tx[vno] = sx ; soa->ty[vno] = sy ; soa->tz[vno] = sz ;
+    soa->nnbrs[vno] = n ;
+  }
+  return(soa) ;
+}
+
 /*-----------------------------------------------------
   Parameters:
 
@@ -3333,6 +3524,171 @@ MRISsampleDistances(MRI_SURFACE *mris, int *nbrs, int max_nbhd)
 }
 #endif
 
+/*-----------------------------------------------------
+  Add niter rings to the neighborhood (v->v) of every unripped
+  vertex, ie, go from v->nsize to v->nsize+niter. All the rings of a
+  vertex are added in one go, and visited vertices are tracked with a
+  per-thread stamp array rather than the shared v->marked field, so
+  the vertices can be done in parallel. The expanded lists are built
+  in new arrays while the old v->v lists of the neighbors are still
+  being read, and swapped in (with vtotal, v2num, v3num and nsize)
+  once all vertices are done. The order of the list is the same as
+  expanding one ring at a time over the whole surface. v->dist and
+  v->dist_orig are left for the caller to (re)allocate.
+  ------------------------------------------------------*/
+static int
+mrisExpandNeighborhoods(MRI_SURFACE *mris, int niter)
+{
+  int vno, nthreads, *stamps, **vlists, *vtotals, *v2nums, *v3nums ;
+
+  if (niter <= 0)
+    return(NO_ERROR) ;
+
+#ifdef HAVE_OPENMP
+  nthreads = omp_get_max_threads() ;
+#else
+  nthreads = 1 ;
+#endif
+  stamps = (int *)calloc((size_t)nthreads*mris->nvertices, sizeof(int)) ;
+  vlists = (int **)calloc(mris->nvertices, sizeof(int *)) ;
+  vtotals = (int *)calloc(mris->nvertices, sizeof(int)) ;
+  v2nums = (int *)calloc(mris->nvertices, sizeof(int)) ;
+  v3nums = (int *)calloc(mris->nvertices, sizeof(int)) ;
+  if (!stamps || !vlists || !vtotals || !v2nums || !v3nums)
+    ErrorExit(ERROR_NO_MEMORY,
+              "MRISsetNeighborhoodSize: could not allocate %d x %d stamps",
+              nthreads, mris->nvertices) ;
+
+  /* build the expanded lists; v->v of every vertex is only read here */
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic,1024)
+#endif
+  for (vno = 0 ; vno < mris->nvertices ; vno++)
+  {
+    int          i, j, n, iter, neighbors, vnum, nring, tag, *stamp ;
+    int          nsize, vtotal, v2num, v3num ;
+    VERTEX       *v, *vnb ;
+    int          vtmp[MAX_NEIGHBORS] ;
+
+#ifdef HAVE_OPENMP
+    stamp = stamps + (size_t)omp_get_thread_num()*mris->nvertices ;
+#else
+    stamp = stamps ;
+#endif
+    v = &mris->vertices[vno] ;
+    if (vno == Gdiag_no)
+      DiagBreak()  ;
+
+    vnum = v->vtotal ;
+    if (v->ripflag || !vnum)
+      continue ;
+
+    // each vertex has its own tag so the stamps never need clearing
+    tag = vno+1 ;
+    stamp[vno] = tag ;
+    for (i = 0 ; i < vnum ; i++)
+    {
+      n = v->v[i] ;
+      if (stamp[n] == tag)
+        fprintf(stderr, "warning: vertex %d has duplicate neighbor %d!\n",
+                vno, n) ;
+      stamp[n] = tag ;
+      vtmp[i] = n ;
+    }
+
+    nsize = v->nsize ;
+    vtotal = v->vtotal ;
+    v2num = v->v2num ;
+    v3num = v->v3num ;
+    neighbors = vnum ;
+    for (iter = 0 ; iter < niter ; iter++)
+    {
+      /* add the unvisited 1-neighbors of everything in the list so far */
+      nring = neighbors ;
+      for (i = 0 ; neighbors < MAX_NEIGHBORS && i < nring ; i++)
+      {
+        vnb = &mris->vertices[vtmp[i]] ;
+        if (vnb->ripflag)
+          continue ;
+
+        for (j = 0 ; j < vnb->vnum ; j++)
+        {
+          n = vnb->v[j] ;
+          if (stamp[n] == tag || mris->vertices[n].ripflag)
+            continue ;
+
+          stamp[n] = tag ;
+          vtmp[neighbors] = n ;
+          if (++neighbors >= MAX_NEIGHBORS)
+          {
+            fprintf(stderr,
+                    "vertex %d has too many neighbors!\n",vno) ;
+            break ;
+          }
+        }
+      }
+      nsize++ ;
+      switch (nsize)
+      {
+      case 2:
+        v2num = neighbors ;
+        break ;
+      case 3:
+        v3num = neighbors ;
+        break ;
+      default:   /* store old neighborhood size in v3num */
+        v3num = vtotal ;
+        break ;
+      }
+      vtotal = neighbors ;
+    }
+
+    vlists[vno] = (int *)calloc(neighbors, sizeof(int)) ;
+    if (!vlists[vno])
+      ErrorExit(ERROR_NO_MEMORY,
+                "MRISsetNeighborhoodSize: could not allocate list of %d "
+                "nbrs at v=%d", neighbors, vno) ;
+    memmove(vlists[vno], vtmp, neighbors*sizeof(int)) ;
+    vtotals[vno] = vtotal ;
+    v2nums[vno] = v2num ;
+    v3nums[vno] = v3num ;
+  }
+
+  /* all readers are done, swap in the new lists */
+  for (vno = 0 ; vno < mris->nvertices ; vno++)
+  {
+    VERTEX       *v ;
+    int          n ;
+
+    if (vlists[vno] == NULL)
+      continue ;
+    v = &mris->vertices[vno] ;
+    free(v->v) ;
+    v->v = vlists[vno] ;
+    v->vtotal = vtotals[vno] ;
+    v->v2num = v2nums[vno] ;
+    v->v3num = v3nums[vno] ;
+    v->nsize += niter ;
+
+    if ((vno == Gdiag_no) && (Gdiag & DIAG_SHOW) && DIAG_VERBOSE_ON)
+    {
+      fprintf(stdout, "v %d: vnum=%d, v2num=%d, vtotal=%d\n",
+              vno, v->vnum, v->v2num, v->vtotal) ;
+      for (n = 0 ; n < v->vtotal ; n++)
+      {
+        fprintf(stdout, "v[%d] = %d\n", n, v->v[n]) ;
+      }
+    }
+  }
+
+  free(vlists) ;
+  free(vtotals) ;
+  free(v2nums) ;
+  free(v3nums) ;
+  free(stamps) ;
+  return(NO_ERROR) ;
+}
+
 /*-----------------------------------------------------
   Parameters:
 
@@ -3345,7 +3701,7 @@ MRISsampleDistances(MRI_SURFACE *mris, int *nbrs, int max_nbhd)
 int
 MRISsetNeighborhoodSize(MRI_SURFACE *mris, int nsize)
 {
-  int          vno, niter, ntotal, vtotal ;
+  int          vno, ntotal, vtotal ;
 
   /*
     now build a list of 2-connected neighbors. After this is done,
@@ -3380,129 +3736,7 @@ MRISsetNeighborhoodSize(MRI_SURFACE *mris, int nsize)
 
   // setting neighborhood size to a value larger than it has been in the past
   mris->max_nsize = nsize ;
-  for (niter = 0 ; niter < nsize-mris->nsize ; niter++)
-  {
-    // this can't be parallelized due to the marking of neighbors
-#ifdef HAVE_OPENMP
-//#pragma omp parallel for
-#endif
-    for (vno = 0 ; vno < mris->nvertices ; vno++)
-    {
-      int          i,n, neighbors, j, vnum, nb_vnum ;
-      VERTEX       *v, *vnb, *vnb2 ;
-      int          vtmp[MAX_NEIGHBORS] ;
-
-      v = &mris->vertices[vno] ;
-      if (vno == Gdiag_no)
-        DiagBreak()  ;
-
-      vnum = v->vtotal ;
-      if (v->ripflag || !vnum)
-        continue ;
-
-      memmove(vtmp, v->v, vnum*sizeof(int)) ;
-
-      /* mark 1-neighbors so we don't count them twice */
-      v->marked = 1 ;
-      for (i = 0 ; i < vnum; i++)
-        mris->vertices[v->v[i]].marked = 1 ;
-
-      /* count 2-neighbors */
-      for (neighbors = vnum, i = 0;
-           neighbors < MAX_NEIGHBORS && i < vnum;
-           i++)
-      {
-        n = v->v[i] ;
-        vnb = &mris->vertices[n] ;
-        vnb->marked = 1 ;
-        if (vnb->ripflag)
-          continue ;
-
-        nb_vnum = vnb->vnum ;
-
-        for (j = 0 ; j < nb_vnum ; j++)
-        {
-          vnb2 = &mris->vertices[vnb->v[j]] ;
-          if (vnb2->ripflag || vnb2->marked)
-            continue ;
-
-          vtmp[neighbors] = vnb->v[j] ;
-          vnb2->marked = 1 ;
-          if (++neighbors >= MAX_NEIGHBORS)
-          {
-            fprintf(stderr,
-                    "vertex %d has too many neighbors!\n",vno) ;
-            break ;
-          }
-        }
-      }
-      /*
-        now reallocate the v->v structure and
-        place the 2-connected neighbors
-        suquentially after the 1-connected neighbors.
-      */
-      free(v->v) ;
-      v->v = (int *)calloc(neighbors, sizeof(int)) ;
-      if (!v->v)
-        ErrorExit(ERROR_NO_MEMORY,
-                  "MRISsetNeighborhoodSize: could not allocate list of %d "
-                  "nbrs at v=%d", neighbors, vno) ;
-
-      v->marked = 0 ;
-      for (n = 0 ; n < neighbors ; n++)
-      {
-        v->v[n] = vtmp[n] ;
-        mris->vertices[vtmp[n]].marked = 0 ;
-      }
-      if (v->dist)
-        free(v->dist) ;
-
-      if (v->dist_orig)
-        free(v->dist_orig) ;
-
-
-      v->dist = (float *)calloc(neighbors, sizeof(float)) ;
-      if (!v->dist)
-        ErrorExit(ERROR_NOMEMORY,
-                  "MRISsetNeighborhoodSize: could not allocate list of %d "
-                  "dists at v=%d", neighbors, vno) ;
-      v->dist_orig = (float *)calloc(neighbors, sizeof(float)) ;
-      if (!v->dist_orig)
-        ErrorExit(ERROR_NOMEMORY,
-                  "MRISsetNeighborhoodSize: could not allocate list of %d "
-                  "dists at v=%d", neighbors, vno) ;
-      v->nsize++ ;
-      switch (v->nsize)
-      {
-      case 2:
-        v->v2num = neighbors ;
-        break ;
-      case 3:
-        v->v3num = neighbors ;
-        break ;
-      default:   /* store old neighborhood size in v3num */
-        v->v3num = v->vtotal ;
-        break ;
-      }
-      v->vtotal = neighbors ;
-      for (n = 0 ; n < neighbors ; n++)
-        for (i = 0 ; i < neighbors ; i++)
-          if (i != n && v->v[i] == v->v[n])
-            fprintf
-            (stderr,
-             "warning: vertex %d has duplicate neighbors %d and %d!\n",
-             vno, i, n) ;
-      if ((vno == Gdiag_no) && (Gdiag & DIAG_SHOW) && DIAG_VERBOSE_ON)
-      {
-        fprintf(stdout, "v %d: vnum=%d, v2num=%d, vtotal=%d\n",
-                vno, v->vnum, v->v2num, v->vtotal) ;
-        for (n = 0 ; n < neighbors ; n++)
-        {
-          fprintf(stdout, "v[%d] = %d\n", n, v->v[n]) ;
-        }
-      }
-    }
-  }
+  mrisExpandNeighborhoods(mris, nsize-mris->nsize) ;
 
   ntotal = vtotal = 0 ;
 #ifdef HAVE_OPENMP
@@ -10842,40 +11076,58 @@ int MRISaverageGradients(MRI_SURFACE *mris, int num_avgs)
     MRISPfree(&mrisp) ;
     MRISPfree(&mrisp_blur) ;
   }
-  else 
+  else
+  {
+    // Average out of a SoA copy of the gradient, ping-ponging between
+    // (dx,dy,dz) and (tx,ty,tz), so that the neighbor reads do not have
+    // to touch the (large) VERTEX structs.
+    MRIS_SOA *soa ;
+    float *sdx, *sdy, *sdz, *stx, *sty, *stz, *tmp ;
+
+    MRISsoaLoad(mris, MRIS_SOA_GRADIENT) ;
+    soa = mris->soa ;
+    sdx = soa->dx ; sdy = soa->dy ; sdz = soa->dz ;
+    stx = soa->tx ; sty = soa->ty ; stz = soa->tz ;
     for (i = 0 ; i < num_avgs ; i++)
     {
 #ifdef HAVE_OPENMP
-#pragma omp parallel for schedule(static,1)
+#pragma omp parallel for schedule(static)
 #endif
       for (vno = 0 ; vno < mris->nvertices ; vno++)
       {
-	VERTEX *v, *vn ;
 	float  dx, dy, dz, num ;
-	int    vnb, *pnb, vnum ;
-	
-        v = &mris->vertices[vno] ;
-        if (v->ripflag)
+	int    vnb, vn, *pnb, vnum ;
+
+        if (soa->ripflag[vno])
+        {
+          stx[vno] = sdx[vno] ; sty[vno] = sdy[vno] ; stz[vno] = sdz[vno] ;
           continue ;
+        }
 
-        dx = v->dx ; dy = v->dy ; dz = v->dz ;
-        pnb = v->v ;
+        dx = sdx[vno] ; dy = sdy[vno] ; dz = sdz[vno] ;
+        pnb = mris->vertices[vno].v ;
         /*      vnum = v->v2num ? v->v2num : v->vnum ;*/
-        vnum = v->vnum ;
+        vnum = mris->vertices[vno].vnum ;
         for (num = 0.0f, vnb = 0 ; vnb < vnum ; vnb++)
         {
-          vn = &mris->vertices[*pnb++] ; /* neighboring vertex pointer */
-          if (vn->ripflag)
+          vn = *pnb++ ; /* neighboring vertex */
+          if (soa->ripflag[vn])
             continue ;
 
           num++ ;
-          dx += vn->dx ; dy += vn->dy ; dz += vn->dz ;
+          dx += sdx[vn] ; dy += sdy[vn] ; dz += sdz[vn] ;
         }
         num++ ;
-        v->tdx = dx / num ; v->tdy = dy / num ; v->tdz = dz / num ;
+        stx[vno] = dx / num ; sty[vno] = dy / num ; stz[vno] = dz / num ;
       }
+      tmp = sdx ; sdx = stx ; stx = tmp ;
+      tmp = sdy ; sdy = sty ; sty = tmp ;
+      tmp = sdz ; sdz = stz ; stz = tmp ;
+    }
+    if (num_avgs > 0)
+    {
 #ifdef HAVE_OPENMP
-#pragma omp parallel for schedule(static,1)
+#pragma omp parallel for schedule(static)
 #endif
       for (vno = 0 ; vno < mris->nvertices ; vno++)
       {
@@ -10885,9 +11137,12 @@ int MRISaverageGradients(MRI_SURFACE *mris, int num_avgs)
         if (v->ripflag)
           continue ;
 
-        v->dx = v->tdx ; v->dy = v->tdy ; v->dz = v->tdz ;
+        v->dx = v->tdx = sdx[vno] ;
+        v->dy = v->tdy = sdy[vno] ;
+        v->dz = v->tdz = sdz[vno] ;
       }
     }
+  }
   if (Gdiag_no >= 0)
   {
     float dot ;
@@ -20662,15 +20917,17 @@ mrisComputeCurvatureTerm(MRI_SURFACE *mris, double l_curv)
 static int
 mrisComputeConvexityTerm(MRI_SURFACE *mris, double l_convex)
 {
-  int     vno, n, m ;
-  VERTEX  *vertex, *vn ;
-  float   sx, sy, sz, nx, ny, nz, nc, x, y, z ;
+  int     vno, n ;
+  VERTEX  *vertex ;
+  MRIS_SOA *soa ;
+  float   sx, sy, sz, nx, ny, nz, nc ;
 
   if (FZERO(l_convex))
   {
     return(NO_ERROR) ;
   }
 
+  soa = mrisSoaNeighborOffsets(mris) ;
   for (vno = 0 ; vno < mris->nvertices ; vno++)
   {
     vertex = &mris->vertices[vno] ;
@@ -20686,23 +20943,11 @@ mrisComputeConvexityTerm(MRI_SURFACE *mris, double l_convex)
     nx = vertex->nx ;
     ny = vertex->ny ;
     nz = vertex->nz ;
-    x = vertex->x ;
-    y = vertex->y ;
-    z = vertex->z ;
 
-    sx = sy = sz = 0.0 ;
-    n=0;
-    for (m = 0 ; m < vertex->vnum ; m++)
-    {
-      vn = &mris->vertices[vertex->v[m]] ;
-      if (!vn->ripflag)
-      {
-        sx += vn->x - x;
-        sy += vn->y - y;
-        sz += vn->z - z;
-        n++;
-      }
-    }
+    sx = soa->tx[vno] ;
+    sy = soa->ty[vno] ;
+    sz = soa->tz[vno] ;
+    n = soa->nnbrs[vno] ;
     if (n>0)
     {
       sx = sx/n;
@@ -20743,15 +20988,17 @@ mrisComputeConvexityTerm(MRI_SURFACE *mris, double l_convex)
 static int
 mrisComputeNormalSpringTerm(MRI_SURFACE *mris, double l_spring)
 {
-  int     vno, n, m ;
-  VERTEX  *vertex, *vn ;
-  float   sx, sy, sz, nx, ny, nz, nc, x, y, z ;
+  int     vno, n ;
+  VERTEX  *vertex ;
+  MRIS_SOA *soa ;
+  float   sx, sy, sz, nx, ny, nz, nc ;
 
   if (FZERO(l_spring))
   {
     return(NO_ERROR) ;
   }
 
+  soa = mrisSoaNeighborOffsets(mris) ;
   for (vno = 0 ; vno < mris->nvertices ; vno++)
   {
     vertex = &mris->vertices[vno] ;
@@ -20767,23 +21014,11 @@ mrisComputeNormalSpringTerm(MRI_SURFACE *mris, double l_spring)
     nx = vertex->nx ;
     ny = vertex->ny ;
     nz = vertex->nz ;
-    x = vertex->x ;
-    y = vertex->y ;
-    z = vertex->z ;
 
-    sx = sy = sz = 0.0 ;
-    n=0;
-    for (m = 0 ; m < vertex->vnum ; m++)
-    {
-      vn = &mris->vertices[vertex->v[m]] ;
-      if (!vn->ripflag)
-      {
-        sx += vn->x - x;
-        sy += vn->y - y;
-        sz += vn->z - z;
-        n++;
-      }
-    }
+    sx = soa->tx[vno] ;
+    sy = soa->ty[vno] ;
+    sz = soa->tz[vno] ;
+    n = soa->nnbrs[vno] ;
     if (n>0)
     {
       sx = sx/n;
@@ -20821,15 +21056,17 @@ mrisComputeNormalSpringTerm(MRI_SURFACE *mris, double l_spring)
 static int
 mrisComputeTangentialSpringTerm(MRI_SURFACE *mris, double l_spring)
 {
-  int     vno, n, m ;
-  VERTEX  *v, *vn ;
-  float   sx, sy, sz, x, y, z, nc ;
+  int     vno, n ;
+  VERTEX  *v ;
+  MRIS_SOA *soa ;
+  float   sx, sy, sz, nc ;
 
   if (FZERO(l_spring))
   {
     return(NO_ERROR) ;
   }
 
+  soa = mrisSoaNeighborOffsets(mris) ;
   for (vno = 0 ; vno < mris->nvertices ; vno++)
   {
     v = &mris->vertices[vno] ;
@@ -20847,23 +21084,10 @@ mrisComputeTangentialSpringTerm(MRI_SURFACE *mris, double l_spring)
       continue ;
     }
 
-    x = v->x ;
-    y = v->y ;
-    z = v->z ;
-
-    sx = sy = sz = 0.0 ;
-    n=0;
-    for (m = 0 ; m < v->vnum ; m++)
-    {
-      vn = &mris->vertices[v->v[m]] ;
-      if (!vn->ripflag)
-      {
-        sx += vn->x-x;
-        sy += vn->y-y;
-        sz += vn->z-z;
-        n++;
-      }
-    }
+    sx = soa->tx[vno] ;
+    sy = soa->ty[vno] ;
+    sz = soa->tz[vno] ;
+    n = soa->nnbrs[vno] ;
 #if 0
     n = 4 ;  /* avg # of nearest neighbors */
 #endif
@@ -22380,9 +22604,10 @@ mrisComputeMaxSpringTerm(MRI_SURFACE *mris, double l_max_spring)
 static int
 mrisComputeSpringTerm(MRI_SURFACE *mris, double l_spring)
 {
-  int     vno, n, m ;
-  VERTEX  *v, *vn ;
-  float   sx, sy, sz, x, y, z, dist_scale ;
+  int     vno, n ;
+  VERTEX  *v ;
+  MRIS_SOA *soa ;
+  float   sx, sy, sz, dist_scale ;
 
   if (FZERO(l_spring))
   {
@@ -22401,6 +22626,7 @@ mrisComputeSpringTerm(MRI_SURFACE *mris, double l_spring)
 #else
   dist_scale = 1.0 ;
 #endif
+  soa = mrisSoaNeighborOffsets(mris) ;
   for (vno = 0 ; vno < mris->nvertices ; vno++)
   {
     v = &mris->vertices[vno] ;
@@ -22418,23 +22644,10 @@ mrisComputeSpringTerm(MRI_SURFACE *mris, double l_spring)
       continue ;
     }
 
-    x = v->x ;
-    y = v->y ;
-    z = v->z ;
-
-    sx = sy = sz = 0.0 ;
-    n=0;
-    for (m = 0 ; m < v->vnum ; m++)
-    {
-      vn = &mris->vertices[v->v[m]] ;
-      if (!vn->ripflag)
-      {
-        sx += vn->x - x;
-        sy += vn->y - y;
-        sz += vn->z - z;
-        n++;
-      }
-    }
+    sx = soa->tx[vno] ;
+    sy = soa->ty[vno] ;
+    sz = soa->tz[vno] ;
+    n = soa->nnbrs[vno] ;
 #if 0
     n = 4 ;  /* avg # of nearest neighbors */
 #endif
@@ -22884,6 +23097,7 @@ mrisComputeDistanceTerm(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
 //  int     max_n, max_v ;
   int     diag_vno1, diag_vno2 ;
   char    *cp ;
+  MRIS_SOA *soa ;
   VECTOR  *v_y[_MAX_FS_THREADS], *v_delta[_MAX_FS_THREADS], *v_n[_MAX_FS_THREADS] ;
 
   if ((cp = getenv("VDIAG1")) != NULL)
@@ -22944,14 +23158,17 @@ mrisComputeDistanceTerm(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
     v_y[tno] = VectorAlloc(3, MATRIX_REAL) ;
     v_delta[tno] = VectorAlloc(3, MATRIX_REAL) ;
   }
+  // neighbor positions and ripflags come from the SoA store
+  MRISsoaLoad(mris, MRIS_SOA_POSITIONS) ;
+  soa = mris->soa ;
 // need to make v_n etc. into arrays and use tids
 #ifdef HAVE_OPENMP
 #pragma omp parallel for schedule(static,1)
 #endif
   for (vno = 0 ; vno < mris->nvertices ; vno++)
   {
-    VERTEX *v, *vn ;
-    int    vnum, n ;
+    VERTEX *v ;
+    int    vnum, n, vn ;
     float   d0, dt, delta, nc, vsmooth = 1.0 ;
 
 #ifdef HAVE_OPENMP
@@ -22979,8 +23196,8 @@ mrisComputeDistanceTerm(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
 
     for (n = 0 ; n < vnum ; n++)
     {
-      vn = &mris->vertices[v->v[n]] ;
-      if (vn->ripflag)
+      vn = v->v[n] ;
+      if (soa->ripflag[vn])
         continue ;
 
       d0 = v->dist_orig[n]/scale ;
@@ -23001,7 +23218,7 @@ mrisComputeDistanceTerm(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
       }
       }
 #endif
-      VECTOR_LOAD(v_y[tid], vn->x - v->x, vn->y - v->y, vn->z - v->z) ;
+      VECTOR_LOAD(v_y[tid], soa->x[vn] - v->x, soa->y[vn] - v->y, soa->z[vn] - v->z) ;
       if ((V3_LEN_IS_ZERO(v_y[tid])))
         continue ;
 
@@ -23013,14 +23230,14 @@ mrisComputeDistanceTerm(MRI_SURFACE *mris, INTEGRATION_PARMS *parms)
                 "nbr %d (%6.6d) @ (%2.2f, %2.2f, %2.2f), "
                 "d0 %2.2f, dt %2.2f, "
                 "delta %2.3f\n\tdx=%2.3f, %2.3f, %2.3f)\n",
-                n, v->v[n], vn->x, vn->y, vn->z, d0, dt,
+                n, vn, soa->x[vn], soa->y[vn], soa->z[vn], d0, dt,
                 delta, V3_X(v_y[tid]), V3_Y(v_y[tid]), V3_Z(v_y[tid])) ;
       if ((vno == diag_vno1 && v->v[n] == diag_vno2) ||
           (vno == diag_vno2 && v->v[n] == diag_vno1))
         printf("nbr %d (%6.6d) @ (%2.2f, %2.2f, %2.2f), "
                "d0 %2.2f, dt %2.2f, "
                "delta %2.3f\n\ty=%2.3f, %2.3f, %2.3f)\n",
-               n, v->v[n], vn->x, vn->y, vn->z, d0, dt,
+               n, vn, soa->x[vn], soa->y[vn], soa->z[vn], d0, dt,
                delta, V3_X(v_y[tid]), V3_Y(v_y[tid]), V3_Z(v_y[tid])) ;
     }
 
@@ -32980,13 +33197,95 @@ MRISrigidBodyAlignVectorLocal(MRI_SURFACE *mris, INTEGRATION_PARMS *old_parms)
 #define ENDING_ANGLE     RADIANS(4.0f)
 #define NANGLES          8
 
+/*!
+  \fn static double mrisRigidBodyCorrelationError(MRI_SURFACE *mris, INTEGRATION_PARMS *parms, int use_stds, float alpha, float beta, float gamma)
+  \brief Returns what mrisComputeCorrelationError() would return after
+  MRISrotate(mris, mris, alpha, beta, gamma), without touching the
+  surface. Reads the positions and ripflags from the SoA store and the
+  curvature from its tx scratch array (see MRISrigidBodyAlignGlobal()),
+  so it can be called concurrently for different rotations. The
+  rotation is computed with the same float arithmetic as MRISrotate()
+  and the sum is accumulated in vertex order, so the value is identical
+  to the rotate/evaluate/restore sequence. geometry_error is not
+  written.
+*/
+static double
+mrisRigidBodyCorrelationError(MRI_SURFACE *mris, INTEGRATION_PARMS *parms,
+                              int use_stds, float alpha, float beta,
+                              float gamma)
+{
+  const MRIS_SOA *soa = mris->soa ;
+  double   src, target, sse, delta, std ;
+  int      vno ;
+  float    x, y, z, ca, cb, cg, sa, sb, sg, xp, yp, zp ;
+  float    cacb, cacgsb, sasg, cgsa ;
+  float    casbsg, cbsa, cgsasb, casg ;
+  float    cacg, sasbsg, cbcg, cbsg ;
+
+  if (FZERO(parms->l_corr + parms->l_pcorr))
+    return(0.0) ;
+
+  sa = sin(alpha) ;
+  sb = sin(beta) ;
+  sg = sin(gamma) ;
+  ca = cos(alpha) ;
+  cb = cos(beta) ;
+  cg = cos(gamma) ;
+  cacb = ca*cb ;
+  cacgsb = ca*cg*sb ;
+  sasg = sa*sg ;
+  cgsa = cg*sa ;
+  casbsg = ca*sb*sg ;
+  cbsa = cb*sa ;
+  cgsasb = cg*sa*sb ;
+  casg = ca*sg ;
+  cacg = ca*cg ;
+  sasbsg = sa*sb*sg ;
+  cbcg = cb*cg ;
+  cbsg = cb*sg ;
+
+  for (sse = 0.0f, vno = 0 ; vno < soa->nvertices ; vno++)
+  {
+    if (soa->ripflag[vno])
+      continue ;
+    x = soa->x[vno] ;
+    y = soa->y[vno] ;
+    z = soa->z[vno] ;
+    xp = x*cacb + z*(-cacgsb - sasg) + y*(cgsa-casbsg) ;
+    yp = -x*cbsa + z*(cgsasb-casg) + y*(cacg+sasbsg) ;
+    zp = z*cbcg + x*sb + y*cbsg ;
+
+    src = soa->tx[vno] ;
+    target = MRISPfunctionVal(parms->mrisp_template, mris, xp, yp, zp,
+                              parms->frame_no) ;
+#if DISABLE_STDS
+    std = 1.0f ;
+#else
+    std = MRISPfunctionVal(parms->mrisp_template, mris, xp, yp, zp,
+                           parms->frame_no+1);
+    std = sqrt(std) ;
+    if (FZERO(std))
+      std = DEFAULT_STD /*FSMALL*/ ;
+    if (!use_stds)
+      std = 1.0f ;
+#endif
+    delta = (src - target) / std ;
+    if (parms->abs_norm)
+      sse += fabs(delta) ;
+    else
+      sse += delta * delta ;
+  }
+  return(sse) ;
+}
+
 int
 MRISrigidBodyAlignGlobal(MRI_SURFACE *mris, INTEGRATION_PARMS *parms,
                          float min_degrees, float max_degrees, int nangles)
 {
   double   alpha, beta, gamma, degrees, delta, mina, minb, ming,
-           sse, min_sse, ext_sse ;
-  int      old_status = mris->status, old_norm, msec;
+           sse, min_sse, ext_sse, *angles = NULL, *sses = NULL ;
+  int      old_status = mris->status, old_norm, msec, max_steps = 0,
+           max_sses = 0 ;
   struct timeb  mytimer;
 
   printf("Starting MRISrigidBodyAlignGlobal()\n");
@@ -33031,48 +33330,110 @@ MRISrigidBodyAlignGlobal(MRI_SURFACE *mris, INTEGRATION_PARMS *parms,
               (float)DEGREES(degrees), (float)min_sse) ;
     }
 
-    for (alpha = -degrees ; alpha <= degrees ; alpha += delta)
+    if (gMRISexternalSSE == NULL)
     {
-      for (beta = -degrees ; beta <= degrees ; beta += delta)
+      /* evaluate the whole grid of rotations concurrently on a
+         read-only copy of the coordinates, then pick the minimum in
+         the same order as the sequential scan below */
+      MRIS_SOA *soa ;
+      int      nsteps, ntotal, n ;
+
+      nsteps = 0 ;
+      for (alpha = -degrees ; alpha <= degrees ; alpha += delta)
       {
-        if (Gdiag & DIAG_SHOW)
+        if (nsteps >= max_steps)
         {
-          fprintf(stdout, "\r(%+2.2f, %+2.2f, %+2.2f), "
-                  "min @ (%2.2f, %2.2f, %2.2f) = %2.1f   ",
-                  (float)DEGREES(alpha), (float)DEGREES(beta), (float)
-                  DEGREES(-degrees), (float)DEGREES(mina),
-                  (float)DEGREES(minb), (float)DEGREES(ming),(float)min_sse);
+          max_steps = 2*nsteps+1 ;
+          angles = (double *)realloc(angles, max_steps*sizeof(double)) ;
+          if (angles == NULL)
+            ErrorExit(ERROR_NOMEMORY, "MRISrigidBodyAlignGlobal: "
+                      "could not allocate %d angles", max_steps) ;
         }
+        angles[nsteps++] = alpha ;
+      }
+      ntotal = nsteps*nsteps*nsteps ;
+      if (ntotal > max_sses)
+      {
+        max_sses = ntotal ;
+        sses = (double *)realloc(sses, max_sses*sizeof(double)) ;
+        if (sses == NULL)
+          ErrorExit(ERROR_NOMEMORY, "MRISrigidBodyAlignGlobal: "
+                    "could not allocate %d rotations", max_sses) ;
+      }
 
-        for (gamma = -degrees ; gamma <= degrees ; gamma += delta)
+      MRISsoaLoad(mris, MRIS_SOA_POSITIONS) ;
+      soa = mris->soa ;
+      for (n = 0 ; n < mris->nvertices ; n++)
+        soa->tx[n] = mris->vertices[n].curv ;
+
+#ifdef HAVE_OPENMP
+      #pragma omp parallel for schedule(dynamic)
+#endif
+      for (n = 0 ; n < ntotal ; n++)
+      {
+        int ia = n / (nsteps*nsteps), ib = (n / nsteps) % nsteps,
+            ig = n % nsteps ;
+        sses[n] = mrisRigidBodyCorrelationError(mris, parms, 1,
+                                                angles[ia], angles[ib],
+                                                angles[ig]) ;
+      }
+
+      for (n = 0 ; n < ntotal ; n++)
+      {
+        if (sses[n] < min_sse)
+        {
+          mina = angles[n / (nsteps*nsteps)] ;
+          minb = angles[(n / nsteps) % nsteps] ;
+          ming = angles[n % nsteps] ;
+          min_sse = sses[n] ;
+        }
+      }
+    }
+    else
+    {
+      for (alpha = -degrees ; alpha <= degrees ; alpha += delta)
+      {
+        for (beta = -degrees ; beta <= degrees ; beta += delta)
         {
-          MRISsaveVertexPositions(mris, TMP_VERTICES) ;
-          MRISrotate(mris, mris, alpha, beta, gamma) ;
-          sse = mrisComputeCorrelationError(mris, parms, 1) ;  /* was 0 !!!! */
-          if (gMRISexternalSSE)
-          {
-            ext_sse = (*gMRISexternalSSE)(mris, parms) ;
-            sse += ext_sse ;
-          }
-          MRISrestoreVertexPositions(mris, TMP_VERTICES) ;
-          if (sse < min_sse)
-          {
-            mina = alpha ;
-            minb = beta ;
-            ming = gamma ;
-            min_sse = sse ;
-          }
-#if 0
           if (Gdiag & DIAG_SHOW)
+          {
             fprintf(stdout, "\r(%+2.2f, %+2.2f, %+2.2f), "
                     "min @ (%2.2f, %2.2f, %2.2f) = %2.1f   ",
                     (float)DEGREES(alpha), (float)DEGREES(beta), (float)
-                    DEGREES(gamma), (float)DEGREES(mina),
+                    DEGREES(-degrees), (float)DEGREES(mina),
                     (float)DEGREES(minb), (float)DEGREES(ming),(float)min_sse);
+          }
+
+          for (gamma = -degrees ; gamma <= degrees ; gamma += delta)
+          {
+            MRISsaveVertexPositions(mris, TMP_VERTICES) ;
+            MRISrotate(mris, mris, alpha, beta, gamma) ;
+            sse = mrisComputeCorrelationError(mris, parms, 1) ;  /* was 0 !!!! */
+            if (gMRISexternalSSE)
+            {
+              ext_sse = (*gMRISexternalSSE)(mris, parms) ;
+              sse += ext_sse ;
+            }
+            MRISrestoreVertexPositions(mris, TMP_VERTICES) ;
+            if (sse < min_sse)
+            {
+              mina = alpha ;
+              minb = beta ;
+              ming = gamma ;
+              min_sse = sse ;
+            }
+#if 0
+            if (Gdiag & DIAG_SHOW)
+              fprintf(stdout, "\r(%+2.2f, %+2.2f, %+2.2f), "
+                      "min @ (%2.2f, %2.2f, %2.2f) = %2.1f   ",
+                      (float)DEGREES(alpha), (float)DEGREES(beta), (float)
+                      DEGREES(gamma), (float)DEGREES(mina),
+                      (float)DEGREES(minb), (float)DEGREES(ming),(float)min_sse);
 #endif
-        } // gamma
-      } // beta
-    } // alpha
+          } // gamma
+        } // beta
+      } // alpha
+    }
 
     if (Gdiag & DIAG_SHOW)
     {
@@ -33127,6 +33488,10 @@ MRISrigidBodyAlignGlobal(MRI_SURFACE *mris, INTEGRATION_PARMS *parms,
     }
   } // degrees
 
+  if (angles)
+    free(angles) ;
+  if (sses)
+    free(sses) ;
   mris->status = old_status ;
   parms->abs_norm = old_norm ;
 
@@ -53900,6 +54265,14 @@ static void computeDisplacement(MRI_SURFACE *mris,DP *dp)
   }
 }
 
+/* Patches are evaluated one at a time: each one is retessellated into
+   mris_corrected itself, marks the shared etable edges as used and adds
+   to the vertex statistics in rp before mrisRestoreVertexState undoes it,
+   and mrisComputeDefectLogLikelihood sets the file-scope l_mri, l_unmri,
+   l_curv and l_qcurv (zeroing l_unmri for small defects). Defects are
+   likewise retessellated one after another into the same mris_corrected.
+   Neither can run concurrently without a private copy of the surface,
+   edge table, rp statistics and weights for each patch. */
 static double
 mrisDefectPatchFitness(MRI_SURFACE *mris, MRI_SURFACE *mris_corrected, MRI *mri,
                        DEFECT_PATCH *dp, int *vertex_trans, DEFECT_VERTEX_STATE *dvs, RP *rp,
@@ -65210,8 +65583,8 @@ static int mrisComputeOptimalRetessellation
   DEFECT_PATCH dps1[MAX_PATCHES], dps2[MAX_PATCHES], \
   *dps, *dp, *dps_next_generation ;
   int i, best_i, j, g, nselected, nreplacements,rank, nunchanged = 0,
-                                                      nelite, ncrossovers, k, l, noverlap ;
-  int *overlap ,ngenerations,nbests,last_euthanasia,
+                                                      nelite, ncrossovers, k, l ;
+  int *overlaps ,nlist,nthreads,ndone,ngenerations,nbests,last_euthanasia,
       nremovedvertices,nfinalvertices;
   double fitness, best_fitness, last_best, fitness_mean,
          fitness_sigma, fitness_norm, pfitness,two_sigma_sq ,last_fitness;
@@ -65372,22 +65745,40 @@ static int mrisComputeOptimalRetessellation
     etable.overlapping_edges = (int **)calloc(nedges, sizeof(int *)) ;
     etable.noverlap = (int *)calloc(nedges, sizeof(int)) ;
     etable.flags = (unsigned char *)calloc(nedges, sizeof(unsigned char)) ;
-    overlap = (int *)calloc(nedges, sizeof(int)) ;
+    /* each thread collects the overlaps of its edge in its own list,
+       which never holds more than MAX_EDGES+1 entries */
+#ifdef HAVE_OPENMP
+    nthreads = omp_get_max_threads() ;
+#else
+    nthreads = 1 ;
+#endif
+    nlist = MIN(nedges, MAX_EDGES+1) ;
+    overlaps = (int *)calloc((size_t)nthreads*nlist, sizeof(int)) ;
     if (!etable.edges ||
         !etable.overlapping_edges ||
         !etable.noverlap ||
-        !overlap)
+        !overlaps)
       ErrorExit(ERROR_NOMEMORY, "mrisComputeOptimalRetessellation: Excessive "
                 "topologic defect encountered: could not allocate %d "
                 "edge table",nedges) ;
 
-    for (nzero = i = 0 ; i < nedges ; i++)  /* compute overlapping
-                                                           for each edge */
+    /* compute overlapping for each edge. The O(nedges^2) intersection
+       tests dominate for large defects; the lists of different edges
+       are independent, so they are built concurrently and come out
+       exactly as in the serial loop */
+    nzero = ndone = 0 ;
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for schedule(dynamic,64) reduction(+:nzero)
+#endif
+    for (i = 0 ; i < nedges ; i++)
     {
-      if (nedges > 50000 && !(i % 25000))
-      {
-        fprintf(WHICH_OUTPUT,"%d of %d edges processed\n", i, nedges) ;
-      }
+      int j, noverlap, *overlap ;
+
+#ifdef HAVE_OPENMP
+      overlap = overlaps + (size_t)omp_get_thread_num()*nlist ;
+#else
+      overlap = overlaps ;
+#endif
       etable.noverlap[i] = 0 ;
       for (noverlap = j = 0 ; j < nedges ; j++)
       {
@@ -65432,9 +65823,22 @@ static int mrisComputeOptimalRetessellation
       {
         nzero++ ;
       }
+      if (nedges > 50000)
+      {
+        /* count the edges as they finish so the progress is in order */
+#ifdef HAVE_OPENMP
+        #pragma omp critical
+#endif
+        {
+          if (!(++ndone % 25000))
+          {
+            fprintf(WHICH_OUTPUT,"%d of %d edges processed\n", ndone, nedges) ;
+          }
+        }
+      }
     }
 
-    free(overlap) ;
+    free(overlaps) ;
   }
 
 
@@ -74700,6 +75104,158 @@ MRI *MRISsmoothMRI(MRIS *Surf,
   MRIScrsLUTFree(crslut);
   return(Targ);
 }
+/*-------------------------------------------------------------------
+  Sparse form of one nearest-neighbor averaging step of
+  MRISsmoothMRIFast(): row r replaces vertex vno[r] with the mean of
+  the values of col[start[r]] ... col[start[r+1]-1], which is the
+  vertex itself followed by its unripped, unmasked neighbors in v[]
+  order. Masked-out vertices have no row.
+  -------------------------------------------------------------------*/
+typedef struct
+{
+  int nrows;
+  int *vno;
+  int *start;
+  int *col;
+}
+MRIS_SMOOTH_OP;
+
+static MRIS_SMOOTH_OP *mrisSmoothOpAlloc(MRIS *Surf, MRI *IncMask)
+{
+  MRIS_SMOOTH_OP *op;
+  int vno, nthnbr, nbrvno, nnz;
+  char *inmask;
+  VERTEX *v;
+
+  op = (MRIS_SMOOTH_OP *)calloc(1, sizeof(MRIS_SMOOTH_OP));
+  inmask = (char *)calloc(Surf->nvertices, sizeof(char));
+  nnz = 0;
+  for (vno = 0 ; vno < Surf->nvertices ; vno++)
+  {
+    // Mask is inclusive
+    inmask[vno] = (!IncMask || !(MRIgetVoxVal(IncMask,vno,0,0,0) < 0.5));
+    nnz += 1 + Surf->vertices[vno].vnum;
+  }
+  op->vno = (int *)calloc(Surf->nvertices, sizeof(int));
+  op->start = (int *)calloc(Surf->nvertices+1, sizeof(int));
+  op->col = (int *)calloc(nnz, sizeof(int));
+  if (!op->vno || !op->start || !op->col)
+    ErrorExit(ERROR_NOMEMORY, "mrisSmoothOpAlloc: could not allocate "
+              "%d x %d operator", Surf->nvertices, nnz) ;
+
+  nnz = 0;
+  for (vno = 0 ; vno < Surf->nvertices ; vno++)
+  {
+    if (!inmask[vno])
+    {
+      continue ;
+    }
+    v = &Surf->vertices[vno] ;
+    op->vno[op->nrows] = vno;
+    op->start[op->nrows] = nnz;
+    op->col[nnz++] = vno;
+    for (nthnbr = 0 ; nthnbr < v->vnum ; nthnbr++)
+    {
+      nbrvno = v->v[nthnbr];
+      if (Surf->vertices[nbrvno].ripflag || !inmask[nbrvno])
+      {
+        continue ;
+      }
+      op->col[nnz++] = nbrvno;
+    }
+    op->nrows++;
+  }
+  op->start[op->nrows] = nnz;
+  free(inmask);
+  return(op);
+}
+
+static void mrisSmoothOpFree(MRIS_SMOOTH_OP **pop)
+{
+  MRIS_SMOOTH_OP *op = *pop;
+  free(op->vno);
+  free(op->start);
+  free(op->col);
+  free(op);
+  *pop = NULL;
+}
+
+/* Number of frames smoothed together by MRISsmoothMRIFast() */
+#define SMOOTH_FRAME_BLOCK 16
+
+/*-------------------------------------------------------------------
+  mrisSmoothOpApply() - applies nSmoothSteps steps of op to nb frames
+  at once. x holds the frames interleaved (x[vno*nb + b] is frame b of
+  vertex vno) and gets the result; y is scratch of the same size.
+  Masked-out vertices must be 0 in x; they stay 0. Each frame is summed
+  in the same order as the single frame loop, so the result is the same
+  whatever nb is.
+  -------------------------------------------------------------------*/
+static float *mrisSmoothOpApply(MRIS_SMOOTH_OP *op, int nSmoothSteps,
+                                int nb, float *x, float *y)
+{
+  int nthstep, r;
+  float *tmp;
+
+  for (nthstep = 0 ; nthstep < nSmoothSteps ; nthstep++)
+  {
+    if (nb == 1)
+    {
+#ifdef HAVE_OPENMP
+      #pragma omp parallel for schedule(static)
+#endif
+      for (r = 0 ; r < op->nrows ; r++)
+      {
+        float sumF ;
+        int k ;
+
+        sumF = x[op->col[op->start[r]]];
+        for (k = op->start[r]+1 ; k < op->start[r+1] ; k++)
+        {
+          sumF += x[op->col[k]];
+        }
+        y[op->vno[r]] = sumF/(op->start[r+1] - op->start[r]);
+      }
+      tmp = x;
+      x = y;
+      y = tmp;
+      continue ;
+    }
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for schedule(static)
+#endif
+    for (r = 0 ; r < op->nrows ; r++)
+    {
+      float sumF[SMOOTH_FRAME_BLOCK], *xn, *yv ;
+      int k, b, num ;
+
+      num = op->start[r+1] - op->start[r];
+      xn = x + (size_t)op->col[op->start[r]]*nb;
+      for (b = 0 ; b < nb ; b++)
+      {
+        sumF[b] = xn[b];
+      }
+      for (k = op->start[r]+1 ; k < op->start[r+1] ; k++)
+      {
+        xn = x + (size_t)op->col[k]*nb;
+        for (b = 0 ; b < nb ; b++)
+        {
+          sumF[b] += xn[b];
+        }
+      }
+      yv = y + (size_t)op->vno[r]*nb;
+      for (b = 0 ; b < nb ; b++)
+      {
+        yv[b] = sumF[b]/num;
+      }
+    }
+    tmp = x;
+    x = y;
+    y = tmp;
+  }
+  return(x);
+}
+
 /*-------------------------------------------------------------------
   MRISsmoothMRIFast() - faster version of MRISsmoothMRI(). Smooths
   values on the surface when the surface values are stored in an
@@ -74712,17 +75268,18 @@ MRI *MRISsmoothMRI(MRIS *Surf,
   data from ripped vertices into unripped vertices (but does go the
   other way). Same for mask. The mask is inclusive, so voxels with
   mask=1 are included. If mask is NULL, it is ignored. Gives identical
-  results as MRISsmoothMRI(); see MRISsmoothMRIFastCheck().
+  results as MRISsmoothMRI(); see MRISsmoothMRIFastCheck(). Frames
+  are smoothed SMOOTH_FRAME_BLOCK at a time with a sparse averaging
+  operator that is built once, on all threads.
   -------------------------------------------------------------------*/
 MRI *MRISsmoothMRIFast(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask,  MRI *Targ)
 {
-  int nnbrs, nthstep, frame, vno, nthnbr, num, nvox, nbrvno,reshape;
+  int frame, f0, nb, b, r, vno, nvox, reshape;
   MRI *SrcTmp,*mritmp,*IncMaskTmp=NULL;
   struct timeb  mytimer;
   int msecTime;
-  int *nNbrs, *nNbrs0, *rip, *rip0, nNbrsMax;
-  float **pF, **pF0, *tF, *tF0, sumF;
-  VERTEX *v, *vn;
+  MRIS_SMOOTH_OP *op;
+  float *x, *y, *xs, *pSrc;
 
   if(Gdiag_no > 0) printf("MRISsmoothMRIFast()\n");
 
@@ -74760,99 +75317,52 @@ MRI *MRISsmoothMRIFast(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask,  MR
     }
   }
 
-  // Alloc arrays. If there are ripped vertices, then only rip
-  // needs nvertices elements
-  nNbrsMax = 12; // Should measure this, but overalloc does not hurt
-  pF = (float **) calloc(Surf->nvertices*nNbrsMax,sizeof(float *));
-  tF = (float *)  calloc(Surf->nvertices,sizeof(float));
-  nNbrs = (int *) calloc(Surf->nvertices,sizeof(int));
-  rip = (int *)   calloc(Surf->nvertices,sizeof(int));
-
-  pF0 = pF;
-  tF0 = tF;
-  rip0 = rip;
-  nNbrs0 = nNbrs;
-
   TimerStart(&mytimer) ;
 
-  // Loop through frames
-  for (frame = 0; frame < Src->nframes; frame ++)
+  // One smoothing step is a sparse matrix times the data. The matrix
+  // is built once and applied to blocks of frames, which are stored
+  // interleaved so that the inner loops run across frames.
+  op = mrisSmoothOpAlloc(Surf, IncMaskTmp);
+  nb = MIN(Src->nframes, SMOOTH_FRAME_BLOCK);
+  x = (float *)calloc((size_t)nvox*nb, sizeof(float));
+  y = (float *)calloc((size_t)nvox*nb, sizeof(float));
+  if (!x || !y)
+    ErrorExit(ERROR_NOMEMORY, "MRISsmoothMRIFast: could not allocate "
+              "%d x %d frames", nvox, nb) ;
+
+  for (f0 = 0; f0 < Src->nframes; f0 += SMOOTH_FRAME_BLOCK)
   {
+    nb = MIN(Src->nframes - f0, SMOOTH_FRAME_BLOCK);
 
-    // Set up pointers for this frame
-    pF = pF0;
-    rip = rip0;
-    nNbrs = nNbrs0;
-    for (vno = 0 ; vno < Surf->nvertices ; vno++)
+    // Masked-out vertices are set to 0 and stay 0
+    memset(x, 0, (size_t)nvox*nb*sizeof(float));
+    memset(y, 0, (size_t)nvox*nb*sizeof(float));
+    for (b = 0; b < nb; b++)
     {
-      v = &Surf->vertices[vno] ;
-      if(IncMaskTmp && MRIgetVoxVal(IncMaskTmp,vno,0,0,0) < 0.5)
-      {
-        // Mask is inclusive, so look for out of mask
-        // should exclude rips here too? Original does not.
-        rip[vno] = 1;
-        MRIFseq_vox(SrcTmp,vno,0,0,frame) = 0;
-        continue ;
-      }
-      rip[vno] = 0;
-      *pF++ = (float *)(&(MRIFseq_vox(SrcTmp,vno,0,0,frame)));
-      nnbrs = Surf->vertices[vno].vnum;
-      num = 1;
-      for (nthnbr = 0 ; nthnbr < nnbrs ; nthnbr++)
+      frame = f0 + b;
+      pSrc = &MRIFseq_vox(SrcTmp,0,0,0,frame);
+      for (r = 0; r < op->nrows; r++)
       {
-        nbrvno = Surf->vertices[vno].v[nthnbr];
-        vn = &Surf->vertices[nbrvno] ;
-        if(vn->ripflag)
-        {
-          continue ;
-        }
-        if(IncMaskTmp && MRIgetVoxVal(IncMaskTmp,nbrvno,0,0,0) < 0.5)
-        {
-          continue ;
-        }
-        *pF++ = (float *)(&(MRIFseq_vox(SrcTmp,nbrvno,0,0,frame)));
-        num++ ;
+        x[(size_t)op->vno[r]*nb + b] = pSrc[op->vno[r]];
       }
-      *nNbrs++ = num; // num takes into account all rips/masks
     }
 
-    // Step through the iterations
-    for(nthstep = 0; nthstep < nSmoothSteps; nthstep++)
+    xs = mrisSmoothOpApply(op, nSmoothSteps, nb, x, y);
+
+    for (b = 0; b < nb; b++)
     {
-      // Init pointers for this iteration
-      pF  = pF0;
-      rip = rip0;
-      tF  = tF0;
-      nNbrs = nNbrs0;
-      // Loop through vertices, average nearest neighbors
-      for (vno = 0 ; vno < Surf->nvertices ; vno++)
+      frame = f0 + b;
+      pSrc = &MRIFseq_vox(SrcTmp,0,0,0,frame);
+      for (vno = 0; vno < nvox; vno++)
       {
-        if(*rip++)
-        {
-          continue ;
-        }
-        sumF = *(*pF++);
-        for(nthnbr = 0 ; nthnbr < (*nNbrs)-1 ; nthnbr++)
-        {
-          sumF += *(*pF++);
-        }
-        *tF++ = sumF/(*nNbrs);
-        nNbrs++;
-      }
-      // Load up for the next step
-      rip = rip0;
-      tF  = tF0;
-      for (vno = 0 ; vno < Surf->nvertices ; vno++)
-      {
-        if(*rip++)
-        {
-          continue ;
-        }
-        MRIsetVoxVal(SrcTmp,vno,0,0,frame, *tF++);
+        pSrc[vno] = xs[(size_t)vno*nb + b];
       }
     }
+  }/* end loop over frame blocks */
 
-  }/* end loop over frame */
+  free(x);
+  free(y);
+  mrisSmoothOpFree(&op);
 
   // Copy to the output
   if(reshape){
@@ -74872,10 +75382,6 @@ MRI *MRISsmoothMRIFast(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask,  MR
 
   MRIfree(&SrcTmp);
   if(IncMaskTmp) MRIfree(&IncMaskTmp);
-  free(pF0);
-  free(tF0);
-  free(rip0);
-  free(nNbrs0);
 
   return(Targ);
 }
@@ -0,0 +1,405 @@
+/**
+ * @file  mrivoxel.cpp
+ * @brief Typed kernels behind the common voxelwise MRI operators
+ *
+ * MRIthreshold(), MRIbinarize(), MRIscalarMul(), MRIlinearScale(),
+ * MRImask() and MRIaverageFrames() call these first. Each one picks
+ * the voxel types once (see mrivoxel.hpp) and runs a typed loop over
+ * rows on all threads. The values are converted exactly as
+ * MRIgetVoxVal()/MRIsetVoxVal() would, so the output is unchanged.
+ * Type combinations that are not handled return ERROR_UNSUPPORTED and
+ * the caller falls back to its generic loop.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ * CVS Revision Info:
+ *    $Author$
+ *    $Date$
+ *    $Revision$
+ *
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <cmath>
+
+#include "mrivoxel.hpp"
+
+extern "C"
+{
+#include "macros.h"
+}
+
+using namespace Freesurfer;
+
+namespace
+{
+
+// ======================================================
+// Voxelwise maps dst = f(src), f taking and returning a float
+
+class ThresholdFn
+{
+public:
+  ThresholdFn( const float _thresh ) : thresh(_thresh) {};
+  float operator()( const float val ) const
+  {
+    return( val < this->thresh ? 0 : val );
+  }
+private:
+  const float thresh;
+};
+
+class ScalarMulFn
+{
+public:
+  ScalarMulFn( const float _scalar ) : scalar(_scalar) {};
+  float operator()( const float val ) const
+  {
+    return( val*this->scalar );
+  }
+private:
+  const float scalar;
+};
+
+class LinearScaleFn
+{
+public:
+  LinearScaleFn( const float _scale, const float _offset,
+                 const int _only_nonzero ) :
+    scale(_scale), offset(_offset), only_nonzero(_only_nonzero) {};
+  float operator()( float val ) const
+  {
+    if( !this->only_nonzero || !DZERO(val) )
+    {
+      val = val*this->scale + this->offset;
+    }
+    return( val );
+  }
+private:
+  const float scale, offset;
+  const int only_nonzero;
+};
+
+
+template<typename TS, typename TD, typename Fn>
+class MapKernel
+{
+public:
+  MapKernel( const MRI *src, MRI *dst, const Fn &_fn ) :
+    vsrc(src), vdst(dst), width(src->width), fn(_fn) {};
+
+  void operator()( const int y, const int z, const int f ) const
+  {
+    const TS *s = this->vsrc.Row(y, z, f);
+    TD *d = this->vdst.Row(y, z, f);
+
+    for( int x = 0; x < this->width; x++ )
+    {
+      d[x] = MRIvoxelTraits<TD>::FromFloat( this->fn( (float)s[x] ) );
+    }
+  }
+
+private:
+  const MRIvoxelView<TS> vsrc;
+  const MRIvoxelView<TD> vdst;
+  const int width;
+  const Fn fn;
+};
+
+template<typename Fn>
+class MapOp
+{
+public:
+  MapOp( const MRI *_src, MRI *_dst, const Fn &_fn ) :
+    src(_src), dst(_dst), fn(_fn) {};
+
+  template<typename TS, typename TD>
+  int Apply( void )
+  {
+    MRIforEachRow( this->src->height, this->src->depth, this->src->nframes,
+                   MapKernel<TS,TD,Fn>( this->src, this->dst, this->fn ) );
+    return( NO_ERROR );
+  }
+
+private:
+  const MRI *src;
+  MRI *dst;
+  const Fn fn;
+};
+
+int MRIsameShape( const MRI *mri_src, const MRI *mri_dst )
+{
+  return( mri_dst->width == mri_src->width &&
+          mri_dst->height == mri_src->height &&
+          mri_dst->depth == mri_src->depth &&
+          mri_dst->nframes >= mri_src->nframes );
+}
+
+template<typename Fn>
+int MRItypedMap( const MRI *mri_src, MRI *mri_dst, const Fn &fn )
+{
+  if( !MRIsameShape( mri_src, mri_dst ) )
+  {
+    return( ERROR_UNSUPPORTED );
+  }
+  MapOp<Fn> op( mri_src, mri_dst, fn );
+  return( MRIdispatchTypes( mri_src->type, mri_dst->type, op ) );
+}
+
+
+// ======================================================
+// MRIbinarize(): the two output values are converted once, which
+// leaves a select per voxel that the compiler can vectorize
+
+template<typename TS, typename TD>
+class BinarizeKernel
+{
+public:
+  BinarizeKernel( const MRI *src, MRI *dst, const float _thresh,
+                  const float low_val, const float hi_val ) :
+    vsrc(src), vdst(dst), width(src->width), thresh(_thresh),
+    low(MRIvoxelTraits<TD>::FromFloat(low_val)),
+    hi(MRIvoxelTraits<TD>::FromFloat(hi_val)) {};
+
+  void operator()( const int y, const int z, const int f ) const
+  {
+    const TS *s = this->vsrc.Row(y, z, f);
+    TD *d = this->vdst.Row(y, z, f);
+
+    for( int x = 0; x < this->width; x++ )
+    {
+      d[x] = ( (float)s[x] < this->thresh ) ? this->low : this->hi;
+    }
+  }
+
+private:
+  const MRIvoxelView<TS> vsrc;
+  const MRIvoxelView<TD> vdst;
+  const int width;
+  const float thresh;
+  const TD low, hi;
+};
+
+class BinarizeOp
+{
+public:
+  BinarizeOp( const MRI *_src, MRI *_dst, const float _thresh,
+              const float _low, const float _hi ) :
+    src(_src), dst(_dst), thresh(_thresh), low(_low), hi(_hi) {};
+
+  template<typename TS, typename TD>
+  int Apply( void )
+  {
+    MRIforEachRow( this->src->height, this->src->depth, this->src->nframes,
+                   BinarizeKernel<TS,TD>( this->src, this->dst, this->thresh,
+                                          this->low, this->hi ) );
+    return( NO_ERROR );
+  }
+
+private:
+  const MRI *src;
+  MRI *dst;
+  const float thresh, low, hi;
+};
+
+
+// ======================================================
+// MRImask(): dst = (mask == mask_val) ? out_val : src
+
+template<typename T, typename TM>
+class MaskKernel
+{
+public:
+  MaskKernel( const MRI *src, const MRI *mask, MRI *dst, const int _maskval,
+              const float _out_val ) :
+    vsrc(src), vmask(mask), vdst(dst), width(src->width),
+    maskval(_maskval), out_val(_out_val) {};
+
+  void operator()( const int y, const int z, const int f ) const
+  {
+    const T *s = this->vsrc.Row(y, z, f);
+    const TM *m = this->vmask.Row(y, z, 0);
+    T *d = this->vdst.Row(y, z, f);
+
+    for( int x = 0; x < this->width; x++ )
+    {
+      const int mask_val = (int)(float)m[x];
+      const float val = (mask_val == this->maskval) ? this->out_val :
+                        (float)s[x];
+      d[x] = MRIvoxelTraits<T>::FromFloat( val );
+    }
+  }
+
+private:
+  const MRIvoxelView<T> vsrc;
+  const MRIvoxelView<TM> vmask;
+  const MRIvoxelView<T> vdst;
+  const int width, maskval;
+  const float out_val;
+};
+
+class MaskOp
+{
+public:
+  MaskOp( const MRI *_src, const MRI *_mask, MRI *_dst, const int _maskval,
+          const float _out_val ) :
+    src(_src), mask(_mask), dst(_dst), maskval(_maskval),
+    out_val(_out_val) {};
+
+  template<typename T, typename TM>
+  int Apply( void )
+  {
+    MRIforEachRow( this->src->height, this->src->depth, this->src->nframes,
+                   MaskKernel<T,TM>( this->src, this->mask, this->dst,
+                                     this->maskval, this->out_val ) );
+    return( NO_ERROR );
+  }
+
+private:
+  const MRI *src, *mask;
+  MRI *dst;
+  const int maskval;
+  const float out_val;
+};
+
+
+// ======================================================
+// MRIaverageFrames(): float dst = mean of src frames [f0, f1]
+
+template<typename TS>
+class AverageFramesKernel
+{
+public:
+  AverageFramesKernel( const MRI *src, MRI *dst, const int _f0,
+                       const int _f1 ) :
+    vsrc(src), vdst(dst), width(src->width), f0(_f0), f1(_f1) {};
+
+  void operator()( const int y, const int z, const int ) const
+  {
+    float *d = this->vdst.Row(y, z, 0);
+    const int nframes = this->f1 - this->f0 + 1;
+
+    // accumulate frame by frame in the row of the output, which adds
+    // the frames of each voxel in the same order as the voxel loop
+    for( int x = 0; x < this->width; x++ )
+    {
+      d[x] = 0.0f;
+    }
+    for( int f = this->f0; f <= this->f1; f++ )
+    {
+      const TS *s = this->vsrc.Row(y, z, f);
+      for( int x = 0; x < this->width; x++ )
+      {
+        d[x] += (float)s[x];
+      }
+    }
+    for( int x = 0; x < this->width; x++ )
+    {
+      d[x] /= nframes;
+    }
+  }
+
+private:
+  const MRIvoxelView<TS> vsrc;
+  const MRIvoxelView<float> vdst;
+  const int width, f0, f1;
+};
+
+class AverageFramesOp
+{
+public:
+  AverageFramesOp( const MRI *_src, MRI *_dst, const int _f0,
+                   const int _f1 ) :
+    src(_src), dst(_dst), f0(_f0), f1(_f1) {};
+
+  template<typename TS>
+  int Apply( void )
+  {
+    MRIforEachRow( this->src->height, this->src->depth, 1,
+                   AverageFramesKernel<TS>( this->src, this->dst,
+                                            this->f0, this->f1 ) );
+    return( NO_ERROR );
+  }
+
+private:
+  const MRI *src;
+  MRI *dst;
+  const int f0, f1;
+};
+
+}
+
+
+// ======================================================
+
+extern "C"
+{
+
+int MRItypedThreshold( const MRI *mri_src, MRI *mri_dst, float threshold )
+{
+  return( MRItypedMap( mri_src, mri_dst, ThresholdFn(threshold) ) );
+}
+
+int MRItypedBinarize( const MRI *mri_src, MRI *mri_dst, float threshold,
+                      float low_val, float hi_val )
+{
+  if( !MRIsameShape( mri_src, mri_dst ) )
+  {
+    return( ERROR_UNSUPPORTED );
+  }
+  BinarizeOp op( mri_src, mri_dst, threshold, low_val, hi_val );
+  return( MRIdispatchTypes( mri_src->type, mri_dst->type, op ) );
+}
+
+int MRItypedScalarMul( const MRI *mri_src, MRI *mri_dst, float scalar )
+{
+  return( MRItypedMap( mri_src, mri_dst, ScalarMulFn(scalar) ) );
+}
+
+int MRItypedLinearScale( const MRI *mri_src, MRI *mri_dst, float scale,
+                         float offset, int only_nonzero )
+{
+  return( MRItypedMap( mri_src, mri_dst,
+                       LinearScaleFn(scale, offset, only_nonzero) ) );
+}
+
+int MRItypedMask( const MRI *mri_src, const MRI *mri_mask, MRI *mri_dst,
+                  int mask, float out_val )
+{
+  // the mask is read at every frame, so it must not be overwritten
+  if( mri_src->type != mri_dst->type || mri_dst == mri_mask ||
+      !MRIsameShape( mri_src, mri_dst ) ||
+      mri_mask->width != mri_src->width ||
+      mri_mask->height != mri_src->height ||
+      mri_mask->depth != mri_src->depth )
+  {
+    return( ERROR_UNSUPPORTED );
+  }
+  MaskOp op( mri_src, mri_mask, mri_dst, mask, out_val );
+  return( MRIdispatchTypes( mri_src->type, mri_mask->type, op ) );
+}
+
+int MRItypedAverageFrames( const MRI *mri_src, MRI *mri_dst,
+                           int start_frame, int end_frame )
+{
+  if( mri_dst->type != MRI_FLOAT || mri_dst == mri_src ||
+      mri_dst->width != mri_src->width ||
+      mri_dst->height != mri_src->height ||
+      mri_dst->depth != mri_src->depth )
+  {
+    return( ERROR_UNSUPPORTED );
+  }
+  AverageFramesOp op( mri_src, mri_dst, start_frame, end_frame );
+  return( MRIdispatchType( mri_src->type, op ) );
+}
+
+}
@@ -74,7 +74,7 @@
 #include "proto.h" // nint
 #include "mrimorph.h"
 #include "timer.h"
-#ifdef _OPENMP
+#ifdef HAVE_OPENMP
 #include <omp.h>
 #endif
 
@@ -97,6 +97,10 @@ typedef struct
 ASEGVOLINDEX;
 
 static int CompareAVIndices(const void *i1, const void *i2);
+static int surf2surfClosestVertices(MRI_SURFACE *SrcSurfReg, MHT *SrcHash,
+                                    MRI_SURFACE *TrgSurfReg, int nlist,
+                                    const int *vtxlist, int *closest,
+                                    float *dmin);
 static int MostHitsInVolVox(ASEGVOLINDEX *avindsorted, int N, int *segidmost, COLOR_TABLE *ct);
 
 /*---------------------------------------------------------
@@ -1120,10 +1124,12 @@ MRI *surf2surf_nnfr(MRI *SrcSurfVals, MRI_SURFACE *SrcSurfReg,
   MRI *TrgSurfVals = NULL;
   int svtx, tvtx, f,n, nrevhits,nSrcLost;
   VERTEX *v;
-  MHT *SrcHash, *TrgHash;
+  MHT *SrcHash=NULL, *TrgHash=NULL;
   float dmin;
   extern char *ResampleVtxMapFile;
   FILE *fp = NULL;
+  int *closest, *revlist;
+  float *closestdist;
 
   /* check dimension consistency */
   if (SrcSurfVals->width != SrcSurfReg->nvertices)
@@ -1182,25 +1188,18 @@ MRI *surf2surf_nnfr(MRI *SrcSurfVals, MRI_SURFACE *SrcSurfReg,
     Go through the forwad loop (finding closest srcvtx to each trgvtx).
     This maps each target vertex to a source vertex */
   printf("Surf2Surf: Forward Loop (%d)\n",TrgSurfReg->nvertices);
+  n = MAX(TrgSurfReg->nvertices,SrcSurfReg->nvertices);
+  closest     = (int *)  calloc(n,sizeof(int));
+  closestdist = (float *)calloc(n,sizeof(float));
+  revlist     = (int *)  calloc(SrcSurfReg->nvertices,sizeof(int));
+  /* find closest source vertex to each target vertex (in parallel) */
+  surf2surfClosestVertices(SrcSurfReg, SrcHash, TrgSurfReg,
+                           TrgSurfReg->nvertices, NULL, closest, closestdist);
   for (tvtx = 0; tvtx < TrgSurfReg->nvertices; tvtx++)
   {
-    if (!UseHash){
-      if (tvtx%100 == 0) {
-        printf("%5d ",tvtx);
-        fflush(stdout);
-      }
-      if (tvtx%1000 == 999){
-        printf("\n");
-        fflush(stdout);
-      }
-    }
-    /* find closest source vertex */
     v = &(TrgSurfReg->vertices[tvtx]);
-    if (UseHash) svtx = MHTfindClosestVertexNo(SrcHash,SrcSurfReg,v,&dmin);
-    else         svtx = MRISfindClosestVertex(SrcSurfReg,v->x,v->y,v->z,&dmin);
-
-    /* hash table failed, so use brute force */
-    if(svtx < 0) svtx = MRISfindClosestVertex(SrcSurfReg,v->x,v->y,v->z,&dmin);
+    svtx = closest[tvtx];
+    dmin = closestdist[tvtx];
 
     /* update the number of hits and distance */
     MRIFseq_vox((*SrcHits),svtx,0,0,0) ++;
@@ -1241,31 +1240,32 @@ MRI *surf2surf_nnfr(MRI *SrcSurfVals, MRI_SURFACE *SrcSurfReg,
     printf("Surf2Surf: Reverse Loop (%d)\n",SrcSurfReg->nvertices);
     nrevhits = 0;
     for (svtx = 0; svtx < SrcSurfReg->nvertices; svtx++)
+      if (MRIFseq_vox((*SrcHits),svtx,0,0,0) == 0) revlist[nrevhits++] = svtx;
+    /* find closest target vertex to each unmapped source vertex */
+    surf2surfClosestVertices(TrgSurfReg, TrgHash, SrcSurfReg,
+                             nrevhits, revlist, closest, closestdist);
+    for (n = 0; n < nrevhits; n++)
     {
-      if (MRIFseq_vox((*SrcHits),svtx,0,0,0) == 0)
-      {
-        nrevhits ++;
-        /* find closest target vertex */
-        v = &(SrcSurfReg->vertices[svtx]);
-        if (UseHash) tvtx = MHTfindClosestVertexNo(TrgHash,TrgSurfReg,v,&dmin);
-        else         tvtx = MRISfindClosestVertex(TrgSurfReg,v->x,v->y,v->z,&dmin);
-	/* Hash table failed, so use brute force */
-        if(tvtx < 0) tvtx = MRISfindClosestVertex(TrgSurfReg,v->x,v->y,v->z,&dmin);
-
-        /* update the number of hits and distance */
-        MRIFseq_vox((*SrcHits),svtx,0,0,0) ++;
-        MRIFseq_vox((*TrgHits),tvtx,0,0,0) ++;
-        MRIFseq_vox((*SrcDist),svtx,0,0,0) += dmin;
-        MRIFseq_vox((*TrgDist),tvtx,0,0,0) += dmin;
-        /* accumulate mapped values for each frame */
-        for (f=0; f < SrcSurfVals->nframes; f++)
-          MRIFseq_vox(TrgSurfVals,tvtx,0,0,f) +=
-            MRIFseq_vox(SrcSurfVals,svtx,0,0,f);
-      }
+      svtx = revlist[n];
+      tvtx = closest[n];
+      dmin = closestdist[n];
+
+      /* update the number of hits and distance */
+      MRIFseq_vox((*SrcHits),svtx,0,0,0) ++;
+      MRIFseq_vox((*TrgHits),tvtx,0,0,0) ++;
+      MRIFseq_vox((*SrcDist),svtx,0,0,0) += dmin;
+      MRIFseq_vox((*TrgDist),tvtx,0,0,0) += dmin;
+      /* accumulate mapped values for each frame */
+      for (f=0; f < SrcSurfVals->nframes; f++)
+        MRIFseq_vox(TrgSurfVals,tvtx,0,0,f) +=
+          MRIFseq_vox(SrcSurfVals,svtx,0,0,f);
     }
     if(UseHash) MHTfree(&TrgHash);
     printf("Reverse Loop had %d hits\n",nrevhits);
   }
+  free(closest);
+  free(closestdist);
+  free(revlist);
 
   /*---------------------------------------------------------------
     Finally, divide the value at each target vertex by the number
@@ -1316,9 +1316,10 @@ MRI *surf2surf_nnfr_jac(MRI *SrcSurfVals, MRI_SURFACE *SrcSurfReg,
 {
   MRI *TrgSurfVals = NULL;
   int svtx, tvtx, f,n, nunmapped, nrevhits,nSrcLost,nhits;
-  VERTEX *v;
-  MHT *SrcHash, *TrgHash;
+  MHT *SrcHash=NULL, *TrgHash=NULL;
   float dmin,srcval;
+  int *closest, *revlist;
+  float *closestdist;
 
   /* check dimension consistency */
   if (SrcSurfVals->width != SrcSurfReg->nvertices)
@@ -1359,14 +1360,18 @@ MRI *surf2surf_nnfr_jac(MRI *SrcSurfVals, MRI_SURFACE *SrcSurfReg,
 
   // First forward loop just counts the number of hits for each src
   printf("Surf2SurfJac: 1st Forward Loop (%d)\n",TrgSurfReg->nvertices);
+  n = MAX(TrgSurfReg->nvertices,SrcSurfReg->nvertices);
+  closest     = (int *)  calloc(n,sizeof(int));
+  closestdist = (float *)calloc(n,sizeof(float));
+  revlist     = (int *)  calloc(SrcSurfReg->nvertices,sizeof(int));
+  /* find closest source vertex to each target vertex (in parallel); the
+     map is the same for both forward loops so it is only computed once */
+  surf2surfClosestVertices(SrcSurfReg, SrcHash, TrgSurfReg,
+                           TrgSurfReg->nvertices, NULL, closest, closestdist);
   nunmapped = 0;
   for (tvtx = 0; tvtx < TrgSurfReg->nvertices; tvtx++){
-    /* find closest source vertex */
-    v = &(TrgSurfReg->vertices[tvtx]);
-    if(UseHash) svtx = MHTfindClosestVertexNo(SrcHash,SrcSurfReg,v,&dmin);
-    else        svtx = MRISfindClosestVertex(SrcSurfReg,v->x,v->y,v->z,&dmin);
-    /* hash table failed, so use brute force */
-    if(svtx < 0) svtx = MRISfindClosestVertex(SrcSurfReg,v->x,v->y,v->z,&dmin);
+    svtx = closest[tvtx];
+    dmin = closestdist[tvtx];
 
     /* update the number of hits and distance */
     MRIFseq_vox((*SrcHits),svtx,0,0,0) ++;  // This is what this loop is for
@@ -1378,12 +1383,7 @@ MRI *surf2surf_nnfr_jac(MRI *SrcSurfVals, MRI_SURFACE *SrcSurfReg,
   // Second forward loop accumulates
   printf("Surf2SurfJac: 2nd Forward Loop (%d)\n",TrgSurfReg->nvertices);
   for (tvtx = 0; tvtx < TrgSurfReg->nvertices; tvtx++) {
-    /* find closest source vertex */
-    v = &(TrgSurfReg->vertices[tvtx]);
-    if(UseHash) svtx = MHTfindClosestVertexNo(SrcHash,SrcSurfReg,v,&dmin);
-    else        svtx = MRISfindClosestVertex(SrcSurfReg,v->x,v->y,v->z,&dmin);
-    /* hash table failed, so use bruce force */
-    if(svtx < 0) svtx = MRISfindClosestVertex(SrcSurfReg,v->x,v->y,v->z,&dmin);
+    svtx = closest[tvtx];
 
     nhits = MRIFseq_vox((*SrcHits),svtx,0,0,0);
     /* Now accumulate mapped values for each frame */
@@ -1409,30 +1409,31 @@ MRI *surf2surf_nnfr_jac(MRI *SrcSurfVals, MRI_SURFACE *SrcSurfReg,
     printf("Surf2SurfJac: Reverse Loop (%d)\n",SrcSurfReg->nvertices);
     nrevhits = 0;
     for (svtx = 0; svtx < SrcSurfReg->nvertices; svtx++)
+      if (MRIFseq_vox((*SrcHits),svtx,0,0,0) == 0) revlist[nrevhits++] = svtx;
+    /* find closest target vertex to each unmapped source vertex */
+    surf2surfClosestVertices(TrgSurfReg, TrgHash, SrcSurfReg,
+                             nrevhits, revlist, closest, closestdist);
+    for (n = 0; n < nrevhits; n++)
     {
-      if (MRIFseq_vox((*SrcHits),svtx,0,0,0) == 0)
-      {
-        nrevhits ++;
-        /* find closest target vertex */
-        v = &(SrcSurfReg->vertices[svtx]);
-        if (UseHash) tvtx = MHTfindClosestVertexNo(TrgHash,TrgSurfReg,v,&dmin);
-        else        tvtx = MRISfindClosestVertex(TrgSurfReg,v->x,v->y,v->z,&dmin);
-	/* Hash table failed, so use brute force */
-        if(tvtx < 0) tvtx = MRISfindClosestVertex(TrgSurfReg,v->x,v->y,v->z,&dmin);
-        /* update the number of hits and distance */
-        MRIFseq_vox((*SrcHits),svtx,0,0,0) ++;
-        MRIFseq_vox((*TrgHits),tvtx,0,0,0) ++;
-        MRIFseq_vox((*SrcDist),svtx,0,0,0) += dmin;
-        MRIFseq_vox((*TrgDist),tvtx,0,0,0) += dmin;
-        /* accumulate mapped values for each frame */
-        for (f=0; f < SrcSurfVals->nframes; f++)
-          MRIFseq_vox(TrgSurfVals,tvtx,0,0,f) +=
-            MRIFseq_vox(SrcSurfVals,svtx,0,0,f);
-      }
+      svtx = revlist[n];
+      tvtx = closest[n];
+      dmin = closestdist[n];
+      /* update the number of hits and distance */
+      MRIFseq_vox((*SrcHits),svtx,0,0,0) ++;
+      MRIFseq_vox((*TrgHits),tvtx,0,0,0) ++;
+      MRIFseq_vox((*SrcDist),svtx,0,0,0) += dmin;
+      MRIFseq_vox((*TrgDist),tvtx,0,0,0) += dmin;
+      /* accumulate mapped values for each frame */
+      for (f=0; f < SrcSurfVals->nframes; f++)
+        MRIFseq_vox(TrgSurfVals,tvtx,0,0,f) +=
+          MRIFseq_vox(SrcSurfVals,svtx,0,0,f);
     }
     if (UseHash)MHTfree(&TrgHash);
     printf("Reverse Loop had %d hits\n",nrevhits);
   }
+  free(closest);
+  free(closestdist);
+  free(revlist);
 
   // Do NOT normalize target vertices with multiple src vertices
 
@@ -1454,6 +1455,45 @@ MRI *surf2surf_nnfr_jac(MRI *SrcSurfVals, MRI_SURFACE *SrcSurfReg,
   return(TrgSurfVals);
 }
 
+/*!
+  \fn static int surf2surfClosestVertices(MRI_SURFACE *SrcSurfReg, MHT *SrcHash,
+      MRI_SURFACE *TrgSurfReg, int nlist, const int *vtxlist, int *closest, float *dmin)
+  \brief For each of the nlist vertices of TrgSurfReg in vtxlist (or
+  the first nlist if vtxlist is NULL), finds the closest vertex in
+  SrcSurfReg and its distance. Uses SrcHash if non-NULL, falling back
+  to brute force if the hash search fails. The searches are run in
+  parallel; the callers accumulate the results in order afterwards.
+*/
+static int surf2surfClosestVertices(MRI_SURFACE *SrcSurfReg, MHT *SrcHash,
+                                    MRI_SURFACE *TrgSurfReg, int nlist,
+                                    const int *vtxlist, int *closest,
+                                    float *dmin)
+{
+  float *xyz;
+  int n;
+  VERTEX *v;
+
+  xyz = (float *) calloc(3*nlist+1,sizeof(float));
+  for (n = 0; n < nlist; n++) {
+    v = &(TrgSurfReg->vertices[vtxlist ? vtxlist[n] : n]);
+    xyz[3*n]   = v->x;
+    xyz[3*n+1] = v->y;
+    xyz[3*n+2] = v->z;
+  }
+  if (SrcHash)
+    MHTfindClosestVertexNoBatch(SrcHash, SrcSurfReg, nlist, xyz, closest, dmin);
+  else {
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for schedule(guided)
+#endif
+    for (n = 0; n < nlist; n++)
+      closest[n] = MRISfindClosestVertex(SrcSurfReg,xyz[3*n],xyz[3*n+1],
+                                         xyz[3*n+2],&dmin[n]);
+  }
+  free(xyz);
+  return(0);
+}
+
 /*-------------------------------------------------------------
   crs2ind() -- returns linear index into a volume stored by column,
   row, slice.
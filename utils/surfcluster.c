@@ -908,3 +908,177 @@ int sclustGrowByDist(MRIS *surf, int seedvtxno, double dthresh,
   
   return(nhits);
 }
+
+/*----------------------------------------------------------------
+  sclustGraphAlloc() - builds the surface graph used by
+  sclustGraphClusters(): the neighbors of each vertex (from v->v[],
+  1-neighbors only) in compressed sparse row form and the area of
+  each vertex (group_avg_area if loaded, otherwise v->area, as summed
+  by SurfClusterSummaryFast(), the default summary).
+  If mask is non-NULL, only vertices where mask > 0.5 can be in a
+  cluster. The graph does not refer back to the surface, so it can
+  be shared by threads that cluster different maps.
+  ----------------------------------------------------------------*/
+SCG *sclustGraphAlloc(MRI_SURFACE *Surf, MRI *mask)
+{
+  SCG *scg;
+  VERTEX *v;
+  int vtx, nbr, nnbrs;
+
+  scg = (SCG *) calloc(1, sizeof(SCG));
+  scg->nvertices = Surf->nvertices;
+  scg->nbrstart  = (int *)   calloc(Surf->nvertices+1, sizeof(int));
+  scg->area      = (float *) calloc(Surf->nvertices, sizeof(float));
+  scg->inmask    = (char *)  calloc(Surf->nvertices, sizeof(char));
+
+  nnbrs = 0;
+  for (vtx = 0; vtx < Surf->nvertices; vtx++)
+    nnbrs += Surf->vertices[vtx].vnum;
+  scg->nbr = (int *) calloc(MAX(nnbrs,1), sizeof(int));
+  if (!scg->nbrstart || !scg->area || !scg->inmask || !scg->nbr)
+  {
+    printf("ERROR: sclustGraphAlloc: could not alloc graph with %d edges\n",
+           nnbrs);
+    sclustGraphFree(&scg);
+    return(NULL);
+  }
+
+  nnbrs = 0;
+  for (vtx = 0; vtx < Surf->nvertices; vtx++)
+  {
+    v = &(Surf->vertices[vtx]);
+    scg->nbrstart[vtx] = nnbrs;
+    for (nbr = 0; nbr < v->vnum; nbr++) scg->nbr[nnbrs++] = v->v[nbr];
+    if (! Surf->group_avg_vtxarea_loaded) scg->area[vtx] = v->area;
+    else                                  scg->area[vtx] = v->group_avg_area;
+    scg->inmask[vtx] = (mask == NULL || MRIgetVoxVal(mask,vtx,0,0,0) > 0.5);
+  }
+  scg->nbrstart[Surf->nvertices] = nnbrs;
+
+  return(scg);
+}
+
+/*----------------------------------------------------------------*/
+int sclustGraphFree(SCG **pscg)
+{
+  SCG *scg = *pscg;
+
+  if (scg == NULL) return(0);
+  if (scg->nbrstart) free(scg->nbrstart);
+  if (scg->nbr)      free(scg->nbr);
+  if (scg->area)     free(scg->area);
+  if (scg->inmask)   free(scg->inmask);
+  free(scg);
+  *pscg = NULL;
+  return(0);
+}
+
+/*----------------------------------------------------------------
+  sclustGraphClusters() - clusters the values in frame of mri (one
+  value per vertex, as from MRIcopyMRIS()) on the surface graph with
+  the same threshold criteria and contiguity as sclustMapSurfClusters(),
+  in a single union-find pass. Neither the graph nor the surface is
+  changed, so different threads can cluster at the same time.
+
+  Returns the clusters in the order of their first vertex, unsorted,
+  with clusterno, nmembers, area, weightvtx, weightarea, maxval and
+  vtxmaxval computed as in SurfClusterSummaryFast(); coordinates are
+  not set. If clusterno is non-NULL, it gets the cluster number of
+  each vertex (1-based, 0 if not in a cluster). Returns NULL if there
+  are no clusters. The caller frees the list.
+  ----------------------------------------------------------------*/
+SCS *sclustGraphClusters(SCG *scg, MRI *mri, int frame,
+                         float thmin, float thmax, int thsign,
+                         int *clusterno, int *nClusters)
+{
+  SCS *scs;
+  int vtx, nbr, p, n;
+  int *parent;
+  double *weightvtx, *weightarea;
+  float vtxval;
+
+  *nClusters = 0;
+  parent = (int *) calloc(scg->nvertices, sizeof(int));
+  if (parent == NULL)
+  {
+    printf("ERROR: sclustGraphClusters: could not alloc %d\n",
+           scg->nvertices);
+    return(NULL);
+  }
+
+  /* a vertex joins the sets of its neighbors that are in range */
+  for (vtx = 0; vtx < scg->nvertices; vtx++)
+  {
+    parent[vtx] = -1;
+    if (!scg->inmask[vtx]) continue;
+    if (!clustValueInRange(MRIgetVoxVal(mri,vtx,0,0,frame),
+                           thmin,thmax,thsign)) continue;
+    parent[vtx] = vtx;
+  }
+  for (vtx = 0; vtx < scg->nvertices; vtx++)
+  {
+    if (parent[vtx] < 0) continue;
+    for (nbr = scg->nbrstart[vtx]; nbr < scg->nbrstart[vtx+1]; nbr++)
+      if (parent[scg->nbr[nbr]] >= 0)
+        clustUnionSets(parent, vtx, scg->nbr[nbr]);
+  }
+
+  /* number the sets by their first vertex: replace each parent with
+     -2-(cluster index), parents always come before their children */
+  for (vtx = 0; vtx < scg->nvertices; vtx++)
+  {
+    p = parent[vtx];
+    if (p == -1) continue;
+    if (p == vtx) parent[vtx] = -2 - (*nClusters)++;
+    else          parent[vtx] = parent[p];
+  }
+  if (*nClusters == 0)
+  {
+    if (clusterno)
+      memset(clusterno, 0, scg->nvertices*sizeof(int));
+    free(parent);
+    return(NULL);
+  }
+
+  scs = (SCS *) calloc(*nClusters, sizeof(SCS));
+  weightvtx  = (double *) calloc(*nClusters, sizeof(double));
+  weightarea = (double *) calloc(*nClusters, sizeof(double));
+
+  /* accumulate in vertex order, as SurfClusterSummaryFast() */
+  for (vtx = 0; vtx < scg->nvertices; vtx++)
+  {
+    if (parent[vtx] == -1)
+    {
+      if (clusterno) clusterno[vtx] = 0;
+      continue;
+    }
+    n = -2-parent[vtx];
+    if (clusterno) clusterno[vtx] = n+1;
+    vtxval = MRIgetVoxVal(mri,vtx,0,0,frame);
+    scs[n].nmembers ++;
+    if (scs[n].nmembers == 1)
+    {
+      scs[n].maxval    = vtxval;
+      scs[n].vtxmaxval = vtx;
+    }
+    scs[n].area += scg->area[vtx];
+    if (fabs(vtxval) > fabs(scs[n].maxval))
+    {
+      scs[n].maxval    = vtxval;
+      scs[n].vtxmaxval = vtx;
+    }
+    weightvtx[n]  += vtxval;
+    weightarea[n] += (vtxval*scg->area[vtx]);
+  }
+  for (n = 0; n < *nClusters; n++)
+  {
+    scs[n].clusterno  = n+1;
+    scs[n].weightvtx  = weightvtx[n];
+    scs[n].weightarea = weightarea[n];
+  }
+
+  free(weightvtx);
+  free(weightarea);
+  free(parent);
+  return(scs);
+}
@@ -0,0 +1,239 @@
+/**
+ * @file  gca_flat_test.c
+ * @brief checks that a GCA read from a flat .fgca file can be freed
+ *
+ * Builds a small GCA with Markov (gibbs) priors, writes it with
+ * GCAwrite() to a temporary .fgca file and reads it back with GCAread(),
+ * which maps the file. Checks that the classifiers and priors match what
+ * was written, then calls GCAfreeGibbs() and GCAfree() on it as
+ * mri_ca_register and mri_em_register do. A second copy is read and
+ * trained on (GCAcompactify()), which must first copy the mapped arrays
+ * onto the heap. Exits with 1 if anything differs.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ * CVS Revision Info:
+ *    $Author$
+ *    $Date$
+ *    $Revision$
+ *
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gca.h"
+#include "error.h"
+
+const char *Progname = NULL;
+
+static GCA *BuildGCA(void)
+{
+  GCA       *gca ;
+  GCA_NODE  *gcan ;
+  GCA_PRIOR *gcap ;
+  GC1D      *gc ;
+  int       x, y, z, n, i, k ;
+
+  gca = GCAalloc(1, 4, 8, 32, 32, 32, 0) ;
+  for (x = 0 ; x < gca->node_width ; x++)
+    for (y = 0 ; y < gca->node_height ; y++)
+      for (z = 0 ; z < gca->node_depth ; z++)
+      {
+        gcan = &gca->nodes[x][y][z] ;
+        gcan->nlabels = 1 + (x+y+z) % 3 ;
+        gcan->total_training = 10*(x+1) ;
+        for (n = 0 ; n < gcan->nlabels ; n++)
+        {
+          gcan->labels[n] = (unsigned short)(x + 2*n + 1) ;
+          gc = &gcan->gcs[n] ;
+          gc->means[0] = 100.0f*x + 10*y + z + n ;
+          gc->covars[0] = 25.0f + n ;
+          gc->ntraining = 5 + n ;
+          for (i = 0 ; i < GIBBS_NEIGHBORS ; i++)
+          {
+            gc->nlabels[i] = (short)(1 + (i+n) % 2) ;
+            gc->labels[i] =
+              (unsigned short *)calloc(gc->nlabels[i], sizeof(unsigned short));
+            gc->label_priors[i] =
+              (float *)calloc(gc->nlabels[i], sizeof(float)) ;
+            for (k = 0 ; k < gc->nlabels[i] ; k++)
+            {
+              gc->labels[i][k] = (unsigned short)(i + k) ;
+              gc->label_priors[i][k] = 1.0f / (1 + i + k) ;
+            }
+          }
+        }
+      }
+  for (x = 0 ; x < gca->prior_width ; x++)
+    for (y = 0 ; y < gca->prior_height ; y++)
+      for (z = 0 ; z < gca->prior_depth ; z++)
+      {
+        gcap = &gca->priors[x][y][z] ;
+        gcap->nlabels = 1 + (x+z) % 2 ;
+        gcap->total_training = x + y ;
+        for (n = 0 ; n < gcap->nlabels ; n++)
+        {
+          gcap->labels[n] = (unsigned short)(y + n) ;
+          gcap->priors[n] = 1.0f / (gcap->nlabels + n) ;
+        }
+      }
+  return(gca) ;
+}
+
+/* returns the number of nodes and priors in b that differ from a */
+static int CompareGCA(GCA *a, GCA *b, int gibbs)
+{
+  GCA_NODE  *gcan_a, *gcan_b ;
+  GCA_PRIOR *gcap_a, *gcap_b ;
+  GC1D      *gc_a, *gc_b ;
+  int       x, y, z, n, i, k, ndiff = 0 ;
+
+  for (x = 0 ; x < a->node_width ; x++)
+    for (y = 0 ; y < a->node_height ; y++)
+      for (z = 0 ; z < a->node_depth ; z++)
+      {
+        gcan_a = &a->nodes[x][y][z] ;
+        gcan_b = &b->nodes[x][y][z] ;
+        if (gcan_a->nlabels != gcan_b->nlabels ||
+            gcan_a->total_training != gcan_b->total_training)
+        {
+          ndiff++ ;
+          continue ;
+        }
+        for (n = 0 ; n < gcan_a->nlabels ; n++)
+        {
+          gc_a = &gcan_a->gcs[n] ;
+          gc_b = &gcan_b->gcs[n] ;
+          if (gcan_a->labels[n] != gcan_b->labels[n] ||
+              gc_a->means[0] != gc_b->means[0] ||
+              gc_a->covars[0] != gc_b->covars[0] ||
+              gc_a->ntraining != gc_b->ntraining)
+          {
+            ndiff++ ;
+            break ;
+          }
+          if (!gibbs)
+          {
+            continue ;
+          }
+          for (i = 0 ; i < GIBBS_NEIGHBORS ; i++)
+          {
+            if (gc_a->nlabels[i] != gc_b->nlabels[i])
+            {
+              ndiff++ ;
+              break ;
+            }
+            for (k = 0 ; k < gc_a->nlabels[i] ; k++)
+              if (gc_a->labels[i][k] != gc_b->labels[i][k] ||
+                  gc_a->label_priors[i][k] != gc_b->label_priors[i][k])
+              {
+                ndiff++ ;
+                break ;
+              }
+          }
+        }
+      }
+  for (x = 0 ; x < a->prior_width ; x++)
+    for (y = 0 ; y < a->prior_height ; y++)
+      for (z = 0 ; z < a->prior_depth ; z++)
+      {
+        gcap_a = &a->priors[x][y][z] ;
+        gcap_b = &b->priors[x][y][z] ;
+        if (gcap_a->nlabels != gcap_b->nlabels ||
+            gcap_a->total_training != gcap_b->total_training)
+        {
+          ndiff++ ;
+          continue ;
+        }
+        for (n = 0 ; n < gcap_a->nlabels ; n++)
+          if (gcap_a->labels[n] != gcap_b->labels[n] ||
+              gcap_a->priors[n] != gcap_b->priors[n])
+          {
+            ndiff++ ;
+            break ;
+          }
+      }
+  return(ndiff) ;
+}
+
+int main(int argc, char *argv[])
+{
+  GCA  *gca, *gca_flat ;
+  char fname[STRLEN] ;
+  int  nfailed = 0 ;
+
+  Progname = argv[0] ;
+  sprintf(fname, "/tmp/gca_flat_test.%d.fgca", (int)getpid()) ;
+
+  gca = BuildGCA() ;
+  if (GCAwrite(gca, fname) != NO_ERROR)
+  {
+    printf("could not write %s\n", fname) ;
+    exit(1) ;
+  }
+  if (!GCAisFlat(fname))
+  {
+    printf("GCAisFlat() does not recognize %s\n", fname) ;
+    nfailed++ ;
+  }
+
+  gca_flat = GCAread(fname) ;
+  if (gca_flat == NULL)
+  {
+    unlink(fname) ;
+    printf("could not read %s\n", fname) ;
+    exit(1) ;
+  }
+  if (CompareGCA(gca, gca_flat, 1))
+  {
+    printf("flat GCA differs from what was written\n") ;
+    nfailed++ ;
+  }
+
+  /* what mri_ca_register and mri_em_register do before registering */
+  GCAfreeGibbs(gca_flat) ;
+  if ((gca_flat->flags & GCA_NO_MRF) == 0)
+  {
+    printf("GCAfreeGibbs() did not set GCA_NO_MRF\n") ;
+    nfailed++ ;
+  }
+  if (CompareGCA(gca, gca_flat, 0))
+  {
+    printf("GCAfreeGibbs() changed the classifiers\n") ;
+    nfailed++ ;
+  }
+  GCAfree(&gca_flat) ;
+
+  /* compaction frees and reallocates the label arrays */
+  gca_flat = GCAread(fname) ;
+  GCAcompactify(gca_flat) ;
+  if (CompareGCA(gca, gca_flat, 1))
+  {
+    printf("GCAcompactify() changed a flat GCA\n") ;
+    nfailed++ ;
+  }
+  GCAfreeGibbs(gca_flat) ;
+  GCAfree(&gca_flat) ;
+
+  unlink(fname) ;
+  GCAfree(&gca) ;
+  if (nfailed)
+  {
+    printf("%d checks FAILED\n", nfailed) ;
+    exit(1) ;
+  }
+  exit(0) ;
+}
@@ -0,0 +1,145 @@
+/**
+ * @file  gtm_sparse_test.c
+ * @brief checks the column-sparse GTM products against the dense ones
+ *
+ * Builds a random design matrix whose columns are only nonzero over a
+ * band of rows (like the bounding box of a seg in GTMbuildX()), stores
+ * it both densely and as a GTMSPARSE, and checks that GTMsparseMtM(),
+ * GTMsparseAtB() and GTMsparseMultiply() give exactly the same result
+ * as MatrixMtM(), MatrixAtB() and MatrixMultiplyD(). Exits with 1 if
+ * any of them differ.
+ *
+ * Usage: gtm_sparse_test [nrows [ncols]]
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ * CVS Revision Info:
+ *    $Author$
+ *    $Date$
+ *    $Revision$
+ *
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "matrix.h"
+#include "macros.h"
+#include "error.h"
+#include "timer.h"
+#include "gtm.h"
+
+const char *Progname = NULL;
+
+static int nrows = 20000, ncols = 80, nframes = 3;
+
+static int SameMatrix(const char *name, MATRIX *dense, MATRIX *sparse)
+{
+  int r, c;
+
+  if (sparse == NULL)
+  {
+    printf("%-8s FAILED\n", name);
+    return(1);
+  }
+  for (r = 1; r <= dense->rows; r++)
+    for (c = 1; c <= dense->cols; c++)
+      if (dense->rptr[r][c] != sparse->rptr[r][c])
+      {
+        printf("%-8s DIFFERENT at %d %d: %g %g\n", name, r, c,
+               dense->rptr[r][c], sparse->rptr[r][c]);
+        return(1);
+      }
+  printf("%-8s ok\n", name);
+  return(0);
+}
+
+int main(int argc, char *argv[])
+{
+  MATRIX *X, *y, *beta, *dense, *sparse;
+  GTMSPARSE *Xsp;
+  int r, c, f, start, width, nnz, nfailed = 0, dense_msec, sparse_msec;
+  float val;
+  struct timeb then;
+
+  Progname = argv[0];
+  if (argc > 1) nrows = atoi(argv[1]);
+  if (argc > 2) ncols = atoi(argv[2]);
+  srand(23);
+  /* the sparse products match the native dense ones, not CBLAS */
+  MatrixSetBackend(MATRIX_BACKEND_NATIVE);
+
+  X = MatrixAlloc(nrows, ncols, MATRIX_REAL);
+  Xsp = GTMsparseAlloc(nrows, ncols);
+  for (c = 0; c < ncols; c++)
+  {
+    // each column spans a band of 5-10% of the rows, with some zeros
+    start = rand() % nrows;
+    width = nrows/20 + rand() % (nrows/20 + 1);
+    if (start + width > nrows) width = nrows - start;
+    Xsp->row[c] = (int *) calloc(sizeof(int), MAX(width,1));
+    Xsp->val[c] = (float *) calloc(sizeof(float), MAX(width,1));
+    Xsp->nalloc[c] = MAX(width,1);
+    nnz = 0;
+    for (r = start; r < start + width; r++)
+    {
+      val = (rand() % 5 == 0) ? 0 : (rand() % 10000)/7777.0;
+      X->rptr[r+1][c+1] = val;
+      if (val == 0) continue;
+      Xsp->row[c][nnz] = r;
+      Xsp->val[c][nnz] = val;
+      nnz++;
+    }
+    Xsp->nnz[c] = nnz;
+  }
+  y = MatrixAlloc(nrows, nframes, MATRIX_REAL);
+  for (r = 1; r <= nrows; r++)
+    for (f = 1; f <= nframes; f++) y->rptr[r][f] = (rand() % 1000)/3.3;
+  beta = MatrixAlloc(ncols, nframes, MATRIX_REAL);
+  for (c = 1; c <= ncols; c++)
+    for (f = 1; f <= nframes; f++) beta->rptr[c][f] = (rand() % 1000)/7.1;
+
+  TimerStart(&then);
+  dense = MatrixMtM(X, NULL);
+  dense_msec = TimerStop(&then);
+  TimerStart(&then);
+  sparse = GTMsparseMtM(Xsp, NULL);
+  sparse_msec = TimerStop(&then);
+  printf("XtX: dense %d ms, sparse %d ms\n", dense_msec, sparse_msec);
+  nfailed += SameMatrix("XtX", dense, sparse);
+  MatrixFree(&dense);
+  MatrixFree(&sparse);
+
+  dense = MatrixAtB(X, y, NULL);
+  sparse = GTMsparseAtB(Xsp, y, NULL);
+  nfailed += SameMatrix("Xty", dense, sparse);
+  MatrixFree(&dense);
+  MatrixFree(&sparse);
+
+  dense = MatrixMultiplyD(X, beta, NULL);
+  sparse = GTMsparseMultiply(Xsp, beta, NULL);
+  nfailed += SameMatrix("X*beta", dense, sparse);
+  MatrixFree(&dense);
+  MatrixFree(&sparse);
+
+  MatrixFree(&X);
+  MatrixFree(&y);
+  MatrixFree(&beta);
+  GTMsparseFree(&Xsp);
+  if (nfailed)
+  {
+    printf("%d comparisons FAILED\n", nfailed);
+    exit(1);
+  }
+  exit(0);
+}
@@ -0,0 +1,266 @@
+/**
+ * @file  matrix_timing.c
+ * @brief times and checks the MATRIX product backends
+ *
+ * For MatrixMultiply(), MatrixMultiplyD(), MatrixMtM() and MatrixAtB()
+ * this runs the simple loops the library used before the blocked
+ * kernels, and the library itself, on random matrices of several
+ * shapes (small transforms up to large design matrices). The native
+ * backend must give identical results; if FreeSurfer was configured
+ * --with-cblas the products are also timed with CBLAS and the largest
+ * relative difference is printed. Exits with 1 if a native result
+ * differs.
+ *
+ * Usage: matrix_timing [scale [nreps]]
+ *
+ * The defaults (scale 1, one rep) are a quick check for make check;
+ * use e.g. "matrix_timing 10 3" for timings at design matrix sizes.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ * CVS Revision Info:
+ *    $Author$
+ *    $Date$
+ *    $Revision$
+ *
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "matrix.h"
+#include "macros.h"
+#include "error.h"
+#include "timer.h"
+
+const char *Progname = NULL;
+
+static int scale = 1, nreps = 1, nfailed = 0;
+
+/* ------------------------------------------------------ */
+/* the loops the library used before the blocked kernels */
+
+static MATRIX *RefMultiply(MATRIX *m1, MATRIX *m2, MATRIX *m3, int dbl)
+{
+  int row, col, i;
+  float fval;
+  double dval;
+
+  for (row = 1; row <= m1->rows; row++)
+    for (col = 1; col <= m2->cols; col++)
+    {
+      fval = 0;
+      dval = 0;
+      for (i = 1; i <= m1->cols; i++)
+      {
+        if (dbl) dval += (double)m1->rptr[row][i] * m2->rptr[i][col];
+        else     fval += m1->rptr[row][i] * m2->rptr[i][col];
+      }
+      m3->rptr[row][col] = dbl ? dval : fval;
+    }
+  return(m3);
+}
+
+static MATRIX *RefMtM(MATRIX *m, MATRIX *mout)
+{
+  int c1, c2, r;
+  double v, v1, v2;
+
+  for (c1 = 1; c1 <= m->cols; c1++)
+    for (c2 = c1; c2 <= m->cols; c2++)
+    {
+      v = 0;
+      for (r = 1; r <= m->rows; r++)
+      {
+        v1 = m->rptr[r][c1];
+        if (v1 == 0) continue;
+        v2 = m->rptr[r][c2];
+        if (v2 == 0) continue;
+        v += v1*v2;
+      }
+      mout->rptr[c1][c2] = v;
+      mout->rptr[c2][c1] = v;
+    }
+  return(mout);
+}
+
+static MATRIX *RefAtB(MATRIX *A, MATRIX *B, MATRIX *mout)
+{
+  int colA, colB, row;
+  double sum;
+
+  for (colA = 1; colA <= A->cols; colA++)
+    for (colB = 1; colB <= B->cols; colB++)
+    {
+      sum = 0;
+      for (row = 1; row <= A->rows; row++)
+        sum += (double)A->rptr[row][colA]*B->rptr[row][colB];
+      mout->rptr[colA][colB] = sum;
+    }
+  return(mout);
+}
+
+/* ------------------------------------------------------ */
+
+static MATRIX *RandomMatrix(int rows, int cols)
+{
+  MATRIX *m = MatrixAlloc(rows, cols, MATRIX_REAL);
+  int r, c;
+
+  for (r = 1; r <= rows; r++)
+    for (c = 1; c <= cols; c++)
+      if (rand() % 8) m->rptr[r][c] = (rand() % 20000)/777.0 - 12.0;
+  return(m);
+}
+
+static double MaxRelDiff(MATRIX *a, MATRIX *b)
+{
+  int r, c;
+  double d, dmax = 0;
+
+  for (r = 1; r <= a->rows; r++)
+    for (c = 1; c <= a->cols; c++)
+    {
+      d = fabs(a->rptr[r][c] - b->rptr[r][c]) /
+          MAX(fabs(a->rptr[r][c]), 1e-6);
+      if (d > dmax) dmax = d;
+    }
+  return(dmax);
+}
+
+static void Report(const char *name, int rows, int inner, int cols,
+                   int ref_msec, int lib_msec, MATRIX *ref, MATRIX *lib,
+                   int backend)
+{
+  double dmax = MaxRelDiff(ref, lib);
+
+  printf("%-16s %6d x %5d x %5d : simple %6d ms, %-6s %6d ms, x%6.1f",
+         name, rows, inner, cols, ref_msec,
+         backend == MATRIX_BACKEND_CBLAS ? "cblas" : "native", lib_msec,
+         (float)ref_msec / (lib_msec > 0 ? lib_msec : 1));
+  if (backend == MATRIX_BACKEND_CBLAS)
+    printf("  maxreldiff %g\n", dmax);
+  else
+  {
+    printf("  %s\n", dmax == 0 ? "ok" : "DIFFERENT");
+    if (dmax != 0) nfailed++;
+  }
+}
+
+#define TIME(msec, stmt) \
+  { struct timeb then; int rep; TimerStart(&then); \
+    for (rep = 0; rep < nreps; rep++) { stmt; } \
+    msec = TimerStop(&then); }
+
+static void TimeMultiply(int rows, int inner, int cols, int backend)
+{
+  MATRIX *m1, *m2, *ref, *lib;
+  int ref_msec, lib_msec;
+
+  MatrixSetBackend(backend);
+  m1 = RandomMatrix(rows, inner);
+  m2 = RandomMatrix(inner, cols);
+  ref = MatrixAlloc(rows, cols, MATRIX_REAL);
+  lib = MatrixAlloc(rows, cols, MATRIX_REAL);
+
+  TIME(ref_msec, RefMultiply(m1, m2, ref, 0));
+  TIME(lib_msec, MatrixMultiply(m1, m2, lib));
+  Report("MatrixMultiply", rows, inner, cols, ref_msec, lib_msec,
+         ref, lib, backend);
+
+  TIME(ref_msec, RefMultiply(m1, m2, ref, 1));
+  TIME(lib_msec, MatrixMultiplyD(m1, m2, lib));
+  Report("MatrixMultiplyD", rows, inner, cols, ref_msec, lib_msec,
+         ref, lib, backend);
+
+  MatrixFree(&m1);
+  MatrixFree(&m2);
+  MatrixFree(&ref);
+  MatrixFree(&lib);
+}
+
+/* MtM and AtB do not use CBLAS; X is rows x cols, B is rows x nB */
+static void TimeMtM(int rows, int cols, int nB)
+{
+  MATRIX *X, *B, *ref, *lib;
+  int ref_msec, lib_msec;
+
+  X = RandomMatrix(rows, cols);
+  B = RandomMatrix(rows, nB);
+  ref = MatrixAlloc(cols, cols, MATRIX_REAL);
+  lib = MatrixAlloc(cols, cols, MATRIX_REAL);
+  TIME(ref_msec, RefMtM(X, ref));
+  TIME(lib_msec, MatrixMtM(X, lib));
+  Report("MatrixMtM", rows, cols, cols, ref_msec, lib_msec,
+         ref, lib, MATRIX_BACKEND_NATIVE);
+  MatrixFree(&ref);
+  MatrixFree(&lib);
+
+  ref = MatrixAlloc(cols, nB, MATRIX_REAL);
+  lib = MatrixAlloc(cols, nB, MATRIX_REAL);
+  TIME(ref_msec, RefAtB(X, B, ref));
+  TIME(lib_msec, MatrixAtB(X, B, lib));
+  Report("MatrixAtB", rows, cols, nB, ref_msec, lib_msec,
+         ref, lib, MATRIX_BACKEND_NATIVE);
+  MatrixFree(&ref);
+  MatrixFree(&lib);
+  MatrixFree(&X);
+  MatrixFree(&B);
+}
+
+int main(int argc, char *argv[])
+{
+  static const int shapes[][3] =
+  {
+    { 4, 4, 4 }, { 3, 3, 3 }, { 4, 4, 10000 }, { 20, 20, 20 },
+    { 200, 200, 200 }, { 1000, 50, 1000 }, { 100, 20000, 10 }
+  };
+  static const int nshapes = sizeof(shapes)/sizeof(shapes[0]);
+  // design matrices: rows x cols, and the number of columns of B
+  static const int designs[][3] =
+  {
+    { 20, 4, 1 }, { 1000, 20, 5 }, { 50000, 10, 1 }, { 2000, 150, 3 }
+  };
+  static const int ndesigns = sizeof(designs)/sizeof(designs[0]);
+  int n, rows, inner, cols;
+
+  Progname = argv[0];
+  if (argc > 1) scale = atoi(argv[1]);
+  if (argc > 2) nreps = atoi(argv[2]);
+  srand(24);
+
+  for (n = 0; n < nshapes; n++)
+  {
+    // small transforms are not scaled
+    rows = shapes[n][0];
+    inner = shapes[n][1];
+    cols = shapes[n][2];
+    if (rows > 4) rows *= scale;
+    if (rows > 4 && cols > 4) cols *= scale;
+    TimeMultiply(rows, inner, cols, MATRIX_BACKEND_NATIVE);
+    MatrixSetBackend(MATRIX_BACKEND_CBLAS);
+    if (MatrixGetBackend() == MATRIX_BACKEND_CBLAS)
+      TimeMultiply(rows, inner, cols, MATRIX_BACKEND_CBLAS);
+  }
+  for (n = 0; n < ndesigns; n++)
+    TimeMtM(designs[n][0]*scale, designs[n][1], designs[n][2]);
+
+  if (nfailed)
+  {
+    printf("%d comparisons FAILED\n", nfailed);
+    exit(1);
+  }
+  exit(0);
+}
@@ -0,0 +1,200 @@
+/**
+ * @file  mri_frame_stream_test.c
+ * @brief checks the frame-streaming reader and writer against MRIread/MRIwrite
+ *
+ * For .mgh and .mgz and each streamed voxel type (uchar, int, float,
+ * short) this writes a random multi-frame volume with MRIwrite(), reads
+ * it back a few frames at a time with MRIframeStreamRead() and compares
+ * every frame with MRIread() of the same file, then writes the frames
+ * to a second file with MRIframeStreamWrite() and checks that MRIread()
+ * of it gives the original volume. Both streams must go to the file
+ * itself, not through a copy in memory. Also checks that closing a write
+ * stream that is missing frames is an error. Exits with 1 if anything
+ * differs.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ * CVS Revision Info:
+ *    $Author$
+ *    $Date$
+ *    $Revision$
+ *
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mri.h"
+#include "macros.h"
+#include "error.h"
+
+const char *Progname = NULL;
+
+/* 7 frames read 3 at a time, so the last read is short */
+#define NFRAMES 7
+#define NREAD   3
+
+static MRI *RandomVolume(int type)
+{
+  MRI *mri;
+  int c, r, s, f;
+  float val;
+
+  mri = MRIallocSequence(13, 11, 9, type, NFRAMES);
+  mri->xsize = 1.5;
+  mri->tr = 2000;
+  for (f = 0; f < mri->nframes; f++)
+    for (s = 0; s < mri->depth; s++)
+      for (r = 0; r < mri->height; r++)
+        for (c = 0; c < mri->width; c++)
+        {
+          if (type == MRI_FLOAT) val = rand()/(float)RAND_MAX - 0.5;
+          else if (type == MRI_UCHAR) val = rand() % 256;
+          else val = rand() % 20001 - 10000;
+          MRIsetVoxVal(mri, c, r, s, f, val);
+        }
+  return(mri);
+}
+
+/* number of voxels of frames 0..n-1 of a that differ from frames
+   frame0..frame0+n-1 of b */
+static int CompareFrames(MRI *a, MRI *b, int frame0, int n)
+{
+  int c, r, s, f, ndiff = 0;
+
+  for (f = 0; f < n; f++)
+    for (s = 0; s < a->depth; s++)
+      for (r = 0; r < a->height; r++)
+        for (c = 0; c < a->width; c++)
+          if (MRIgetVoxVal(a,c,r,s,f) != MRIgetVoxVal(b,c,r,s,frame0+f))
+            ndiff++;
+  return(ndiff);
+}
+
+static int TestStream(int type, const char *ext)
+{
+  char fname[STRLEN], fname2[STRLEN];
+  MRI *mri, *mri_read, *mri_frames;
+  MRI_FRAME_STREAM *fsin, *fsout;
+  int n, frame, ndiff = 0, err = 0;
+
+  sprintf(fname, "/tmp/mri_frame_stream_test.%d.%s", (int)getpid(), ext);
+  sprintf(fname2, "/tmp/mri_frame_stream_test.%d.2.%s", (int)getpid(), ext);
+  mri = RandomVolume(type);
+  if (MRIwrite(mri, fname) != NO_ERROR)
+  {
+    printf("  could not write %s\n", fname);
+    MRIfree(&mri);
+    return(1);
+  }
+  mri_read = MRIread(fname);
+  fsin = MRIframeStreamOpenRead(fname);
+  fsout = MRIframeStreamOpenWrite(fname2, mri, NFRAMES);
+  if (mri_read == NULL || fsin == NULL || fsout == NULL)
+  {
+    printf("  could not open %s or %s\n", fname, fname2);
+    err = 1;
+  }
+  else if (fsin->nframes != NFRAMES || fsin->mri->type != type ||
+           fsin->mri->xsize != mri->xsize || fsin->mri->tr != mri->tr)
+  {
+    printf("  stream header does not match the volume\n");
+    err = 1;
+  }
+  else if (fsin->fp == NULL || fsout->fp == NULL)
+  {
+    printf("  %s is not streamed from disk\n", ext);
+    err = 1;
+  }
+  else
+  {
+    /* read through the stream, compare with MRIread, write it back out */
+    mri_frames = MRIframeStreamAlloc(fsin, NREAD);
+    frame = 0;
+    while ((n = MRIframeStreamRead(fsin, mri_frames, NREAD)) > 0)
+    {
+      ndiff += CompareFrames(mri_frames, mri_read, frame, n);
+      if (MRIframeStreamWrite(fsout, mri_frames, n) != NO_ERROR) err = 1;
+      frame += n;
+    }
+    if (n < 0 || frame != NFRAMES)
+    {
+      printf("  streamed %d of %d frames\n", frame, NFRAMES);
+      err = 1;
+    }
+    if (ndiff)
+    {
+      printf("  %d streamed voxels differ from MRIread\n", ndiff);
+      err = 1;
+    }
+    MRIfree(&mri_frames);
+  }
+  MRIframeStreamClose(&fsin);
+  if (MRIframeStreamClose(&fsout) != NO_ERROR) err = 1;
+  if (mri_read) MRIfree(&mri_read);
+
+  /* the streamed copy must read back as the original */
+  if (!err)
+  {
+    mri_read = MRIread(fname2);
+    if (mri_read == NULL || mri_read->nframes != NFRAMES ||
+        mri_read->type != type || CompareFrames(mri, mri_read, 0, NFRAMES))
+    {
+      printf("  MRIread of the streamed %s differs\n", fname2);
+      err = 1;
+    }
+    if (mri_read) MRIfree(&mri_read);
+  }
+
+  /* a write stream closed early is an error */
+  fsout = MRIframeStreamOpenWrite(fname2, mri, NFRAMES);
+  if (fsout == NULL || MRIframeStreamWrite(fsout, mri, 1) != NO_ERROR ||
+      MRIframeStreamClose(&fsout) == NO_ERROR)
+  {
+    printf("  closing a short write stream was not an error\n");
+    err = 1;
+  }
+
+  unlink(fname);
+  unlink(fname2);
+  MRIfree(&mri);
+  return(err);
+}
+
+int main(int argc, char *argv[])
+{
+  static const int types[] = { MRI_UCHAR, MRI_INT, MRI_FLOAT, MRI_SHORT };
+  static const char *typenames[] = { "uchar", "int", "float", "short" };
+  static const char *exts[] = { "mgh", "mgz" };
+  int t, e, err, nfailed = 0;
+
+  Progname = argv[0];
+  srand(18);
+
+  for (e = 0; e < 2; e++)
+    for (t = 0; t < 4; t++)
+    {
+      err = TestStream(types[t], exts[e]);
+      printf("%s %-5s: %s\n", exts[e], typenames[t], err ? "FAILED" : "ok");
+      nfailed += err;
+    }
+
+  if (nfailed)
+  {
+    printf("%d comparisons FAILED\n", nfailed);
+    exit(1);
+  }
+  exit(0);
+}
@@ -0,0 +1,100 @@
+/*--------------------------------------------
+  mrishash_demo_300_fill_timing.c
+
+  Notes:
+  ------
+  Times the MRIS_HASH_TABLE operations that the surface programs
+  lean on: building face and vertex tables, removing and re-adding
+  the faces of every vertex (as is done when a vertex is moved), and
+  closest-vertex queries. Run it against builds of the old and the
+  new table to compare.
+
+  Usage: mrishash_demo_300_fill_timing [nreps [res]]
+
+  ----------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "macros.h"
+#include "error.h"
+#include "diag.h"
+#include "proto.h"
+#include "mrisurf.h"
+#include "mri.h"
+#include "timer.h"
+#include "icosahedron.h"
+
+char * Progname;
+
+//-----------------------------------
+int main(int argc, char *argv[]) {
+//-----------------------------------
+  MRI_SURFACE *mris;
+  MHT *mht = NULL;
+  VERTEX *v;
+  struct timeb then;
+  int nreps = 10, rep, vno, msec, nfound, vtxnum;
+  float res = 1.0;
+  double r, scale, vtx_distance;
+
+  if (getenv("SKIP_MRISHASH_TEST")) exit(77); // bypass
+
+  Progname = argv[0];
+  if (argc > 1) nreps = atoi(argv[1]);
+  if (argc > 2) res   = atof(argv[2]);
+
+  // 160k vertex sphere with a brain-ish radius of 70mm
+  mris = ic163842_make_surface(0, 0);
+  v = &mris->vertices[0];
+  r = sqrt(v->x*v->x + v->y*v->y + v->z*v->z);
+  scale = 70.0/r;
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    v = &mris->vertices[vno];
+    v->x *= scale; v->y *= scale; v->z *= scale;
+  }
+  MRIScomputeMetricProperties(mris);
+  printf("%d vertices, %d faces, res %g mm, %d reps\n",
+         mris->nvertices, mris->nfaces, res, nreps);
+
+  TimerStart(&then);
+  for (rep = 0; rep < nreps; rep++)
+    mht = MHTfillTableAtResolution(mris, mht, CURRENT_VERTICES, res);
+  msec = TimerStop(&then);
+  printf("face table fill:        %8.2f ms/table\n", (double)msec/nreps);
+
+  TimerStart(&then);
+  for (rep = 0; rep < nreps; rep++)
+    for (vno = 0; vno < mris->nvertices; vno++) {
+      MHTremoveAllFaces(mht, mris, &mris->vertices[vno]);
+      MHTaddAllFaces(mht, mris, &mris->vertices[vno]);
+    }
+  msec = TimerStop(&then);
+  printf("remove+add all faces:   %8.2f ms/pass\n", (double)msec/nreps);
+  MHTfree(&mht);
+
+  TimerStart(&then);
+  for (rep = 0; rep < nreps; rep++)
+    mht = MHTfillVertexTableRes(mris, mht, CURRENT_VERTICES, res);
+  msec = TimerStop(&then);
+  printf("vertex table fill:      %8.2f ms/table\n", (double)msec/nreps);
+
+  nfound = 0;
+  TimerStart(&then);
+  for (rep = 0; rep < nreps; rep++)
+    for (vno = 0; vno < mris->nvertices; vno++) {
+      v = &mris->vertices[vno];
+      MHTfindClosestVertexGeneric(mht, mris, v->x+0.1, v->y-0.1, v->z,
+                                  2*res, -1, NULL, &vtxnum, &vtx_distance);
+      if (vtxnum >= 0) nfound++;
+    }
+  msec = TimerStop(&then);
+  printf("closest vertex queries: %8.2f ms/pass (%d found)\n",
+         (double)msec/nreps, nfound/nreps);
+
+  MHTfree(&mht);
+  MRISfree(&mris);
+  exit(0);
+}
@@ -0,0 +1,293 @@
+/**
+ * @file  mrivoxel_timing.cpp
+ * @brief times the typed voxel kernels against the generic accessors
+ *
+ * For each operator that has a typed kernel (mrivoxel.cpp) this runs
+ * the old per-voxel MRIgetVoxVal()/MRIsetVoxVal() loop and the kernel
+ * on the same input, checks that the outputs are identical and prints
+ * both times. Exits with 1 if any output differs.
+ *
+ * Usage: mrivoxel_timing [size [nreps]]
+ *
+ * The defaults (32^3, one rep) are a quick check for make check; use
+ * e.g. "mrivoxel_timing 128 5" for timings.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ * CVS Revision Info:
+ *    $Author$
+ *    $Date$
+ *    $Revision$
+ *
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+extern "C"
+{
+#include "mri.h"
+#include "macros.h"
+#include "error.h"
+#include "timer.h"
+}
+
+const char *Progname = NULL;
+
+static int size = 32, nreps = 1, nframes = 3;
+
+// ------------------------------------------------------
+// the loops the operators ran before the typed kernels
+
+static void RefThreshold( MRI *src, MRI *dst, float threshold )
+{
+  for( int f = 0; f < src->nframes; f++ )
+    for( int z = 0; z < src->depth; z++ )
+      for( int y = 0; y < src->height; y++ )
+        for( int x = 0; x < src->width; x++ )
+        {
+          float val = MRIgetVoxVal(src, x, y, z, f);
+          if( val < threshold )
+          {
+            val = 0;
+          }
+          MRIsetVoxVal(dst, x, y, z, f, val);
+        }
+}
+
+static void RefBinarize( MRI *src, MRI *dst, float threshold,
+                         float low_val, float hi_val )
+{
+  for( int f = 0; f < src->nframes; f++ )
+    for( int z = 0; z < src->depth; z++ )
+      for( int y = 0; y < src->height; y++ )
+        for( int x = 0; x < src->width; x++ )
+        {
+          double val = MRIgetVoxVal(src, x, y, z, f);
+          val = (val < threshold) ? low_val : hi_val;
+          MRIsetVoxVal(dst, x, y, z, f, val);
+        }
+}
+
+static void RefScalarMul( MRI *src, MRI *dst, float scalar )
+{
+  for( int f = 0; f < src->nframes; f++ )
+    for( int z = 0; z < src->depth; z++ )
+      for( int y = 0; y < src->height; y++ )
+        for( int x = 0; x < src->width; x++ )
+        {
+          float dval = MRIgetVoxVal(src, x, y, z, f);
+          MRIsetVoxVal(dst, x, y, z, f, dval*scalar);
+        }
+}
+
+static void RefLinearScale( MRI *src, MRI *dst, float scale, float offset,
+                            int only_nonzero )
+{
+  for( int f = 0; f < src->nframes; f++ )
+    for( int z = 0; z < src->depth; z++ )
+      for( int y = 0; y < src->height; y++ )
+        for( int x = 0; x < src->width; x++ )
+        {
+          float val = MRIgetVoxVal(src, x, y, z, f);
+          if( !only_nonzero || !DZERO(val) )
+          {
+            val = val*scale+offset;
+          }
+          if( dst->type == MRI_UCHAR )
+          {
+            if( val > 255 )
+            {
+              val = 255;
+            }
+            else if( val < 0 )
+            {
+              val = 0;
+            }
+          }
+          MRIsetVoxVal(dst, x, y, z, f, val);
+        }
+}
+
+static void RefMask( MRI *src, MRI *mask, MRI *dst, int maskval,
+                     float out_val )
+{
+  for( int z = 0; z < src->depth; z++ )
+    for( int y = 0; y < src->height; y++ )
+      for( int x = 0; x < src->width; x++ )
+      {
+        int mask_val = MRIgetVoxVal(mask, x, y, z, 0);
+        for( int f = 0; f < src->nframes; f++ )
+        {
+          float val = (mask_val == maskval) ? out_val :
+                      MRIgetVoxVal(src, x, y, z, f);
+          MRIsetVoxVal(dst, x, y, z, f, val);
+        }
+      }
+}
+
+static void RefAverageFrames( MRI *src, MRI *dst, int f0, int f1 )
+{
+  int nf = f1 - f0 + 1;
+  for( int x = 0; x < src->width; x++ )
+    for( int y = 0; y < src->height; y++ )
+      for( int z = 0; z < src->depth; z++ )
+      {
+        float sum = 0.0;
+        for( int f = f0; f <= f1; f++ )
+        {
+          sum += MRIgetVoxVal(src, x, y, z, f);
+        }
+        sum /= nf;
+        MRIsetVoxVal(dst, x, y, z, 0, sum);
+      }
+}
+
+// ------------------------------------------------------
+
+static MRI *RandomVolume( int type, int nf )
+{
+  MRI *mri = MRIallocSequence(size, size, size, type, nf);
+  for( int f = 0; f < nf; f++ )
+    for( int z = 0; z < size; z++ )
+      for( int y = 0; y < size; y++ )
+        for( int x = 0; x < size; x++ )
+        {
+          float val = (rand() % 2000) - 500 + (rand() % 100)/100.0;
+          if( type == MRI_UCHAR )
+          {
+            val = rand() % 256;
+          }
+          else if( rand() % 8 == 0 )
+          {
+            val = 0;
+          }
+          MRIsetVoxVal(mri, x, y, z, f, val);
+        }
+  return(mri);
+}
+
+static int SameVoxels( MRI *a, MRI *b )
+{
+  size_t nbytes = (size_t)a->width * MRIsizeof(a->type);
+  for( int s = 0; s < a->depth*a->nframes; s++ )
+    for( int y = 0; y < a->height; y++ )
+      if( memcmp(a->slices[s][y], b->slices[s][y], nbytes) )
+      {
+        return(0);
+      }
+  return(1);
+}
+
+static int nfailed = 0;
+
+static void Report( const char *name, int stype, int dtype,
+                    int ref_msec, int typed_msec, MRI *ref, MRI *typed )
+{
+  int same = SameVoxels(ref, typed);
+  printf("%-16s %d -> %d : generic %6d ms, typed %6d ms, x%5.1f  %s\n",
+         name, stype, dtype, ref_msec, typed_msec,
+         (float)ref_msec / (typed_msec > 0 ? typed_msec : 1),
+         same ? "ok" : "DIFFERENT");
+  if( !same )
+  {
+    nfailed++;
+  }
+}
+
+#define TIME(msec, stmt) \
+  { struct timeb then; TimerStart(&then); \
+    for( int rep = 0; rep < nreps; rep++ ) { stmt; } \
+    msec = TimerStop(&then); }
+
+int main( int argc, char *argv[] )
+{
+  static const int types[] = { MRI_UCHAR, MRI_SHORT, MRI_INT, MRI_FLOAT };
+  static const int ntypes = sizeof(types)/sizeof(types[0]);
+  int ref_msec, typed_msec;
+
+  Progname = argv[0];
+  if( argc > 1 )
+  {
+    size = atoi(argv[1]);
+  }
+  if( argc > 2 )
+  {
+    nreps = atoi(argv[2]);
+  }
+  printf("%d^3 voxels, %d frames, %d reps\n", size, nframes, nreps);
+  srand(17);
+
+  for( int i = 0; i < ntypes; i++ )
+  {
+    MRI *src = RandomVolume(types[i], nframes);
+    MRI *mask = RandomVolume(MRI_UCHAR, 1);
+
+    for( int j = 0; j < ntypes; j++ )
+    {
+      MRI *ref = MRIallocSequence(size, size, size, types[j], nframes);
+      MRI *typed = MRIallocSequence(size, size, size, types[j], nframes);
+
+      TIME(ref_msec, RefThreshold(src, ref, 100));
+      TIME(typed_msec, MRItypedThreshold(src, typed, 100));
+      Report("MRIthreshold", types[i], types[j], ref_msec, typed_msec,
+             ref, typed);
+
+      TIME(ref_msec, RefBinarize(src, ref, 100, 0, 1));
+      TIME(typed_msec, MRItypedBinarize(src, typed, 100, 0, 1));
+      Report("MRIbinarize", types[i], types[j], ref_msec, typed_msec,
+             ref, typed);
+
+      TIME(ref_msec, RefScalarMul(src, ref, 1.7));
+      TIME(typed_msec, MRItypedScalarMul(src, typed, 1.7));
+      Report("MRIscalarMul", types[i], types[j], ref_msec, typed_msec,
+             ref, typed);
+
+      TIME(ref_msec, RefLinearScale(src, ref, 0.3, 12.5, 1));
+      TIME(typed_msec, MRItypedLinearScale(src, typed, 0.3, 12.5, 1));
+      Report("MRIlinearScale", types[i], types[j], ref_msec, typed_msec,
+             ref, typed);
+
+      if( types[i] == types[j] )
+      {
+        TIME(ref_msec, RefMask(src, mask, ref, 0, -1));
+        TIME(typed_msec, MRItypedMask(src, mask, typed, 0, -1));
+        Report("MRImask", types[i], types[j], ref_msec, typed_msec,
+               ref, typed);
+      }
+      MRIfree(&ref);
+      MRIfree(&typed);
+    }
+
+    {
+      MRI *ref = MRIalloc(size, size, size, MRI_FLOAT);
+      MRI *typed = MRIalloc(size, size, size, MRI_FLOAT);
+      TIME(ref_msec, RefAverageFrames(src, ref, 0, nframes-1));
+      TIME(typed_msec, MRItypedAverageFrames(src, typed, 0, nframes-1));
+      Report("MRIaverageFrames", types[i], MRI_FLOAT, ref_msec, typed_msec,
+             ref, typed);
+      MRIfree(&ref);
+      MRIfree(&typed);
+    }
+    MRIfree(&src);
+    MRIfree(&mask);
+  }
+
+  if( nfailed )
+  {
+    printf("%d comparisons FAILED\n", nfailed);
+    exit(1);
+  }
+  exit(0);
+}
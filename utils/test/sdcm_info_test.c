@@ -0,0 +1,222 @@
+/**
+ * @file  sdcm_info_test.c
+ * @brief checks that ReadSDCMFileInfo() gets back what WriteSDCMFileInfo() wrote
+ *
+ * Fills SDCMFILEINFO structures with random values (including NULL
+ * strings, strings with backslashes and newlines, and floats that
+ * need all their digits), writes them to a temporary file as
+ * ScanSiemensDCMDir() does for its index, reads them back and checks
+ * that every field is exactly the same. Exits with 1 if any differ.
+ *
+ * Usage: sdcm_info_test [nrecords]
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ * CVS Revision Info:
+ *    $Author$
+ *    $Date$
+ *    $Revision$
+ *
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mri.h"
+#include "utils.h"
+#include "DICOMRead.h"
+
+const char *Progname = NULL;
+
+static int nrecords = 100;
+
+static char *RandomString(void)
+{
+  static const char chars[] = "abcXYZ019 ^.*_-\\\n";
+  char str[40];
+  int n, len;
+
+  if (rand() % 5 == 0)
+  {
+    return(NULL);
+  }
+  len = rand() % 30;
+  for (n = 0; n < len; n++)
+  {
+    str[n] = chars[rand() % (sizeof(chars)-1)];
+  }
+  str[len] = '\0';
+  return(strcpyalloc(str));
+}
+
+static float RandomFloat(void)
+{
+  return((rand() - RAND_MAX/2) / 7777.7f);
+}
+
+static double RandomDouble(void)
+{
+  return((rand() - RAND_MAX/2) / 7777.7 + rand() / 1e14);
+}
+
+static SDCMFILEINFO *RandomInfo(void)
+{
+  SDCMFILEINFO *sdfi = (SDCMFILEINFO *) calloc(1, sizeof(SDCMFILEINFO));
+  int k;
+
+  sdfi->FileName = RandomString();
+  sdfi->PatientName = RandomString();
+  sdfi->StudyDate = RandomString();
+  sdfi->StudyTime = RandomString();
+  sdfi->SeriesTime = RandomString();
+  sdfi->AcquisitionTime = RandomString();
+  sdfi->PulseSequence = RandomString();
+  sdfi->ProtocolName = RandomString();
+  sdfi->PhEncDir = RandomString();
+  sdfi->NumarisVer = RandomString();
+  sdfi->ScannerModel = RandomString();
+  sdfi->TransferSyntaxUID = RandomString();
+
+  sdfi->EchoNo = rand();
+  sdfi->SeriesNo = rand();
+  sdfi->ImageNo = rand();
+  sdfi->NImageRows = rand();
+  sdfi->NImageCols = rand();
+  sdfi->lRepetitions = -rand();
+  sdfi->SliceArraylSize = rand();
+  sdfi->RunNo = rand();
+  sdfi->IsMosaic = rand() % 2;
+  sdfi->NFrames = rand();
+  sdfi->nthDirection = rand();
+  sdfi->UseSliceScaleFactor = rand() % 2;
+  sdfi->ErrorFlag = rand() % 2;
+
+  sdfi->FlipAngle = RandomFloat();
+  sdfi->EchoTime = RandomFloat();
+  sdfi->RepetitionTime = RandomFloat();
+  sdfi->InversionTime = RandomFloat();
+  sdfi->FieldStrength = RandomFloat();
+  sdfi->PhEncFOV = RandomFloat();
+  sdfi->ReadoutFOV = RandomFloat();
+  sdfi->LargestValue = RandomFloat();
+  for (k = 0; k < 3; k++)
+  {
+    sdfi->VolDim[k] = rand();
+    sdfi->ImgPos[k] = RandomFloat();
+    sdfi->Vc[k] = RandomFloat();
+    sdfi->Vr[k] = RandomFloat();
+    sdfi->Vs[k] = RandomFloat();
+    sdfi->VolRes[k] = RandomFloat();
+    sdfi->VolCenter[k] = RandomFloat();
+  }
+
+  sdfi->bValue = RandomDouble();
+  sdfi->SliceScaleFactor = RandomDouble();
+  sdfi->bval = RandomDouble();
+  sdfi->bvecx = RandomDouble();
+  sdfi->bvecy = RandomDouble();
+  sdfi->bvecz = RandomDouble();
+  return(sdfi);
+}
+
+static int SameString(const char *a, const char *b)
+{
+  if (a == NULL || b == NULL)
+  {
+    return(a == b);
+  }
+  return(strcmp(a, b) == 0);
+}
+
+/* strings compared as strings, then everything else byte for byte */
+static int SameInfo(SDCMFILEINFO *a, SDCMFILEINFO *b)
+{
+  SDCMFILEINFO ca, cb;
+
+  if (!SameString(a->FileName, b->FileName) ||
+      !SameString(a->PatientName, b->PatientName) ||
+      !SameString(a->StudyDate, b->StudyDate) ||
+      !SameString(a->StudyTime, b->StudyTime) ||
+      !SameString(a->SeriesTime, b->SeriesTime) ||
+      !SameString(a->AcquisitionTime, b->AcquisitionTime) ||
+      !SameString(a->PulseSequence, b->PulseSequence) ||
+      !SameString(a->ProtocolName, b->ProtocolName) ||
+      !SameString(a->PhEncDir, b->PhEncDir) ||
+      !SameString(a->NumarisVer, b->NumarisVer) ||
+      !SameString(a->ScannerModel, b->ScannerModel) ||
+      !SameString(a->TransferSyntaxUID, b->TransferSyntaxUID))
+  {
+    return(0);
+  }
+  memcpy(&ca, a, sizeof(SDCMFILEINFO));
+  memcpy(&cb, b, sizeof(SDCMFILEINFO));
+  ca.FileName = cb.FileName = NULL;
+  ca.PatientName = cb.PatientName = NULL;
+  ca.StudyDate = cb.StudyDate = NULL;
+  ca.StudyTime = cb.StudyTime = NULL;
+  ca.SeriesTime = cb.SeriesTime = NULL;
+  ca.AcquisitionTime = cb.AcquisitionTime = NULL;
+  ca.PulseSequence = cb.PulseSequence = NULL;
+  ca.ProtocolName = cb.ProtocolName = NULL;
+  ca.PhEncDir = cb.PhEncDir = NULL;
+  ca.NumarisVer = cb.NumarisVer = NULL;
+  ca.ScannerModel = cb.ScannerModel = NULL;
+  ca.TransferSyntaxUID = cb.TransferSyntaxUID = NULL;
+  return(memcmp(&ca, &cb, sizeof(SDCMFILEINFO)) == 0);
+}
+
+int main(int argc, char *argv[])
+{
+  SDCMFILEINFO **written, *read;
+  FILE *fp;
+  int n, nfailed = 0;
+
+  Progname = argv[0];
+  if (argc > 1)
+  {
+    nrecords = atoi(argv[1]);
+  }
+  srand(25);
+
+  fp = tmpfile();
+  if (fp == NULL)
+  {
+    printf("could not create a temporary file\n");
+    exit(1);
+  }
+  written = (SDCMFILEINFO **) calloc(nrecords, sizeof(SDCMFILEINFO *));
+  for (n = 0; n < nrecords; n++)
+  {
+    written[n] = RandomInfo();
+    if (WriteSDCMFileInfo(fp, written[n]))
+    {
+      printf("WriteSDCMFileInfo() failed\n");
+      exit(1);
+    }
+  }
+
+  rewind(fp);
+  for (n = 0; n < nrecords; n++)
+  {
+    read = ReadSDCMFileInfo(fp);
+    if (read == NULL || !SameInfo(written[n], read))
+    {
+      printf("record %d %s\n", n, read == NULL ? "not read" : "DIFFERENT");
+      nfailed++;
+    }
+  }
+  fclose(fp);
+  printf("%d records, %d different\n", nrecords, nfailed);
+  exit(nfailed > 0);
+}
@@ -0,0 +1,386 @@
+/**
+ * @file  sdcm_scan_test.c
+ * @brief checks ScanSiemensDCMDir() with several processes and an index
+ *
+ * Writes a small directory of Siemens (and one GE, and one non-DICOM)
+ * files to a temporary directory and scans it serially without an
+ * index. Then it is scanned with several processes into a scan index,
+ * which must give the same info for every file. The files are then
+ * blanked without changing their size or mtime, so that a third scan
+ * only gets the same info if it comes from the index. Finally the
+ * index must be ignored when FS_NO_SLICE_SCALE_FACTOR is changed.
+ * Exits with 1 if any check fails.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ * CVS Revision Info:
+ *    $Author$
+ *    $Date$
+ *    $Revision$
+ *
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utime.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "mri.h"
+#include "utils.h"
+#include "DICOMRead.h"
+
+const char *Progname = NULL;
+
+#define NSERIESFILES 20
+
+static unsigned char buf[4096];
+static int nbuf;
+
+/* appends a little endian explicit VR data element to buf */
+static void Element(int group, int elem, const char *vr,
+                    const void *val, int len)
+{
+  int pad = len % 2, longvr;
+
+  longvr = (!strcmp(vr,"OB") || !strcmp(vr,"OW") || !strcmp(vr,"UN"));
+  buf[nbuf++] = group & 0xff;
+  buf[nbuf++] = group >> 8;
+  buf[nbuf++] = elem & 0xff;
+  buf[nbuf++] = elem >> 8;
+  buf[nbuf++] = vr[0];
+  buf[nbuf++] = vr[1];
+  if (longvr)
+  {
+    buf[nbuf++] = 0;
+    buf[nbuf++] = 0;
+    buf[nbuf++] = (len+pad) & 0xff;
+    buf[nbuf++] = (len+pad) >> 8;
+    buf[nbuf++] = 0;
+    buf[nbuf++] = 0;
+  }
+  else
+  {
+    buf[nbuf++] = (len+pad) & 0xff;
+    buf[nbuf++] = (len+pad) >> 8;
+  }
+  memcpy(buf+nbuf, val, len);
+  nbuf += len;
+  if (pad)
+  {
+    buf[nbuf++] = strcmp(vr,"UI") ? ' ' : '\0';
+  }
+}
+
+static void String(int group, int elem, const char *vr, const char *val)
+{
+  Element(group, elem, vr, val, strlen(val));
+}
+
+static void UShort(int group, int elem, int val)
+{
+  unsigned char us[2];
+  us[0] = val & 0xff;
+  us[1] = val >> 8;
+  Element(group, elem, "US", us, 2);
+}
+
+static int WriteDICOM(const char *fname, int series, int inst,
+                      const char *manufacturer)
+{
+  unsigned char pixels[128], ul[4];
+  char tmpstr[100];
+  int n, metastart;
+  FILE *fp;
+
+  nbuf = 0;
+  memset(buf, 0, 128);
+  nbuf = 128;
+  memcpy(buf+nbuf, "DICM", 4);
+  nbuf += 4;
+
+  /* group length, filled in after the meta elements */
+  memset(ul, 0, 4);
+  Element(0x2, 0x0, "UL", ul, 4);
+  metastart = nbuf;
+  Element(0x2, 0x1, "OB", "\0\1", 2);
+  String(0x2, 0x2, "UI", "1.2.840.10008.5.1.4.1.1.4");
+  sprintf(tmpstr, "1.2.3.%d.%d", series, inst);
+  String(0x2, 0x3, "UI", tmpstr);
+  String(0x2, 0x10, "UI", "1.2.840.10008.1.2.1");
+  n = nbuf - metastart;
+  buf[metastart-4] = n & 0xff;
+  buf[metastart-3] = (n >> 8) & 0xff;
+
+  String(0x8, 0x20, "DA", "20260101");
+  String(0x8, 0x30, "TM", "120000");
+  String(0x8, 0x31, "TM", "120000");
+  sprintf(tmpstr, "120%03d", inst);
+  String(0x8, 0x32, "TM", tmpstr);
+  String(0x8, 0x60, "CS", "MR");
+  String(0x8, 0x70, "LO", manufacturer);
+  String(0x8, 0x1090, "LO", "TrioTim");
+  String(0x10, 0x10, "PN", "Test^Subject");
+  String(0x18, 0x20, "CS", "GR");
+  String(0x18, 0x24, "SH", "*tfl3d1");
+  String(0x18, 0x50, "DS", "1.5");
+  String(0x18, 0x80, "DS", "2000");
+  String(0x18, 0x81, "DS", "30");
+  String(0x18, 0x82, "DS", "0");
+  String(0x18, 0x86, "IS", "1");
+  String(0x18, 0x87, "DS", "3");
+  String(0x18, 0x1020, "LO", "syngo MR B17");
+  sprintf(tmpstr, "proto_%d", series);
+  String(0x18, 0x1030, "LO", tmpstr);
+  String(0x18, 0x1312, "CS", "COL");
+  String(0x18, 0x1314, "DS", "90");
+  sprintf(tmpstr, "%d", series);
+  String(0x20, 0x11, "IS", tmpstr);
+  sprintf(tmpstr, "%d", inst);
+  String(0x20, 0x13, "IS", tmpstr);
+  sprintf(tmpstr, "-100\\-100\\%g", 1.5*inst);
+  String(0x20, 0x32, "DS", tmpstr);
+  String(0x20, 0x37, "DS", "1\\0\\0\\0\\1\\0");
+  UShort(0x28, 0x2, 1);
+  String(0x28, 0x4, "CS", "MONOCHROME2");
+  UShort(0x28, 0x10, 8);
+  UShort(0x28, 0x11, 8);
+  String(0x28, 0x30, "DS", "1\\1");
+  UShort(0x28, 0x100, 16);
+  UShort(0x28, 0x101, 12);
+  UShort(0x28, 0x102, 11);
+  UShort(0x28, 0x103, 0);
+  for (n = 0; n < 128; n++)
+  {
+    pixels[n] = n;
+  }
+  Element(0x7fe0, 0x10, "OW", pixels, 128);
+
+  fp = fopen(fname, "wb");
+  if (fp == NULL)
+  {
+    return(1);
+  }
+  fwrite(buf, 1, nbuf, fp);
+  return(fclose(fp) != 0);
+}
+
+/* overwrites fname with zeros, keeping its size and mtime */
+static int BlankFile(const char *fname)
+{
+  struct stat st;
+  struct utimbuf ut;
+  FILE *fp;
+  long n;
+
+  if (stat(fname, &st) != 0)
+  {
+    return(1);
+  }
+  fp = fopen(fname, "r+b");
+  if (fp == NULL)
+  {
+    return(1);
+  }
+  for (n = 0; n < (long)st.st_size; n++)
+  {
+    fputc(0, fp);
+  }
+  fclose(fp);
+  ut.actime = st.st_atime;
+  ut.modtime = st.st_mtime;
+  return(utime(fname, &ut));
+}
+
+/* the info of the files as text, to compare scans */
+static char *InfoText(SDCMFILEINFO **list, int n, long *len)
+{
+  FILE *fp;
+  char *text;
+  int k;
+
+  fp = tmpfile();
+  for (k = 0; k < n; k++)
+  {
+    WriteSDCMFileInfo(fp, list[k]);
+  }
+  *len = ftell(fp);
+  rewind(fp);
+  text = (char *) calloc(*len+1, sizeof(char));
+  if (fread(text, 1, *len, fp) != (size_t)*len)
+  {
+    *len = -1;
+  }
+  fclose(fp);
+  return(text);
+}
+
+static void FreeList(SDCMFILEINFO **list, int n)
+{
+  int k;
+
+  for (k = 0; k < n; k++)
+  {
+    FreeSDCMFileInfo(&list[k]);
+  }
+  if (list)
+  {
+    free(list);
+  }
+}
+
+/* scans dir and compares the info with reftext; returns 0 if same */
+static int ScanAndCompare(const char *dir, const char *reftext, long reflen,
+                          int *nfiles)
+{
+  SDCMFILEINFO **list;
+  char *text;
+  long len;
+  int same;
+
+  list = ScanSiemensDCMDir(dir, nfiles);
+  text = InfoText(list, *nfiles, &len);
+  same = (len == reflen && memcmp(text, reftext, len) == 0);
+  free(text);
+  FreeList(list, *nfiles);
+  return(same ? 0 : 1);
+}
+
+static void RemoveDir(const char *dir)
+{
+  struct dirent *de;
+  DIR *dp;
+  char fname[STRLEN];
+
+  dp = opendir(dir);
+  if (dp == NULL)
+  {
+    return;
+  }
+  while ((de = readdir(dp)) != NULL)
+  {
+    if (de->d_name[0] == '.')
+    {
+      continue;
+    }
+    sprintf(fname, "%s/%s", dir, de->d_name);
+    unlink(fname);
+  }
+  closedir(dp);
+  rmdir(dir);
+}
+
+int main(int argc, char *argv[])
+{
+  char topdir[STRLEN], dcmdir[STRLEN], indexdir[STRLEN], fname[STRLEN];
+  SDCMFILEINFO **list;
+  char *reftext;
+  long reflen;
+  int series, inst, nref, nfiles, nfailed = 0;
+  FILE *fp;
+
+  Progname = argv[0];
+  unsetenv("FS_NO_SLICE_SCALE_FACTOR");
+  unsetenv("FS_DICOM_SCAN_INDEX");
+  unsetenv("FS_DICOM_SCAN_NPROC");
+
+  strcpy(topdir, "/tmp/sdcm_scan_test.XXXXXX");
+  if (mkdtemp(topdir) == NULL)
+  {
+    printf("could not create a temporary directory\n");
+    exit(1);
+  }
+  sprintf(dcmdir, "%s/dicom", topdir);
+  sprintf(indexdir, "%s/index", topdir);
+  mkdir(dcmdir, 0777);
+  mkdir(indexdir, 0777);
+  for (series = 3; series <= 5; series += 2)
+  {
+    for (inst = 1; inst <= NSERIESFILES; inst++)
+    {
+      sprintf(fname, "%s/s%02d_%04d.dcm", dcmdir, series, inst);
+      if (WriteDICOM(fname, series, inst, "SIEMENS"))
+      {
+        printf("could not write %s\n", fname);
+        exit(1);
+      }
+    }
+  }
+  sprintf(fname, "%s/ge.dcm", dcmdir);
+  WriteDICOM(fname, 7, 1, "GE MEDICAL");
+  sprintf(fname, "%s/README.txt", dcmdir);
+  fp = fopen(fname, "w");
+  fprintf(fp, "not dicom\n");
+  fclose(fp);
+
+  /* reference: one process, no index */
+  SDCMScanNProc = 1;
+  SDCMScanIndexDir = NULL;
+  list = ScanSiemensDCMDir(dcmdir, &nref);
+  reftext = InfoText(list, nref, &reflen);
+  FreeList(list, nref);
+  if (nref != 2*NSERIESFILES)
+  {
+    printf("serial scan found %d of %d Siemens files\n", nref,
+           2*NSERIESFILES);
+    nfailed++;
+  }
+
+  /* several processes, writing the index */
+  SDCMScanNProc = 4;
+  SDCMScanIndexDir = indexdir;
+  if (ScanAndCompare(dcmdir, reftext, reflen, &nfiles) || nfiles != nref)
+  {
+    printf("parallel scan differs from serial scan\n");
+    nfailed++;
+  }
+
+  /* the files are no longer DICOM, so only the index has their info */
+  for (series = 3; series <= 5; series += 2)
+  {
+    for (inst = 1; inst <= NSERIESFILES; inst++)
+    {
+      sprintf(fname, "%s/s%02d_%04d.dcm", dcmdir, series, inst);
+      BlankFile(fname);
+    }
+  }
+  if (ScanAndCompare(dcmdir, reftext, reflen, &nfiles) || nfiles != nref)
+  {
+    printf("scan of unchanged files did not come from the index\n");
+    nfailed++;
+  }
+
+  /* an index made with other settings must not be used */
+  setenv("FS_NO_SLICE_SCALE_FACTOR", "1", 1);
+  list = ScanSiemensDCMDir(dcmdir, &nfiles);
+  FreeList(list, nfiles);
+  if (nfiles != 0)
+  {
+    printf("index used with another FS_NO_SLICE_SCALE_FACTOR\n");
+    nfailed++;
+  }
+  unsetenv("FS_NO_SLICE_SCALE_FACTOR");
+
+  free(reftext);
+  RemoveDir(dcmdir);
+  RemoveDir(indexdir);
+  rmdir(topdir);
+  if (nfailed)
+  {
+    printf("%d checks FAILED\n", nfailed);
+    exit(1);
+  }
+  exit(0);
+}
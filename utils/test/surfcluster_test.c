@@ -0,0 +1,165 @@
+/**
+ * @file  surfcluster_test.c
+ * @brief checks sclustGraphClusters() against sclustMapSurfClusters()
+ *
+ * Builds a grid surface with random vertex areas and a group average
+ * surface area (as mri_glmfit sets for fsaverage), and clusters random
+ * maps with both sclustMapSurfClusters(), through its default summary,
+ * and sclustGraphClusters() on a graph from sclustGraphAlloc(). The
+ * clusters must have the same members, area and area-weighted value.
+ * Exits with 1 if any differ.
+ *
+ * Usage: surfcluster_test [nmaps]
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ * CVS Revision Info:
+ *    $Author$
+ *    $Date$
+ *    $Revision$
+ *
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "mri.h"
+#include "mrisurf.h"
+#include "surfcluster.h"
+
+const char *Progname = NULL;
+
+#define GRID 40
+
+static int nmaps = 20;
+
+/* GRID x GRID vertices, each connected to its 4 neighbors */
+static MRI_SURFACE *GridSurface(void)
+{
+  MRI_SURFACE *surf;
+  VERTEX *v;
+  int row, col, vtx;
+
+  surf = MRISalloc(GRID*GRID, 0);
+  surf->total_area = 0;
+  for (row = 0; row < GRID; row++)
+  {
+    for (col = 0; col < GRID; col++)
+    {
+      vtx = row*GRID + col;
+      v = &surf->vertices[vtx];
+      v->x = col;
+      v->y = row;
+      v->z = 0;
+      v->area = 0.5 + rand()/(float)RAND_MAX;
+      surf->total_area += v->area;
+      v->v = (int *) calloc(4, sizeof(int));
+      v->vnum = 0;
+      if (col > 0)      v->v[v->vnum++] = vtx-1;
+      if (col < GRID-1) v->v[v->vnum++] = vtx+1;
+      if (row > 0)      v->v[v->vnum++] = vtx-GRID;
+      if (row < GRID-1) v->v[v->vnum++] = vtx+GRID;
+    }
+  }
+  surf->group_avg_surface_area = 1.37*surf->total_area;
+  surf->group_avg_vtxarea_loaded = 0;
+  return(surf);
+}
+
+static int SameFloat(double a, double b)
+{
+  return(fabs(a-b) <= 1e-4*(fabs(a)+fabs(b)) + 1e-6);
+}
+
+/* returns the number of clusters that differ */
+static int CompareClusters(MRI_SURFACE *surf, SCG *scg, MRI *map)
+{
+  SCS *scs_map, *scs_graph;
+  int nmap, ngraph, n, m, ndiff = 0;
+
+  scs_map = sclustMapSurfClusters(surf, 2.0, -1, 0, 0, &nmap, NULL);
+  scs_graph = sclustGraphClusters(scg, map, 0, 2.0, -1, 0, NULL, &ngraph);
+  if (nmap != ngraph)
+  {
+    printf("%d clusters on the surface, %d on the graph\n", nmap, ngraph);
+    ndiff = abs(nmap-ngraph);
+  }
+  for (n = 0; n < ngraph; n++)
+  {
+    /* the surface clusters are sorted, so match them by their max */
+    for (m = 0; m < nmap; m++)
+      if (scs_map[m].vtxmaxval == scs_graph[n].vtxmaxval) break;
+    if (m == nmap ||
+        scs_map[m].nmembers != scs_graph[n].nmembers ||
+        !SameFloat(scs_map[m].area, scs_graph[n].area) ||
+        !SameFloat(scs_map[m].weightarea, scs_graph[n].weightarea))
+    {
+      if (m < nmap)
+        printf("cluster at %d: nmembers %d %d, area %g %g\n",
+               scs_graph[n].vtxmaxval,
+               scs_map[m].nmembers, scs_graph[n].nmembers,
+               scs_map[m].area, scs_graph[n].area);
+      ndiff++;
+    }
+  }
+  if (scs_map)   free(scs_map);
+  if (scs_graph) free(scs_graph);
+  return(ndiff);
+}
+
+int main(int argc, char *argv[])
+{
+  MRI_SURFACE *surf;
+  SCG *scg;
+  MRI *map;
+  int n, vtx, ndiff, nfailed = 0;
+
+  Progname = argv[0];
+  if (argc > 1)
+  {
+    nmaps = atoi(argv[1]);
+  }
+  srand(21);
+
+  surf = GridSurface();
+  scg = sclustGraphAlloc(surf, NULL);
+  if (scg == NULL)
+  {
+    printf("sclustGraphAlloc() failed\n");
+    exit(1);
+  }
+  map = MRIallocSequence(surf->nvertices, 1, 1, MRI_FLOAT, 1);
+
+  for (n = 0; n < nmaps; n++)
+  {
+    for (vtx = 0; vtx < surf->nvertices; vtx++)
+    {
+      surf->vertices[vtx].val = 8.0*rand()/(float)RAND_MAX - 4.0;
+      MRIsetVoxVal(map, vtx, 0, 0, 0, surf->vertices[vtx].val);
+    }
+    ndiff = CompareClusters(surf, scg, map);
+    if (ndiff > 0)
+    {
+      printf("map %d: %d clusters differ\n", n, ndiff);
+      nfailed++;
+    }
+  }
+  printf("%d maps, %d different\n", nmaps, nfailed);
+
+  MRIfree(&map);
+  sclustGraphFree(&scg);
+  MRISfree(&surf);
+  exit(nfailed > 0);
+}
@@ -0,0 +1,216 @@
+/**
+ * @file  volcluster_test.c
+ * @brief checks clustLabelClusters() against clustGrow()
+ *
+ * Thresholds random smoothed volumes, clusters them with the hit map
+ * and clustGrow() (as mri_volcluster does) and with the union-find
+ * labeler clustLabelClusters(), and checks that both find the same
+ * clusters, with the same sizes and maxima, for 6- and 26-connectivity.
+ * Exits with 1 if they differ.
+ *
+ * Usage: volcluster_test [size]
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ * CVS Revision Info:
+ *    $Author$
+ *    $Date$
+ *    $Revision$
+ *
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "mri.h"
+#include "macros.h"
+#include "error.h"
+#include "timer.h"
+#include "volcluster.h"
+
+const char *Progname = NULL;
+
+static int size = 48;
+
+/* random volume, box-smoothed so that there are clusters of all sizes */
+static MRI *RandomVolume(void)
+{
+  MRI *noise, *vol;
+  int c, r, s, dc, dr, ds, n;
+  double sum;
+
+  noise = MRIalloc(size, size, size, MRI_FLOAT);
+  vol = MRIalloc(size, size, size, MRI_FLOAT);
+  for (s = 0; s < size; s++)
+    for (r = 0; r < size; r++)
+      for (c = 0; c < size; c++)
+        MRIsetVoxVal(noise, c, r, s, 0, (rand() % 2001)/1000.0 - 1.0);
+
+  for (s = 0; s < size; s++)
+    for (r = 0; r < size; r++)
+      for (c = 0; c < size; c++)
+      {
+        sum = 0;
+        n = 0;
+        for (ds = -1; ds <= 1; ds++)
+          for (dr = -1; dr <= 1; dr++)
+            for (dc = -1; dc <= 1; dc++)
+            {
+              if (c+dc < 0 || c+dc >= size || r+dr < 0 || r+dr >= size ||
+                  s+ds < 0 || s+ds >= size) continue;
+              sum += MRIgetVoxVal(noise, c+dc, r+dr, s+ds, 0);
+              n++;
+            }
+        MRIsetVoxVal(vol, c, r, s, 0, sum/n);
+      }
+  MRIfree(&noise);
+  return(vol);
+}
+
+/* clusters found the way mri_volcluster does it */
+static VOLCLUSTER **GrowClusters(MRI *vol, float thmin, int thsign,
+                                 MRI *mask, int allowdiag, int *nclusters)
+{
+  VOLCLUSTER **list;
+  MRI *HitMap;
+  int nhits, *hitcol=NULL, *hitrow=NULL, *hitslc=NULL, n;
+
+  *nclusters = 0;
+  HitMap = clustInitHitMap(vol, 0, thmin, -1, thsign, &nhits,
+                           &hitcol, &hitrow, &hitslc, mask, 0);
+  list = clustAllocClusterList(MAX(nhits,1));
+  for (n = 0; n < nhits; n++)
+  {
+    if (MRIgetVoxVal(HitMap, hitcol[n], hitrow[n], hitslc[n], 0)) continue;
+    list[*nclusters] = clustGrow(hitcol[n], hitrow[n], hitslc[n],
+                                 HitMap, allowdiag);
+    clustMaxMember(list[*nclusters], vol, 0, thsign);
+    (*nclusters)++;
+  }
+  if (nhits > 0)
+  {
+    free(hitcol);
+    free(hitrow);
+    free(hitslc);
+  }
+  MRIfree(&HitMap);
+  return(list);
+}
+
+/* volume with the (1-based) cluster number at each member */
+static MRI *ClusterVolume(VOLCLUSTER **list, int nclusters)
+{
+  MRI *cvol = MRIalloc(size, size, size, MRI_INT);
+  int n, m;
+
+  for (n = 0; n < nclusters; n++)
+    for (m = 0; m < list[n]->nmembers; m++)
+      MRIsetVoxVal(cvol, list[n]->col[m], list[n]->row[m], list[n]->slc[m],
+                   0, n+1);
+  return(cvol);
+}
+
+static int Compare(VOLCLUSTER **grown, int ngrown,
+                   VOLCLUSTER **labeled, int nlabeled)
+{
+  MRI *gvol, *lvol;
+  int *map, c, r, s, g, l, n, err = 0;
+
+  if (ngrown != nlabeled)
+  {
+    printf("  %d clusters grown, %d labeled\n", ngrown, nlabeled);
+    return(1);
+  }
+  gvol = ClusterVolume(grown, ngrown);
+  lvol = ClusterVolume(labeled, nlabeled);
+
+  /* each grown cluster must map to exactly one labeled cluster */
+  map = (int *) calloc(ngrown+1, sizeof(int));
+  for (s = 0; s < size && !err; s++)
+    for (r = 0; r < size && !err; r++)
+      for (c = 0; c < size && !err; c++)
+      {
+        g = MRIgetVoxVal(gvol, c, r, s, 0);
+        l = MRIgetVoxVal(lvol, c, r, s, 0);
+        if ((g == 0) != (l == 0)) err = 1;
+        else if (g && map[g] == 0) map[g] = l;
+        else if (g && map[g] != l) err = 1;
+      }
+  for (n = 0; n < ngrown && !err; n++)
+  {
+    l = map[n+1] - 1;
+    if (grown[n]->nmembers != labeled[l]->nmembers ||
+        grown[n]->maxval != labeled[l]->maxval) err = 1;
+  }
+  if (err) printf("  clusters differ\n");
+
+  free(map);
+  MRIfree(&gvol);
+  MRIfree(&lvol);
+  return(err);
+}
+
+int main(int argc, char *argv[])
+{
+  static const float thresh[] = { 0.05, 0.15, 0.3 };
+  static const int thsign[] = { 1, 0, -1 };
+  MRI *vol, *mask;
+  VOLCLUSTER **grown, **labeled;
+  int ngrown, nlabeled, i, j, allowdiag, c, r, s, nfailed = 0;
+  int grow_msec, label_msec;
+  struct timeb then;
+
+  Progname = argv[0];
+  if (argc > 1) size = atoi(argv[1]);
+  srand(53);
+
+  vol = RandomVolume();
+  /* fractional mask values are truncated, so 0.5 is outside the mask */
+  mask = MRIalloc(size, size, size, MRI_FLOAT);
+  for (s = 0; s < size; s++)
+    for (r = 0; r < size; r++)
+      for (c = 0; c < size; c++)
+        MRIsetVoxVal(mask, c, r, s, 0, (rand() % 10) ? 1 : 0.5*(rand() % 2));
+
+  for (i = 0; i < 3; i++)
+    for (j = 0; j < 3; j++)
+      for (allowdiag = 0; allowdiag <= 1; allowdiag++)
+      {
+        TimerStart(&then);
+        grown = GrowClusters(vol, thresh[i], thsign[j], j == 1 ? mask : NULL,
+                             allowdiag, &ngrown);
+        grow_msec = TimerStop(&then);
+        TimerStart(&then);
+        labeled = clustLabelClusters(vol, 0, thresh[i], -1, thsign[j],
+                                     j == 1 ? mask : NULL, 0,
+                                     allowdiag ? 26 : 6, &nlabeled);
+        label_msec = TimerStop(&then);
+        printf("thresh %4.2f sign %2d nbrs %2d: %6d clusters, "
+               "grow %5d ms, label %5d ms\n", thresh[i], thsign[j],
+               allowdiag ? 26 : 6, ngrown, grow_msec, label_msec);
+        if (labeled == NULL ||
+            Compare(grown, ngrown, labeled, nlabeled)) nfailed++;
+        clustFreeClusterList(&grown, ngrown);
+        if (labeled) clustFreeClusterList(&labeled, nlabeled);
+      }
+
+  MRIfree(&vol);
+  MRIfree(&mask);
+  if (nfailed)
+  {
+    printf("%d comparisons FAILED\n", nfailed);
+    exit(1);
+  }
+  exit(0);
+}
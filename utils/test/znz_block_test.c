@@ -0,0 +1,247 @@
+/**
+ * @file  znz_block_test.c
+ * @brief checks the blocked gzip files written through znzopen()
+ *
+ * Writes a buffer of several ZNZ_BLOCK_SIZE (1MB) blocks to a compressed
+ * znz file, in pieces that straddle the block boundaries, and checks
+ * that it is written as blocked gzip members, that it reads back the
+ * same with znzread() (also after a znzseek() into a later block) and
+ * with plain zlib gzread(). Then writes a multi-frame float volume
+ * to an .mgz with MRIwrite() and checks that MRIread() gets back
+ * every voxel. Exits with 1 if anything differs.
+ */
+/*
+ * Original Author: REPLACE_WITH_FULL_NAME_OF_CREATING_AUTHOR
+ * CVS Revision Info:
+ *    $Author$
+ *    $Date$
+ *    $Revision$
+ *
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "mri.h"
+#include "error.h"
+#include "znzlib.h"
+
+const char *Progname = NULL;
+
+#define BLOCK  (1<<20)
+#define NBYTES (3*BLOCK + 12345)
+
+/* half random, half runs, so that the blocks compress differently */
+static unsigned char *TestBuffer(size_t nbytes)
+{
+  unsigned char *buf;
+  size_t n;
+
+  buf = (unsigned char *)malloc(nbytes);
+  for (n = 0; n < nbytes; n++)
+  {
+    if ((n / 4096) % 2)
+      buf[n] = (unsigned char)(rand() & 0xff);
+    else
+      buf[n] = (unsigned char)((n / 512) & 0xff);
+  }
+  return(buf);
+}
+
+/* the first gzip member must carry the 'F','Z' extra field */
+static int CheckBlocked(const char *fname)
+{
+  unsigned char hdr[16];
+  FILE *fp;
+  size_t n = 0;
+
+  fp = fopen(fname, "rb");
+  if (fp)
+  {
+    n = fread(hdr, 1, sizeof(hdr), fp);
+    fclose(fp);
+  }
+  if (n == sizeof(hdr) && hdr[0] == 0x1f && hdr[1] == 0x8b &&
+      (hdr[3] & 0x04) && hdr[12] == 'F' && hdr[13] == 'Z')
+    return(0);
+  printf("  %s is not blocked gzip\n", fname);
+  return(1);
+}
+
+static int WriteZnz(const char *fname, unsigned char *buf, size_t nbytes)
+{
+  znzFile fp;
+  size_t n, len;
+
+  fp = znzopen(fname, "wb", 1);
+  if (znz_isnull(fp))
+  {
+    printf("  could not open %s for writing\n", fname);
+    return(1);
+  }
+  /* odd-sized writes so that some of them span two blocks */
+  for (n = 0; n < nbytes; n += len)
+  {
+    len = 100003;
+    if (len > nbytes - n)
+      len = nbytes - n;
+    if (znzwrite(buf+n, 1, len, fp) != len)
+    {
+      printf("  znzwrite() failed at byte %d\n", (int)n);
+      znzclose(fp);
+      return(1);
+    }
+  }
+  znzclose(fp);
+  return(0);
+}
+
+static int ReadZnz(const char *fname, unsigned char *buf, size_t nbytes,
+                   long offset)
+{
+  unsigned char *rbuf;
+  znzFile fp;
+  size_t n;
+  int ok;
+
+  fp = znzopen(fname, "rb", 1);
+  if (znz_isnull(fp))
+  {
+    printf("  could not open %s for reading\n", fname);
+    return(1);
+  }
+  rbuf = (unsigned char *)malloc(nbytes+1);
+  if (offset > 0 && znzseek(fp, offset, SEEK_SET) < 0)
+  {
+    printf("  znzseek() to %ld failed\n", offset);
+    znzclose(fp);
+    free(rbuf);
+    return(1);
+  }
+  n = znzread(rbuf, 1, nbytes+1, fp);
+  ok = (n == nbytes-offset &&
+        memcmp(rbuf, buf+offset, nbytes-offset) == 0);
+  if (!ok)
+    printf("  znzread() from %ld differs\n", offset);
+  znzclose(fp);
+  free(rbuf);
+  return(!ok);
+}
+
+static int ReadGz(const char *fname, unsigned char *buf, size_t nbytes)
+{
+  unsigned char *rbuf;
+  gzFile gz;
+  size_t nread;
+  int n, ok;
+
+  gz = gzopen(fname, "rb");
+  if (gz == NULL)
+  {
+    printf("  gzopen() of %s failed\n", fname);
+    return(1);
+  }
+  rbuf = (unsigned char *)malloc(nbytes+1);
+  nread = 0;
+  while ((n = gzread(gz, rbuf+nread, (unsigned)(nbytes+1-nread))) > 0)
+    nread += n;
+  ok = (n == 0 && nread == nbytes && memcmp(rbuf, buf, nbytes) == 0);
+  if (!ok)
+    printf("  gzread() differs\n");
+  gzclose(gz);
+  free(rbuf);
+  return(!ok);
+}
+
+/* returns the number of voxels that differ */
+static int CompareVolumes(MRI *a, MRI *b)
+{
+  int c, r, s, f, ndiff = 0;
+
+  if (a->width != b->width || a->height != b->height ||
+      a->depth != b->depth || a->nframes != b->nframes ||
+      a->type != b->type)
+    return(-1);
+  for (f = 0; f < a->nframes; f++)
+    for (s = 0; s < a->depth; s++)
+      for (r = 0; r < a->height; r++)
+        for (c = 0; c < a->width; c++)
+          if (MRIgetVoxVal(a,c,r,s,f) != MRIgetVoxVal(b,c,r,s,f))
+            ndiff++;
+  return(ndiff);
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned char *buf;
+  char fname[STRLEN], mgzname[STRLEN];
+  MRI *mri, *mri2;
+  int c, r, s, f, nfailed = 0;
+
+  Progname = argv[0];
+  srand(5);
+  sprintf(fname, "/tmp/znz_block_test.%d.gz", (int)getpid());
+  sprintf(mgzname, "/tmp/znz_block_test.%d.mgz", (int)getpid());
+
+  buf = TestBuffer(NBYTES);
+  printf("%d bytes through znzwrite() and znzread()\n", NBYTES);
+  if (WriteZnz(fname, buf, NBYTES))
+    nfailed++;
+  else
+  {
+    nfailed += CheckBlocked(fname);
+    nfailed += ReadZnz(fname, buf, NBYTES, 0);
+    /* seek into a later block */
+    nfailed += ReadZnz(fname, buf, NBYTES, 2*BLOCK + 777);
+    nfailed += ReadGz(fname, buf, NBYTES);
+  }
+  unlink(fname);
+  free(buf);
+
+  /* 64^3 floats is one block per frame */
+  mri = MRIallocSequence(64, 64, 64, MRI_FLOAT, 3);
+  for (f = 0; f < mri->nframes; f++)
+    for (s = 0; s < mri->depth; s++)
+      for (r = 0; r < mri->height; r++)
+        for (c = 0; c < mri->width; c++)
+          MRIsetVoxVal(mri, c, r, s, f,
+                       (rand() % 2) ? rand()/(float)RAND_MAX : c+r+s+f);
+  printf("%d frames through MRIwrite() and MRIread() of .mgz\n",
+         mri->nframes);
+  if (MRIwrite(mri, mgzname) != NO_ERROR)
+  {
+    printf("could not write %s\n", mgzname);
+    exit(1);
+  }
+  nfailed += CheckBlocked(mgzname);
+  mri2 = MRIread(mgzname);
+  if (mri2 == NULL || CompareVolumes(mri, mri2) != 0)
+  {
+    printf("  MRIread() of %s differs\n", mgzname);
+    nfailed++;
+  }
+  unlink(mgzname);
+  if (mri2)
+    MRIfree(&mri2);
+  MRIfree(&mri);
+
+  if (nfailed)
+  {
+    printf("%d checks FAILED\n", nfailed);
+    exit(1);
+  }
+  exit(0);
+}
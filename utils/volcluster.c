@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <limits.h>
 
 #include <numerics.h>
 #include "diag.h"
@@ -41,6 +42,10 @@
 #include "volcluster.h"
 #include "surfcluster.h"
 
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
 /*---------------------------------------------------------------
   vculstSrcVersion(void) - returns CVS version of this file.
   ---------------------------------------------------------------*/
@@ -442,9 +447,8 @@ int clustGrowOneVoxel(VOLCLUSTER *vc, int col0, int row0, int slc0,
 VOLCLUSTER *clustGrow(int col0, int row0, int slc0, MRI *HitMap, int AllowDiag)
 {
   VOLCLUSTER *vc;
-  int nthmember, nmembers_now;
+  int nthmember;
   int col, row, slc;
-  int nadded, nthpass, n;
 
   vc = (VOLCLUSTER *) calloc(1, sizeof(VOLCLUSTER));
 
@@ -453,28 +457,271 @@ VOLCLUSTER *clustGrow(int col0, int row0, int slc0, MRI *HitMap, int AllowDiag)
   MRIsetVoxVal(HitMap,col0,row0,slc0,0,1);
   vc->voxsize = HitMap->xsize * HitMap->ysize * HitMap->zsize;
 
-  nthpass = 0;
-  nadded = 1;
-  while (nadded > 0)
+  /* The member list is the queue of a breadth-first search: each
+     member is grown from exactly once, in the order it was added.
+     Members that have already been grown from have no unvisited
+     neighbors left, so this adds the same voxels in the same order
+     as re-walking the whole list until nothing is added, without
+     the quadratic cost for large clusters. */
+  for (nthmember = 0; nthmember < vc->nmembers; nthmember ++)
+  {
+    col = vc->col[nthmember];
+    row = vc->row[nthmember];
+    slc = vc->slc[nthmember];
+    clustGrowOneVoxel(vc, col, row, slc, HitMap, AllowDiag);
+  }
+
+  return(vc);
+}
+
+
+/*-------------------------------------------------------------------
+  clustFindRoot() - root of element k in a union-find forest, where
+  parent[k] == k for roots. Sets are joined with clustUnionSets(),
+  which keeps the smallest element of a set as its root, so parents
+  always come before their children. Halves the path on the way up.
+  Used by clustLabelClusters() and sclustGraphClusters().
+  -------------------------------------------------------------------*/
+int clustFindRoot(int *parent, int k)
+{
+  while (parent[k] != k)
+  {
+    parent[k] = parent[parent[k]];
+    k = parent[k];
+  }
+  return(k);
+}
+
+/*-------------------------------------------------------------------*/
+int clustUnionSets(int *parent, int a, int b)
+{
+  a = clustFindRoot(parent,a);
+  b = clustFindRoot(parent,b);
+  if (a < b) parent[b] = a;
+  else if (b < a) parent[a] = b;
+  return(MIN(a,b));
+}
+
+/*-------------------------------------------------------------------
+  clustUnionSlices() - unions each hit voxel in slices [s0,s1) with
+  its hit neighbors that come earlier in memory order, looking no
+  further back than slice smin. nbr holds the (col,row,slc) offsets
+  of the nnbrs earlier neighbors.
+  -------------------------------------------------------------------*/
+static void clustUnionSlices(int *parent, int width, int height,
+                             int s0, int s1, int smin,
+                             int nbr[][3], int nnbrs)
+{
+  int col, row, slc, c, r, s, k, n;
+
+  for (slc = s0; slc < s1; slc++)
+  {
+    for (row = 0; row < height; row++)
+    {
+      for (col = 0; col < width; col++)
+      {
+        k = col + width*(row + height*slc);
+        if (parent[k] < 0) continue;
+        for (n = 0; n < nnbrs; n++)
+        {
+          c = col + nbr[n][0];
+          r = row + nbr[n][1];
+          s = slc + nbr[n][2];
+          if (c < 0 || c >= width || r < 0 || r >= height || s < smin)
+            continue;
+          if (parent[c + width*(r + height*s)] < 0) continue;
+          clustUnionSets(parent, k, c + width*(r + height*s));
+        }
+      }
+    }
+  }
+}
+
+/*-------------------------------------------------------------------
+  clustLabelClusters() - finds the clusters of voxels in vol (at frame)
+  that fall in the threshold range (see clustValueInRange()) and are
+  inside binmask (if non-NULL). nbrs is the connectivity: 6 (faces),
+  18 (faces and edges) or 26 (faces, edges and corners); 6 and 26
+  give the same clusters as clustGrow() with AllowDiag=0 and 1.
+
+  This is a two-pass union-find labeler. The slices are split into
+  one slab per thread and each slab is labeled independently, then
+  the slabs are merged across their boundary slices. Since the root
+  of a set is always its smallest voxel index, the result does not
+  depend on the number of threads. Each cluster is returned with its
+  members (in memory order), maximum (as clustMaxMember()), voxsize
+  and centroid. Clusters are in the order of their first voxel.
+  Returns NULL on error. Voxel coordinates (x,y,z) are not set.
+  -------------------------------------------------------------------*/
+VOLCLUSTER **clustLabelClusters(MRI *vol, int frame,
+                                float thmin, float thmax, int thsign,
+                                MRI *binmask, int maskframe, int nbrs,
+                                int *nClusters)
+{
+  VOLCLUSTER **vclist, *vc;
+  int width, height, depth, nvox, nslabs, slab, k, p, id, nclusters;
+  int nbr[13][3], nnbrs, dcol, drow, dslc, dsum, col, row, slc;
+  int *parent, *nmembers;
+  double *csum;
+
+  *nClusters = 0;
+  if (nbrs != 6 && nbrs != 18 && nbrs != 26)
+  {
+    printf("ERROR: clustLabelClusters: nbrs = %d, must be 6, 18, or 26\n",
+           nbrs);
+    return(NULL);
+  }
+  width  = vol->width;
+  height = vol->height;
+  depth  = vol->depth;
+  if ((double)width*height*depth > INT_MAX)
   {
-    //printf("%4d  %5d  %d\n",nthpass,vc->nmembers,nadded);
+    printf("ERROR: clustLabelClusters: volume too large\n");
+    return(NULL);
+  }
+  nvox = width*height*depth;
 
-    nadded = 0;
-    nmembers_now = vc->nmembers;
-    for (nthmember = 0; nthmember < nmembers_now; nthmember ++)
+  /* the neighbors that come before a voxel in memory order */
+  nnbrs = 0;
+  for (dslc = -1; dslc <= 0; dslc++)
+  {
+    for (drow = -1; drow <= 1; drow++)
     {
-      col = vc->col[nthmember];
-      row = vc->row[nthmember];
-      slc = vc->slc[nthmember];
-      n = clustGrowOneVoxel(vc, col, row, slc, HitMap, AllowDiag);
-      //printf("Grown: %3d %3d %3d  %d\n",col,row,slc,n);
-      nadded += n;
+      for (dcol = -1; dcol <= 1; dcol++)
+      {
+        if (dslc == 0 && (drow > 0 || (drow == 0 && dcol >= 0))) continue;
+        dsum = abs(dcol) + abs(drow) + abs(dslc);
+        if (nbrs == 6 && dsum > 1) continue;
+        if (nbrs == 18 && dsum > 2) continue;
+        nbr[nnbrs][0] = dcol;
+        nbr[nnbrs][1] = drow;
+        nbr[nnbrs][2] = dslc;
+        nnbrs++;
+      }
     }
+  }
 
-    nthpass ++;
+  parent = (int *) calloc(nvox, sizeof(int));
+  if (parent == NULL)
+  {
+    printf("ERROR: clustLabelClusters: could not alloc %d\n",nvox);
+    return(NULL);
   }
 
-  return(vc);
+  /* first pass: threshold and union within each slab */
+#ifdef HAVE_OPENMP
+  nslabs = MIN(depth, omp_get_max_threads());
+#else
+  nslabs = 1;
+#endif
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for
+#endif
+  for (slab = 0; slab < nslabs; slab++)
+  {
+    int s0, s1, c, r, s, kk;
+
+    s0 = (int)(((long)slab*depth)/nslabs);
+    s1 = (int)(((long)(slab+1)*depth)/nslabs);
+    for (s = s0; s < s1; s++)
+    {
+      for (r = 0; r < height; r++)
+      {
+        for (c = 0; c < width; c++)
+        {
+          kk = c + width*(r + height*s);
+          parent[kk] = -1;
+          if (binmask != NULL &&
+              (int)MRIgetVoxVal(binmask,c,r,s,maskframe) == 0) continue;
+          if (clustValueInRange(MRIgetVoxVal(vol,c,r,s,frame),
+                                thmin,thmax,thsign))
+            parent[kk] = kk;
+        }
+      }
+    }
+    clustUnionSlices(parent, width, height, s0, s1, s0, nbr, nnbrs);
+  }
+
+  /* merge step: join each slab to the one below it */
+  for (slab = 1; slab < nslabs; slab++)
+  {
+    int s0 = (int)(((long)slab*depth)/nslabs);
+    clustUnionSlices(parent, width, height, s0, s0+1, s0-1, nbr, nnbrs);
+  }
+
+  /* second pass: replace each parent with -2-(cluster number). A
+     root comes before the rest of its set and every parent comes
+     before its child, so the parent has always been replaced. */
+  nclusters = 0;
+  for (k = 0; k < nvox; k++)
+  {
+    p = parent[k];
+    if (p == -1) continue;
+    if (p == k) parent[k] = -2 - nclusters++;
+    else        parent[k] = parent[p];
+  }
+
+  vclist = clustAllocClusterList(MAX(nclusters,1));
+  nmembers = (int *) calloc(MAX(nclusters,1), sizeof(int));
+  csum = (double *) calloc(3*MAX(nclusters,1), sizeof(double));
+  if (vclist == NULL || nmembers == NULL || csum == NULL)
+  {
+    printf("ERROR: clustLabelClusters: could not alloc %d clusters\n",
+           nclusters);
+    if (vclist) free(vclist);
+    if (nmembers) free(nmembers);
+    if (csum) free(csum);
+    free(parent);
+    return(NULL);
+  }
+
+  for (k = 0; k < nvox; k++)
+    if (parent[k] != -1) nmembers[-2-parent[k]]++;
+  for (id = 0; id < nclusters; id++)
+  {
+    vclist[id] = clustAllocCluster(nmembers[id]);
+    vclist[id]->nmembers = 0;
+    vclist[id]->voxsize = vol->xsize * vol->ysize * vol->zsize;
+  }
+
+  k = 0;
+  for (slc = 0; slc < depth; slc++)
+  {
+    for (row = 0; row < height; row++)
+    {
+      for (col = 0; col < width; col++, k++)
+      {
+        if (parent[k] == -1) continue;
+        id = -2-parent[k];
+        vc = vclist[id];
+        vc->col[vc->nmembers] = col;
+        vc->row[vc->nmembers] = row;
+        vc->slc[vc->nmembers] = slc;
+        vc->nmembers++;
+        csum[3*id]   += col;
+        csum[3*id+1] += row;
+        csum[3*id+2] += slc;
+      }
+    }
+  }
+
+  for (id = 0; id < nclusters; id++)
+  {
+    vc = vclist[id];
+    vc->ccol = csum[3*id]   / vc->nmembers;
+    vc->crow = csum[3*id+1] / vc->nmembers;
+    vc->cslc = csum[3*id+2] / vc->nmembers;
+    clustMaxMember(vc, vol, frame, thsign);
+  }
+
+  free(nmembers);
+  free(csum);
+  free(parent);
+
+  if (Gdiag_no > 1)
+    printf("INFO: clustLabelClusters: found %d clusters\n", nclusters);
+  *nClusters = nclusters;
+  return(vclist);
 }
 
 
@@ -663,6 +910,9 @@ VOLCLUSTER *clustCopyCluster(VOLCLUSTER *vc)
   vc2->maxmember = vc->maxmember;
   vc2->maxval = vc->maxval;
   vc2->voxsize = vc->voxsize;
+  vc2->ccol = vc->ccol;
+  vc2->crow = vc->crow;
+  vc2->cslc = vc->cslc;
 
   vc2->pval_clusterwise     = vc->pval_clusterwise;
   vc2->pval_clusterwise_low = vc->pval_clusterwise_low;
@@ -877,63 +1127,27 @@ VOLCLUSTER **clustGetClusters(MRI *vol, int frame,
                               MRI *binmask, int *nClusters,
                               MATRIX *XFM)
 {
-  int nthhit,nclusters,nhits, *hitcol=NULL, *hitrow=NULL, *hitslc=NULL;
-  int col,row,slc,allowdiag=0,nprunedclusters;
-  MRI *HitMap;
+  int nclusters,nthcluster,allowdiag=0,nprunedclusters;
   VOLCLUSTER **ClusterList, **ClusterList2;
   float voxsizemm3, distthresh=0;
 
   voxsizemm3 = vol->xsize*vol->ysize*vol->zsize;
 
-  /* Initialize the hit map - this is a map of voxels that have been
-     accounted for as either outside of a the threshold range or
-     belonging to a cluster. The initialization is for thresholding */
-  HitMap = clustInitHitMap(vol, frame, threshmin, threshmax, threshsign,
-                           &nhits, &hitcol, &hitrow, &hitslc, binmask,0);
-  if (HitMap == NULL)
-  {
-    // Nothing survived the first thresholding
-    *nClusters = 0;
-    return(NULL);
-  }
-  if (Gdiag_no > 0) printf("INFO: Found %d voxels in threhold range\n",nhits);
-
-  /* Allocate an array of clusters equal to the number of hits -- this
-     is the maximum number of clusters possible */
-  ClusterList = clustAllocClusterList(nhits);
+  /* Find the connected clusters of voxels in the threshold range */
+  ClusterList = clustLabelClusters(vol, frame, threshmin, threshmax,
+                                   threshsign, binmask, 0,
+                                   allowdiag ? 26 : 6, &nclusters);
   if (ClusterList == NULL)
   {
-    printf("ERROR: could not alloc %d clusters\n",nhits);
+    *nClusters = 0;
     return(NULL);
   }
 
-  nclusters = 0;
-  for (nthhit = 0; nthhit < nhits; nthhit ++)
+  for (nthcluster = 0; nthcluster < nclusters; nthcluster ++)
   {
-
-    /* Determine whether this hit is still valid. It may
-       not be if it was assigned to the cluster of a
-       previous hit */
-    col = hitcol[nthhit];
-    row = hitrow[nthhit];
-    slc = hitslc[nthhit];
-    if (MRIgetVoxVal(HitMap,col,row,slc,0)) continue;
-
-    /* Grow cluster using this hit as a seed */
-    ClusterList[nclusters] = clustGrow(col,row,slc,HitMap,allowdiag);
-    ClusterList[nclusters]->voxsize = voxsizemm3;
-
-    /* Determine the member with the maximum value */
-    clustMaxMember(ClusterList[nclusters], vol, frame, threshsign);
-
-    if (XFM) clustComputeTal(ClusterList[nclusters],XFM);
-
-    /* increment the number of clusters */
-    nclusters ++;
+    ClusterList[nthcluster]->voxsize = voxsizemm3;
+    if (XFM) clustComputeTal(ClusterList[nthcluster],XFM);
   }
-  free(hitcol);
-  free(hitrow);
-  free(hitslc);
 
   if (Gdiag_no > 0)
     printf("INFO: Found %d clusters that meet threshold criteria\n",
@@ -966,8 +1180,6 @@ VOLCLUSTER **clustGetClusters(MRI *vol, int frame,
   clustFreeClusterList(&ClusterList,nclusters);
   ClusterList = ClusterList2;
 
-  MRIfree(&HitMap);
-
   if (Gdiag_no > 0) printf("INFO: Found %d final clusters\n",nclusters);
   *nClusters = nclusters;
   return(ClusterList);
@@ -42,6 +42,457 @@
 #define _POSIX_C_SOURCE 1
 #endif
 #include "znzlib.h"
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
+#ifdef HAVE_ZLIB
+/*
+  Blocked gzip files.
+
+  Compressed files opened for writing are written as a series of
+  independent gzip members, each holding up to ZNZ_BLOCK_SIZE bytes
+  of uncompressed data. Concatenated members are a valid gzip file
+  (gunzip and gzread() read them as a single stream), but the members
+  can be compressed and decompressed in parallel. Each member header
+  carries an extra field (SI1='F', SI2='Z') holding the compressed and
+  uncompressed sizes of the member so that a reader can find the next
+  member, or skip over it, without inflating it. Compressed files
+  without this field are read through gzread() as before.
+
+  The number of blocks processed at a time is the number of OpenMP
+  threads.
+*/
+#define ZNZ_BLOCK_SIZE  (1<<20)
+#define ZNZ_MAX_BLOCKS  64
+#define ZNZ_HDR_SIZE    24  /* gzip header (10) + XLEN (2) + extra field (12) */
+#define ZNZ_TRL_SIZE     8  /* CRC32 + ISIZE */
+
+struct znzblocks
+{
+  FILE *fp;
+  int writing;
+  int level;
+  int nblocks;          /* number of blocks (de)compressed at a time */
+  unsigned char *ubuf;  /* nblocks*ZNZ_BLOCK_SIZE uncompressed bytes */
+  size_t ulen;          /* number of bytes in ubuf */
+  size_t upos;          /* read position in ubuf */
+  long ubase;           /* uncompressed file offset of ubuf[0] */
+  unsigned char **cbuf; /* compressed data of each block */
+  size_t *cbufsize;     /* allocated size of each cbuf */
+  size_t *clen;         /* compressed size of each block */
+  size_t *blen;         /* uncompressed size of each block */
+  unsigned long *crc;   /* crc32 of each block */
+  int nmembers;         /* number of members written */
+  int eof;
+};
+
+static void znzbPutLE32(unsigned char *p, unsigned long v)
+{
+  p[0] = (unsigned char)(v & 0xff);
+  p[1] = (unsigned char)((v >> 8) & 0xff);
+  p[2] = (unsigned char)((v >> 16) & 0xff);
+  p[3] = (unsigned char)((v >> 24) & 0xff);
+}
+
+static unsigned long znzbGetLE32(const unsigned char *p)
+{
+  return (unsigned long)p[0] | ((unsigned long)p[1] << 8) |
+    ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+static void znzbFree(struct znzblocks *zb)
+{
+  int n;
+  if (zb->cbuf)
+  {
+    for (n=0; n < zb->nblocks; n++) free(zb->cbuf[n]);
+  }
+  free(zb->cbuf);
+  free(zb->cbufsize);
+  free(zb->clen);
+  free(zb->blen);
+  free(zb->crc);
+  free(zb->ubuf);
+  free(zb);
+}
+
+static struct znzblocks *znzbAlloc(FILE *fp, int writing, int level)
+{
+  struct znzblocks *zb;
+  int n, nblocks = 1;
+
+#ifdef HAVE_OPENMP
+  nblocks = omp_get_max_threads();
+#endif
+  if (nblocks < 1) nblocks = 1;
+  if (nblocks > ZNZ_MAX_BLOCKS) nblocks = ZNZ_MAX_BLOCKS;
+
+  zb = (struct znzblocks *) calloc(1,sizeof(struct znzblocks));
+  if (zb == NULL) return NULL;
+  zb->fp = fp;
+  zb->writing = writing;
+  zb->level = level;
+  zb->nblocks = nblocks;
+  zb->ubuf = (unsigned char *) malloc((size_t)nblocks*ZNZ_BLOCK_SIZE);
+  zb->cbuf = (unsigned char **) calloc(nblocks,sizeof(unsigned char *));
+  zb->cbufsize = (size_t *) calloc(nblocks,sizeof(size_t));
+  zb->clen = (size_t *) calloc(nblocks,sizeof(size_t));
+  zb->blen = (size_t *) calloc(nblocks,sizeof(size_t));
+  zb->crc = (unsigned long *) calloc(nblocks,sizeof(unsigned long));
+  if (!zb->ubuf || !zb->cbuf || !zb->cbufsize || !zb->clen || !zb->blen || !zb->crc)
+  {
+    znzbFree(zb);
+    return NULL;
+  }
+  if (writing)
+  {
+    /* compressBound() includes the zlib wrapper, so it also bounds raw deflate */
+    for (n=0; n < nblocks; n++)
+    {
+      zb->cbufsize[n] = compressBound(ZNZ_BLOCK_SIZE);
+      zb->cbuf[n] = (unsigned char *) malloc(zb->cbufsize[n]);
+      if (zb->cbuf[n] == NULL)
+      {
+        znzbFree(zb);
+        return NULL;
+      }
+    }
+  }
+  return zb;
+}
+
+/* Compresses the pending data as independent blocks (in parallel) and
+   writes them out as gzip members. If force is set, a member is
+   written even when there is no pending data (an empty gzip file must
+   still have one member). Returns 0 on success. */
+static int znzbFlushWrite(struct znzblocks *zb, int force)
+{
+  int n, nb, err = 0;
+  unsigned char hdr[ZNZ_HDR_SIZE], trl[ZNZ_TRL_SIZE];
+
+  if (zb->ulen == 0 && !force) return 0;
+  nb = (int)((zb->ulen + ZNZ_BLOCK_SIZE - 1) / ZNZ_BLOCK_SIZE);
+  if (nb == 0) nb = 1;
+  for (n=0; n < nb; n++)
+  {
+    zb->blen[n] = ZNZ_BLOCK_SIZE;
+    if (n == nb-1) zb->blen[n] = zb->ulen - (size_t)n*ZNZ_BLOCK_SIZE;
+  }
+
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for num_threads(nb) reduction(+:err) schedule(static,1)
+#endif
+  for (n=0; n < nb; n++)
+  {
+    z_stream strm;
+    unsigned char *src = zb->ubuf + (size_t)n*ZNZ_BLOCK_SIZE;
+    memset(&strm,0,sizeof(strm));
+    if (deflateInit2(&strm,zb->level,Z_DEFLATED,-MAX_WBITS,8,Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+      err++;
+      continue;
+    }
+    strm.next_in   = src;
+    strm.avail_in  = (uInt) zb->blen[n];
+    strm.next_out  = zb->cbuf[n];
+    strm.avail_out = (uInt) zb->cbufsize[n];
+    if (deflate(&strm,Z_FINISH) != Z_STREAM_END) err++;
+    zb->clen[n] = strm.total_out;
+    deflateEnd(&strm);
+    zb->crc[n] = crc32(crc32(0L,Z_NULL,0),src,(uInt) zb->blen[n]);
+  }
+  if (err)
+  {
+    fprintf(stderr,"** ERROR: znzlib: failed to compress block\n");
+    return -1;
+  }
+
+  memset(hdr,0,sizeof(hdr));
+  hdr[0] = 0x1f;  /* ID1 */
+  hdr[1] = 0x8b;  /* ID2 */
+  hdr[2] = 8;     /* CM = deflate */
+  hdr[3] = 4;     /* FLG = FEXTRA */
+  hdr[9] = 255;   /* OS = unknown */
+  hdr[10] = 12;   /* XLEN */
+  hdr[12] = 'F';  /* SI1 */
+  hdr[13] = 'Z';  /* SI2 */
+  hdr[14] = 8;    /* LEN */
+  for (n=0; n < nb; n++)
+  {
+    znzbPutLE32(hdr+16,(unsigned long) zb->clen[n]);
+    znzbPutLE32(hdr+20,(unsigned long) zb->blen[n]);
+    znzbPutLE32(trl,zb->crc[n]);
+    znzbPutLE32(trl+4,(unsigned long) zb->blen[n]);
+    if (fwrite(hdr,1,ZNZ_HDR_SIZE,zb->fp) != ZNZ_HDR_SIZE ||
+        fwrite(zb->cbuf[n],1,zb->clen[n],zb->fp) != zb->clen[n] ||
+        fwrite(trl,1,ZNZ_TRL_SIZE,zb->fp) != ZNZ_TRL_SIZE)
+    {
+      fprintf(stderr,"** ERROR: znzlib: failed to write block\n");
+      return -1;
+    }
+    zb->nmembers++;
+  }
+  zb->ubase += (long) zb->ulen;
+  zb->ulen = 0;
+  return 0;
+}
+
+static size_t znzbWrite(struct znzblocks *zb, const void *buf, size_t nbytes)
+{
+  size_t cap = (size_t)zb->nblocks*ZNZ_BLOCK_SIZE, n, done = 0;
+  const unsigned char *p = (const unsigned char *) buf;
+
+  while (done < nbytes)
+  {
+    n = cap - zb->ulen;
+    if (n > nbytes-done) n = nbytes-done;
+    memcpy(zb->ubuf+zb->ulen,p+done,n);
+    zb->ulen += n;
+    done += n;
+    if (zb->ulen == cap && znzbFlushWrite(zb,0) != 0) break;
+  }
+  return done;
+}
+
+/* Reads the header of the next member. Returns 1 if a member was
+   found, 0 at the end of the file, and -1 if the member does not
+   have the block size field. */
+static int znzbReadHeader(FILE *fp, size_t *clen, size_t *blen)
+{
+  unsigned char hdr[ZNZ_HDR_SIZE];
+  size_t nread;
+
+  nread = fread(hdr,1,ZNZ_HDR_SIZE,fp);
+  if (nread == 0) return 0;
+  if (nread != ZNZ_HDR_SIZE || hdr[0] != 0x1f || hdr[1] != 0x8b ||
+      hdr[2] != 8 || hdr[3] != 4 || hdr[10] != 12 || hdr[11] != 0 ||
+      hdr[12] != 'F' || hdr[13] != 'Z' || hdr[14] != 8 || hdr[15] != 0)
+    return -1;
+  *clen = znzbGetLE32(hdr+16);
+  *blen = znzbGetLE32(hdr+20);
+  if (*blen > ZNZ_BLOCK_SIZE) return -1;
+  return 1;
+}
+
+/* Reads up to nblocks members and inflates them (in parallel) into
+   ubuf. Returns the number of bytes now in ubuf (0 at end of file) or
+   -1 on error. */
+static long znzbFill(struct znzblocks *zb)
+{
+  int n, nb, r, err = 0;
+  size_t off[ZNZ_MAX_BLOCKS], clen, blen;
+  unsigned char trl[ZNZ_TRL_SIZE];
+
+  zb->ubase += (long) zb->ulen;
+  zb->ulen = zb->upos = 0;
+  if (zb->eof) return 0;
+
+  for (nb=0; nb < zb->nblocks; nb++)
+  {
+    r = znzbReadHeader(zb->fp,&clen,&blen);
+    if (r == 0)
+    {
+      zb->eof = 1;
+      break;
+    }
+    if (r < 0)
+    {
+      fprintf(stderr,"** ERROR: znzlib: bad block header\n");
+      return -1;
+    }
+    if (clen > zb->cbufsize[nb])
+    {
+      free(zb->cbuf[nb]);
+      zb->cbuf[nb] = (unsigned char *) malloc(clen);
+      if (zb->cbuf[nb] == NULL)
+      {
+        zb->cbufsize[nb] = 0;
+        fprintf(stderr,"** ERROR: znzlib: failed to alloc %lu bytes\n",
+                (unsigned long) clen);
+        return -1;
+      }
+      zb->cbufsize[nb] = clen;
+    }
+    if (fread(zb->cbuf[nb],1,clen,zb->fp) != clen ||
+        fread(trl,1,ZNZ_TRL_SIZE,zb->fp) != ZNZ_TRL_SIZE ||
+        znzbGetLE32(trl+4) != (unsigned long) blen)
+    {
+      fprintf(stderr,"** ERROR: znzlib: truncated block\n");
+      return -1;
+    }
+    zb->clen[nb] = clen;
+    zb->blen[nb] = blen;
+    zb->crc[nb] = znzbGetLE32(trl);
+    off[nb] = zb->ulen;
+    zb->ulen += blen;
+  }
+
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for num_threads(nb > 0 ? nb : 1) reduction(+:err) schedule(static,1)
+#endif
+  for (n=0; n < nb; n++)
+  {
+    z_stream strm;
+    unsigned char *dst = zb->ubuf + off[n];
+    memset(&strm,0,sizeof(strm));
+    if (inflateInit2(&strm,-MAX_WBITS) != Z_OK)
+    {
+      err++;
+      continue;
+    }
+    strm.next_in   = zb->cbuf[n];
+    strm.avail_in  = (uInt) zb->clen[n];
+    strm.next_out  = dst;
+    strm.avail_out = (uInt) zb->blen[n];
+    if (inflate(&strm,Z_FINISH) != Z_STREAM_END || strm.total_out != zb->blen[n])
+      err++;
+    inflateEnd(&strm);
+    if (crc32(crc32(0L,Z_NULL,0),dst,(uInt) zb->blen[n]) != zb->crc[n]) err++;
+  }
+  if (err)
+  {
+    fprintf(stderr,"** ERROR: znzlib: corrupt compressed block\n");
+    zb->ulen = 0;
+    return -1;
+  }
+  return (long) zb->ulen;
+}
+
+static size_t znzbRead(struct znzblocks *zb, void *buf, size_t nbytes)
+{
+  size_t n, done = 0;
+  unsigned char *p = (unsigned char *) buf;
+
+  while (done < nbytes)
+  {
+    if (zb->upos == zb->ulen && znzbFill(zb) <= 0) break;
+    n = zb->ulen - zb->upos;
+    if (n > nbytes-done) n = nbytes-done;
+    memcpy(p+done,zb->ubuf+zb->upos,n);
+    zb->upos += n;
+    done += n;
+  }
+  return done;
+}
+
+/* Seeks to an uncompressed offset. Reading: whole members before the
+   target are skipped without being inflated; seeking backwards
+   restarts from the beginning of the file. Writing: only forward,
+   zeros are written. Returns the new offset or -1. */
+static long znzbSeek(struct znzblocks *zb, long offset, int whence)
+{
+  long target, pos;
+  size_t clen, blen, n;
+  unsigned char zeros[4096];
+  int r;
+
+  if (whence == SEEK_SET) target = offset;
+  else if (whence == SEEK_CUR)
+    target = zb->ubase + (long)(zb->writing ? zb->ulen : zb->upos) + offset;
+  else return -1;
+  if (target < 0) return -1;
+
+  if (zb->writing)
+  {
+    if (target < zb->ubase + (long) zb->ulen) return -1;
+    memset(zeros,0,sizeof(zeros));
+    while (zb->ubase + (long) zb->ulen < target)
+    {
+      n = (size_t)(target - zb->ubase - (long) zb->ulen);
+      if (n > sizeof(zeros)) n = sizeof(zeros);
+      if (znzbWrite(zb,zeros,n) != n) return -1;
+    }
+    return target;
+  }
+
+  if (target >= zb->ubase && target <= zb->ubase + (long) zb->ulen)
+  {
+    zb->upos = (size_t)(target - zb->ubase);
+    return target;
+  }
+  if (target < zb->ubase)
+  {
+    if (fseek(zb->fp,0L,SEEK_SET) != 0) return -1;
+    zb->ubase = 0;
+    zb->eof = 0;
+  }
+  else zb->ubase += (long) zb->ulen;
+  zb->ulen = zb->upos = 0;
+
+  /* skip members that end before the target */
+  while (!zb->eof)
+  {
+    pos = ftell(zb->fp);
+    r = znzbReadHeader(zb->fp,&clen,&blen);
+    if (r < 0) return -1;
+    if (r == 0)
+    {
+      zb->eof = 1;
+      break;
+    }
+    if (zb->ubase + (long) blen > target)
+    {
+      if (fseek(zb->fp,pos,SEEK_SET) != 0) return -1;
+      break;
+    }
+    if (fseek(zb->fp,(long)(clen+ZNZ_TRL_SIZE),SEEK_CUR) != 0) return -1;
+    zb->ubase += (long) blen;
+  }
+  if (zb->ubase < target && znzbFill(zb) < 0) return -1;
+  if (target > zb->ubase + (long) zb->ulen) return -1;
+  zb->upos = (size_t)(target - zb->ubase);
+  return target;
+}
+
+/* Opens path as a blocked gzip file if mode is write or if the file
+   starts with a member that has the block size field. Returns NULL
+   otherwise, in which case the caller falls back to gzopen(). */
+static struct znzblocks *znzbOpen(const char *path, const char *mode)
+{
+  struct znzblocks *zb;
+  FILE *fp;
+  size_t clen, blen;
+  const char *c;
+  int level = Z_DEFAULT_COMPRESSION;
+
+  if (mode[0] == 'w')
+  {
+    for (c = mode; *c; c++)
+    {
+      if (*c >= '0' && *c <= '9') level = *c - '0';
+    }
+    fp = fopen(path,"wb");
+    if (fp == NULL) return NULL;
+    zb = znzbAlloc(fp,1,level);
+    if (zb == NULL) fclose(fp);
+    return zb;
+  }
+  if (mode[0] != 'r' || strchr(mode,'+')) return NULL;
+
+  fp = fopen(path,"rb");
+  if (fp == NULL) return NULL;
+  if (znzbReadHeader(fp,&clen,&blen) != 1)
+  {
+    fclose(fp);
+    return NULL;
+  }
+  rewind(fp);
+  zb = znzbAlloc(fp,0,level);
+  if (zb == NULL) fclose(fp);
+  return zb;
+}
+
+static int znzbClose(struct znzblocks *zb)
+{
+  int retval = 0;
+  if (zb->writing && znzbFlushWrite(zb,zb->nmembers == 0) != 0) retval = -1;
+  if (fclose(zb->fp) != 0) retval = -1;
+  znzbFree(zb);
+  return retval;
+}
+#endif
+
 
 /* Note extra argument (use_compression) where
    use_compression==0 is no compression
@@ -63,10 +514,13 @@ znzFile znzopen(const char *path, const char *mode, int use_compression)
 #ifdef HAVE_ZLIB
   file->zfptr = NULL;
 
+  file->zbfptr = NULL;
+
   if (use_compression)
   {
     file->withz = 1;
-    if ((file->zfptr = gzopen(path,mode)) == NULL)
+    file->zbfptr = znzbOpen(path,mode);
+    if (file->zbfptr == NULL && (file->zfptr = gzopen(path,mode)) == NULL)
     {
       free(file);
       file = NULL;
@@ -105,6 +559,7 @@ znzFile znzdopen(int fd, const char *mode, int use_compression)
   {
     file->withz = 1;
     file->zfptr = gzdopen(fd,mode);
+    file->zbfptr = NULL;
     file->nzfptr = NULL;
   }
   else
@@ -116,6 +571,7 @@ znzFile znzdopen(int fd, const char *mode, int use_compression)
 #endif
 #ifdef HAVE_ZLIB
     file->zfptr = NULL;
+    file->zbfptr = NULL;
   };
 #endif
   return file;
@@ -128,6 +584,10 @@ int Xznzclose(znzFile * file)
   if (*file!=NULL)
   {
 #ifdef HAVE_ZLIB
+    if ((*file)->zbfptr!=NULL)
+    {
+      retval = znzbClose((*file)->zbfptr);
+    }
     if ((*file)->zfptr!=NULL)
     {
       retval = gzclose((*file)->zfptr);
@@ -152,6 +612,8 @@ size_t znzread(void* buf, size_t size, size_t nmemb, znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->zbfptr!=NULL)
+    return znzbRead(file->zbfptr,buf,size*nmemb) / size;
   if (file->zfptr!=NULL)
     return (size_t) (gzread(file->zfptr,buf,((int) size)*((int) nmemb)) / size);
 #endif
@@ -165,6 +627,8 @@ size_t znzwrite(void* buf, size_t size, size_t nmemb, znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->zbfptr!=NULL)
+    return znzbWrite(file->zbfptr,buf,size*nmemb) / size;
   if (file->zfptr!=NULL)
     return (size_t) ( gzwrite(file->zfptr,buf,size*nmemb) / size );
 #endif
@@ -178,6 +642,7 @@ long znzseek(znzFile file, long offset, int whence)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->zbfptr!=NULL) return znzbSeek(file->zbfptr,offset,whence);
   if (file->zfptr!=NULL) return (long) gzseek(file->zfptr,offset,whence);
 #endif
   return fseek(file->nzfptr,offset,whence);
@@ -190,6 +655,8 @@ int znzrewind(znzFile stream)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (stream->zbfptr!=NULL)
+    return (znzbSeek(stream->zbfptr,0L,SEEK_SET) == 0) ? 0 : -1;
   if (stream->zfptr!=NULL) return gzrewind(stream->zfptr);
 #endif
   rewind(stream->nzfptr);
@@ -203,6 +670,9 @@ long znztell(znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->zbfptr!=NULL)
+    return file->zbfptr->ubase + (long)(file->zbfptr->writing ?
+                                        file->zbfptr->ulen : file->zbfptr->upos);
   if (file->zfptr!=NULL) return (long) gztell(file->zfptr);
 #endif
   return ftell(file->nzfptr);
@@ -215,6 +685,8 @@ int znzputs(char* str, znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->zbfptr!=NULL)
+    return (int) znzbWrite(file->zbfptr,str,strlen(str));
   if (file->zfptr!=NULL) return gzputs(file->zfptr,str);
 #endif
   return fputs(str,file->nzfptr);
@@ -228,6 +700,20 @@ char * znzgets(char* str, int size, znzFile file)
     return NULL;
   }
 #ifdef HAVE_ZLIB
+  if (file->zbfptr!=NULL)
+  {
+    int n = 0;
+    struct znzblocks *zb = file->zbfptr;
+    while (n < size-1)
+    {
+      if (zb->upos == zb->ulen && znzbFill(zb) <= 0) break;
+      str[n++] = (char) zb->ubuf[zb->upos++];
+      if (str[n-1] == '\n') break;
+    }
+    if (n == 0) return NULL;
+    str[n] = '\0';
+    return str;
+  }
   if (file->zfptr!=NULL) return gzgets(file->zfptr,str,size);
 #endif
   return fgets(str,size,file->nzfptr);
@@ -241,6 +727,8 @@ int znzflush(znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->zbfptr!=NULL)
+    return file->zbfptr->writing ? znzbFlushWrite(file->zbfptr,0) : 0;
   if (file->zfptr!=NULL) return gzflush(file->zfptr,Z_SYNC_FLUSH);
 #endif
   return fflush(file->nzfptr);
@@ -254,6 +742,8 @@ int znzeof(znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->zbfptr!=NULL)
+    return file->zbfptr->eof && file->zbfptr->upos == file->zbfptr->ulen;
   if (file->zfptr!=NULL) return gzeof(file->zfptr);
 #endif
   return feof(file->nzfptr);
@@ -267,6 +757,11 @@ int znzputc(int c, znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->zbfptr!=NULL)
+  {
+    unsigned char uc = (unsigned char) c;
+    return (znzbWrite(file->zbfptr,&uc,1) == 1) ? (int) uc : EOF;
+  }
   if (file->zfptr!=NULL) return gzputc(file->zfptr,c);
 #endif
   return fputc(c,file->nzfptr);
@@ -280,6 +775,12 @@ int znzgetc(znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->zbfptr!=NULL)
+  {
+    struct znzblocks *zb = file->zbfptr;
+    if (zb->upos == zb->ulen && znzbFill(zb) <= 0) return EOF;
+    return (int) zb->ubuf[zb->upos++];
+  }
   if (file->zfptr!=NULL) return gzgetc(file->zfptr);
 #endif
   return fgetc(file->nzfptr);
@@ -299,7 +800,7 @@ int znzprintf(znzFile stream, const char *format, ...)
   }
   va_start(va, format);
 #ifdef HAVE_ZLIB
-  if (stream->zfptr!=NULL)
+  if (stream->zbfptr!=NULL || stream->zfptr!=NULL)
   {
     int size;  /* local to HAVE_ZLIB block */
     size = strlen(format) + 1000000;  /* overkill I hope */
@@ -310,7 +811,10 @@ int znzprintf(znzFile stream, const char *format, ...)
       return retval;
     }
     vsprintf(tmpstr,format,va);
-    retval=gzprintf(stream->zfptr,"%s",tmpstr);
+    if (stream->zbfptr!=NULL)
+      retval=(int) znzbWrite(stream->zbfptr,tmpstr,strlen(tmpstr));
+    else
+      retval=gzprintf(stream->zfptr,"%s",tmpstr);
     free(tmpstr);
   }
   else